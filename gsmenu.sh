@@ -806,6 +806,20 @@ case "$@" in
     "set gs system dvr_reenc_bitrate"*)
         : # noop
         ;;
+    "get gs system dvr_reenc_rc"*)
+        echo -n "cbr"
+        emit_values "cbr\nvbr\navbr\nfixqp"
+        ;;
+    "set gs system dvr_reenc_rc"*)
+        : # noop
+        ;;
+    "get gs system dvr_reenc_gop"*)
+        echo -n "auto"
+        emit_values "auto\n30\n60\n120\n240"
+        ;;
+    "set gs system dvr_reenc_gop"*)
+        : # noop
+        ;;
     "set gs system dvr_osd"*)
         : # noop
         ;;
@@ -2,8 +2,15 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <iostream>
+#include <chrono>
 #include <filesystem>
+#include <fstream>
+#include <map>
 #include <regex>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "spdlog/spdlog.h"
 
@@ -17,42 +24,28 @@ extern "C" {
 
 namespace fs = std::filesystem;
 
-// Strip H265 AUD (type 35), PREFIX_SEI (type 39), and SUFFIX_SEI (type 40)
-// from an Annex-B bitstream before handing it to minimp4, which rejects these
-// NAL types and would otherwise fail to write any frame.
-static std::shared_ptr<std::vector<uint8_t>>
-hevc_strip_supplemental(const uint8_t *data, size_t len)
-{
-    auto out = std::make_shared<std::vector<uint8_t>>();
-    out->reserve(len);
-    const uint8_t *p   = data;
-    const uint8_t *end = data + len;
-    for (;; p++) {
-        int nal_size;
-        p = find_nal_unit(p, (int)(end - p), &nal_size);
-        if (!nal_size)
-            break;
-        int nal_type = (p[0] >> 1) & 0x3f;
-        if (nal_type != 35 && nal_type != 39 && nal_type != 40) {
-            static const uint8_t sc[] = {0, 0, 0, 1};
-            out->insert(out->end(), sc, sc + 4);
-            out->insert(out->end(), p, p + nal_size);
-        }
-    }
-    return out->empty() ? nullptr : out;
-}
-
 int dvr_enabled = 0;
+int dvr_preroll_ms = 0;
+std::atomic<bool> dvr_drop_non_reference{false};
 const int SEQUENCE_PADDING = 4; // Configurable padding for sequence numbers
+static const char *JOURNAL_SUFFIX = ".rec";
+static const char *JOURNAL_TMP_SUFFIX = ".rec.tmp";
+static const char *RECOVERING_SUFFIX = ".recovering";
 
-int write_callback(int64_t offset, const void *buffer, size_t size, void *token){
-	dvr_write_ctx *ctx = (dvr_write_ctx*)token;
-	fseek(ctx->f, offset, SEEK_SET);
-	int ret = fwrite(buffer, 1, size, ctx->f) != size;
-	int64_t end = offset + (int64_t)size;
-	if (end > ctx->file_size)
-		ctx->file_size = end;
-	return ret;
+// Sample timing, 90 kHz units
+static const unsigned DEFAULT_FRAME_DURATION = 90000 / 60;
+// Longer frame intervals are reported as gaps (link loss, dropped frames);
+// they are kept in the timeline so the file stays in step with wall time.
+static const int64_t GAP_DURATION = 90000 / 5;
+// Stream timestamps disagreeing with the arrival times by more than this
+// mean the sender restarted or the timestamp source changed.
+static const int64_t RESYNC_TOLERANCE = 90000;
+// With --dvr-segment-on link-loss, an outage this long ends the segment.
+static const uint64_t LINK_LOSS_US = 1000000;
+
+static uint64_t monotonic_us() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
 Dvr::Dvr(dvr_thread_params params) {
@@ -64,17 +57,24 @@ Dvr::Dvr(dvr_thread_params params) {
 	video_frm_width = params.video_p.video_frm_width;
 	video_frm_height = params.video_p.video_frm_height;
 	codec = params.video_p.codec;
-	write_ctx.f = NULL;
-	write_ctx.file_size = 0;
+	preroll.configure(params.preroll_ms * 1000ULL, params.preroll_max_bytes);
+	retention = params.retention;
+	segment_s = params.segment_s;
+	segment_align = params.segment_align;
+	segment_on_link_loss = params.segment_on_link_loss;
+	telemetry.set_format(params.telemetry_format);
+	mux = nullptr;
 	mp4wr = nullptr;
 }
 
 Dvr::~Dvr() {}
 
-void Dvr::frame(std::shared_ptr<std::vector<uint8_t>> frame) {
+void Dvr::frame(EncodedFramePtr frame, uint64_t timestamp) {
 	dvr_rpc rpc = {
 		.command = dvr_rpc::RPC_FRAME,
-		.frame = frame
+		.frame = frame,
+		.timestamp = timestamp,
+		.arrival_us = monotonic_us()
 	};
 	enqueue_dvr_command(rpc);
 }
@@ -121,6 +121,14 @@ void Dvr::toggle_recording() {
 	enqueue_dvr_command(rpc);
 };
 
+void Dvr::segment(const char *reason) {
+	dvr_rpc rpc = {
+		.command = dvr_rpc::RPC_SEGMENT
+	};
+	rpc.reason = reason;
+	enqueue_dvr_command(rpc);
+}
+
 void Dvr::shutdown() {
 	dvr_rpc rpc = {
 		.command = dvr_rpc::RPC_SHUTDOWN
@@ -157,7 +165,7 @@ void Dvr::loop() {
 			case dvr_rpc::RPC_SET_PARAMS:
 				{
 					SPDLOG_DEBUG("got rpc SET_PARAMS");
-					if (write_ctx.f == NULL) {
+					if (!writer.is_open()) {
 						break;
 					}
 					init();
@@ -166,7 +174,7 @@ void Dvr::loop() {
 			case dvr_rpc::RPC_START:
 				{
 					SPDLOG_DEBUG("got rpc START");
-					if (write_ctx.f != NULL) {
+					if (writer.is_open()) {
 						break;
 					}
 					if (start() == 0) {
@@ -180,7 +188,7 @@ void Dvr::loop() {
 			case dvr_rpc::RPC_STOP:
 				{
 					SPDLOG_DEBUG("got rpc STOP");
-					if (write_ctx.f == NULL) {
+					if (!writer.is_open()) {
 						break;
 					}
 					stop();
@@ -189,7 +197,7 @@ void Dvr::loop() {
 			case dvr_rpc::RPC_TOGGLE:
 				{
 					SPDLOG_DEBUG("got rpc TOGGLE");
-					if (write_ctx.f == NULL) {
+					if (!writer.is_open()) {
 						if (start() == 0) {
 							idr_request_record_start();
 							if (video_frm_width > 0 && video_frm_height > 0) {
@@ -201,53 +209,17 @@ void Dvr::loop() {
 					}
 					break;
 				}
-			case dvr_rpc::RPC_FRAME:
+			case dvr_rpc::RPC_SEGMENT:
 				{
-					if (!_ready_to_write) {
-						break;
-					}
-					std::shared_ptr<std::vector<uint8_t>> frame = rpc.frame;
-					if (codec == VideoCodec::H265) {
-						frame = hevc_strip_supplemental(frame->data(), frame->size());
-						if (!frame) break;
+					SPDLOG_DEBUG("got rpc SEGMENT");
+					if (writer.is_open() && !segment_requested) {
+						segment_requested = rpc.reason;
 					}
-					// Cache parameter sets as they arrive (they don't change)
-					if (!params_complete)
-						cache_parameter_sets(frame->data(), frame->size());
-					// File splitting: split on next IDR when over size limit
-					if (max_file_size > 0 && write_ctx.file_size > max_file_size) {
-						if (!split_pending) {
-							split_pending = true;
-							if (on_start_cb) on_start_cb();
-							idr_request_record_start();
-						}
-						if (params_complete && is_idr(frame->data(), frame->size())) {
-							split();
-							split_pending = false;
-							// Build and replay VPS/SPS/PPS into new writer
-							{
-								static const uint8_t sc[] = {0, 0, 0, 1};
-								std::vector<uint8_t> params;
-								if (!cached_vps.empty()) {
-									params.insert(params.end(), sc, sc + 4);
-									params.insert(params.end(), cached_vps.begin(), cached_vps.end());
-								}
-								if (!cached_sps.empty()) {
-									params.insert(params.end(), sc, sc + 4);
-									params.insert(params.end(), cached_sps.begin(), cached_sps.end());
-								}
-								if (!cached_pps.empty()) {
-									params.insert(params.end(), sc, sc + 4);
-									params.insert(params.end(), cached_pps.begin(), cached_pps.end());
-								}
-								mp4_h26x_write_nal(mp4wr, params.data(), params.size(), 0);
-							}
-							mp4_h26x_write_nal(mp4wr, frame->data(),
-								frame->size(), 90000/video_framerate);
-							break;
-						}
-					}
-					mp4_h26x_write_nal(mp4wr, frame->data(), frame->size(), 90000/video_framerate);
+					break;
+				}
+			case dvr_rpc::RPC_FRAME:
+				{
+					handle_frame(rpc.frame, rpc.timestamp, rpc.arrival_us, true);
 					break;
 				}
 			case dvr_rpc::RPC_SHUTDOWN:
@@ -256,12 +228,121 @@ void Dvr::loop() {
 		}
 	}
 end:
-	if (write_ctx.f != NULL) {
+	if (writer.is_open()) {
 		stop();
 	}
 	spdlog::info("DVR thread done.");
 }
 
+// live is false for frames replayed from the pre-roll buffer: those are
+// already in memory and bypass the congestion check.
+void Dvr::handle_frame(EncodedFramePtr frame,
+					   uint64_t timestamp, uint64_t arrival_us, bool live) {
+	if (!_ready_to_write && !preroll.enabled()) {
+		return;
+	}
+	// Index the access unit once; filtering, parameter set
+	// caching, IDR detection and muxing all work off the spans.
+	nal_view.scan(frame->data(), frame->size(), codec == VideoCodec::H265);
+	if (!nal_view.muxable_count())
+		return;
+	// Cache parameter sets as they arrive (they don't change)
+	if (!params_complete) {
+		cache_parameter_sets();
+		if (params_complete && _ready_to_write)
+			write_journal();
+	}
+	bool idr = nal_view.has_irap();
+	if (!_ready_to_write) {
+		// Not recording: keep the last seconds around. Headers are cached
+		// above and replayed when the next file is set up.
+		if (nal_view.has_vcl()) {
+			preroll.push({EncodedFrame::compact(frame), timestamp, arrival_us, idr});
+			if (arrival_us - preroll_published_us >= 1000000) {
+				osd_publish_uint_fact("dvr.preroll_ms", NULL, 0, preroll.duration_us() / 1000);
+				preroll_published_us = arrival_us;
+			}
+		}
+		return;
+	}
+	// Headers on their own (re-encoder) only go into the
+	// track configuration; they take no time.
+	if (!nal_view.has_vcl()) {
+		write_frame(nal_view, 0);
+		return;
+	}
+	// Storage can't keep up: drop frames rather than stall the
+	// queue, and resume only on an IDR so nothing references a
+	// frame that never made it to the file.
+	bool congested = live && writer.congested();
+	if (congested)
+		drop_until_idr = true;
+	if (drop_until_idr) {
+		if (congested || !idr) {
+			writer.count_dropped_frame();
+			return;
+		}
+		drop_until_idr = false;
+	}
+	// Degraded storage: shed the pictures no other picture depends on
+	if (live && !idr && dvr_drop_non_reference.load(std::memory_order_relaxed) &&
+		!nal_view.has_reference()) {
+		skipped_non_reference++;
+		return;
+	}
+	if (live && writer.failed()) {
+		spdlog::error("DVR: writing {} failed, closing it", current_file_path);
+		osd_publish_bool_fact("dvr.write_error", NULL, 0, true);
+		stop();
+		return;
+	}
+	if (live && retention) {
+		check_storage(arrival_us);
+		if (!_ready_to_write)
+			return;
+	}
+	// A new segment starts on the next IDR once one is due
+	if (segment_on_link_loss && pending_frame && !segment_requested &&
+		arrival_us - pending_arrival_us >= LINK_LOSS_US)
+		segment_requested = "link loss";
+	if (!split_pending) {
+		split_reason = segment_due();
+		if (split_reason) {
+			split_pending = true;
+			if (on_start_cb) on_start_cb();
+			idr_request_record_start();
+		}
+	}
+	if (split_pending && params_complete && idr) {
+		// The held back frame ends the current file; across a link loss it
+		// gets the nominal duration so the outage isn't kept in either file.
+		bool outage = arrival_us - pending_arrival_us >= LINK_LOSS_US;
+		flush_pending_frame(!outage, timestamp, arrival_us);
+		split(split_reason);
+		split_pending = false;
+		if (!_ready_to_write)
+			return;
+		// Replay VPS/SPS/PPS into new writer
+		write_parameter_sets();
+	}
+	queue_frame(frame, timestamp, arrival_us);
+}
+
+// Put the buffered seconds before the start at the head of a new file.
+void Dvr::flush_preroll() {
+	std::deque<DvrPrerollFrame> frames = preroll.take();
+	if (frames.empty())
+		return;
+	spdlog::info("DVR: recording starts with {} ms of pre-roll ({} frames)",
+				 (frames.back().arrival_us - frames.front().arrival_us) / 1000, frames.size());
+	if (params_complete)
+		write_parameter_sets();
+	for (DvrPrerollFrame &f : frames) {
+		handle_frame(std::move(f.data), f.timestamp, f.arrival_us, false);
+	}
+	osd_publish_uint_fact("dvr.preroll_ms", NULL, 0, 0);
+}
+
 int Dvr::start() {
 	char *fname_tpl = filename_template;
 	std::string rec_dir, filename_pattern;
@@ -277,28 +358,34 @@ int Dvr::start() {
 		return -1;
 	}
 
+	if (retention && !retention->make_room()) {
+		spdlog::error("DVR: not enough free space in {} to start a recording", rec_dir);
+		osd_publish_bool_fact("dvr.storage_full", NULL, 0, true);
+		return -1;
+	}
+
 	if (dvr_filenames_with_sequence) {
 		// Get the next file number
-		std::regex pattern(R"(^(\d+)_.*)"); // Matches filenames that start with digits followed by '_'
-		int maxNumber = -1;
 		int nextFileNumber = 0;
+		if (retention) {
+			nextFileNumber = retention->next_sequence();
+		} else {
+			std::regex pattern(R"(^(\d+)_.*)"); // Matches filenames that start with digits followed by '_'
+			int maxNumber = -1;
 
-		for (const auto &entry : fs::directory_iterator(rec_dir)) {
-			if (entry.is_regular_file())
-			{
-				std::string filename = entry.path().filename().string();
-				std::smatch match;
-
-				if (std::regex_match(filename, match, pattern))
+			for (const auto &entry : fs::directory_iterator(rec_dir)) {
+				if (entry.is_regular_file())
 				{
-					int number = std::stoi(match[1].str());
-					maxNumber = std::max(maxNumber, number);
+					std::string filename = entry.path().filename().string();
+					std::smatch match;
+
+					if (std::regex_match(filename, match, pattern))
+					{
+						int number = std::stoi(match[1].str());
+						maxNumber = std::max(maxNumber, number);
+					}
 				}
 			}
-		}
-		if (maxNumber == -1) {
-			nextFileNumber = 0;
-		} else {
 			nextFileNumber = maxNumber + 1;
 		}
 
@@ -317,6 +404,7 @@ int Dvr::start() {
 
 	// Construct final filename
 	std::string finalFilename = rec_dir + "/" + paddedNumber + formattedFilename;
+	current_file_path = finalFilename;
 
 	// Store base path (without extension) for split naming
 	split_part = 0;
@@ -326,18 +414,30 @@ int Dvr::start() {
 		current_base_path = finalFilename;
 	}
 
-	if ((write_ctx.f = fopen(finalFilename.c_str(), "w")) == NULL) {
+	if (writer.open(finalFilename) != 0) {
 		spdlog::error("unable to open DVR file {}", finalFilename);
 		return -1;
 	}
-	write_ctx.file_size = 0;
-	mux = MP4E_open(0 /*sequential_mode*/, mp4_fragmentation_mode, &write_ctx, write_callback);
+	keyframe_index.create(finalFilename, codec == VideoCodec::H265);
+	file_time = 0;
+	start_segment_clock();
+	telemetry.open(finalFilename);
+	if (retention)
+		retention->begin(finalFilename, codec == VideoCodec::H265 ? "h265" : "h264");
+	osd_publish_bool_fact("dvr.storage_full", NULL, 0, false);
+	osd_publish_bool_fact("dvr.write_error", NULL, 0, false);
+	drop_until_idr = false;
+	nominal_duration = video_framerate > 0 ? 90000 / video_framerate : DEFAULT_FRAME_DURATION;
+	mux = MP4E_open(0 /*sequential_mode*/, mp4_fragmentation_mode, this, Dvr::mp4_write_callback);
 	if (max_file_size > 0)
 		spdlog::info("DVR file splitting enabled at {} MB", max_file_size / (1024*1024));
+	if (segment_s > 0)
+		spdlog::info("DVR segments of {} s{}", segment_s, segment_align ? ", aligned to the clock" : "");
 	return 0;
 }
 
 void Dvr::init() {
+	flush_pending_frame(false, 0, 0);
 	spdlog::info("setting up dvr and mux to {}x{}", video_frm_width, video_frm_height);
 	if (!mp4wr)
 		mp4wr = (mp4_h26x_writer_t *)malloc(sizeof(mp4_h26x_writer_t));
@@ -347,110 +447,666 @@ void Dvr::init() {
 											  codec==VideoCodec::H265)) {
 		spdlog::error("mp4_h26x_write_init failed");
 		mux = NULL;
-		write_ctx.f = NULL;
+		writer.close();
+	} else {
+		write_journal();
 	}
 	_ready_to_write = 1;
+	if (writer.is_open())
+		flush_preroll();
 	if (on_start_cb) on_start_cb();
 }
 
 void Dvr::stop() {
+	flush_pending_frame(false, 0, 0);
 	MP4E_close(mux);
 	mux = nullptr;
 	if (mp4wr) {
 		mp4_h26x_write_close(mp4wr);  // frees the struct (minimp4 API)
 		mp4wr = nullptr;
 	}
-	fclose(write_ctx.f);
-	write_ctx.f = NULL;
-	write_ctx.file_size = 0;
+	write_mfra();
+	writer.close();
+	keyframe_index.close();
+	telemetry.close();
+	remove_journal();
+	if (retention)
+		retention->finish(current_file_path, file_time / 90);
 	_ready_to_write = 0;
-}
-
-// Check if buffer contains an IDR/IRAP slice.
-bool Dvr::is_idr(const uint8_t *data, size_t len) {
-	const uint8_t *p = data;
-	const uint8_t *end = data + len;
-
-	for (;; p++) {
-		int nal_size;
-		p = find_nal_unit(p, (int)(end - p), &nal_size);
-		if (!nal_size) break;
-
-		if (codec == VideoCodec::H265) {
-			int nal_type = (p[0] >> 1) & 0x3f;
-			if (nal_type >= 16 && nal_type <= 23) return true; // IRAP
-		} else {
-			int nal_type = p[0] & 0x1f;
-			if (nal_type == 5) return true; // IDR
-		}
+	if (skipped_non_reference) {
+		spdlog::info("DVR: {} non-reference frames left out of the recording", skipped_non_reference);
+		skipped_non_reference = 0;
 	}
-	return false;
 }
 
-// Cache VPS/SPS/PPS NALs individually from any buffer.
+// Cache VPS/SPS/PPS NALs individually from the current access unit.
 // Called on each frame until all required params are collected.
-void Dvr::cache_parameter_sets(const uint8_t *data, size_t len) {
-	const uint8_t *p = data;
-	const uint8_t *end = data + len;
-
-	for (;; p++) {
-		int nal_size;
-		p = find_nal_unit(p, (int)(end - p), &nal_size);
-		if (!nal_size) break;
-
-		if (codec == VideoCodec::H265) {
-			int t = (p[0] >> 1) & 0x3f;
-			if (t == 32 && cached_vps.empty())
-				cached_vps.assign(p, p + nal_size);
-			else if (t == 33 && cached_sps.empty())
-				cached_sps.assign(p, p + nal_size);
-			else if (t == 34 && cached_pps.empty())
-				cached_pps.assign(p, p + nal_size);
+void Dvr::cache_parameter_sets() {
+	bool hevc = codec == VideoCodec::H265;
+	for (const NalSpan &span : nal_view.spans()) {
+		const uint8_t *p = nal_view.nal(span);
+		std::vector<uint8_t> *slot = nullptr;
+		if (hevc) {
+			if (span.type == 32) slot = &cached_vps;
+			else if (span.type == 33) slot = &cached_sps;
+			else if (span.type == 34) slot = &cached_pps;
 		} else {
-			int t = p[0] & 0x1f;
-			if (t == 7 && cached_sps.empty())
-				cached_sps.assign(p, p + nal_size);
-			else if (t == 8 && cached_pps.empty())
-				cached_pps.assign(p, p + nal_size);
+			if (span.type == 7) slot = &cached_sps;
+			else if (span.type == 8) slot = &cached_pps;
 		}
+		if (slot && slot->empty())
+			slot->assign(p, p + span.length);
 	}
 
-	if (codec == VideoCodec::H265)
+	if (hevc)
 		params_complete = !cached_vps.empty() && !cached_sps.empty() && !cached_pps.empty();
 	else
 		params_complete = !cached_sps.empty() && !cached_pps.empty();
 }
 
-void Dvr::split() {
-	spdlog::info("DVR file split at {} MB (part {})",
-		write_ctx.file_size / (1024*1024), split_part + 1);
+void Dvr::write_parameter_sets() {
+	if (!cached_vps.empty())
+		mp4_h26x_write_nal_unit(mp4wr, cached_vps.data(), cached_vps.size(), 0);
+	if (!cached_sps.empty())
+		mp4_h26x_write_nal_unit(mp4wr, cached_sps.data(), cached_sps.size(), 0);
+	if (!cached_pps.empty())
+		mp4_h26x_write_nal_unit(mp4wr, cached_pps.data(), cached_pps.size(), 0);
+}
+
+// Hold the frame just indexed in nal_view until the next one tells how long
+// it lasts, and write the previously held frame now that its duration is known.
+void Dvr::queue_frame(EncodedFramePtr frame,
+					  uint64_t timestamp, uint64_t arrival_us) {
+	flush_pending_frame(true, timestamp, arrival_us);
+	std::swap(nal_view, pending_view);
+	pending_frame = std::move(frame);
+	pending_ts = timestamp;
+	pending_arrival_us = arrival_us;
+}
+
+// Without a next frame (file being closed) the last frame gets the nominal
+// frame interval.
+void Dvr::flush_pending_frame(bool have_next, uint64_t next_ts, uint64_t next_arrival_us) {
+	if (!pending_frame)
+		return;
+	unsigned duration = have_next ? frame_duration(next_ts, next_arrival_us) : nominal_duration;
+	if (mp4wr) {
+		// The muxer appends, so the frame starts at the current end of file.
+		// A fragmented file is indexed by the frame's moof, which the first
+		// frame's headers come before.
+		if (pending_view.has_irap()) {
+			if (mp4_fragmentation_mode)
+				keyframe_moof_pending = true;
+			else
+				keyframe_index.append(file_time, writer.file_size());
+		}
+		if (telemetry.is_open() && pending_arrival_us - telemetry_flushed_us >= 200000) {
+			telemetry.flush(pending_arrival_us, file_time * 100 / 9);
+			telemetry_flushed_us = pending_arrival_us;
+		}
+		int64_t start = writer.file_size();
+		write_frame(pending_view, duration);
+		file_time += duration;
+		if (!mp4_fragmentation_mode && writer.file_size() > start) {
+			// Real timing for recovery: bytes the frame took in the mdat and its duration
+			char line[32];
+			int n = snprintf(line, sizeof(line), "%lld %u\n", (long long)(writer.file_size() - start), duration);
+			writer.log(line, n);
+		}
+	}
+	pending_frame.reset();
+}
+
+// Why the current file should end, or nullptr while it goes on.
+const char *Dvr::segment_due() {
+	if (max_file_size > 0 && writer.file_size() > max_file_size)
+		return "size";
+	if (segment_requested)
+		return segment_requested;
+	if (segment_s > 0) {
+		if (segment_align ? time(nullptr) >= segment_deadline
+						  : file_time >= (uint64_t)segment_s * 90000)
+			return "duration";
+	}
+	return nullptr;
+}
+
+// Aligned segments end on the next multiple of the segment length of the
+// wall clock (e.g. :00, :05, :10 with 5 minutes); the first one is shorter.
+void Dvr::start_segment_clock() {
+	split_pending = false;
+	segment_requested = nullptr;
+	if (segment_s > 0 && segment_align) {
+		time_t now = time(nullptr);
+		segment_deadline = now - now % segment_s + segment_s;
+	}
+}
+
+// Let the retention policy make room as the file grows; when the card is
+// full anyway, close the file while its index still fits.
+void Dvr::check_storage(uint64_t arrival_us) {
+	if (arrival_us - storage_checked_us < 1000000)
+		return;
+	storage_checked_us = arrival_us;
+	if (retention->update(current_file_path, writer.file_size()))
+		return;
+	spdlog::error("DVR: storage full, closing {}", current_file_path);
+	osd_publish_bool_fact("dvr.storage_full", NULL, 0, true);
+	stop();
+}
+
+unsigned Dvr::frame_duration(uint64_t next_ts, uint64_t next_arrival_us) {
+	int64_t delta = (int64_t)(next_ts - pending_ts);
+	int64_t wall = (int64_t)(next_arrival_us - pending_arrival_us) * 9 / 100;
+	if (delta - wall > RESYNC_TOLERANCE || wall - delta > RESYNC_TOLERANCE) {
+		// The stream clock jumped: trust the arrival times for this one
+		delta = wall > 0 ? wall : nominal_duration;
+		timestamp_resets++;
+		spdlog::warn("DVR: timestamp discontinuity, bridged with {} ms from arrival time",
+					 delta / 90);
+		osd_publish_uint_fact("dvr.timestamp_resets", NULL, 0, timestamp_resets);
+	} else if (delta <= 0) {
+		// Repeated or reordered timestamp; samples can't have zero length
+		return nominal_duration;
+	}
+	if (delta > GAP_DURATION) {
+		timestamp_gaps++;
+		spdlog::info("DVR: {} ms gap in the stream", delta / 90);
+		osd_publish_uint_fact("dvr.timestamp_gaps", NULL, 0, timestamp_gaps);
+	} else {
+		nominal_duration = (unsigned)delta;
+	}
+	return (unsigned)delta;
+}
+
+// Ends a fragmented file with its keyframes as an mfra box, so qtdemux
+// seeks straight to a moof instead of walking all of them.
+void Dvr::write_mfra() {
+	keyframe_moof_pending = false;
+	if (!mp4_fragmentation_mode || !writer.is_open() || keyframe_index.entries().empty())
+		return;
+	std::vector<uint8_t> box = keyframe_index.mfra(1);
+	writer.write(writer.file_size(), box.data(), box.size());
+}
+
+static bool parse_moof(const uint8_t *p, const uint8_t *end, uint64_t *duration, bool *keyframe);
+
+// The muxer writes each moof in one piece: index the keyframe's own, not
+// the moof of an SEI sent ahead of it.
+int Dvr::mp4_write_callback(int64_t offset, const void *buffer, size_t size, void *token) {
+	Dvr *dvr = (Dvr *)token;
+	const uint8_t *box = (const uint8_t *)buffer;
+	if (dvr->keyframe_moof_pending && size >= 8 && !memcmp(box + 4, "moof", 4)) {
+		uint64_t duration = 0;
+		bool keyframe = false;
+		if (parse_moof(box + 8, box + size, &duration, &keyframe) && keyframe) {
+			dvr->keyframe_index.append(dvr->file_time, offset);
+			dvr->keyframe_moof_pending = false;
+		}
+	}
+	return DvrWriter::mp4_write_callback(offset, buffer, size, &dvr->writer);
+}
+
+// Hand an indexed access unit to the muxer span by span, in place.
+void Dvr::write_frame(const NalView &view, unsigned duration) {
+	bool hevc = view.hevc();
+	for (const NalSpan &span : view.spans()) {
+		if (NalView::is_supplemental(hevc, span.type))
+			continue;
+		mp4_h26x_write_nal_unit(mp4wr, view.nal(span), span.length, duration);
+	}
+}
+
+void Dvr::split(const char *reason) {
+	spdlog::info("DVR file split ({}) at {} MB, {} s (part {})", reason,
+		writer.file_size() / (1024*1024), file_time / 90000, split_part + 1);
 
 	// Close current file
 	MP4E_close(mux);
 	mux = nullptr;
 	mp4_h26x_write_close(mp4wr);
 	mp4wr = nullptr;
-	fclose(write_ctx.f);
-	write_ctx.f = NULL;
-	write_ctx.file_size = 0;
+	write_mfra();
+	writer.close();
+	keyframe_index.close();
+	telemetry.close();
+	remove_journal();
+	if (retention)
+		retention->finish(current_file_path, file_time / 90);
 
 	// Open next part
 	split_part++;
 	std::string nextFilename = current_base_path + "_part" + std::to_string(split_part + 1) + ".mp4";
-	if ((write_ctx.f = fopen(nextFilename.c_str(), "w")) == NULL) {
+	current_file_path = nextFilename;
+	if (writer.open(nextFilename) != 0) {
 		spdlog::error("unable to open DVR split file {}", nextFilename);
 		_ready_to_write = 0;
 		return;
 	}
-	mux = MP4E_open(0, mp4_fragmentation_mode, &write_ctx, write_callback);
+	keyframe_index.create(nextFilename, codec == VideoCodec::H265);
+	file_time = 0;
+	start_segment_clock();
+	telemetry.open(nextFilename);
+	if (retention)
+		retention->begin(nextFilename, codec == VideoCodec::H265 ? "h265" : "h264");
+	mux = MP4E_open(0, mp4_fragmentation_mode, this, Dvr::mp4_write_callback);
 	mp4wr = (mp4_h26x_writer_t *)malloc(sizeof(mp4_h26x_writer_t));
 	if (MP4E_STATUS_OK != mp4_h26x_write_init(mp4wr, mux,
 		video_frm_width, video_frm_height, codec == VideoCodec::H265)) {
 		spdlog::error("mp4_h26x_write_init failed on split file");
 		_ready_to_write = 0;
+		return;
+	}
+	write_journal();
+}
+
+static std::string hex_encode(const std::vector<uint8_t> &v) {
+	static const char digits[] = "0123456789abcdef";
+	std::string out;
+	out.reserve(v.size() * 2);
+	for (uint8_t b : v) {
+		out.push_back(digits[b >> 4]);
+		out.push_back(digits[b & 0xf]);
+	}
+	return out;
+}
+
+static std::vector<uint8_t> hex_decode(const std::string &s) {
+	std::vector<uint8_t> out;
+	for (size_t i = 0; i + 1 < s.size(); i += 2)
+		out.push_back((uint8_t)std::stoul(s.substr(i, 2), nullptr, 16));
+	return out;
+}
+
+// (Re)write the recovery journal for the current file.  Written to a temp
+// file and renamed so a crash never leaves a half-written journal behind.
+// Only once the parameter sets are known: without them recovery can't
+// rebuild anything, handle_frame() writes it when the last one arrives,
+// before the first frame.  The writer then appends a "<bytes> <duration>"
+// line per frame of a regular MP4 with each sync, so recovery restores the
+// real timing and not just the nominal frame rate.
+void Dvr::write_journal() {
+	if (current_file_path.empty() || !writer.is_open() || !params_complete)
+		return;
+	std::string path = current_file_path + JOURNAL_SUFFIX;
+	std::string tmp = current_file_path + JOURNAL_TMP_SUFFIX;
+	FILE *f = fopen(tmp.c_str(), "w");
+	if (!f) {
+		spdlog::warn("unable to write DVR journal {}", path);
+		return;
+	}
+	fprintf(f, "codec=%s\n", codec == VideoCodec::H265 ? "h265" : "h264");
+	fprintf(f, "width=%u\nheight=%u\n", video_frm_width, video_frm_height);
+	fprintf(f, "framerate=%u\n", 90000 / std::max(nominal_duration, 1u));
+	fprintf(f, "fragmented=%d\n", mp4_fragmentation_mode);
+	if (!cached_vps.empty())
+		fprintf(f, "vps=%s\n", hex_encode(cached_vps).c_str());
+	if (!cached_sps.empty())
+		fprintf(f, "sps=%s\n", hex_encode(cached_sps).c_str());
+	if (!cached_pps.empty())
+		fprintf(f, "pps=%s\n", hex_encode(cached_pps).c_str());
+	fflush(f);
+	fsync(fileno(f));
+	fclose(f);
+	if (rename(tmp.c_str(), path.c_str()) == 0 && !mp4_fragmentation_mode)
+		writer.attach_log(path);
+}
+
+// Not after a failed write: recovery rebuilds what made it to the card.
+void Dvr::remove_journal() {
+	if (current_file_path.empty() || writer.failed())
+		return;
+	unlink((current_file_path + JOURNAL_SUFFIX).c_str());
+}
+
+// ── Recovery of unfinished recordings ───────────────────────────────────────
+
+static int recovery_write_callback(int64_t offset, const void *buffer, size_t size, void *token) {
+	FILE *f = (FILE *)token;
+	fseeko(f, offset, SEEK_SET);
+	return fwrite(buffer, 1, size, f) != size;
+}
+
+static uint32_t read_be32(const uint8_t *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static bool has_suffix(const std::string &name, const char *suffix) {
+	size_t len = strlen(suffix);
+	return name.size() > len && name.compare(name.size() - len, std::string::npos, suffix) == 0;
+}
+
+DvrRecovery::DvrRecovery(const std::string &dir) {
+	std::error_code ec;
+	for (const auto &entry : fs::directory_iterator(dir, ec)) {
+		if (!entry.is_regular_file())
+			continue;
+		std::string name = entry.path().string();
+		if (has_suffix(name, JOURNAL_SUFFIX)) {
+			journals.push_back(name);
+		} else if (has_suffix(name, JOURNAL_TMP_SUFFIX) || has_suffix(name, RECOVERING_SUFFIX)) {
+			// Left by a crash before the rename; the journal or file they
+			// were replacing is still there
+			spdlog::info("Removing stale {}", name);
+			unlink(name.c_str());
+		}
+	}
+	if (!journals.empty())
+		spdlog::info("Found {} unfinished DVR recording(s) in {}", journals.size(), dir);
+}
+
+void *DvrRecovery::__THREAD__(void *context) {
+	pthread_setname_np(pthread_self(), "__DVRRECOVER");
+	((DvrRecovery *)context)->run();
+	return nullptr;
+}
+
+void DvrRecovery::run() {
+	for (const auto &journal : journals) {
+		if (cancelled)
+			break;
+		if (recover(journal))
+			unlink(journal.c_str());
+	}
+	spdlog::info("DVR recovery done.");
+}
+
+// Returns true when the journal is no longer needed.
+bool DvrRecovery::recover(const std::string &journal_path) {
+	std::string path = journal_path.substr(0, journal_path.size() - strlen(JOURNAL_SUFFIX));
+	std::map<std::string, std::string> kv;
+	std::vector<std::pair<uint32_t, uint32_t>> frames;   // bytes, duration
+	{
+		std::ifstream in(journal_path);
+		std::string line;
+		while (std::getline(in, line)) {
+			auto eq = line.find('=');
+			if (eq != std::string::npos) {
+				kv[line.substr(0, eq)] = line.substr(eq + 1);
+				continue;
+			}
+			// A frame line cut short by the crash has no newline
+			unsigned long bytes, duration;
+			if (!in.eof() && sscanf(line.c_str(), "%lu %lu", &bytes, &duration) == 2)
+				frames.emplace_back((uint32_t)bytes, (uint32_t)duration);
+		}
+	}
+
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		spdlog::warn("DVR recovery: {} is gone, dropping journal", path);
+		return true;
+	}
+	struct stat st;
+	fstat(fd, &st);
+	int64_t size = st.st_size;
+	const int64_t hdr = 24;  // minimp4 ftyp
+
+	if (kv["fragmented"] == "1") {
+		// Fragments are self-contained; just cut off a torn last box.
+		int64_t pos = 0;
+		uint8_t box[8];
+		while (pos + 8 <= size && pread(fd, box, 8, pos) == 8) {
+			uint32_t box_size = read_be32(box);
+			if (box_size < 8 || pos + box_size > size)
+				break;
+			pos += box_size;
+		}
+		close(fd);
+		if (pos < size) {
+			spdlog::info("DVR recovery: truncating fragmented {} to {} bytes", path, pos);
+			truncate(path.c_str(), pos);
+		}
+		return true;
+	}
+
+	// MP4E_close() patches a free+mdat (or 64-bit mdat) header over the
+	// placeholder at offset 24; if that happened the file is complete.
+	uint8_t placeholder[8];
+	if (size < hdr + 16 || pread(fd, placeholder, 8, hdr) != 8 ||
+		memcmp(placeholder + 4, "ftyp", 4) != 0) {
+		close(fd);
+		return true;
+	}
+
+	bool hevc = kv["codec"] == "h265";
+	std::vector<uint8_t> vps = hex_decode(kv["vps"]);
+	std::vector<uint8_t> sps = hex_decode(kv["sps"]);
+	std::vector<uint8_t> pps = hex_decode(kv["pps"]);
+	int width = atoi(kv["width"].c_str());
+	int height = atoi(kv["height"].c_str());
+	int framerate = atoi(kv["framerate"].c_str());
+	if (framerate <= 0)
+		framerate = 60;
+	if (sps.empty() || pps.empty() || (hevc && vps.empty()) || width <= 0 || height <= 0) {
+		// Keep the journal: the file is unplayable and should stay marked
+		spdlog::warn("DVR recovery: {} has no parameter sets, can't rebuild it", path);
+		close(fd);
+		return false;
+	}
+
+	const uint8_t *data = (const uint8_t *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		spdlog::error("DVR recovery: unable to map {}", path);
+		return false;
+	}
+	madvise((void *)data, size, MADV_SEQUENTIAL);
+
+	std::string out_path = path + RECOVERING_SUFFIX;
+	FILE *out = fopen(out_path.c_str(), "w");
+	if (!out) {
+		munmap((void *)data, size);
+		spdlog::error("DVR recovery: unable to create {}", out_path);
+		return false;
+	}
+	spdlog::info("DVR recovery: rebuilding index of {}", path);
+
+	MP4E_mux_t *mux = MP4E_open(0, 0, out, recovery_write_callback);
+	mp4_h26x_writer_t mp4wr;
+	mp4_h26x_write_init(&mp4wr, mux, width, height, hevc);
+
+	if (!vps.empty())
+		mp4_h26x_write_nal_unit(&mp4wr, vps.data(), vps.size(), 0);
+	mp4_h26x_write_nal_unit(&mp4wr, sps.data(), sps.size(), 0);
+	mp4_h26x_write_nal_unit(&mp4wr, pps.data(), pps.size(), 0);
+
+	// Samples start right after ftyp + 16-byte placeholder, each NAL stored
+	// with a 4-byte big-endian length.  Stop at the first torn/zeroed one.
+	// Frames get the durations from the journal; the ones recorded after
+	// its last sync get the nominal frame interval.
+	const int nominal = 90000 / framerate;
+	int duration = nominal;
+	int64_t pos = hdr + 16;
+	int64_t nals = 0;
+	size_t timed = 0;              // frames given their journal duration
+	int64_t frame_end = pos;
+	while (pos + 5 <= size && !cancelled) {
+		uint32_t len = read_be32(data + pos);
+		if (len == 0 || pos + 4 + (int64_t)len > size || (data[pos + 4] & 0x80))
+			break;
+		if (pos == frame_end && timed < frames.size()) {
+			frame_end = pos + frames[timed].first;
+			duration = frames[timed].second;
+			timed++;
+		}
+		if (pos >= frame_end || pos + 4 + (int64_t)len > frame_end) {
+			// Past the journal, or it doesn't match the data: nominal from here
+			if (frame_end > pos)
+				timed--;
+			frames.clear();
+			frame_end = -1;
+			duration = nominal;
+		}
+		mp4_h26x_write_nal_unit(&mp4wr, data + pos + 4, len, duration);
+		pos += 4 + len;
+		nals++;
+	}
+
+	MP4E_close(mux);
+	mp4_h26x_write_close(&mp4wr);
+	bool ok = fflush(out) == 0 && fsync(fileno(out)) == 0;
+	fclose(out);
+	munmap((void *)data, size);
+
+	if (cancelled || !ok || nals == 0) {
+		unlink(out_path.c_str());
+		if (nals == 0 && !cancelled) {
+			spdlog::warn("DVR recovery: no usable video in {}", path);
+			return true;
+		}
+		return false;
+	}
+	if (rename(out_path.c_str(), path.c_str()) != 0) {
+		spdlog::error("DVR recovery: unable to replace {}", path);
+		unlink(out_path.c_str());
+		return false;
+	}
+	// The samples moved; the keyframe index is rebuilt when the file is played
+	unlink(DvrIndex::sidecar_path(path).c_str());
+	spdlog::info("DVR recovery: {} rebuilt, {} NAL units, {} frames with their timing, {} of {} bytes used",
+				 path, nals, timed, pos, size);
+	return true;
+}
+
+
+static int index_read_callback(int64_t offset, void *buffer, size_t size, void *token) {
+	int fd = *(int *)token;
+	return pread(fd, buffer, size, offset) != (ssize_t)size;
+}
+
+// Sum of the sample durations in a moof, and whether it starts with a sync sample.
+static bool parse_moof(const uint8_t *p, const uint8_t *end, uint64_t *duration, bool *keyframe) {
+	while (end - p >= 8) {
+		uint32_t box_size = read_be32(p);
+		if (box_size < 8 || box_size > end - p)
+			return false;
+		const uint8_t *body = p + 8, *box_end = p + box_size;
+		if (!memcmp(p + 4, "traf", 4)) {
+			if (!parse_moof(body, box_end, duration, keyframe))
+				return false;
+		} else if (!memcmp(p + 4, "trun", 4) && box_end - body >= 8) {
+			uint32_t flags = read_be32(body) & 0xffffff;
+			uint32_t count = read_be32(body + 4);
+			const uint8_t *q = body + 8;
+			if (flags & 0x001)
+				q += 4;
+			if (flags & 0x004) {
+				if (q + 4 > box_end)
+					return false;
+				*keyframe = !(read_be32(q) & 0x10000);   // sample_is_non_sync_sample
+				q += 4;
+			}
+			int per_sample = 4 * (!!(flags & 0x100) + !!(flags & 0x200) + !!(flags & 0x400) + !!(flags & 0x800));
+			for (uint32_t i = 0; i < count && q + per_sample <= box_end; i++, q += per_sample) {
+				if (flags & 0x100)
+					*duration += read_be32(q);
+			}
+		}
+		p = box_end;
 	}
+	return true;
 }
 
+bool dvr_index_rebuild(const std::string &mp4_path, const std::atomic<bool> *cancel) {
+	int fd = open(mp4_path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	fstat(fd, &st);
+	int64_t size = st.st_size;
+
+	MP4D_demux_t mp4;
+	if (!MP4D_open(&mp4, index_read_callback, &fd, size) || mp4.track_count == 0) {
+		spdlog::warn("DVR: can't index {}, not a readable MP4", mp4_path);
+		close(fd);
+		return false;
+	}
+	bool hevc = mp4.track[0].object_type_indication != MP4_OBJECT_TYPE_AVC;
+	DvrIndex index;
+	bool ok = true;
+	bool has_mfra = false, append_mfra = false;
+
+	MP4D_track_t *tr = &mp4.track[0];
+	if (tr->sample_count > 0) {
+		// Regular file: look at the first slice of every sample, past any
+		// AUD or SEI in front of it. Walk the chunks in order;
+		// MP4D_frame_offset() rescans the chunk each call.
+		unsigned sample = 0, group = 0;
+		for (unsigned nc = 0; nc < tr->chunk_count && sample < tr->sample_count && ok; nc++) {
+			if (group + 1 < tr->sample_to_chunk_count && nc + 1 == tr->sample_to_chunk[group + 1].first_chunk)
+				group++;
+			unsigned in_chunk = tr->chunk_count == 1 ? tr->sample_count : tr->sample_to_chunk[group].samples_per_chunk;
+			MP4D_file_offset_t ofs = tr->chunk_offset[nc];
+			for (unsigned k = 0; k < in_chunk && sample < tr->sample_count && ok; k++, sample++) {
+				if ((sample & 4095) == 0 && cancel && cancel->load(std::memory_order_relaxed))
+					ok = false;
+				unsigned bytes = tr->entry_size[sample];
+				int type = dvr_index_slice_type(fd, ofs, bytes, hevc);
+				uint64_t t = (uint64_t)tr->timestamp[sample] * DvrIndex::TIMESCALE / tr->timescale;
+				if (type >= 0 && NalView::is_irap(hevc, type) &&
+					(index.entries().empty() || index.entries().back().time != t))
+					index.add(t, ofs);
+				ofs += bytes;
+			}
+		}
+	} else {
+		// Fragmented file: one moof (+ mdat) per sample
+		uint64_t time = 0;
+		int64_t pos = 0;
+		uint8_t box[8];
+		std::vector<uint8_t> moof;
+		while (ok && pos + 8 <= size && pread(fd, box, 8, pos) == 8) {
+			if (cancel && cancel->load(std::memory_order_relaxed))
+				ok = false;
+			uint32_t box_size = read_be32(box);
+			if (box_size < 8 || pos + box_size > size)
+				break;
+			if (!memcmp(box + 4, "mfra", 4))
+				has_mfra = true;
+			if (!memcmp(box + 4, "moof", 4)) {
+				moof.resize(box_size - 8);
+				if (pread(fd, moof.data(), moof.size(), pos + 8) != (ssize_t)moof.size())
+					break;
+				uint64_t duration = 0;
+				bool keyframe = false;
+				if (!parse_moof(moof.data(), moof.data() + moof.size(), &duration, &keyframe))
+					break;
+				if (keyframe)
+					index.add(time * DvrIndex::TIMESCALE / tr->timescale, pos);
+				time += duration;
+			}
+			pos += box_size;
+		}
+		// Only a file that ends on a complete box can take an mfra after it
+		append_mfra = ok && !has_mfra && pos == size && tr->timescale == DvrIndex::TIMESCALE &&
+					  !index.entries().empty();
+	}
+	MP4D_close(&mp4);
+	close(fd);
+
+	if (!ok)
+		return false;
+	if (append_mfra) {
+		// Lets qtdemux seek this file without walking every moof the next
+		// time it is played
+		std::vector<uint8_t> mfra = index.mfra(1);
+		fd = open(mp4_path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+		if (fd < 0 || write(fd, mfra.data(), mfra.size()) != (ssize_t)mfra.size()) {
+			spdlog::warn("DVR: unable to append mfra to {}", mp4_path);
+			if (fd >= 0 && ftruncate(fd, size) != 0)
+				spdlog::warn("DVR: unable to undo a partial mfra in {}", mp4_path);
+		}
+		if (fd >= 0)
+			close(fd);
+	}
+	if (!index.save(mp4_path, hevc)) {
+		spdlog::warn("DVR: unable to write keyframe index for {}", mp4_path);
+		return false;
+	}
+	spdlog::info("DVR: indexed {} keyframes in {}", index.entries().size(), mp4_path);
+	return true;
+}
 
 // C-compatible interface
 extern "C" {
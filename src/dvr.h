@@ -8,19 +8,23 @@
 #include <mutex>
 #include <condition_variable>
 #include <functional>
+#include <atomic>
+#include <string>
+#include <vector>
 
 #include "gstrtpreceiver.h"
+#include "dvr_writer.h"
+#include "nal_view.h"
+#include "dvr_preroll.h"
+#include "dvr_index.h"
+#include "dvr_retention.h"
+#include "dvr_telemetry.h"
 
 enum DvrMode { DVR_MODE_RAW = 0, DVR_MODE_REENCODE = 1, DVR_MODE_BOTH = 2 };
 
 struct MP4E_mux_tag;
 struct mp4_h26x_writer_tag;
 
-struct dvr_write_ctx {
-    FILE *f;
-    int64_t file_size;  // tracks max written offset
-};
-
 struct video_params {
     uint32_t video_frm_width;
     uint32_t video_frm_height;
@@ -33,6 +37,13 @@ struct dvr_thread_params {
     bool dvr_filenames_with_sequence = false;
     int video_framerate = -1;
     int64_t max_file_size = 0;  // 0 = no limit; bytes
+    int segment_s = 0;          // 0 = no time based segments
+    bool segment_align = false; // segment boundaries on multiples of segment_s of the wall clock
+    bool segment_on_link_loss = false;
+    int preroll_ms = 0;         // 0 = no pre-roll
+    size_t preroll_max_bytes = 0;
+    DvrRetention *retention = nullptr;  // shared by the DVRs of a directory, optional
+    DvrTelemetry::Format telemetry_format = DvrTelemetry::CSV;  // with --dvr-telemetry
     video_params video_p;
 };
 
@@ -43,23 +54,36 @@ struct dvr_rpc {
         RPC_START,
         RPC_TOGGLE,
         RPC_SHUTDOWN,
-        RPC_SET_PARAMS
+        RPC_SET_PARAMS,
+        RPC_SEGMENT
     } command;
     /* union { */
-        std::shared_ptr<std::vector<uint8_t>> frame;
+        EncodedFramePtr frame;
     /*     video_params params; */
     /* }; */
+    uint64_t timestamp = 0;    // RPC_FRAME: 90 kHz stream timestamp
+    uint64_t arrival_us = 0;   // RPC_FRAME: monotonic time the frame was queued
+    const char *reason = nullptr;   // RPC_SEGMENT: static string, for the log
 };
 
 
 extern int dvr_enabled;
+// Seconds kept before the start of a recording, in ms; frames have to reach
+// the DVR even while it's not recording when this is set.
+extern int dvr_preroll_ms;
+static inline bool dvr_frames_wanted() { return dvr_enabled || dvr_preroll_ms > 0; }
+// Set by DvrHealth as a last resort on slow storage: pictures nothing
+// references are left out of the recordings.
+extern std::atomic<bool> dvr_drop_non_reference;
 
 class Dvr {
 public:
     explicit Dvr(dvr_thread_params params);
     virtual ~Dvr();
 
-    void frame(std::shared_ptr<std::vector<uint8_t>> frame);
+    // timestamp is in 90 kHz units (RTP clock); only the differences between
+    // consecutive frames are used, to derive each sample's duration.
+    void frame(EncodedFramePtr frame, uint64_t timestamp);
     void set_video_params(uint32_t video_frm_width,
                           uint32_t video_frm_height,
                           VideoCodec codec);
@@ -68,6 +92,8 @@ public:
     void set_video_framerate(int rate);
     void set_max_file_size(int64_t size);
     void toggle_recording();
+    // Close the current file at the next IDR and go on in a new one.
+    void segment(const char *reason);
     void shutdown();
 
     static void *__THREAD__(void *context);
@@ -82,9 +108,24 @@ private:
     int start();
     void stop();
     void init();
-    void split();
-    bool is_idr(const uint8_t *data, size_t len);
-    void cache_parameter_sets(const uint8_t *data, size_t len);
+    void split(const char *reason);
+    const char *segment_due();
+    void start_segment_clock();
+    void cache_parameter_sets();
+    void write_parameter_sets();
+    void handle_frame(EncodedFramePtr frame,
+                      uint64_t timestamp, uint64_t arrival_us, bool live);
+    void flush_preroll();
+    void queue_frame(EncodedFramePtr frame,
+                     uint64_t timestamp, uint64_t arrival_us);
+    void flush_pending_frame(bool have_next, uint64_t next_ts, uint64_t next_arrival_us);
+    unsigned frame_duration(uint64_t next_ts, uint64_t next_arrival_us);
+    void write_frame(const NalView &view, unsigned duration);
+    void write_mfra();
+    static int mp4_write_callback(int64_t offset, const void *buffer, size_t size, void *token);
+    void write_journal();
+    void remove_journal();
+    void check_storage(uint64_t arrival_us);
 private:
     std::queue<dvr_rpc> dvrQueue;
     std::mutex mtx;
@@ -99,16 +140,76 @@ private:
     VideoCodec codec;
     int _ready_to_write = 0;
     bool split_pending = false;
+    const char *split_reason = nullptr;
+    int segment_s = 0;
+    bool segment_align = false;
+    bool segment_on_link_loss = false;
+    const char *segment_requested = nullptr;   // event waiting for the next IDR
+    time_t segment_deadline = 0;               // aligned segments: wall clock end
     int split_part = 0;
     std::string current_base_path;  // base path without .mp4 for split naming
+    std::string current_file_path;  // file being written, for the recovery journal
     std::vector<uint8_t> cached_vps;   // H.265 only
     std::vector<uint8_t> cached_sps;
     std::vector<uint8_t> cached_pps;
     bool params_complete = false;
-
-    dvr_write_ctx write_ctx;
+    NalView nal_view;                  // spans of the access unit being written
+    bool drop_until_idr = false;  // writer backed up; skip to the next IDR
+    uint64_t skipped_non_reference = 0;
+
+    // A sample's duration is only known once the next frame arrives, so the
+    // last frame is held back until then (or until the file is closed).
+    EncodedFramePtr pending_frame;
+    NalView pending_view;
+    uint64_t pending_ts = 0;
+    uint64_t pending_arrival_us = 0;
+    unsigned nominal_duration = 0;     // last regular frame interval, 90 kHz
+    uint64_t timestamp_gaps = 0;
+    uint64_t timestamp_resets = 0;
+
+    DvrIndex keyframe_index;           // "<file>.idx" sidecar
+    bool keyframe_moof_pending = false; // fragmented: index the next moof
+    uint64_t file_time = 0;            // decode time of the next sample, 90 kHz
+
+    DvrRetention *retention = nullptr;
+    uint64_t storage_checked_us = 0;
+
+    DvrTelemetry telemetry;            // "<file>.csv" / "<file>.srt" sidecar
+    uint64_t telemetry_flushed_us = 0;
+
+    DvrPreroll preroll;                // filled while not recording
+    uint64_t preroll_published_us = 0;
+
+    DvrWriter writer;
     MP4E_mux_tag *mux;
     mp4_h26x_writer_tag *mp4wr;
 };
 
+// Rebuilds recordings left unfinished by a crash or power cut.
+//
+// While a file is being recorded the DVR keeps a small "<file>.rec" journal
+// next to it with the codec, geometry and parameter sets (written once those
+// are known), then one "<bytes> <duration>" line per frame appended with
+// each sync of the data; it is removed once the MP4 index has been written.
+// Frames past the last synced line get the nominal frame rate.  A journal
+// found at startup therefore marks a file without a usable moov, and stays
+// until the file has been rebuilt.  The constructor only lists the journals
+// (cheap, must run before any Dvr starts recording); __THREAD__ then re-muxes
+// each file from the length-prefixed NAL units in its mdat.
+class DvrRecovery {
+public:
+    explicit DvrRecovery(const std::string &dir);
+
+    bool pending() const { return !journals.empty(); }
+    void cancel() { cancelled = true; }
+
+    static void *__THREAD__(void *context);
+private:
+    void run();
+    bool recover(const std::string &journal_path);
+
+    std::vector<std::string> journals;
+    std::atomic<bool> cancelled{false};
+};
+
 #endif
@@ -0,0 +1,189 @@
+#include <pthread.h>
+#include <algorithm>
+#include <chrono>
+
+#include "spdlog/spdlog.h"
+
+#include "dvr_health.h"
+extern "C" {
+#include "osd.h"
+}
+
+std::mutex DvrHealth::writers_mtx_;
+std::map<const void *, DvrHealth::Writer> DvrHealth::writers_;
+
+static uint64_t monotonic_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+DvrHealth::DvrHealth(Actions actions, bool degrade)
+    : actions_(std::move(actions)), degrade_(degrade) {}
+
+DvrHealth::~DvrHealth() {}
+
+void DvrHealth::report(const void *token, const DvrStorageSample &sample, uint64_t now_ms) {
+    std::lock_guard<std::mutex> lock(writers_mtx_);
+    Writer &w = writers_[token];
+    // A reopened writer counts its drops from zero again
+    if (sample.dropped_frames < w.sample.dropped_frames)
+        w.dropped_seen = 0;
+    w.sample = sample;
+    w.seen_ms = now_ms;
+}
+
+void DvrHealth::forget(const void *token) {
+    std::lock_guard<std::mutex> lock(writers_mtx_);
+    writers_.erase(token);
+}
+
+void DvrHealth::tick(uint64_t now_ms) {
+    bool pressure = false;
+    bool healthy = true;
+    bool losing_frames = false;
+    std::string why;
+    {
+        std::lock_guard<std::mutex> lock(writers_mtx_);
+        for (auto &entry : writers_) {
+            Writer &w = entry.second;
+            const DvrStorageSample &s = w.sample;
+            bool stalled = now_ms - w.seen_ms >= STALE_S * 1000;
+            bool dropped = s.dropped_frames > w.dropped_seen;
+            w.dropped_seen = s.dropped_frames;
+            if (dropped)
+                losing_frames = true;
+            if (stalled)
+                why = "writes stalled";
+            else if (dropped)
+                why = "frames dropped";
+            else if (s.p99_ms >= P99_MS)
+                why = "p99 latency " + std::to_string(s.p99_ms) + " ms";
+            else if (s.queue_pct >= QUEUE_PCT)
+                why = "queue " + std::to_string(s.queue_pct) + "% full";
+            else if (s.busy_pct >= BUSY_PCT)
+                why = "busy " + std::to_string(s.busy_pct) + "%";
+            else {
+                if (s.busy_pct >= HEALTHY_BUSY_PCT || s.queue_pct >= HEALTHY_QUEUE_PCT)
+                    healthy = false;
+                continue;
+            }
+            pressure = true;
+            healthy = false;
+        }
+    }
+
+    Level previous = level_;
+    if (pressure) {
+        healthy_since_ms_ = 0;
+        if (!pressure_since_ms_)
+            pressure_since_ms_ = now_ms;
+        bool sustained = losing_frames || now_ms - pressure_since_ms_ >= PRESSURE_S * 1000;
+        bool cooled = !last_action_ms_ || now_ms - last_action_ms_ >= COOLDOWN_S * 1000;
+        if (degrade_ && sustained && cooled && escalate()) {
+            spdlog::info("DVR storage degraded because of: {}", why);
+            last_action_ms_ = now_ms;
+        }
+    } else if (healthy) {
+        pressure_since_ms_ = 0;
+        if (!healthy_since_ms_)
+            healthy_since_ms_ = now_ms;
+        // Undo one step per HEALTHY_S
+        if (now_ms - healthy_since_ms_ >= HEALTHY_S * 1000 && relax()) {
+            healthy_since_ms_ = now_ms;
+            last_action_ms_ = now_ms;
+        }
+    } else {
+        pressure_since_ms_ = 0;
+        healthy_since_ms_ = 0;
+    }
+
+    bool degraded = bitrate_pct_ < 100 || raw_only_ || drop_non_ref_;
+    if (losing_frames)
+        level_ = LOSING_FRAMES;
+    else if (degraded)
+        level_ = DEGRADED;
+    else if (pressure)
+        level_ = PRESSURE;
+    else
+        level_ = HEALTHY;
+    // The ladder steps warn for themselves
+    if (level_ == LOSING_FRAMES && previous != LOSING_FRAMES)
+        warn("DVR: SD card too slow, frames lost");
+    else if (level_ == PRESSURE && previous == HEALTHY)
+        warn("DVR: SD card falling behind (" + why + ")");
+    osd_publish_uint_fact("dvr.storage_level", NULL, 0, level_);
+}
+
+// Apply the next step that has an effect.
+bool DvrHealth::escalate() {
+    if (bitrate_pct_ > MIN_BITRATE_PCT) {
+        unsigned pct = bitrate_pct_ >= MIN_BITRATE_PCT + BITRATE_STEP_PCT
+                     ? bitrate_pct_ - BITRATE_STEP_PCT : MIN_BITRATE_PCT;
+        if (actions_.set_bitrate && actions_.set_bitrate(pct)) {
+            bitrate_pct_ = pct;
+            warn("DVR: SD card too slow, re-encode bitrate lowered to " + std::to_string(pct) + "%");
+            return true;
+        }
+    }
+    if (!raw_only_ && actions_.raw_only && actions_.raw_only()) {
+        raw_only_ = true;
+        warn("DVR: SD card too slow, recording the raw stream only");
+        return true;
+    }
+    if (!drop_non_ref_ && actions_.drop_non_reference && actions_.drop_non_reference(true)) {
+        drop_non_ref_ = true;
+        warn("DVR: SD card too slow, skipping non-reference frames");
+        return true;
+    }
+    return false;
+}
+
+// Undo the last step still in place, except the raw-only switch.
+bool DvrHealth::relax() {
+    if (drop_non_ref_) {
+        if (actions_.drop_non_reference)
+            actions_.drop_non_reference(false);
+        drop_non_ref_ = false;
+        warn("DVR: SD card keeping up, recording all frames again");
+        return true;
+    }
+    if (bitrate_pct_ < 100) {
+        bitrate_pct_ = std::min(bitrate_pct_ + BITRATE_STEP_PCT, 100u);
+        if (actions_.set_bitrate)
+            actions_.set_bitrate(bitrate_pct_);
+        warn("DVR: SD card keeping up, re-encode bitrate back to " + std::to_string(bitrate_pct_) + "%");
+        return true;
+    }
+    return false;
+}
+
+void DvrHealth::warn(const std::string &msg) {
+    spdlog::warn("{}", msg);
+    osd_publish_str_fact("dvr.storage_warning", NULL, 0, msg.c_str());
+}
+
+void DvrHealth::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+}
+
+void *DvrHealth::__THREAD__(void *context) {
+    pthread_setname_np(pthread_self(), "__DVRHEALTH");
+    ((DvrHealth *)context)->loop();
+    return nullptr;
+}
+
+void DvrHealth::loop() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (!stop_) {
+        cv_.wait_for(lock, std::chrono::seconds(1), [this] { return stop_; });
+        if (stop_)
+            break;
+        lock.unlock();
+        tick(monotonic_ms());
+        lock.lock();
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef DVR_HEALTH_H
+#define DVR_HEALTH_H
+
+#include <stdint.h>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+// ---------------------------------------------------------------------------
+// DvrHealth: watches how the card keeps up with the recordings and degrades
+// them before frames are lost.
+//
+//  Every DvrWriter reports its windowed figures about once a second.  The
+//  card is under pressure when a writer is busy BUSY_PCT of the time, its
+//  queue is QUEUE_PCT full, its 99th percentile latency reaches P99_MS, or
+//  frames were dropped.  After PRESSURE_S seconds of pressure (at once on
+//  drops) the next step of the ladder is applied, at most one step per
+//  COOLDOWN_S:
+//
+//    1. lower the re-encode bitrate in BITRATE_STEP_PCT steps down to
+//       MIN_BITRATE_PCT of the configured one
+//    2. stop recording the re-encoded stream when both are recorded
+//    3. leave non-reference frames out of the recordings
+//
+//  After HEALTHY_S seconds of comfortable figures the steps are undone one
+//  at a time, last first; the raw-only switch stays (it restarted the
+//  recording once already).  Steps that don't apply (no re-encoder, single
+//  stream) are skipped.  Level changes are shown on the OSD.
+// ---------------------------------------------------------------------------
+
+struct DvrStorageSample {
+    unsigned write_kbps = 0;      // data written
+    unsigned capacity_kbps = 0;   // write rate while the card was busy
+    unsigned busy_pct = 0;        // share of time spent in writes and syncs
+    unsigned p50_ms = 0;
+    unsigned p95_ms = 0;
+    unsigned p99_ms = 0;
+    unsigned queue_pct = 0;       // queue fill against the drop threshold
+    uint64_t dropped_frames = 0;  // since the file was opened
+};
+
+class DvrHealth {
+public:
+    // dvr.storage_level
+    enum Level { HEALTHY = 0, PRESSURE = 1, DEGRADED = 2, LOSING_FRAMES = 3 };
+
+    // What the monitor may do. Each returns false when it has no effect,
+    // so the ladder moves on to the next step.
+    struct Actions {
+        std::function<bool(unsigned pct)> set_bitrate;   // % of the configured bitrate
+        std::function<bool()> raw_only;
+        std::function<bool(bool)> drop_non_reference;
+    };
+
+    // degrade false: report and warn only.
+    DvrHealth(Actions actions, bool degrade);
+    ~DvrHealth();
+
+    // From the writer threads; token identifies the writer. A writer that
+    // stops reporting for STALE_S is taken as stalled on the card.
+    static void report(const void *token, const DvrStorageSample &sample, uint64_t now_ms);
+    static void forget(const void *token);
+
+    // One evaluation; the thread calls it every second.
+    void tick(uint64_t now_ms);
+    Level level() const { return level_; }
+    unsigned bitrate_pct() const { return bitrate_pct_; }
+    bool raw_only() const { return raw_only_; }
+    bool dropping_non_reference() const { return drop_non_ref_; }
+
+    void shutdown();
+    static void *__THREAD__(void *context);
+
+    static const unsigned BUSY_PCT = 85;
+    static const unsigned QUEUE_PCT = 50;
+    static const unsigned P99_MS = 1000;
+    static const unsigned HEALTHY_BUSY_PCT = 50;
+    static const unsigned HEALTHY_QUEUE_PCT = 10;
+    static const uint64_t PRESSURE_S = 3;
+    static const uint64_t COOLDOWN_S = 5;
+    static const uint64_t HEALTHY_S = 15;
+    static const uint64_t STALE_S = 3;
+    static const unsigned BITRATE_STEP_PCT = 25;
+    static const unsigned MIN_BITRATE_PCT = 25;
+
+private:
+    struct Writer {
+        DvrStorageSample sample;
+        uint64_t seen_ms = 0;
+        uint64_t dropped_seen = 0;   // drops already accounted for
+    };
+    void loop();
+    bool escalate();
+    bool relax();
+    void warn(const std::string &msg);
+
+    static std::mutex writers_mtx_;
+    static std::map<const void *, Writer> writers_;
+
+    Actions actions_;
+    bool degrade_;
+    Level level_ = HEALTHY;
+    unsigned bitrate_pct_ = 100;
+    bool raw_only_ = false;
+    bool drop_non_ref_ = false;
+    uint64_t pressure_since_ms_ = 0;   // 0 while not under pressure
+    uint64_t healthy_since_ms_ = 0;
+    uint64_t last_action_ms_ = 0;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+};
+
+#endif // DVR_HEALTH_H
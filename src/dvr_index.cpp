@@ -0,0 +1,185 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "spdlog/spdlog.h"
+
+#include "dvr_index.h"
+#include "nal_view.h"
+
+static const char MAGIC[4] = {'P', 'P', 'K', 'I'};
+static const uint16_t VERSION = 1;
+static const size_t HEADER_SIZE = 16;
+static const size_t RECORD_SIZE = 16;
+
+static void put_le(uint8_t *p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put_be(std::vector<uint8_t> &v, uint64_t x, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--)
+        v.push_back((uint8_t)(x >> (8 * i)));
+}
+
+static uint64_t get_le(const uint8_t *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = bytes - 1; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static void make_header(uint8_t *h, bool hevc) {
+    memset(h, 0, HEADER_SIZE);
+    memcpy(h, MAGIC, 4);
+    put_le(h + 4, VERSION, 2);
+    h[6] = hevc ? 1 : 0;
+    put_le(h + 8, DvrIndex::TIMESCALE, 4);
+}
+
+bool DvrIndex::create(const std::string &mp4_path, bool hevc) {
+    close();
+    entries_.clear();
+    std::string path = sidecar_path(mp4_path);
+    file_ = fopen(path.c_str(), "wb");
+    if (!file_) {
+        spdlog::warn("DVR: unable to create keyframe index {}: {}", path, strerror(errno));
+        return false;
+    }
+    uint8_t h[HEADER_SIZE];
+    make_header(h, hevc);
+    if (fwrite(h, 1, sizeof(h), file_) != sizeof(h) || fflush(file_) != 0) {
+        spdlog::warn("DVR: unable to write keyframe index {}", path);
+        close();
+        return false;
+    }
+    return true;
+}
+
+void DvrIndex::append(uint64_t time, uint64_t offset) {
+    entries_.push_back({time, offset});
+    if (!file_)
+        return;
+    uint8_t r[RECORD_SIZE];
+    put_le(r, time, 8);
+    put_le(r + 8, offset, 8);
+    // One record per GOP; flush right away so it survives a crash
+    if (fwrite(r, 1, sizeof(r), file_) != sizeof(r) || fflush(file_) != 0) {
+        spdlog::warn("DVR: keyframe index write failed, index disabled for this file");
+        close();
+    }
+}
+
+void DvrIndex::close() {
+    if (file_) {
+        fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+bool DvrIndex::load(const std::string &mp4_path) {
+    entries_.clear();
+    struct stat st;
+    if (stat(mp4_path.c_str(), &st) != 0)
+        return false;
+    FILE *f = fopen(sidecar_path(mp4_path).c_str(), "rb");
+    if (!f)
+        return false;
+    uint8_t h[HEADER_SIZE];
+    if (fread(h, 1, sizeof(h), f) != sizeof(h) || memcmp(h, MAGIC, 4) != 0 ||
+        get_le(h + 4, 2) != VERSION || get_le(h + 8, 4) != TIMESCALE) {
+        fclose(f);
+        return false;
+    }
+    uint8_t r[RECORD_SIZE];
+    while (fread(r, 1, sizeof(r), f) == sizeof(r)) {
+        DvrIndexEntry e = {get_le(r, 8), get_le(r + 8, 8)};
+        if (e.offset >= (uint64_t)st.st_size)
+            break;
+        if (!entries_.empty() && e.time < entries_.back().time)
+            break;
+        entries_.push_back(e);
+    }
+    fclose(f);
+    return true;
+}
+
+bool DvrIndex::save(const std::string &mp4_path, bool hevc) const {
+    std::string path = sidecar_path(mp4_path);
+    std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f)
+        return false;
+    std::vector<uint8_t> buf(HEADER_SIZE + entries_.size() * RECORD_SIZE);
+    make_header(buf.data(), hevc);
+    uint8_t *p = buf.data() + HEADER_SIZE;
+    for (const DvrIndexEntry &e : entries_) {
+        put_le(p, e.time, 8);
+        put_le(p + 8, e.offset, 8);
+        p += RECORD_SIZE;
+    }
+    bool ok = fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::vector<uint8_t> DvrIndex::mfra(uint32_t track_id) const {
+    std::vector<uint8_t> box;
+    const uint32_t tfra_size = 24 + entries_.size() * 19;
+    const uint32_t mfra_size = 8 + tfra_size + 16;
+    put_be(box, mfra_size, 4);
+    box.insert(box.end(), {'m', 'f', 'r', 'a'});
+    put_be(box, tfra_size, 4);
+    box.insert(box.end(), {'t', 'f', 'r', 'a'});
+    put_be(box, 0x01000000, 4);   // version 1: 64-bit time and offset
+    put_be(box, track_id, 4);
+    put_be(box, 0, 4);            // 1-byte traf, trun and sample numbers
+    put_be(box, entries_.size(), 4);
+    for (const DvrIndexEntry &e : entries_) {
+        put_be(box, e.time, 8);
+        put_be(box, e.offset, 8);
+        box.insert(box.end(), {1, 1, 1});   // one traf, one trun, one sample per moof
+    }
+    put_be(box, 16, 4);
+    box.insert(box.end(), {'m', 'f', 'r', 'o'});
+    put_be(box, 0, 4);
+    put_be(box, mfra_size, 4);
+    return box;
+}
+
+int dvr_index_slice_type(int fd, uint64_t offset, uint32_t size, bool hevc) {
+    uint64_t end = offset + size;
+    while (offset + 5 <= end) {
+        uint8_t hdr[5];
+        if (pread(fd, hdr, sizeof(hdr), offset) != (ssize_t)sizeof(hdr))
+            return -1;
+        uint32_t len = (uint32_t)hdr[0] << 24 | hdr[1] << 16 | hdr[2] << 8 | hdr[3];
+        uint8_t type = hevc ? (hdr[4] >> 1) & 0x3f : hdr[4] & 0x1f;
+        if (NalView::is_vcl(hevc, type))
+            return type;
+        if (len == 0)
+            return -1;
+        offset += 4 + (uint64_t)len;
+    }
+    return -1;
+}
+
+const DvrIndexEntry *DvrIndex::at_or_before(uint64_t time) const {
+    auto it = std::upper_bound(entries_.begin(), entries_.end(), time,
+                               [](uint64_t t, const DvrIndexEntry &e) { return t < e.time; });
+    if (it == entries_.begin())
+        return nullptr;
+    return &*(it - 1);
+}
+
+const DvrIndexEntry *DvrIndex::after(uint64_t time) const {
+    auto it = std::upper_bound(entries_.begin(), entries_.end(), time,
+                               [](uint64_t t, const DvrIndexEntry &e) { return t < e.time; });
+    return it == entries_.end() ? nullptr : &*it;
+}
@@ -0,0 +1,79 @@
+#ifndef DVR_INDEX_H
+#define DVR_INDEX_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// DvrIndex: keyframe index kept next to a DVR recording as "<file>.idx".
+//
+//  The DVR appends one record per keyframe while recording: decode time
+//  from the start of the file and the byte offset where the keyframe's data
+//  (or, in fragmented files, its moof) begins.  Playback looks keyframes up
+//  here and seeks straight to one, without decoding from an earlier IDR.
+//  Fragmented recordings also get the index as an mfra box at the end of the
+//  file, which qtdemux reads to jump to a moof instead of walking all of
+//  them, so seeking takes the same time whatever the recording length.
+//
+//  Layout, little-endian: 16-byte header ("PPKI", u16 version, u8 codec
+//  (0 = H.264, 1 = H.265), u8 reserved, u32 timescale, u32 reserved)
+//  followed by 16-byte records (u64 time, u64 offset).  A torn last record
+//  is ignored on load.
+// ---------------------------------------------------------------------------
+
+struct DvrIndexEntry {
+    uint64_t time;     // TIMESCALE units from the start of the file
+    uint64_t offset;   // byte offset in the MP4 file: the keyframe's data,
+                       // or its moof in a fragmented file
+};
+
+class DvrIndex {
+public:
+    static const uint32_t TIMESCALE = 90000;
+
+    ~DvrIndex() { close(); }
+
+    static std::string sidecar_path(const std::string &mp4_path) { return mp4_path + ".idx"; }
+
+    // Writing, while recording. Errors only disable the sidecar; the
+    // entries are kept for mfra().
+    bool create(const std::string &mp4_path, bool hevc);
+    void append(uint64_t time, uint64_t offset);
+    void close();
+
+    // The entries as an mfra box (tfra for track_id, then mfro), for a
+    // fragmented file whose entries point at moof boxes.
+    std::vector<uint8_t> mfra(uint32_t track_id) const;
+
+    // Reading. Entries pointing past the end of the MP4 are dropped.
+    bool load(const std::string &mp4_path);
+    // Write entries() as a complete sidecar, atomically.
+    bool save(const std::string &mp4_path, bool hevc) const;
+    void add(uint64_t time, uint64_t offset) { entries_.push_back({time, offset}); }
+
+    const std::vector<DvrIndexEntry> &entries() const { return entries_; }
+    // Last keyframe at or before time, nullptr if there is none.
+    const DvrIndexEntry *at_or_before(uint64_t time) const;
+    // First keyframe strictly after time, nullptr if there is none.
+    const DvrIndexEntry *after(uint64_t time) const;
+
+private:
+    FILE *file_ = nullptr;
+    std::vector<DvrIndexEntry> entries_;
+};
+
+// nal_unit_type of the first slice of the MP4 sample at offset (4-byte
+// length-prefixed NALs), past any AUD, SEI or parameter sets in front of
+// it; -1 if the sample has no slice or can't be read.
+int dvr_index_slice_type(int fd, uint64_t offset, uint32_t size, bool hevc);
+
+// Build the sidecar of a recording that has none (older recordings,
+// recovered files); a fragmented one also gets its mfra appended. Defined
+// in dvr.cpp, the translation unit that compiles minimp4. Returns false on
+// failure or when cancelled.
+bool dvr_index_rebuild(const std::string &mp4_path, const std::atomic<bool> *cancel);
+
+#endif // DVR_INDEX_H
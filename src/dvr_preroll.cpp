@@ -0,0 +1,63 @@
+#include "dvr_preroll.h"
+
+void DvrPreroll::configure(uint64_t max_us, size_t max_bytes) {
+    max_us_ = max_us;
+    max_bytes_ = max_bytes;
+    if (!enabled())
+        clear();
+    else
+        trim();
+}
+
+void DvrPreroll::push(DvrPrerollFrame frame) {
+    if (!enabled() || !frame.data)
+        return;
+    // Nothing can be decoded before the first keyframe
+    if (frames_.empty() && !frame.keyframe)
+        return;
+    bytes_ += frame.data->size();
+    if (frame.keyframe)
+        keyframes_++;
+    frames_.push_back(std::move(frame));
+    trim();
+}
+
+std::deque<DvrPrerollFrame> DvrPreroll::take() {
+    std::deque<DvrPrerollFrame> out;
+    out.swap(frames_);
+    bytes_ = 0;
+    keyframes_ = 0;
+    return out;
+}
+
+void DvrPreroll::clear() {
+    frames_.clear();
+    bytes_ = 0;
+    keyframes_ = 0;
+}
+
+void DvrPreroll::trim() {
+    while (keyframes_ > 1) {
+        if (bytes_ > max_bytes_) {
+            drop_first_gop();
+            continue;
+        }
+        // Only drop the oldest GOP if the rest still covers the window
+        size_t i = 1;
+        while (!frames_[i].keyframe)
+            i++;
+        if (frames_.back().arrival_us - frames_[i].arrival_us < max_us_)
+            break;
+        drop_first_gop();
+    }
+    if (bytes_ > max_bytes_)
+        clear();
+}
+
+void DvrPreroll::drop_first_gop() {
+    do {
+        bytes_ -= frames_.front().data->size();
+        frames_.pop_front();
+    } while (!frames_.empty() && !frames_.front().keyframe);
+    keyframes_--;
+}
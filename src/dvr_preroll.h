@@ -0,0 +1,61 @@
+#ifndef DVR_PREROLL_H
+#define DVR_PREROLL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "encoded_frame.h"
+
+// ---------------------------------------------------------------------------
+// DvrPreroll: the last few seconds of encoded video, kept while not recording.
+//
+//  Frames are held by reference (the shared buffers coming from the receiver
+//  or the encoder), so buffering costs no copies; the caller compacts frames
+//  borrowing scarce encoder memory before pushing them.  The buffer always starts
+//  at a keyframe: frames arriving before the first one are ignored and old
+//  footage is dropped one whole GOP at a time, as long as what remains still
+//  covers the requested window.  The byte cap is hard: when a single GOP
+//  outgrows it, everything is dropped until the next keyframe.
+// ---------------------------------------------------------------------------
+
+struct DvrPrerollFrame {
+    EncodedFramePtr data;
+    uint64_t timestamp = 0;    // 90 kHz stream timestamp
+    uint64_t arrival_us = 0;   // monotonic arrival time
+    bool keyframe = false;     // IDR / IRAP access unit
+};
+
+class DvrPreroll {
+public:
+    // Keep at least max_us of footage using at most max_bytes. Either one
+    // being 0 disables the buffer.
+    void configure(uint64_t max_us, size_t max_bytes);
+    bool enabled() const { return max_us_ > 0 && max_bytes_ > 0; }
+
+    void push(DvrPrerollFrame frame);
+    // Hand over the buffered frames, oldest (a keyframe) first, and empty the buffer.
+    std::deque<DvrPrerollFrame> take();
+    void clear();
+
+    size_t frames() const { return frames_.size(); }
+    size_t bytes() const { return bytes_; }
+    // Arrival time span from the first to the last buffered frame.
+    uint64_t duration_us() const {
+        return frames_.empty() ? 0 : frames_.back().arrival_us - frames_.front().arrival_us;
+    }
+
+private:
+    void trim();
+    void drop_first_gop();
+
+    uint64_t max_us_ = 0;
+    size_t max_bytes_ = 0;
+    std::deque<DvrPrerollFrame> frames_;
+    size_t bytes_ = 0;
+    size_t keyframes_ = 0;
+};
+
+#endif // DVR_PREROLL_H
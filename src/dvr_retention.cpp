@@ -0,0 +1,275 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include "spdlog/spdlog.h"
+
+#include "dvr_retention.h"
+#include "dvr_telemetry.h"
+extern "C" {
+#include "osd.h"
+}
+
+namespace fs = std::filesystem;
+
+const char *const DvrRetention::SIDECAR_SUFFIXES[] = {".idx", nullptr};
+
+static const char *CATALOGUE_NAME = ".dvr_catalogue";
+
+static uint64_t monotonic_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool has_suffix(const std::string &s, const char *suffix) {
+    size_t n = strlen(suffix);
+    return s.size() > n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+static bool file_exists(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+// Sequence number of "<digits>_..." names, -1 for anything else.
+static int sequence_of(const std::string &name) {
+    size_t digits = 0;
+    while (digits < name.size() && isdigit((unsigned char)name[digits]))
+        digits++;
+    if (digits == 0 || digits >= name.size() || name[digits] != '_')
+        return -1;
+    return atoi(name.c_str());
+}
+
+DvrRetention::DvrRetention(const std::string &dir, uint64_t min_free, uint64_t quota)
+    : dir_(dir), catalogue_path_(dir + "/" + CATALOGUE_NAME), min_free_(min_free), quota_(quota) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    load();
+    scan();
+    save();
+    uint64_t total = 0;
+    for (const auto &r : recordings_)
+        total += r.second.size;
+    spdlog::info("DVR catalogue: {} recordings, {} MB in {}", recordings_.size(), total / (1024 * 1024), dir_);
+}
+
+void DvrRetention::load() {
+    std::ifstream in(catalogue_path_);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        std::string name, codec;
+        DvrRecording rec;
+        if (!std::getline(fields, name, '\t'))
+            continue;
+        if (!(fields >> rec.size >> rec.duration_ms >> rec.start_time >> codec))
+            continue;
+        rec.codec = codec == "-" ? "" : codec;
+        recordings_[name] = rec;
+    }
+}
+
+// Reconcile the catalogue with the directory: forget deleted files, pick up
+// files copied in or recorded by older versions, refresh sizes (recovery
+// rewrites files).
+void DvrRetention::scan() {
+    std::map<std::string, DvrRecording> found;
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator(dir_, ec)) {
+        std::string name = entry.path().filename().string();
+        if (!entry.is_regular_file(ec))
+            continue;
+        next_sequence_ = std::max(next_sequence_, sequence_of(name) + 1);
+        if (!has_suffix(name, ".mp4"))
+            continue;
+        struct stat st;
+        if (stat(entry.path().c_str(), &st) != 0)
+            continue;
+        DvrRecording rec;
+        auto known = recordings_.find(name);
+        if (known != recordings_.end())
+            rec = known->second;
+        else
+            rec.start_time = st.st_mtime;
+        rec.size = st.st_size;
+        rec.active = false;
+        found[name] = rec;
+    }
+    recordings_.swap(found);
+}
+
+void DvrRetention::save() {
+    deletable_ = 0;
+    for (const auto &r : recordings_)
+        if (!is_protected(r.first, r.second))
+            deletable_ += r.second.size;
+
+    std::string tmp = catalogue_path_ + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (!f) {
+        spdlog::warn("unable to write DVR catalogue {}: {}", catalogue_path_, strerror(errno));
+        return;
+    }
+    fprintf(f, "# name\tsize\tduration_ms\tstart_time\tcodec\n");
+    for (const auto &r : recordings_) {
+        fprintf(f, "%s\t%llu\t%llu\t%lld\t%s\n", r.first.c_str(),
+                (unsigned long long)r.second.size, (unsigned long long)r.second.duration_ms,
+                (long long)r.second.start_time, r.second.codec.empty() ? "-" : r.second.codec.c_str());
+    }
+    fclose(f);
+    rename(tmp.c_str(), catalogue_path_.c_str());
+}
+
+int DvrRetention::next_sequence() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return next_sequence_++;
+}
+
+uint64_t DvrRetention::free_bytes() {
+    struct statvfs vfs;
+    if (statvfs(dir_.c_str(), &vfs) != 0)
+        return UINT64_MAX;
+    return (uint64_t)vfs.f_bavail * vfs.f_frsize;
+}
+
+bool DvrRetention::is_protected(const std::string &name, const DvrRecording &rec) {
+    if (rec.active)
+        return true;
+    std::string path = dir_ + "/" + name;
+    return file_exists(path + ".rec") || file_exists(path + ".keep");
+}
+
+// Delete the oldest recording that isn't protected.
+bool DvrRetention::remove_oldest() {
+    auto victim = recordings_.end();
+    for (auto it = recordings_.begin(); it != recordings_.end(); ++it) {
+        if (is_protected(it->first, it->second))
+            continue;
+        if (victim == recordings_.end() || it->second.start_time < victim->second.start_time)
+            victim = it;
+    }
+    if (victim == recordings_.end())
+        return false;
+
+    std::string path = dir_ + "/" + victim->first;
+    if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+        spdlog::warn("DVR retention: unable to delete {}: {}", path, strerror(errno));
+        return false;
+    }
+    for (const char *const *suffix = SIDECAR_SUFFIXES; *suffix; suffix++)
+        unlink((path + *suffix).c_str());
+    unlink(DvrTelemetry::sidecar_path(path, DvrTelemetry::CSV).c_str());
+    unlink(DvrTelemetry::sidecar_path(path, DvrTelemetry::SRT).c_str());
+    spdlog::info("DVR retention: deleted {} ({} MB)", path, victim->second.size / (1024 * 1024));
+    recordings_.erase(victim);
+    deleted_++;
+    osd_publish_uint_fact("dvr.retention_deleted", NULL, 0, deleted_);
+    return true;
+}
+
+bool DvrRetention::enforce() {
+    bool changed = false;
+    uint64_t free = free_bytes();
+    while (true) {
+        uint64_t total = 0;
+        for (const auto &r : recordings_)
+            total += r.second.size;
+        bool low_space = min_free_ > 0 && free < min_free_;
+        bool over_quota = quota_ > 0 && total > quota_;
+        if (!low_space && !over_quota)
+            break;
+        if (!remove_oldest())
+            break;
+        changed = true;
+        free = free_bytes();
+    }
+    if (changed)
+        save();
+    publish_remaining(free);
+    return free >= RESERVE_BYTES;
+}
+
+// Recording time left at the current rate, counting what the policy may
+// still delete.
+void DvrRetention::publish_remaining(uint64_t free) {
+    if (bytes_per_s_ <= 0)
+        return;
+    uint64_t total = 0;
+    for (const auto &r : recordings_)
+        total += r.second.size;
+    uint64_t deletable = deletable_;
+    uint64_t floor = min_free_ > RESERVE_BYTES ? min_free_ : RESERVE_BYTES;
+    uint64_t usable = min_free_ > 0 ? free + deletable : free;
+    uint64_t avail = usable > floor ? usable - floor : 0;
+    if (quota_ > 0) {
+        uint64_t budget = quota_ + deletable;
+        avail = std::min(avail, budget > total ? budget - total : 0);
+    }
+    osd_publish_uint_fact("dvr.remaining_s", NULL, 0, (uint64_t)(avail / bytes_per_s_));
+}
+
+bool DvrRetention::make_room() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return enforce();
+}
+
+void DvrRetention::begin(const std::string &path, const std::string &codec) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    std::string name = fs::path(path).filename().string();
+    DvrRecording &rec = recordings_[name];
+    rec = DvrRecording();
+    rec.start_time = time(nullptr);
+    rec.codec = codec;
+    rec.active = true;
+    next_sequence_ = std::max(next_sequence_, sequence_of(name) + 1);
+    save();
+}
+
+void DvrRetention::finish(const std::string &path, uint64_t duration_ms) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = recordings_.find(fs::path(path).filename().string());
+    if (it == recordings_.end())
+        return;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0)
+        it->second.size = st.st_size;
+    it->second.duration_ms = duration_ms;
+    it->second.active = false;
+    save();
+}
+
+bool DvrRetention::update(const std::string &path, uint64_t size) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = recordings_.find(fs::path(path).filename().string());
+    if (it != recordings_.end()) {
+        if (size > it->second.size)
+            rate_bytes_ += size - it->second.size;
+        it->second.size = size;
+    }
+    uint64_t now = monotonic_us();
+    if (rate_start_us_ == 0) {
+        rate_start_us_ = now;
+        rate_bytes_ = 0;
+    } else if (now - rate_start_us_ >= 5000000) {
+        double rate = rate_bytes_ * 1e6 / (now - rate_start_us_);
+        bytes_per_s_ = bytes_per_s_ > 0 ? 0.7 * bytes_per_s_ + 0.3 * rate : rate;
+        rate_start_us_ = now;
+        rate_bytes_ = 0;
+    }
+    return enforce();
+}
+
+std::map<std::string, DvrRecording> DvrRetention::recordings() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return recordings_;
+}
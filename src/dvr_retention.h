@@ -0,0 +1,93 @@
+#ifndef DVR_RETENTION_H
+#define DVR_RETENTION_H
+
+#include <stdint.h>
+#include <time.h>
+#include <map>
+#include <mutex>
+#include <string>
+
+// ---------------------------------------------------------------------------
+// DvrRetention: catalogue and space policy of the DVR directory.
+//
+//  The catalogue ("<dir>/.dvr_catalogue") lists every recording with its
+//  size, duration, start time and codec.  It is reconciled with the
+//  directory once at startup and then kept up to date incrementally as the
+//  DVR opens and closes files, so picking the next sequence number or the
+//  oldest recording never rescans the card.
+//
+//  Space is enforced against an optional free-space floor and an optional
+//  quota on the total size of the recordings, by deleting the oldest
+//  recordings (with their sidecars) first.  Files being recorded, files
+//  waiting for recovery ("<file>.rec") and files marked with a "<file>.keep"
+//  sidecar are never deleted.  Independently of the policy, recordings are
+//  stopped cleanly while RESERVE_BYTES are still free, so the MP4 index can
+//  always be written.
+//
+//  Shared by all Dvr instances writing to the directory; thread-safe.
+// ---------------------------------------------------------------------------
+
+struct DvrRecording {
+    uint64_t size = 0;
+    uint64_t duration_ms = 0;   // 0 when unknown (files from before the catalogue)
+    int64_t  start_time = 0;    // unix time
+    std::string codec;          // "h264", "h265", or empty when unknown
+    bool active = false;        // being recorded
+};
+
+class DvrRetention {
+public:
+    // min_free: delete old recordings to keep this much free (0 = off).
+    // quota: delete old recordings to keep their total under this (0 = off).
+    DvrRetention(const std::string &dir, uint64_t min_free, uint64_t quota);
+
+    // Next number for --dvr-sequenced-files.
+    int next_sequence();
+
+    // Apply the policy before a recording starts. False when even after
+    // deleting everything allowed there is no room for a new file.
+    bool make_room();
+    // A recording was opened / closed.
+    void begin(const std::string &path, const std::string &codec);
+    void finish(const std::string &path, uint64_t duration_ms);
+    // Called about once a second by each recording DVR with the current
+    // file size: applies the policy and publishes dvr.remaining_s. False
+    // when the card is full and the recording has to be closed now.
+    bool update(const std::string &path, uint64_t size);
+
+    std::map<std::string, DvrRecording> recordings();
+
+    // Stop recordings while this much is still free.
+    static const uint64_t RESERVE_BYTES = 32ULL * 1024 * 1024;
+    // Sidecar files ("<file>.mp4<suffix>") removed together with a recording;
+    // the telemetry sidecars are removed as well.
+    static const char *const SIDECAR_SUFFIXES[];
+
+private:
+    void scan();
+    void load();
+    void save();                          // also recounts deletable_
+    uint64_t free_bytes();
+    bool enforce();                       // caller holds mtx_
+    bool remove_oldest();                 // caller holds mtx_
+    bool is_protected(const std::string &name, const DvrRecording &rec);
+    void publish_remaining(uint64_t free);
+
+    std::string dir_;
+    std::string catalogue_path_;
+    uint64_t min_free_;
+    uint64_t quota_;
+
+    std::mutex mtx_;
+    std::map<std::string, DvrRecording> recordings_;   // by file name
+    int next_sequence_ = 0;
+    uint64_t deleted_ = 0;
+    uint64_t deletable_ = 0;              // bytes the policy may delete
+
+    // Combined write rate of the active recordings, for dvr.remaining_s
+    uint64_t rate_bytes_ = 0;
+    uint64_t rate_start_us_ = 0;
+    double   bytes_per_s_ = 0;
+};
+
+#endif // DVR_RETENTION_H
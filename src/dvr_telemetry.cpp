@@ -0,0 +1,190 @@
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#include "spdlog/spdlog.h"
+
+#include "dvr_telemetry.h"
+
+std::vector<std::string> DvrTelemetry::selection_;
+std::mutex DvrTelemetry::registry_mtx_;
+std::vector<DvrTelemetry *> DvrTelemetry::registry_;
+std::atomic<int> DvrTelemetry::open_count_{0};
+
+static uint64_t monotonic_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void DvrTelemetry::select(const char *list) {
+    selection_.clear();
+    std::string all(list);
+    size_t pos = 0;
+    while (pos <= all.size()) {
+        size_t comma = all.find(',', pos);
+        if (comma == std::string::npos)
+            comma = all.size();
+        if (comma > pos)
+            selection_.push_back(all.substr(pos, comma - pos));
+        pos = comma + 1;
+    }
+}
+
+bool DvrTelemetry::wanted(const std::string &name) {
+    for (const std::string &s : selection_) {
+        if (!s.empty() && s.back() == '*') {
+            if (name.compare(0, s.size() - 1, s, 0, s.size() - 1) == 0)
+                return true;
+        } else if (name == s) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void DvrTelemetry::record(const std::string &name, const std::string &tags, const std::string &value) {
+    Sample sample = {monotonic_us(), name, tags, value};
+    std::lock_guard<std::mutex> lock(registry_mtx_);
+    for (DvrTelemetry *t : registry_)
+        t->push(sample);
+}
+
+void DvrTelemetry::push(const Sample &sample) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (queue_.size() >= MAX_QUEUED) {
+        queue_.pop_front();
+        dropped_++;
+    }
+    queue_.push_back(sample);
+}
+
+std::string DvrTelemetry::sidecar_path(const std::string &mp4_path, Format format) {
+    std::string base = mp4_path;
+    if (base.size() >= 4 && base.compare(base.size() - 4, 4, ".mp4") == 0)
+        base.resize(base.size() - 4);
+    return base + extension(format);
+}
+
+bool DvrTelemetry::open(const std::string &mp4_path) {
+    close();
+    if (!selected())
+        return false;
+    path_ = sidecar_path(mp4_path, format_);
+    file_ = fopen(path_.c_str(), "w");
+    if (!file_) {
+        spdlog::warn("DVR: unable to create telemetry sidecar {}: {}", path_, strerror(errno));
+        return false;
+    }
+    if (format_ == CSV)
+        fprintf(file_, "time_s,fact,tags,value\n");
+    last_media_us_ = 0;
+    latest_.clear();
+    cue_start_ms_ = 0;
+    cue_number_ = 0;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        queue_.clear();
+        dropped_ = 0;
+    }
+    std::lock_guard<std::mutex> lock(registry_mtx_);
+    registry_.push_back(this);
+    open_count_++;
+    return true;
+}
+
+void DvrTelemetry::close() {
+    if (!file_)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(registry_mtx_);
+        registry_.erase(std::remove(registry_.begin(), registry_.end(), this), registry_.end());
+        open_count_--;
+    }
+    // Whatever is still queued came in after the last frame
+    flush(monotonic_us(), last_media_us_);
+    if (format_ == SRT && !latest_.empty())
+        write_cue();
+    if (dropped_)
+        spdlog::warn("DVR: {} telemetry samples dropped in {}", dropped_, path_);
+    fclose(file_);
+    file_ = nullptr;
+}
+
+void DvrTelemetry::flush(uint64_t arrival_us, uint64_t media_us) {
+    if (!file_)
+        return;
+    std::deque<Sample> samples;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        samples.swap(queue_);
+    }
+    for (const Sample &s : samples) {
+        // Samples older than the anchor frame may predate the file; clamp
+        // them to the start of the file, and keep the sidecar monotonic.
+        int64_t t = (int64_t)media_us + (int64_t)(s.time_us - arrival_us);
+        uint64_t at = std::max<int64_t>(t, (int64_t)last_media_us_);
+        last_media_us_ = at;
+        if (format_ == CSV)
+            write_csv(s, at);
+        else
+            write_srt(s, at);
+    }
+    last_media_us_ = std::max(last_media_us_, media_us);
+}
+
+static void write_csv_field(FILE *f, const std::string &v) {
+    if (v.find_first_of(",\"\n") == std::string::npos) {
+        fputs(v.c_str(), f);
+        return;
+    }
+    fputc('"', f);
+    for (char c : v) {
+        if (c == '"')
+            fputc('"', f);
+        fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+void DvrTelemetry::write_csv(const Sample &s, uint64_t media_us) {
+    fprintf(file_, "%llu.%03llu,", (unsigned long long)(media_us / 1000000),
+            (unsigned long long)(media_us / 1000 % 1000));
+    write_csv_field(file_, s.name);
+    fputc(',', file_);
+    write_csv_field(file_, s.tags);
+    fputc(',', file_);
+    write_csv_field(file_, s.value);
+    fputc('\n', file_);
+}
+
+void DvrTelemetry::write_srt(const Sample &s, uint64_t media_us) {
+    uint64_t ms = media_us / 1000;
+    // The first cue starts with the first value; from then on every
+    // interval shows the latest values
+    if (latest_.empty())
+        cue_start_ms_ = ms - ms % SRT_INTERVAL_MS;
+    while (ms >= cue_start_ms_ + SRT_INTERVAL_MS) {
+        write_cue();
+        cue_start_ms_ += SRT_INTERVAL_MS;
+    }
+    std::string key = s.tags.empty() ? s.name : s.name + "[" + s.tags + "]";
+    latest_[key] = s.value;
+}
+
+static void write_srt_time(FILE *f, uint64_t ms) {
+    fprintf(f, "%02llu:%02llu:%02llu,%03llu", (unsigned long long)(ms / 3600000),
+            (unsigned long long)(ms / 60000 % 60), (unsigned long long)(ms / 1000 % 60),
+            (unsigned long long)(ms % 1000));
+}
+
+void DvrTelemetry::write_cue() {
+    fprintf(file_, "%u\n", ++cue_number_);
+    write_srt_time(file_, cue_start_ms_);
+    fputs(" --> ", file_);
+    write_srt_time(file_, cue_start_ms_ + SRT_INTERVAL_MS);
+    fputc('\n', file_);
+    for (const auto &v : latest_)
+        fprintf(file_, "%s=%s\n", v.first.c_str(), v.second.c_str());
+    fputc('\n', file_);
+}
@@ -0,0 +1,93 @@
+#ifndef DVR_TELEMETRY_H
+#define DVR_TELEMETRY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// DvrTelemetry: selected OSD facts recorded next to the DVR video.
+//
+//  The fact publisher hands every fact matching the --dvr-telemetry
+//  selection to all open sidecars; each keeps them in a bounded queue
+//  (MAX_QUEUED samples, the oldest are dropped beyond that) stamped with
+//  the monotonic arrival time.  The owning Dvr thread drains the queue as
+//  it writes video, mapping arrival times onto the file's media time
+//  through the arrival time of the frame just written, so the sidecar is in
+//  step with the video as it was received.
+//
+//  Two formats: "<file>.csv" (time_s,fact,tags,value, one row per fact
+//  update) for analysis, or "<file>.srt" subtitles showing the latest
+//  values every SRT_INTERVAL_MS, which players pick up next to the MP4.
+// ---------------------------------------------------------------------------
+
+class DvrTelemetry {
+public:
+    enum Format { CSV = 0, SRT = 1 };
+
+    // Comma separated fact names; a trailing '*' matches a prefix
+    // ("mavlink.*"). Set once at startup, before any fact is published.
+    static void select(const char *list);
+    static bool selected() { return !selection_.empty(); }
+    // Cheap check for the publisher: is any sidecar open at all?
+    static bool active() { return open_count_.load(std::memory_order_relaxed) > 0; }
+    static bool wanted(const std::string &name);
+    // Queue a fact update for every open sidecar. tags is "key=value;..."
+    static void record(const std::string &name, const std::string &tags, const std::string &value);
+
+    // Sidecar name for a recording: the MP4 name with the format's extension.
+    static std::string sidecar_path(const std::string &mp4_path, Format format);
+    static const char *extension(Format format) { return format == SRT ? ".srt" : ".csv"; }
+
+    explicit DvrTelemetry(Format format = CSV) : format_(format) {}
+    ~DvrTelemetry() { close(); }
+
+    void set_format(Format format) { format_ = format; }   // takes effect on open()
+    bool open(const std::string &mp4_path);
+    void close();
+    bool is_open() const { return file_ != nullptr; }
+
+    // Write out what was queued. The frame that arrived at arrival_us sits
+    // at media_us in the file.
+    void flush(uint64_t arrival_us, uint64_t media_us);
+
+    static const size_t MAX_QUEUED = 4096;
+    static const uint64_t SRT_INTERVAL_MS = 500;
+
+private:
+    struct Sample {
+        uint64_t time_us;   // monotonic arrival
+        std::string name;
+        std::string tags;
+        std::string value;
+    };
+    void push(const Sample &sample);
+    void write_csv(const Sample &sample, uint64_t media_us);
+    void write_srt(const Sample &sample, uint64_t media_us);
+    void write_cue();
+
+    static std::vector<std::string> selection_;
+    static std::mutex registry_mtx_;
+    static std::vector<DvrTelemetry *> registry_;
+    static std::atomic<int> open_count_;
+
+    Format format_;
+    FILE *file_ = nullptr;
+    std::string path_;
+    std::mutex mtx_;
+    std::deque<Sample> queue_;
+    uint64_t dropped_ = 0;
+    uint64_t last_media_us_ = 0;
+
+    // SRT: latest value per fact, shown in cues of SRT_INTERVAL_MS
+    std::map<std::string, std::string> latest_;
+    uint64_t cue_start_ms_ = 0;
+    unsigned cue_number_ = 0;
+};
+
+#endif // DVR_TELEMETRY_H
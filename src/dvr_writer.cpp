@@ -0,0 +1,454 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+
+#include "spdlog/spdlog.h"
+
+#include "dvr_writer.h"
+#include "dvr_health.h"
+extern "C" {
+#include "osd.h"
+}
+
+// Upper bound on chunks coalesced into a single pwritev().
+static const int MAX_IOV = std::min(IOV_MAX, 64);
+// Spare chunks kept around for reuse; the rest go back to the allocator.
+static const size_t MAX_FREE_CHUNKS = 4;
+
+static uint64_t monotonic_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+DvrWriter::DvrWriter() {}
+
+DvrWriter::~DvrWriter() {
+    close();
+    for (uint8_t *c : free_chunks_)
+        free(c);
+    free_chunks_.clear();
+}
+
+int DvrWriter::open(const std::string &path) {
+    if (fd_ >= 0)
+        close();
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd_ < 0) {
+        spdlog::error("DvrWriter: unable to open {}: {}", path, strerror(errno));
+        return -1;
+    }
+    path_ = path;
+    staging_ = Chunk();
+    append_pos_ = 0;
+    file_size_ = 0;
+    stop_ = false;
+    io_error_ = false;
+    queued_bytes_ = 0;
+    dropped_frames_ = 0;
+    lat_max_us_ = lat_sum_us_ = lat_count_ = 0;
+    busy_us_ = bytes_ = 0;
+    periods_.clear();
+    latencies_.clear();
+    last_publish_ms_ = monotonic_us() / 1000;
+    prealloc_ok_ = true;
+    allocated_ = 0;
+    written_end_ = 0;
+    last_sync_ms_ = last_publish_ms_;
+    dirty_ = false;
+    if (pthread_create(&tid_, NULL, &DvrWriter::__THREAD__, this) != 0) {
+        spdlog::error("DvrWriter: unable to start writer thread");
+        ::close(fd_);
+        fd_ = -1;
+        return -1;
+    }
+    thread_running_ = true;
+    return 0;
+}
+
+void DvrWriter::close() {
+    if (fd_ < 0)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        flush_staging();
+        stop_ = true;
+    }
+    cv_.notify_one();
+    if (thread_running_) {
+        pthread_join(tid_, NULL);
+        thread_running_ = false;
+    }
+    publish_stats();
+    DvrHealth::forget(this);
+    if (log_fd_ >= 0) {
+        ::close(log_fd_);
+        log_fd_ = -1;
+    }
+    log_pending_.clear();
+    // Give back the reservation past the last byte
+    if (allocated_ > written_end_ && ftruncate(fd_, written_end_) != 0)
+        spdlog::warn("DvrWriter: unable to trim {}: {}", path_, strerror(errno));
+    ::close(fd_);
+    fd_ = -1;
+}
+
+bool DvrWriter::attach_log(const std::string &path) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        spdlog::warn("DvrWriter: unable to open {}: {}", path, strerror(errno));
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (log_fd_ >= 0) {
+        // The writer thread may be writing to the one attached
+        ::close(fd);
+        return false;
+    }
+    log_fd_ = fd;
+    return true;
+}
+
+void DvrWriter::log(const void *data, size_t size) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (log_fd_ >= 0)
+        log_pending_.append((const char *)data, size);
+}
+
+int DvrWriter::mp4_write_callback(int64_t offset, const void *buffer, size_t size, void *token) {
+    return ((DvrWriter *)token)->write(offset, buffer, size);
+}
+
+// ── Muxer side ──────────────────────────────────────────────────────────────
+
+int DvrWriter::write(int64_t offset, const void *buffer, size_t size) {
+    if (fd_ < 0)
+        return 1;
+    const uint8_t *src = (const uint8_t *)buffer;
+    int64_t end = offset + (int64_t)size;
+    if (end > file_size_)
+        file_size_ = end;
+
+    std::lock_guard<std::mutex> lock(mtx_);
+
+    if (offset < append_pos_) {
+        // Out-of-order write. Whatever extends past the append position is
+        // handled below as a regular append.
+        int64_t patch_end = std::min(end, append_pos_);
+        size_t patch_len = (size_t)(patch_end - offset);
+        if (staging_.data && offset >= staging_.offset) {
+            memcpy(staging_.data + (offset - staging_.offset), src, patch_len);
+        } else {
+            if (staging_.data && patch_end > staging_.offset)
+                flush_staging();
+            Op op;
+            op.patch_offset = offset;
+            op.patch.assign(src, src + patch_len);
+            submit(std::move(op));
+        }
+        src += patch_len;
+        size -= patch_len;
+        offset = patch_end;
+    } else if (offset > append_pos_) {
+        // Hole: minimp4 leaves one on every open (bytes 32 to 40, the mdat
+        // header it patches in on close). It reads as zeros until then.
+        flush_staging();
+        append_pos_ = offset;
+    }
+
+    while (size > 0) {
+        if (!staging_.data) {
+            staging_.data = alloc_chunk();
+            if (!staging_.data)
+                return 1;
+            staging_.offset = append_pos_;
+            staging_.used = 0;
+        }
+        size_t n = std::min(size, CHUNK_SIZE - staging_.used);
+        memcpy(staging_.data + staging_.used, src, n);
+        staging_.used += n;
+        append_pos_ += n;
+        src += n;
+        size -= n;
+        if (staging_.used == CHUNK_SIZE)
+            flush_staging();
+    }
+    return 0;
+}
+
+void DvrWriter::flush_staging() {
+    if (!staging_.data)
+        return;
+    if (staging_.used == 0) {
+        free_chunks_.push_back(staging_.data);
+    } else {
+        Op op;
+        op.chunk = staging_;
+        submit(std::move(op));
+    }
+    staging_ = Chunk();
+}
+
+void DvrWriter::submit(Op &&op) {
+    size_t bytes = op.chunk.data ? op.chunk.used : op.patch.size();
+    queued_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    ops_.push_back(std::move(op));
+    cv_.notify_one();
+}
+
+uint8_t *DvrWriter::alloc_chunk() {
+    if (!free_chunks_.empty()) {
+        uint8_t *c = free_chunks_.back();
+        free_chunks_.pop_back();
+        return c;
+    }
+    void *p = nullptr;
+    if (posix_memalign(&p, CHUNK_ALIGN, CHUNK_SIZE) != 0) {
+        spdlog::error("DvrWriter: out of memory");
+        return nullptr;
+    }
+    return (uint8_t *)p;
+}
+
+// ── Writer thread ───────────────────────────────────────────────────────────
+
+void *DvrWriter::__THREAD__(void *context) {
+    pthread_setname_np(pthread_self(), "__DVRWRITE");
+    ((DvrWriter *)context)->loop();
+    return nullptr;
+}
+
+void DvrWriter::loop() {
+    while (true) {
+        std::vector<Chunk> batch;
+        Op patch;
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            cv_.wait_for(lock, std::chrono::seconds(1),
+                         [this] { return stop_ || !ops_.empty(); });
+            if (ops_.empty()) {
+                if (stop_) {
+                    lock.unlock();
+                    if (dirty_ && !io_error_)
+                        sync();
+                    break;
+                }
+                // Quiet for a while: push out the partial chunk so a low
+                // bitrate stream still reaches the card in bounded time.
+                flush_staging();
+                if (!ops_.empty())
+                    continue;
+                lock.unlock();
+                publish_stats();
+                continue;
+            }
+            // Coalesce file-contiguous chunks into one pwritev()
+            while (!ops_.empty() && ops_.front().chunk.data &&
+                   (int)batch.size() < MAX_IOV) {
+                const Chunk &c = ops_.front().chunk;
+                if (!batch.empty() &&
+                    c.offset != batch.back().offset + (int64_t)batch.back().used)
+                    break;
+                batch.push_back(c);
+                ops_.pop_front();
+            }
+            if (batch.empty()) {
+                patch = std::move(ops_.front());
+                ops_.pop_front();
+            }
+        }
+        if (!batch.empty())
+            write_chunks(batch);
+        else
+            write_patch(patch);
+
+        uint64_t now_ms = monotonic_us() / 1000;
+        if (dirty_ && !io_error_ && now_ms - last_sync_ms_ >= SYNC_INTERVAL_MS) {
+            sync();
+            last_sync_ms_ = now_ms;
+        }
+        if (now_ms - last_publish_ms_ >= 1000)
+            publish_stats();
+    }
+}
+
+// Data first, then the side log describing it.
+void DvrWriter::sync() {
+    uint64_t t0 = monotonic_us();
+    fdatasync(fd_);
+    record_latency(monotonic_us() - t0, 0);
+    dirty_ = false;
+
+    std::string pending;
+    int log_fd;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        pending.swap(log_pending_);
+        log_fd = log_fd_;
+    }
+    if (log_fd < 0 || pending.empty())
+        return;
+    if (::write(log_fd, pending.data(), pending.size()) != (ssize_t)pending.size() ||
+        fdatasync(log_fd) != 0)
+        spdlog::warn("DvrWriter: side log of {} not written: {}", path_, strerror(errno));
+}
+
+void DvrWriter::preallocate(int64_t end) {
+    while (prealloc_ok_ && end > allocated_) {
+        if (fallocate(fd_, FALLOC_FL_KEEP_SIZE, allocated_, PREALLOC_SIZE) != 0) {
+            // Not supported by every filesystem (exFAT, older vfat); also
+            // stop on ENOSPC and let the write itself report the error.
+            spdlog::warn("DvrWriter: preallocation disabled for {}: {}", path_, strerror(errno));
+            prealloc_ok_ = false;
+            break;
+        }
+        allocated_ += PREALLOC_SIZE;
+    }
+}
+
+void DvrWriter::write_chunks(std::vector<Chunk> &chunks) {
+    struct iovec iov[64];
+    int iovcnt = (int)chunks.size();
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        iov[i].iov_base = chunks[i].data;
+        iov[i].iov_len = chunks[i].used;
+        total += chunks[i].used;
+    }
+
+    if (!io_error_) {
+        uint64_t t0 = monotonic_us();
+        int64_t offset = chunks[0].offset;
+        preallocate(offset + (int64_t)total);
+        struct iovec *v = iov;
+        int left = iovcnt;
+        while (left > 0) {
+            ssize_t n = pwritev(fd_, v, left, offset);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                spdlog::error("DvrWriter: write to {} failed: {}", path_, strerror(errno));
+                io_error_ = true;
+                break;
+            }
+            offset += n;
+            // Advance past fully written iovecs, trim a partially written one
+            while (left > 0 && (size_t)n >= v->iov_len) {
+                n -= v->iov_len;
+                v++;
+                left--;
+            }
+            if (left > 0) {
+                v->iov_base = (uint8_t *)v->iov_base + n;
+                v->iov_len -= n;
+            }
+        }
+        written_end_ = std::max(written_end_, offset);
+        dirty_ = true;
+        record_latency(monotonic_us() - t0, total);
+    }
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (Chunk &c : chunks) {
+        if (free_chunks_.size() < MAX_FREE_CHUNKS)
+            free_chunks_.push_back(c.data);
+        else
+            free(c.data);
+    }
+    queued_bytes_.fetch_sub(total, std::memory_order_relaxed);
+}
+
+void DvrWriter::write_patch(const Op &op) {
+    if (!io_error_) {
+        uint64_t t0 = monotonic_us();
+        ssize_t n;
+        do {
+            n = pwrite(fd_, op.patch.data(), op.patch.size(), op.patch_offset);
+        } while (n < 0 && errno == EINTR);
+        if (n != (ssize_t)op.patch.size()) {
+            spdlog::error("DvrWriter: header patch at {} failed: {}", op.patch_offset,
+                          n < 0 ? strerror(errno) : "short write");
+            io_error_ = true;
+        }
+        written_end_ = std::max(written_end_, op.patch_offset + (int64_t)op.patch.size());
+        dirty_ = true;
+        record_latency(monotonic_us() - t0, op.patch.size());
+    }
+    queued_bytes_.fetch_sub(op.patch.size(), std::memory_order_relaxed);
+}
+
+void DvrWriter::record_latency(uint64_t us, size_t bytes) {
+    lat_max_us_ = std::max(lat_max_us_, us);
+    lat_sum_us_ += us;
+    lat_count_++;
+    busy_us_ += us;
+    bytes_ += bytes;
+    latencies_.emplace_back(monotonic_us() / 1000, (uint32_t)std::min<uint64_t>(us, UINT32_MAX));
+    if (us > 200000)
+        spdlog::warn("DvrWriter: storage stalled for {} ms", us / 1000);
+}
+
+void DvrWriter::publish_stats() {
+    size_t depth;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        depth = ops_.size();
+    }
+
+    // Slide the window
+    uint64_t now_ms = monotonic_us() / 1000;
+    periods_.push_back({now_ms, now_ms - last_publish_ms_, busy_us_, bytes_});
+    while (!periods_.empty() && now_ms - periods_.front().end_ms >= STATS_WINDOW_S * 1000)
+        periods_.pop_front();
+    while (!latencies_.empty() && now_ms - latencies_.front().first >= STATS_WINDOW_S * 1000)
+        latencies_.pop_front();
+
+    uint64_t elapsed_ms = 0, busy_us = 0, bytes = 0;
+    for (const Period &p : periods_) {
+        elapsed_ms += p.elapsed_ms;
+        busy_us += p.busy_us;
+        bytes += p.bytes;
+    }
+    std::vector<uint32_t> sorted;
+    sorted.reserve(latencies_.size());
+    for (const auto &l : latencies_)
+        sorted.push_back(l.second);
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile_ms = [&sorted](unsigned pct) -> unsigned {
+        return sorted.empty() ? 0 : sorted[(sorted.size() - 1) * pct / 100] / 1000;
+    };
+
+    DvrStorageSample h;
+    h.write_kbps = elapsed_ms ? bytes * 8 / elapsed_ms : 0;
+    // What the card sustains while it's busy: headroom is capacity - rate
+    h.capacity_kbps = busy_us ? bytes * 8000 / busy_us : 0;
+    h.busy_pct = elapsed_ms ? (unsigned)std::min<uint64_t>(busy_us / 10 / elapsed_ms, 100) : 0;
+    h.p50_ms = percentile_ms(50);
+    h.p95_ms = percentile_ms(95);
+    h.p99_ms = percentile_ms(99);
+    h.queue_pct = (unsigned)std::min<uint64_t>(
+        queued_bytes_.load(std::memory_order_relaxed) * 100 / std::max<size_t>(max_queued_bytes_, 1), 100);
+    h.dropped_frames = dropped_frames_.load(std::memory_order_relaxed);
+    DvrHealth::report(this, h, now_ms);
+
+    void *batch = osd_batch_init(10);
+    osd_add_uint_fact(batch, "dvr.write_latency_ms", NULL, 0, lat_max_us_ / 1000);
+    osd_add_uint_fact(batch, "dvr.write_latency_avg_ms", NULL, 0,
+                      lat_count_ ? lat_sum_us_ / lat_count_ / 1000 : 0);
+    osd_add_uint_fact(batch, "dvr.write_latency_p50_ms", NULL, 0, h.p50_ms);
+    osd_add_uint_fact(batch, "dvr.write_latency_p95_ms", NULL, 0, h.p95_ms);
+    osd_add_uint_fact(batch, "dvr.write_latency_p99_ms", NULL, 0, h.p99_ms);
+    osd_add_uint_fact(batch, "dvr.write_kbps", NULL, 0, h.write_kbps);
+    osd_add_uint_fact(batch, "dvr.write_capacity_kbps", NULL, 0, h.capacity_kbps);
+    osd_add_uint_fact(batch, "dvr.write_busy_pct", NULL, 0, h.busy_pct);
+    osd_add_uint_fact(batch, "dvr.write_queue_depth", NULL, 0, depth);
+    osd_add_uint_fact(batch, "dvr.dropped_frames", NULL, 0, h.dropped_frames);
+    osd_publish_batch(batch);
+    lat_max_us_ = lat_sum_us_ = lat_count_ = 0;
+    busy_us_ = bytes_ = 0;
+    last_publish_ms_ = now_ms;
+}
@@ -0,0 +1,169 @@
+#ifndef DVR_WRITER_H
+#define DVR_WRITER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// DvrWriter: moves DVR file I/O off the DVR thread.
+//
+//  minimp4 emits many small writes, almost all of them appended at the end
+//  of the file.  Those are collected into large page-aligned chunks which a
+//  dedicated writer thread issues sequentially with pwritev(), coalescing
+//  several queued chunks per syscall.  The few out-of-order writes (the mdat
+//  size patch done by MP4E_close) are applied in memory when they land in
+//  the chunk still being filled, or queued as separate patch ops otherwise.
+//  Ops are executed strictly in FIFO order, so a patch always lands after
+//  the data it overwrites.
+//
+//  File space is reserved ahead of the data in PREALLOC_SIZE steps with
+//  fallocate(FALLOC_FL_KEEP_SIZE), which keeps the file contiguous on the
+//  card and saves a metadata update per write; the reservation past the
+//  last byte is released on close().  Data is fdatasync()'d every
+//  SYNC_INTERVAL_MS so a power cut loses at most that much footage.
+//
+//  A side log (the DVR's recovery journal) can be attached: what is
+//  appended to it is written and synced right after each fdatasync() of
+//  the data, so it never lags the footage on the card by more than one
+//  sync interval.
+//
+//  After a failed write nothing more is written; failed() tells the DVR,
+//  which closes the file and leaves its journal for recovery.
+//
+//  The queue is bounded.  When the card stalls and the queue fills up,
+//  congested() turns true and the caller is expected to drop frames (up to
+//  the next IDR) instead of blocking; those drops are counted here so they
+//  are reported together with the write latency and queue depth.
+//
+//  Every write and sync is timed.  Over the last STATS_WINDOW_S seconds the
+//  writer reports the write rate, the share of time the card was busy, the
+//  rate it sustains while busy and latency percentiles, and hands the same
+//  figures to DvrHealth, which degrades the recording when the card can't
+//  keep up.
+// ---------------------------------------------------------------------------
+
+class DvrWriter {
+public:
+    DvrWriter();
+    ~DvrWriter();
+
+    // Create/truncate path and start the writer thread. Returns 0 on success.
+    int open(const std::string &path);
+    // Flush everything queued, stop the writer thread and close the file.
+    void close();
+    bool is_open() const { return fd_ >= 0; }
+
+    // minimp4-compatible write. Never blocks on storage.
+    int write(int64_t offset, const void *buffer, size_t size);
+
+    // Append to path with every sync of the data, until close(). One side
+    // log per open().
+    bool attach_log(const std::string &path);
+    // Queue bytes for the side log. Never blocks on storage.
+    void log(const void *data, size_t size);
+
+    // Highest offset written so far (logical file size).
+    int64_t file_size() const { return file_size_; }
+
+    // A write or sync failed: nothing more reaches the file, which should be
+    // closed. Stays set until the next open().
+    bool failed() const { return io_error_.load(std::memory_order_relaxed); }
+
+    // True when the queue is over its high-water mark; frames should be dropped.
+    bool congested() const {
+        return queued_bytes_.load(std::memory_order_relaxed) >= max_queued_bytes_;
+    }
+    void count_dropped_frame() { dropped_frames_.fetch_add(1, std::memory_order_relaxed); }
+
+    // Upper bound on the bytes waiting for the writer thread.
+    void set_max_queued_bytes(size_t bytes) { max_queued_bytes_ = bytes; }
+
+    // Token is a DvrWriter*. Signature matches MP4E_open()'s write callback.
+    static int mp4_write_callback(int64_t offset, const void *buffer, size_t size, void *token);
+
+    static void *__THREAD__(void *context);
+
+    static const size_t CHUNK_SIZE = 1024 * 1024;
+    static const size_t CHUNK_ALIGN = 4096;
+    static const int64_t PREALLOC_SIZE = 32 * 1024 * 1024;
+    static const uint64_t SYNC_INTERVAL_MS = 2000;
+    static const uint64_t STATS_WINDOW_S = 10;
+
+private:
+    struct Chunk {
+        uint8_t *data = nullptr;
+        int64_t  offset = 0;   // file offset of data[0]
+        size_t   used = 0;
+    };
+    struct Op {
+        Chunk chunk;                 // sequential data (chunk.data != nullptr)
+        int64_t patch_offset = 0;    // out-of-order patch otherwise
+        std::vector<uint8_t> patch;
+    };
+
+    void loop();
+    void flush_staging();       // queue the chunk being filled (caller holds mtx_)
+    void submit(Op &&op);       // caller holds mtx_
+    uint8_t *alloc_chunk();     // caller holds mtx_
+    void write_chunks(std::vector<Chunk> &chunks);
+    void write_patch(const Op &op);
+    void preallocate(int64_t end);
+    void sync();
+    void record_latency(uint64_t us, size_t bytes);
+    void publish_stats();
+
+    int fd_ = -1;
+    std::string path_;
+    pthread_t tid_;
+    bool thread_running_ = false;
+
+    // Muxer side (DVR thread), under mtx_; the writer thread only flushes
+    // staging_ after a second without a full chunk.
+    Chunk   staging_;
+    int64_t append_pos_ = 0;
+    int64_t file_size_ = 0;
+
+    std::mutex              mtx_;
+    std::condition_variable cv_;
+    std::deque<Op>          ops_;
+    std::string             log_pending_;   // side log bytes not written yet
+    std::vector<uint8_t *>  free_chunks_;
+    bool                    stop_ = false;
+
+    std::atomic<size_t>   queued_bytes_{0};
+    size_t                max_queued_bytes_ = 16 * CHUNK_SIZE;
+    std::atomic<uint64_t> dropped_frames_{0};
+    std::atomic<bool>     io_error_{false};    // set by the writer thread
+
+    int log_fd_ = -1;
+
+    // Writer thread only.
+    bool     prealloc_ok_ = true;
+    int64_t  allocated_ = 0;       // bytes reserved with fallocate()
+    int64_t  written_end_ = 0;     // highest offset actually written
+    uint64_t last_sync_ms_ = 0;
+    bool     dirty_ = false;
+
+    // Latency stats, writer thread only; reset on every publish.
+    uint64_t lat_max_us_ = 0;
+    uint64_t lat_sum_us_ = 0;
+    uint64_t lat_count_ = 0;
+    uint64_t last_publish_ms_ = 0;
+    uint64_t busy_us_ = 0;        // time spent in writes and syncs
+    uint64_t bytes_ = 0;
+
+    // Writer thread only: the last STATS_WINDOW_S seconds.
+    struct Period {
+        uint64_t end_ms, elapsed_ms, busy_us, bytes;
+    };
+    std::deque<Period> periods_;
+    std::deque<std::pair<uint64_t, uint32_t>> latencies_;   // (time ms, latency us)
+};
+
+#endif // DVR_WRITER_H
@@ -0,0 +1,69 @@
+#include <string.h>
+#include <mutex>
+
+#include "encoded_frame.h"
+
+static std::mutex pool_mtx;
+static std::vector<std::vector<uint8_t>> pool;
+
+static std::vector<uint8_t> pool_get(size_t size) {
+    std::vector<uint8_t> buf;
+    {
+        std::lock_guard<std::mutex> lock(pool_mtx);
+        if (!pool.empty()) {
+            buf.swap(pool.back());
+            pool.pop_back();
+        }
+    }
+    buf.resize(size);
+    return buf;
+}
+
+static void pool_put(std::vector<uint8_t> &&buf) {
+    if (buf.capacity() > EncodedFrame::POOL_MAX_BYTES)
+        return;
+    std::lock_guard<std::mutex> lock(pool_mtx);
+    if (pool.size() < EncodedFrame::POOL_BUFFERS)
+        pool.push_back(std::move(buf));
+}
+
+EncodedFramePtr EncodedFrame::borrow(const uint8_t *data, size_t size, Release release,
+                                     bool scarce) {
+    std::shared_ptr<EncodedFrame> f(new EncodedFrame());
+    f->data_ = data;
+    f->size_ = size;
+    f->scarce_ = scarce;
+    f->release_ = std::move(release);
+    return f;
+}
+
+EncodedFramePtr EncodedFrame::copy(const uint8_t *data, size_t size) {
+    std::shared_ptr<EncodedFrame> f(new EncodedFrame());
+    f->owned_ = pool_get(size);
+    if (size)
+        memcpy(f->owned_.data(), data, size);
+    f->data_ = f->owned_.data();
+    f->size_ = size;
+    return f;
+}
+
+EncodedFramePtr EncodedFrame::adopt(std::vector<uint8_t> &&bytes) {
+    std::shared_ptr<EncodedFrame> f(new EncodedFrame());
+    f->owned_ = std::move(bytes);
+    f->data_ = f->owned_.data();
+    f->size_ = f->owned_.size();
+    return f;
+}
+
+EncodedFramePtr EncodedFrame::compact(const EncodedFramePtr &frame) {
+    if (!frame || !frame->scarce_)
+        return frame;
+    return copy(frame->data_, frame->size_);
+}
+
+EncodedFrame::~EncodedFrame() {
+    if (release_)
+        release_();
+    else if (owned_.capacity())
+        pool_put(std::move(owned_));
+}
@@ -0,0 +1,64 @@
+#ifndef ENCODED_FRAME_H
+#define ENCODED_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// EncodedFrame: an encoded access unit on its way to the decoder and the DVR.
+//
+//  The bytes stay where the producer put them: a frame borrows the memory
+//  of a mapped GstBuffer or an MppPacket and gives it back through its
+//  release hook when the last reference goes away, so the receiver and the
+//  re-encoder hand over frames without copying them.  Producers whose memory
+//  is a scarce pool (the encoder's packet buffers) mark their frames so;
+//  anyone keeping frames around for long (the DVR pre-roll) calls compact()
+//  to move those into owned memory first.
+//
+//  Owned memory comes from a small pool of reusable buffers, so copies that
+//  do happen don't churn the allocator.
+// ---------------------------------------------------------------------------
+
+class EncodedFrame;
+using EncodedFramePtr = std::shared_ptr<const EncodedFrame>;
+
+class EncodedFrame {
+public:
+    using Release = std::function<void()>;
+
+    // Refer to data until the frame is destroyed, then call release.
+    static EncodedFramePtr borrow(const uint8_t *data, size_t size, Release release,
+                                  bool scarce = false);
+    // Owned copy, in a pooled buffer.
+    static EncodedFramePtr copy(const uint8_t *data, size_t size);
+    static EncodedFramePtr adopt(std::vector<uint8_t> &&bytes);
+    // frame itself unless it borrows scarce memory, then an owned copy.
+    static EncodedFramePtr compact(const EncodedFramePtr &frame);
+
+    ~EncodedFrame();
+    EncodedFrame(const EncodedFrame &) = delete;
+    EncodedFrame &operator=(const EncodedFrame &) = delete;
+
+    const uint8_t *data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    bool scarce() const { return scarce_; }
+
+    // Pooled buffers kept for reuse, and the largest one worth keeping.
+    static const size_t POOL_BUFFERS = 16;
+    static const size_t POOL_MAX_BYTES = 4 * 1024 * 1024;
+
+private:
+    EncodedFrame() = default;
+
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    bool scarce_ = false;
+    Release release_;
+    std::vector<uint8_t> owned_;
+};
+
+#endif // ENCODED_FRAME_H
@@ -0,0 +1,77 @@
+#include <cmath>
+
+#include "frame_pacer.h"
+
+FramePacer::FramePacer(int64_t interval_ns)
+    : interval_(interval_ns), period_((double)interval_ns) {}
+
+void FramePacer::set_interval(int64_t interval_ns) {
+    if (interval_ns == interval_)
+        return;
+    interval_ = interval_ns;
+    locked_ = tracked_ >= LOCK_FRAMES &&
+              std::fabs(period_ - interval_) * 100 <= (double)interval_ * LOCK_RANGE_PCT;
+}
+
+void FramePacer::source_frame(int64_t ts_ns) {
+    since_tick_++;
+
+    // First frame, or the stream stalled: acquire again
+    if (tracked_ == 0 || ts_ns - last_ts_ > MAX_GAP * (int64_t)period_ || ts_ns < last_ts_) {
+        phase_ = (double)ts_ns;
+        first_ts_ = ts_ns;
+        last_ts_ = ts_ns;
+        tracked_ = 1;
+        locked_ = false;
+        return;
+    }
+    last_ts_ = ts_ns;
+
+    if (tracked_ < LOCK_FRAMES) {
+        // Acquisition: the average period so far, no smoothing of the phase
+        if (ts_ns > first_ts_)
+            period_ = (double)(ts_ns - first_ts_) / tracked_;
+        phase_ = (double)ts_ns;
+    } else {
+        // Tracking: frames lost on the way are whole periods
+        double k = std::floor((ts_ns - phase_) / period_ + 0.5);
+        if (k < 1)
+            k = 1;
+        double predicted = phase_ + k * period_;
+        double err = ts_ns - predicted;
+        double limit = period_ / 2;
+        if (err > limit) err = limit;
+        if (err < -limit) err = -limit;
+        phase_ = predicted + PHASE_GAIN * err;
+        period_ += PERIOD_GAIN * err / k;
+    }
+    tracked_++;
+    locked_ = tracked_ >= LOCK_FRAMES &&
+              std::fabs(period_ - interval_) * 100 <= (double)interval_ * LOCK_RANGE_PCT;
+}
+
+int64_t FramePacer::next_tick(int64_t last_tick_ns) const {
+    if (locked_ && last_tick_ns - last_ts_ < MAX_GAP * (int64_t)period_) {
+        // Half an interval after the first source frame due more than half
+        // a period after the last tick, so no frame gets two ticks
+        double offset = interval_ / 2.0;
+        double n = std::ceil((last_tick_ns + period_ / 2 - offset - phase_) / period_);
+        return (int64_t)(phase_ + n * period_ + offset);
+    }
+    return last_tick_ns + interval_;
+}
+
+FramePacer::Action FramePacer::tick(bool fresh) {
+    if (!fresh) {
+        duplicated_++;
+        return DUPLICATE;
+    }
+    if (since_tick_ > 1)
+        dropped_ += since_tick_ - 1;
+    since_tick_ = 0;
+    return SUBMIT;
+}
+
+void FramePacer::idle_tick() {
+    since_tick_ = 0;
+}
@@ -0,0 +1,69 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <stdint.h>
+
+// ---------------------------------------------------------------------------
+// FramePacer: locks the re-encode timer to the source's frame cadence.
+//
+//  The decoder reports the feed timestamp of every frame.  A second order
+//  phase-locked loop tracks the source's period and phase from them, so an
+//  air unit clock running slightly fast or slow against ours is followed
+//  instead of slipping a frame every few seconds, and a few ms of arrival
+//  jitter are averaged out.
+//
+//  While the source period is within LOCK_RANGE_PCT of the configured
+//  interval the timer ticks once per source frame, half an interval after
+//  the frame is due.  Otherwise (a 30 fps source for a 60 fps recording,
+//  no source at all) it ticks at the configured interval.  At every tick
+//  the pacer decides what is submitted: the newest frame, dropping the
+//  ones it superseded, or a duplicate of the previous one when nothing
+//  new is ready.
+//
+//  Not thread-safe; FrameProcessor serialises the decoder and timer side.
+//  Times are CLOCK_MONOTONIC nanoseconds.
+// ---------------------------------------------------------------------------
+
+class FramePacer {
+public:
+    enum Action { SUBMIT, DUPLICATE };
+
+    explicit FramePacer(int64_t interval_ns);
+    void set_interval(int64_t interval_ns);
+
+    // A source frame was fed to the decoder at ts_ns.
+    void source_frame(int64_t ts_ns);
+
+    // Scheduled time of the tick after the one scheduled at last_tick_ns.
+    int64_t next_tick(int64_t last_tick_ns) const;
+
+    // At a tick: fresh tells whether a frame was published since the last.
+    Action tick(bool fresh);
+    // A tick nothing is recorded at; the frames seen so far aren't drops.
+    void idle_tick();
+
+    bool locked() const { return locked_; }
+    int64_t period_ns() const { return (int64_t)period_; }
+    uint64_t duplicated() const { return duplicated_; }
+    uint64_t dropped() const { return dropped_; }
+
+    static constexpr double PHASE_GAIN = 1.0 / 8;
+    static constexpr double PERIOD_GAIN = 1.0 / 256;
+    static constexpr int LOCK_RANGE_PCT = 5;
+    static constexpr unsigned LOCK_FRAMES = 30;   // tracked frames before locking
+    static constexpr int64_t MAX_GAP = 8;         // periods without frames: start over
+
+private:
+    int64_t interval_;
+    double period_;              // source period estimate
+    double phase_ = 0;           // when the last source frame was due
+    int64_t first_ts_ = 0;       // acquisition start
+    int64_t last_ts_ = 0;
+    unsigned tracked_ = 0;       // frames since (re)acquisition
+    bool locked_ = false;
+    unsigned since_tick_ = 0;    // source frames since the last fresh tick
+    uint64_t duplicated_ = 0;
+    uint64_t dropped_ = 0;
+};
+
+#endif // FRAME_PACER_H
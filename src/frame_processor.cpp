@@ -5,42 +5,73 @@
 
 #include "spdlog/spdlog.h"
 
-#include <rga/im2d.h>
-#include <rga/rga.h>
-
 #include "dvr.h"
 #include "frame_processor.h"
+extern "C" {
+#include "osd.h"
+}
 
-// Map MPP pixel format to the corresponding RGA format for im2d DMA copies.
-static int mpp_fmt_to_rga(MppFrameFormat fmt)
+// Both the DMA-buf and the CPU view of an MPP buffer holding frame m.
+static ImageBuffer image_of(MppBuffer buf, const FrameProcFrame &m)
 {
-    switch (fmt) {
-    case MPP_FMT_YUV420SP:        return RK_FORMAT_YCbCr_420_SP;
-    case MPP_FMT_YUV420SP_10BIT:  return RK_FORMAT_YCbCr_420_SP_10B;
-    default:                      return RK_FORMAT_YCbCr_420_SP;
-    }
+    ImageBuffer b;
+    b.fd         = mpp_buffer_get_fd(buf);
+    b.ptr        = (uint8_t *)mpp_buffer_get_ptr(buf);
+    b.size       = mpp_buffer_get_size(buf);
+    b.width      = m.width;
+    b.height     = m.height;
+    b.hor_stride = m.hor_stride;
+    b.ver_stride = m.ver_stride;
+    b.fmt        = m.fmt == MPP_FMT_YUV420SP_10BIT ? ImageFormat::NV12_10 : ImageFormat::NV12;
+    return b;
 }
 
 static inline uint32_t align_up(uint32_t v, uint32_t a) {
     return (v + a - 1) & ~(a - 1);
 }
 
-FrameProcessor::FrameProcessor(MppEncoder *enc, int fps, EncResolution res)
-    : encoder(enc), interval_ns(1000000000L / fps), target_res_((int)res) {
+static int64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+FrameProcessor::FrameProcessor(MppEncoder *enc, int fps, EncResolution res,
+                               ImageBackend backend)
+    : interval_ns(1000000000L / fps), pacer_(1000000000L / fps),
+      ops_(image_ops_create(backend)) {
     mpp_buffer_group_get_internal(&hold_grp, MPP_BUFFER_TYPE_DRM);
+    spdlog::info("FrameProcessor: image operations by {}", ops_->name());
+    add_rendition(enc, res);
 }
 
 FrameProcessor::~FrameProcessor() {
     shutdown();
-    if (last_copy)   { mpp_buffer_put(last_copy);   last_copy   = nullptr; }
-    if (proc_copy_)  { mpp_buffer_put(proc_copy_);  proc_copy_  = nullptr; }
-    if (blend_rgba_) { mpp_buffer_put(blend_rgba_); blend_rgba_ = nullptr; }
+    for (auto &r : renditions_) {
+        if (r.last_copy) { mpp_buffer_put(r.last_copy); r.last_copy = nullptr; }
+        if (r.proc_copy) { mpp_buffer_put(r.proc_copy); r.proc_copy = nullptr; }
+    }
     if (hold_grp)    { mpp_buffer_group_put(hold_grp); hold_grp = nullptr; }
 }
 
+void FrameProcessor::add_rendition(MppEncoder *enc, EncResolution res) {
+    if (renditions_.size() >= MAX_RENDITIONS) {
+        spdlog::warn("FrameProcessor: at most {} renditions", (int)MAX_RENDITIONS);
+        return;
+    }
+    Rendition r;
+    r.encoder = enc;
+    r.res = res;
+    renditions_.push_back(r);
+}
+
 void FrameProcessor::push_latest(MppBuffer buf, uint32_t w, uint32_t h,
-                                uint32_t hs, uint32_t vs, MppFrameFormat fmt) {
+                                uint32_t hs, uint32_t vs, MppFrameFormat fmt, uint64_t ts_ms) {
     if (!running) return;
+    {
+        std::lock_guard<std::mutex> lock(pacer_mtx_);
+        pacer_.source_frame((int64_t)ts_ms * 1000000);
+    }
     mpp_buffer_inc_ref(buf);
     FrameProcFrame nf;
     nf.buffer = buf; nf.width = w; nf.height = h;
@@ -70,12 +101,16 @@ void FrameProcessor::drain_decoder_refs() {
     // At this point no decoder buffers are referenced by the pacer.
 }
 
-void FrameProcessor::set_osd_blend(int prime_fd, uint32_t w, uint32_t h, uint32_t stride_px) {
+void FrameProcessor::set_osd_blend(int prime_fd, const uint8_t *map, uint32_t w, uint32_t h,
+                                   uint32_t stride_px, bool premultiplied) {
     std::lock_guard<std::mutex> lock(osd_mtx_);
-    osd_info_.prime_fd   = prime_fd;
-    osd_info_.width      = w;
-    osd_info_.height     = h;
-    osd_info_.stride_px  = stride_px;
+    osd_info_.prime_fd      = prime_fd;
+    osd_info_.map           = map;
+    osd_info_.width         = w;
+    osd_info_.height        = h;
+    osd_info_.stride_px     = stride_px;
+    osd_info_.premultiplied = premultiplied;
+    osd_info_.serial++;
 }
 
 void FrameProcessor::set_color_correction(float gain, float offset, int drm_fd) {
@@ -86,6 +121,84 @@ void FrameProcessor::set_color_correction(float gain, float offset, int drm_fd)
     // Actual EGL/GL init happens lazily on the processor thread (first frame)
 }
 
+bool FrameProcessor::frames_wanted() const {
+    return wanted_ ? wanted_() : dvr_frames_wanted();
+}
+
+void FrameProcessor::publish(const char *fact, uint64_t value) {
+    if (!name_) {
+        osd_publish_uint_fact(fact, NULL, 0, value);
+        return;
+    }
+    osd_tag tags[1];
+    strncpy(tags[0].key, "encoder", TAG_MAX_LEN - 1);
+    strncpy(tags[0].val, name_, TAG_MAX_LEN - 1);
+    tags[0].key[TAG_MAX_LEN - 1] = '\0';
+    tags[0].val[TAG_MAX_LEN - 1] = '\0';
+    osd_publish_uint_fact(fact, tags, 1, value);
+}
+
+// Size r's working buffer for proc_meta.width x height and fill in the
+// rest of its geometry.
+bool FrameProcessor::prepare_buffer(Rendition &r, MppFrameFormat fmt) {
+    uint32_t hs = align_up(r.proc_meta.width, 16);
+    uint32_t vs = align_up(r.proc_meta.height, 16);
+    size_t sz = (size_t)hs * vs * 3 / 2;  // NV12
+
+    if (hold_grp && (!r.proc_copy || mpp_buffer_get_size(r.proc_copy) < sz)) {
+        if (r.proc_copy) { mpp_buffer_put(r.proc_copy); r.proc_copy = nullptr; }
+        mpp_buffer_get(hold_grp, &r.proc_copy, sz);
+    }
+    r.proc_meta.hor_stride = hs;
+    r.proc_meta.ver_stride = vs;
+    r.proc_meta.fmt        = fmt;
+    r.proc_meta.buffer     = nullptr;
+    return r.proc_copy != nullptr;
+}
+
+// Scale the finished first rendition down (or up) into another one.
+void FrameProcessor::scale_rendition(const Rendition &from, Rendition &to) {
+    to.proc_ready = ops_->resize(image_of(from.proc_copy, from.proc_meta),
+                                 image_of(to.proc_copy, to.proc_meta));
+    if (!to.proc_ready)
+        spdlog::warn("{} rendition resize failed {}x{} -> {}x{}", ops_->name(),
+                     from.proc_meta.width, from.proc_meta.height,
+                     to.proc_meta.width, to.proc_meta.height);
+}
+
+// Composite the visible OSD rectangles into the rendition's NV12 buffer.
+// The OSD buffer is uncached, so it is only scanned for visible tiles when
+// a new OSD frame comes to be blended, not every time one is published.
+void FrameProcessor::blend_osd(Rendition &r, const OsdInfo &osd) {
+    auto t0 = std::chrono::steady_clock::now();
+    if (osd.serial != osd_scanned_) {
+        osd_tiles_.scan(osd.map, osd.width, osd.height, osd.stride_px * 4);
+        osd_scanned_ = osd.serial;
+    }
+
+    ImageBuffer src;
+    src.fd         = osd.prime_fd;
+    src.ptr        = const_cast<uint8_t *>(osd.map);
+    src.width      = osd.width;
+    src.height     = osd.height;
+    src.hor_stride = osd.stride_px;
+    src.ver_stride = osd.height;
+    src.fmt        = ImageFormat::BGRA;
+    ImageBuffer frame = image_of(r.proc_copy, r.proc_meta);
+    for (const BlendRect &o : osd_tiles_.rects())
+        ops_->blend(src, osd.premultiplied, o, frame);
+
+    auto t1 = std::chrono::steady_clock::now();
+    blend_us_sum_ += std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+    blend_count_++;
+    if (t1 - blend_published_ >= std::chrono::seconds(1)) {
+        publish("dvr.osd_blend_us", blend_us_sum_ / blend_count_);
+        blend_us_sum_ = 0;
+        blend_count_ = 0;
+        blend_published_ = t1;
+    }
+}
+
 // ── Processor thread entry point ────────────────────────────────────────────
 
 void *FrameProcessor::__THREAD__(void *p) {
@@ -128,36 +241,35 @@ void FrameProcessor::process_loop() {
         }
         if (!fresh.buffer) continue;
 
-        // If DVR is not active, just drain the frame to release the decoder ref.
-        if (!dvr_enabled || !encoder) {
+        // If DVR is not active (nor buffering a pre-roll), just drain the
+        // frame to release the decoder ref.
+        if (!frames_wanted() || !renditions_[0].encoder) {
             fresh.release();
             continue;
         }
 
         auto t_start = std::chrono::steady_clock::now();
 
+        // Output sizes of all renditions, fitted to the source aspect.
+        {
+            std::lock_guard<std::mutex> lock(res_mtx_);
+            for (auto &r : renditions_)
+                r.res.fit(fresh.width, fresh.height, r.proc_meta.width, r.proc_meta.height);
+        }
+        Rendition &first = renditions_[0];
+
         // ── Copy / resize / color-correct ───────────────────────────────
         // copy_mtx_ is held so drain_decoder_refs() can safely wait for us.
         {
             std::lock_guard<std::mutex> copy_lock(copy_mtx_);
 
-            // Compute target dimensions based on resolution setting.
-            uint32_t dst_w, dst_h, dst_hs, dst_vs;
-            if (target_res_.load(std::memory_order_relaxed) == 0) {
-                dst_w = 1280; dst_h = 720;
-            } else {
-                dst_w = 1920; dst_h = 1080;
-            }
-            dst_hs = align_up(dst_w, 16);
-            dst_vs = align_up(dst_h, 16);
-
-            size_t dst_sz = (size_t)dst_hs * dst_vs * 3 / 2;  // NV12
+            first.proc_ready = prepare_buffer(first, fresh.fmt);
+            uint32_t dst_w  = first.proc_meta.width;
+            uint32_t dst_h  = first.proc_meta.height;
+            uint32_t dst_hs = first.proc_meta.hor_stride;
+            uint32_t dst_vs = first.proc_meta.ver_stride;
 
-            if (hold_grp && (!proc_copy_ || mpp_buffer_get_size(proc_copy_) < dst_sz)) {
-                if (proc_copy_) { mpp_buffer_put(proc_copy_); proc_copy_ = nullptr; }
-                mpp_buffer_get(hold_grp, &proc_copy_, dst_sz);
-            }
-            if (proc_copy_) {
+            if (first.proc_ready) {
                 // Re-init color correction if source dimensions changed.
                 if (cc_init_done_ &&
                     (fresh.width != cc_width_ || fresh.height != cc_height_)) {
@@ -180,88 +292,56 @@ void FrameProcessor::process_loop() {
                         mpp_buffer_get_fd(fresh.buffer),
                         fresh.width, fresh.height,
                         fresh.hor_stride, fresh.ver_stride,
-                        mpp_buffer_get_fd(proc_copy_),
+                        mpp_buffer_get_fd(first.proc_copy),
                         dst_w, dst_h, dst_hs, dst_vs);
                 }
                 if (!copied) {
-                    // Fallback: RGA resize (or copy if same size)
-                    int rga_fmt = mpp_fmt_to_rga(fresh.fmt);
-                    rga_buffer_t src_rga = wrapbuffer_fd_t(
-                        mpp_buffer_get_fd(fresh.buffer),
-                        fresh.width, fresh.height,
-                        fresh.hor_stride, fresh.ver_stride, rga_fmt);
-                    rga_buffer_t dst_rga = wrapbuffer_fd_t(
-                        mpp_buffer_get_fd(proc_copy_),
-                        dst_w, dst_h, dst_hs, dst_vs, rga_fmt);
-                    if (fresh.width == dst_w && fresh.height == dst_h) {
-                        if (imcopy(src_rga, dst_rga) != IM_STATUS_SUCCESS) {
-                            size_t copy_sz = (size_t)fresh.hor_stride * fresh.ver_stride * 3 / 2;
-                            size_t actual = mpp_buffer_get_size(fresh.buffer);
-                            if (copy_sz > actual) copy_sz = actual;
-                            void *sp = mpp_buffer_get_ptr(fresh.buffer);
-                            void *dp = mpp_buffer_get_ptr(proc_copy_);
-                            if (sp && dp) memcpy(dp, sp, copy_sz);
-                        }
-                    } else {
-                        if (imresize(src_rga, dst_rga) != IM_STATUS_SUCCESS) {
-                            spdlog::warn("RGA resize failed {}x{} -> {}x{}",
-                                         fresh.width, fresh.height, dst_w, dst_h);
-                        }
-                    }
+                    // Plain resize (or copy if same size)
+                    first.proc_ready = ops_->resize(image_of(fresh.buffer, fresh),
+                                                    image_of(first.proc_copy, first.proc_meta));
+                    if (!first.proc_ready)
+                        spdlog::warn("{} resize failed {}x{} -> {}x{}", ops_->name(),
+                                     fresh.width, fresh.height, dst_w, dst_h);
                 }
-                proc_meta_.width      = dst_w;
-                proc_meta_.height     = dst_h;
-                proc_meta_.hor_stride = dst_hs;
-                proc_meta_.ver_stride = dst_vs;
-                proc_meta_.fmt        = fresh.fmt;
-                proc_meta_.buffer     = nullptr;
             }
             fresh.release();  // decoder buffer is free again
         }
 
-        if (!proc_copy_) continue;
+        if (!first.proc_ready) continue;
 
-        // ── OSD blend on proc_copy_ ─────────────────────────────────────
+        // ── OSD blend on the first rendition ────────────────────────────
         {
             OsdInfo osd_snap;
             {
                 std::lock_guard<std::mutex> lock(osd_mtx_);
                 osd_snap = osd_info_;
             }
-            if (osd_snap.prime_fd >= 0 && osd_snap.width > 0 && osd_snap.height > 0) {
-                size_t bgra_sz = (size_t)proc_meta_.hor_stride * proc_meta_.ver_stride * 4;
-                if (!blend_rgba_ || mpp_buffer_get_size(blend_rgba_) < bgra_sz) {
-                    if (blend_rgba_) { mpp_buffer_put(blend_rgba_); blend_rgba_ = nullptr; }
-                    mpp_buffer_get(hold_grp, &blend_rgba_, bgra_sz);
-                }
-                if (blend_rgba_) {
-                    rga_buffer_t nv12 = wrapbuffer_fd_t(
-                        mpp_buffer_get_fd(proc_copy_),
-                        proc_meta_.width, proc_meta_.height,
-                        proc_meta_.hor_stride, proc_meta_.ver_stride,
-                        RK_FORMAT_YCbCr_420_SP);
-                    rga_buffer_t bgra = wrapbuffer_fd_t(
-                        mpp_buffer_get_fd(blend_rgba_),
-                        proc_meta_.width, proc_meta_.height,
-                        proc_meta_.hor_stride, proc_meta_.ver_stride,
-                        RK_FORMAT_BGRA_8888);
-                    rga_buffer_t osd = wrapbuffer_fd_t(
-                        osd_snap.prime_fd,
-                        osd_snap.width, osd_snap.height,
-                        osd_snap.stride_px, osd_snap.height,
-                        RK_FORMAT_BGRA_8888);
-                    imcvtcolor(nv12, bgra, RK_FORMAT_YCbCr_420_SP, RK_FORMAT_BGRA_8888);
-                    imblend(osd, bgra, IM_ALPHA_BLEND_SRC_OVER);
-                    imcvtcolor(bgra, nv12, RK_FORMAT_BGRA_8888, RK_FORMAT_YCbCr_420_SP);
-                }
-            }
+            // Only 8-bit frames take an OSD
+            if (osd_snap.prime_fd >= 0 && osd_snap.map && osd_snap.width > 0 && osd_snap.height > 0
+                && first.proc_meta.fmt == MPP_FMT_YUV420SP)
+                blend_osd(first, osd_snap);
         }
 
-        // ── Publish: swap proc buffer into last_copy for the timer ──────
+        // ── Further renditions: scaled from the blended first one ──────
+        for (size_t i = 1; i < renditions_.size(); i++) {
+            if (prepare_buffer(renditions_[i], first.proc_meta.fmt))
+                scale_rendition(first, renditions_[i]);
+        }
+
+        // ── Publish: hand proc buffers over as last_copy for the timer ──
+        // The old last_copy may still be in the encoder (it holds a ref of
+        // its own), so it is never written again: the next frame takes a
+        // buffer from hold_grp, which only hands out unreferenced ones.
         {
             std::lock_guard<std::mutex> lock(ready_mtx_);
-            std::swap(proc_copy_, last_copy);
-            last_meta = proc_meta_;
+            for (auto &r : renditions_) {
+                if (!r.proc_ready) continue;
+                if (r.last_copy) mpp_buffer_put(r.last_copy);
+                r.last_copy = r.proc_copy;
+                r.proc_copy = nullptr;
+                r.last_meta = r.proc_meta;
+                r.proc_ready = false;
+            }
             ready_fresh_ = true;
         }
         ready_cv_.notify_one();
@@ -274,13 +354,11 @@ void FrameProcessor::process_loop() {
             long ival_us = interval_ns.load(std::memory_order_relaxed) / 1000;
 
             // Running average over ~64 frames (shift-based EMA).
-            static long avg_us = 0;
-            avg_us = avg_us ? avg_us + (proc_us - avg_us) / 64 : proc_us;
-            static int log_counter = 0;
-            if (++log_counter >= 120) {
+            proc_avg_us_ = proc_avg_us_ ? proc_avg_us_ + (proc_us - proc_avg_us_) / 64 : proc_us;
+            if (++proc_log_count_ >= 120) {
                 spdlog::debug("FrameProcessor process avg={} us (budget {} us)",
-                              avg_us, ival_us);
-                log_counter = 0;
+                              proc_avg_us_, ival_us);
+                proc_log_count_ = 0;
             }
 
             if (proc_us > ival_us) {
@@ -304,54 +382,94 @@ void FrameProcessor::process_loop() {
 // No image processing happens here, so it never misses a tick.
 
 void FrameProcessor::timer_loop() {
-    struct timespec next;
-    clock_gettime(CLOCK_MONOTONIC, &next);
+    int64_t tick_ns = monotonic_ns();
+    int64_t published_ns = tick_ns;
     while (running) {
-        next.tv_nsec += interval_ns.load(std::memory_order_relaxed);
-        if (next.tv_nsec >= 1000000000L) {
-            next.tv_nsec -= 1000000000L;
-            next.tv_sec++;
+        {
+            std::lock_guard<std::mutex> lock(pacer_mtx_);
+            pacer_.set_interval(interval_ns.load(std::memory_order_relaxed));
+            tick_ns = pacer_.next_tick(tick_ns);
         }
+        struct timespec next;
+        next.tv_sec  = tick_ns / 1000000000L;
+        next.tv_nsec = tick_ns % 1000000000L;
         clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
         if (!running) break;
-        if (!dvr_enabled || !encoder) continue;
+        if (!frames_wanted() || !renditions_[0].encoder) {
+            std::lock_guard<std::mutex> lock(pacer_mtx_);
+            pacer_.idle_tick();
+            continue;
+        }
 
-        // Pick the latest processed frame.  If no fresh frame is ready,
+        // Pick the latest processed frames.  If no fresh frame is ready,
         // wait up to half an interval for the processor to finish — this
         // avoids unnecessary repeats (micro-stutters) when processing is
         // just slightly slower than the timer tick.
-        MppBuffer frame = nullptr;
-        FrameProcFrame meta;
+        FrameProcFrame frames[MAX_RENDITIONS];
         {
             std::unique_lock<std::mutex> lock(ready_mtx_);
-            if (!ready_fresh_ && last_copy) {
+            if (!renditions_[0].last_copy) {
+                std::lock_guard<std::mutex> plock(pacer_mtx_);
+                pacer_.idle_tick();
+                continue;
+            }
+            bool absorbed = false;
+            if (!ready_fresh_) {
                 auto grace = std::chrono::nanoseconds(
                     interval_ns.load(std::memory_order_relaxed) / 2);
                 ready_cv_.wait_for(lock, grace,
                     [&]{ return ready_fresh_ || !running; });
                 if (!running) break;
                 if (ready_fresh_) {
-                    // Fresh frame arrived during grace — re-anchor timer
-                    // so we don't cascade from the delayed tick.
-                    clock_gettime(CLOCK_MONOTONIC, &next);
+                    absorbed = true;
                     spdlog::debug("FrameProcessor grace period absorbed late frame");
                 }
             }
+            {
+                std::lock_guard<std::mutex> plock(pacer_mtx_);
+                pacer_.tick(ready_fresh_);
+                // Free running: re-anchor after a late frame so we don't
+                // cascade from the delayed tick.  A locked pacer follows
+                // the source by itself.
+                if (absorbed && !pacer_.locked())
+                    tick_ns = monotonic_ns();
+            }
             ready_fresh_ = false;
-            if (last_copy) {
-                mpp_buffer_inc_ref(last_copy);
-                frame = last_copy;
-                meta  = last_meta;
+            for (size_t i = 0; i < renditions_.size(); i++) {
+                Rendition &r = renditions_[i];
+                if (!r.last_copy || !r.encoder) continue;
+                mpp_buffer_inc_ref(r.last_copy);
+                frames[i] = r.last_meta;
+                frames[i].buffer = r.last_copy;
             }
         }
-        if (frame) {
-            struct timespec now;
-            clock_gettime(CLOCK_MONOTONIC, &now);
-            uint64_t pts_ms = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
-            encoder->push_frame(frame,
-                                meta.width, meta.height,
-                                meta.hor_stride, meta.ver_stride,
-                                meta.fmt, pts_ms);
+        // Stamped with the scheduled time, free of wake-up latency
+        uint64_t pts_ms = (uint64_t)tick_ns / 1000000;
+        for (size_t i = 0; i < renditions_.size(); i++) {
+            FrameProcFrame &meta = frames[i];
+            if (!meta.buffer) continue;
+            Rendition &r = renditions_[i];
+            // Encoder pipeline full: skip this tick rather than queue up
+            // latency; the pts of the next frame keeps the timing right.
+            if (!r.encoder->push_frame(meta.buffer,
+                                       meta.width, meta.height,
+                                       meta.hor_stride, meta.ver_stride,
+                                       meta.fmt, pts_ms)) {
+                meta.release();
+                if (++r.busy_ticks % 60 == 1)
+                    spdlog::debug("FrameProcessor: encoder {} busy, {} ticks skipped",
+                                  i, r.busy_ticks);
+            }
+        }
+
+        if (tick_ns - published_ns >= 1000000000L) {
+            std::lock_guard<std::mutex> lock(pacer_mtx_);
+            publish("dvr.frames_duplicated", pacer_.duplicated());
+            publish("dvr.frames_dropped", pacer_.dropped());
+            spdlog::debug("FrameProcessor pacer {} period={} us, {} duplicated, {} dropped",
+                          pacer_.locked() ? "locked" : "free running",
+                          pacer_.period_ns() / 1000, pacer_.duplicated(), pacer_.dropped());
+            published_ns = tick_ns;
         }
     }
 }
@@ -3,13 +3,20 @@
 
 #include <stdint.h>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <vector>
 
 #include <rockchip/rk_mpi.h>
 
 #include "mpp_encoder.h"
 #include "frame_colorcorrect.h"
+#include "osd_blend.h"
+#include "frame_pacer.h"
+#include "image_ops.h"
 
 // ---------------------------------------------------------------------------
 // FrameProcessor: feeds MppEncoder at a steady fps regardless of incoming rate.
@@ -17,13 +24,33 @@
 //  Two internal threads:
 //   1. Processor thread (has GL context): receives decoded frames, performs
 //      copy/resize/color-correction/OSD-blend, publishes the result.
-//   2. Timer thread: wakes at target fps intervals and submits the latest
+//   2. Timer thread: wakes when the FramePacer says and submits the latest
 //      processed frame to the encoder — or repeats the last one if none
 //      arrived, preventing a speedup effect when source fps < target fps.
+//      The pacer follows the source's cadence from the decoder's feed
+//      timestamps when it is close to the target fps, so a slightly
+//      different air unit clock doesn't make the recording judder.
+//      Duplicated and dropped frames are published as dvr.frames_duplicated
+//      and dvr.frames_dropped.
 //
 //  Decoupling processing from pacing ensures the timer is never blocked by
 //  heavy image work.  Throughput is limited by the slowest single stage
-//  instead of the serial sum of all stages.
+//  instead of the serial sum of all stages.  When the encoder already has
+//  its pipeline full the tick is skipped instead of queueing more latency.
+//
+//  Several renditions can be encoded from the same frames, each by its own
+//  MppEncoder (a full-quality recording and a small proxy, say).  The first
+//  one is produced from the decoded frame as above; the others are scaled
+//  down from it, so they carry the same OSD and color correction.
+//  Every tick submits all renditions with the same pts.  Output sizes are
+//  fitted to the aspect ratio of the source.
+//
+//  The OSD is composited straight into the NV12 frame, and only where it
+//  has visible pixels (see osd_blend.h).  The average blend time is
+//  published as dvr.osd_blend_us.
+//
+//  Copies, scaling and blending go through ImageOps (image_ops.h): the RGA
+//  with the CPU taking over what it fails by default, or either alone.
 // ---------------------------------------------------------------------------
 
 struct FrameProcFrame {
@@ -40,20 +67,36 @@ struct FrameProcFrame {
 
 class FrameProcessor {
 public:
-    FrameProcessor(MppEncoder *enc, int fps, EncResolution res = EncResolution::Res1080p);
+    FrameProcessor(MppEncoder *enc, int fps, EncResolution res = EncResolution(),
+                   ImageBackend backend = ImageBackend::AUTO);
     ~FrameProcessor();
 
+    // Encode another rendition with enc. Call before the thread starts.
+    void add_rendition(MppEncoder *enc, EncResolution res);
+
+    // Frames are only processed and encoded while wanted() is true; by
+    // default while the DVR wants them (dvr_frames_wanted()). Call before
+    // the thread starts.
+    void set_frames_wanted(std::function<bool()> wanted) { wanted_ = std::move(wanted); }
+    // Tag the facts it publishes with encoder=<name>. Call before the
+    // thread starts.
+    void set_name(const char *name) { name_ = name; }
+
     // Called from decoder thread: update the latest available frame.
+    // ts_ms — when the frame was fed to the decoder (CLOCK_MONOTONIC)
     void push_latest(MppBuffer buf, uint32_t w, uint32_t h,
-                     uint32_t hs, uint32_t vs, MppFrameFormat fmt);
+                     uint32_t hs, uint32_t vs, MppFrameFormat fmt, uint64_t ts_ms);
 
     void shutdown();
 
     // Live-update the pacing interval (thread-safe).
     void set_fps(int fps) { interval_ns.store(1000000000L / fps, std::memory_order_relaxed); }
 
-    // Set encoder output resolution (thread-safe).
-    void set_resolution(EncResolution r) { target_res_.store((int)r, std::memory_order_relaxed); }
+    // Set the first rendition's output resolution (thread-safe).
+    void set_resolution(EncResolution r) {
+        std::lock_guard<std::mutex> lock(res_mtx_);
+        renditions_[0].res = r;
+    }
 
     // Enable GPU color correction using the DRM gamma formula y = clamp((x+offset)*gain, 0, 1).
     // Safe to call from any thread.  drm_fd is used to create the GBM/EGL context (lazy).
@@ -71,47 +114,88 @@ public:
     void drain_decoder_refs();
 
     // Called from the OSD thread each time a new OSD frame is ready.
-    // prime_fd  — DMA-buf fd of the OSD modeset_buf (BGRA/ARGB8888)
-    // w, h      — OSD pixel dimensions
-    // stride_px — row stride in pixels (= buf->stride / 4)
-    void set_osd_blend(int prime_fd, uint32_t w, uint32_t h, uint32_t stride_px);
+    // prime_fd      — DMA-buf fd of the OSD modeset_buf (BGRA/ARGB8888), -1 disables
+    // map           — CPU mapping of the same buffer
+    // w, h          — OSD pixel dimensions
+    // stride_px     — row stride in pixels (= buf->stride / 4)
+    // premultiplied — colours are premultiplied by alpha (Cairo; LVGL's aren't)
+    // Only takes note of the buffer: its visible tiles are looked up on the
+    // processor thread, once per OSD frame that actually gets blended.
+    void set_osd_blend(int prime_fd, const uint8_t *map, uint32_t w, uint32_t h,
+                       uint32_t stride_px, bool premultiplied);
 
     static void *__THREAD__(void *p);
     static void *__TIMER_THREAD__(void *p);
 
+    static const size_t MAX_RENDITIONS = 4;
+
 private:
+    struct Rendition {
+        MppEncoder     *encoder    = nullptr;
+        EncResolution   res;                   // guarded by res_mtx_
+        // Processor thread only:
+        MppBuffer       proc_copy  = nullptr;  // working buffer, fresh from hold_grp per frame
+        FrameProcFrame  proc_meta;
+        bool            proc_ready = false;    // proc_copy holds this frame
+        // Guarded by ready_mtx_:
+        MppBuffer       last_copy  = nullptr;  // latest processed frame pixels
+        FrameProcFrame  last_meta;
+        uint64_t        busy_ticks = 0;        // timer thread only
+    };
+
     void process_loop();
     void timer_loop();
+    // OSD blend — shared between OSD thread (writer) and processor thread (reader)
+    struct OsdInfo {
+        int            prime_fd{-1};
+        const uint8_t *map{nullptr};
+        uint32_t       width{0}, height{0}, stride_px{0};
+        bool           premultiplied{true};
+        uint64_t       serial{0};       // bumped for every new OSD frame
+    };
+
+    bool frames_wanted() const;
+    void publish(const char *fact, uint64_t value);
+    bool prepare_buffer(Rendition &r, MppFrameFormat fmt);
+    void scale_rendition(const Rendition &from, Rendition &to);
+    void blend_osd(Rendition &r, const OsdInfo &osd);
 
-    MppEncoder            *encoder;
+    std::function<bool()> wanted_;
+    const char           *name_ = nullptr;
     std::atomic<long>     interval_ns;
-    std::atomic<int>      target_res_{1};  // 0=720p, 1=1080p
     std::atomic<bool>     running{true};
+    std::mutex              res_mtx_;
+    // [0] is made from the decoded frame, the others from [0]. Fixed once
+    // the thread runs.
+    std::vector<Rendition>  renditions_;
     std::mutex              mtx;       // guards pending (shared with frame/decoder thread)
     std::condition_variable cv_;       // signalled by push_latest(); processor waits here
     std::mutex              copy_mtx_; // held by processor while it uses a decoder buffer
     FrameProcFrame     pending;   // latest from decoder (shared with decoder thread)
 
     // Shared between processor (writer) and timer (reader):
-    std::mutex              ready_mtx_;       // guards last_copy / last_meta
+    std::mutex              ready_mtx_;       // guards the renditions' last_copy / last_meta
     std::condition_variable ready_cv_;        // signalled when fresh frame published
     bool                    ready_fresh_{false}; // true = last_copy updated since last pickup
-    MppBuffer         last_copy   = nullptr;  // latest processed frame pixels
-    FrameProcFrame     last_meta;              // geometry/format for last_copy
+
+    // Shared between decoder (source timestamps) and timer thread
+    std::mutex              pacer_mtx_;
+    FramePacer              pacer_;
 
     // Only accessed from the processor thread — no mutex needed:
     MppBufferGroup    hold_grp  = nullptr;  // our own DRM buffer pool
-    MppBuffer         proc_copy_  = nullptr;  // processor's working buffer
-    MppBuffer         blend_rgba_ = nullptr;  // BGRA intermediate for OSD compositing
-    FrameProcFrame     proc_meta_;              // metadata being built by processor
+    long              proc_avg_us_ = 0;     // EMA of the processing time
+    int               proc_log_count_ = 0;
+    std::unique_ptr<ImageOps> ops_;         // copy / scale / blend backend
+    uint64_t          blend_us_sum_ = 0;    // dvr.osd_blend_us accumulation
+    unsigned          blend_count_ = 0;
+    std::chrono::steady_clock::time_point blend_published_;
 
-    // OSD blend — shared between OSD thread (writer) and processor thread (reader)
-    struct OsdInfo {
-        int      prime_fd{-1};
-        uint32_t width{0}, height{0}, stride_px{0};
-    };
     std::mutex  osd_mtx_;
     OsdInfo     osd_info_;      // latest OSD frame descriptor
+    // Processor thread only: visible areas of OSD frame osd_scanned_
+    OsdTiles    osd_tiles_;
+    uint64_t    osd_scanned_ = 0;
 
     // Color correction — lazy-initialized on the processor thread on first frame.
     // Written by UI thread (set_color_correction / set_color_correction_enabled),
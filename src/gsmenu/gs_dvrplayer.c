@@ -87,10 +87,26 @@ static void play_pause_event_handler(lv_event_t * e)
     }
 }
 
-// Event handler for the fast-rewind button
+// Paused when the play/pause button offers to play
+static bool playback_paused(void)
+{
+    return btn_play_pause &&
+           strcmp(lv_label_get_text(lv_obj_get_child(btn_play_pause, 0)), LV_SYMBOL_PLAY) == 0;
+}
+
+// Event handler for the fast-rewind button; while paused it scrubs one
+// keyframe back
 static void fr_event_handler(lv_event_t * e)
 {
     timer_reset_handler(e);
+    if (playback_paused()) {
+#ifndef USE_SIMULATOR
+        scrub_playback(-1);
+#else
+        printf("scrub_playback(-1);\n");
+#endif
+        return;
+    }
 #ifndef USE_SIMULATOR
     skip_duration(-10000);  // Skip back 10 seconds
 #else
@@ -98,10 +114,19 @@ static void fr_event_handler(lv_event_t * e)
 #endif
 }
 
-// Event handler for the fast-forward button
+// Event handler for the fast-forward button; while paused it scrubs one
+// keyframe forward
 static void ff_event_handler(lv_event_t * e)
 {
     timer_reset_handler(e);
+    if (playback_paused()) {
+#ifndef USE_SIMULATOR
+        scrub_playback(1);
+#else
+        printf("scrub_playback(1);\n");
+#endif
+        return;
+    }
 #ifndef USE_SIMULATOR
     skip_duration(10000);  // Skip forward 10 seconds
 #else
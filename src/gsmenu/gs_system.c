@@ -38,6 +38,8 @@ static lv_obj_t * dvr_reenc_fps;
 static lv_obj_t * dvr_reenc_bitrate;
 static lv_obj_t * dvr_reenc_resolution;
 static lv_obj_t * dvr_reenc_osd;
+static lv_obj_t * dvr_reenc_rc;
+static lv_obj_t * dvr_reenc_gop;
 
 extern lv_obj_t * ap_fpv_ssid;
 extern lv_obj_t * ap_fpv_password;
@@ -57,6 +59,13 @@ void dvr_reenc_set_osd(int enabled);
 void dvr_reenc_set_bitrate(int kbps);
 void dvr_reenc_set_codec(int idx);
 void dvr_reenc_set_resolution(int idx);
+// Rate control: mode 0=cbr, 1=vbr, 2=avbr, 3=fixqp; QPs 1..51; gop in
+// frames, 0 = two seconds; intra refresh in macroblock rows, 0 = off.
+void dvr_reenc_set_rc_mode(int mode);
+void dvr_reenc_set_qp_range(int qp_min, int qp_max);
+void dvr_reenc_set_fixed_qp(int qp);
+void dvr_reenc_set_gop(int frames);
+void dvr_reenc_set_intra_refresh(int rows);
 void dvr_set_mode(int mode);
 void dvr_start_all(void);
 void dvr_stop_all(void);
@@ -66,6 +75,11 @@ int  dvr_reenc_get_bitrate(void);
 int  dvr_reenc_get_osd(void);
 int  dvr_reenc_get_codec(void);
 int  dvr_reenc_get_resolution(void);
+int  dvr_reenc_get_rc_mode(void);
+void dvr_reenc_get_qp_range(int *qp_min, int *qp_max);
+int  dvr_reenc_get_fixed_qp(void);
+int  dvr_reenc_get_gop(void);
+int  dvr_reenc_get_intra_refresh(void);
 void dvr_set_max_size(int mb);
 int  dvr_get_max_size(void);
 #ifndef USE_SIMULATOR
@@ -90,9 +104,9 @@ static void update_dvr_mode_visibility(void)
     if (show_raw) lv_obj_remove_flag(rec_fps, LV_OBJ_FLAG_HIDDEN);
     else          lv_obj_add_flag(rec_fps, LV_OBJ_FLAG_HIDDEN);
 
-    lv_obj_t *reenc_widgets[] = {dvr_reenc_codec, dvr_reenc_fps,
-                                  dvr_reenc_bitrate, dvr_reenc_resolution, dvr_reenc_osd};
-    for (int i = 0; i < 5; i++) {
+    lv_obj_t *reenc_widgets[] = {dvr_reenc_codec, dvr_reenc_fps, dvr_reenc_bitrate,
+                                  dvr_reenc_resolution, dvr_reenc_osd, dvr_reenc_rc, dvr_reenc_gop};
+    for (int i = 0; i < 7; i++) {
         if (show_reenc) lv_obj_remove_flag(reenc_widgets[i], LV_OBJ_FLAG_HIDDEN);
         else            lv_obj_add_flag(reenc_widgets[i], LV_OBJ_FLAG_HIDDEN);
     }
@@ -121,6 +135,28 @@ static void reload_dvr_reenc_osd_fn(lv_obj_t *page, lv_obj_t *parameter) {
     lv_unlock();
 }
 
+// The options come from gsmenu.sh, the selection from the running encoder.
+static void reload_dvr_reenc_rc_fn(lv_obj_t *page, lv_obj_t *parameter) {
+    reload_dropdown_value(page, parameter);
+    lv_obj_t *dd = lv_obj_get_child_by_type(parameter, 0, &lv_dropdown_class);
+    lv_lock();
+    lv_dropdown_set_selected(dd, (uint32_t)dvr_reenc_get_rc_mode());
+    lv_unlock();
+}
+
+static void reload_dvr_reenc_gop_fn(lv_obj_t *page, lv_obj_t *parameter) {
+    reload_dropdown_value(page, parameter);
+    lv_obj_t *dd = lv_obj_get_child_by_type(parameter, 0, &lv_dropdown_class);
+    char val[16] = "auto";
+    int gop = dvr_reenc_get_gop();
+    if (gop > 0)
+        snprintf(val, sizeof(val), "%d", gop);
+    lv_lock();
+    int32_t idx = lv_dropdown_get_option_index(dd, val);
+    if (idx >= 0) lv_dropdown_set_selected(dd, (uint32_t)idx);
+    lv_unlock();
+}
+
 static void reload_rx_mode_fn(lv_obj_t *page, lv_obj_t *parameter) {
     reload_dropdown_value(page, parameter);
     lv_lock();
@@ -327,6 +363,34 @@ void dvr_reenc_resolution_cb(lv_event_t *e) {
     }
 }
 
+void dvr_reenc_rc_cb(lv_event_t *e) {
+    lv_event_code_t event = lv_event_get_code(e);
+    if (event == LV_EVENT_VALUE_CHANGED) {
+        lv_obj_t *ta = lv_event_get_target(e);
+        int mode = lv_dropdown_get_selected(ta); // 0=cbr, 1=vbr, 2=avbr, 3=fixqp
+#ifndef USE_SIMULATOR
+        dvr_reenc_set_rc_mode(mode);
+#else
+        printf("dvr_reenc_set_rc_mode(%d);\n", mode);
+#endif
+    }
+}
+
+void dvr_reenc_gop_cb(lv_event_t *e) {
+    lv_event_code_t event = lv_event_get_code(e);
+    if (event == LV_EVENT_VALUE_CHANGED) {
+        lv_obj_t *ta = lv_event_get_target(e);
+        char val[32] = "";
+        lv_dropdown_get_selected_str(ta, val, sizeof(val) - 1);
+        int frames = atoi(val); // "auto" = 0
+#ifndef USE_SIMULATOR
+        dvr_reenc_set_gop(frames);
+#else
+        printf("dvr_reenc_set_gop(%d);\n", frames);
+#endif
+    }
+}
+
 void resolution_cb(lv_event_t *e) {
     if (lv_event_get_code(e) == LV_EVENT_VALUE_CHANGED)
         show_restart_notice();
@@ -565,6 +629,12 @@ void create_gs_system_dvr_menu(lv_obj_t * parent) {
     dvr_reenc_bitrate = create_dropdown(cont, LV_SYMBOL_SETTINGS, "Bitrate (kbps)", "", "dvr_reenc_bitrate", menu_page_data, false);
     lv_obj_add_event_cb(lv_obj_get_child_by_type(dvr_reenc_bitrate, 0, &lv_dropdown_class), dvr_reenc_bitrate_cb, LV_EVENT_VALUE_CHANGED, NULL);
     use_sub_back_handler(dvr_reenc_bitrate);
+    dvr_reenc_rc = create_dropdown(cont, LV_SYMBOL_SETTINGS, "Rate control", "", "dvr_reenc_rc", menu_page_data, false);
+    lv_obj_add_event_cb(lv_obj_get_child_by_type(dvr_reenc_rc, 0, &lv_dropdown_class), dvr_reenc_rc_cb, LV_EVENT_VALUE_CHANGED, NULL);
+    use_sub_back_handler(dvr_reenc_rc);
+    dvr_reenc_gop = create_dropdown(cont, LV_SYMBOL_SETTINGS, "GOP (frames)", "", "dvr_reenc_gop", menu_page_data, false);
+    lv_obj_add_event_cb(lv_obj_get_child_by_type(dvr_reenc_gop, 0, &lv_dropdown_class), dvr_reenc_gop_cb, LV_EVENT_VALUE_CHANGED, NULL);
+    use_sub_back_handler(dvr_reenc_gop);
     dvr_reenc_osd = create_switch(cont, LV_SYMBOL_SETTINGS, "Record OSD in DVR", "dvr_osd", menu_page_data, false);
     lv_obj_add_event_cb(lv_obj_get_child_by_type(dvr_reenc_osd, 0, &lv_switch_class), dvr_reenc_osd_cb, LV_EVENT_VALUE_CHANGED, NULL);
     use_sub_back_handler(dvr_reenc_osd);
@@ -578,6 +648,8 @@ void create_gs_system_dvr_menu(lv_obj_t * parent) {
     add_entry_to_menu_page(menu_page_data, "Loading Re-enc Res ...",     dvr_reenc_resolution, reload_dropdown_value);
     add_entry_to_menu_page(menu_page_data, "Loading Re-enc FPS ...",     dvr_reenc_fps,        reload_dropdown_value);
     add_entry_to_menu_page(menu_page_data, "Loading Re-enc Bitrate ...", dvr_reenc_bitrate,    reload_dropdown_value);
+    add_entry_to_menu_page(menu_page_data, "Loading Re-enc RC ...",      dvr_reenc_rc,         reload_dvr_reenc_rc_fn);
+    add_entry_to_menu_page(menu_page_data, "Loading Re-enc GOP ...",     dvr_reenc_gop,        reload_dvr_reenc_gop_fn);
     add_entry_to_menu_page(menu_page_data, "Loading DVR OSD ...",        dvr_reenc_osd,        reload_dvr_reenc_osd_fn);
     add_entry_to_menu_page(menu_page_data, "Loading DVR Mode ...",       dvr_mode_dd,          reload_dvr_mode_fn);
 
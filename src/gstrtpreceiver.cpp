@@ -4,6 +4,8 @@
 //
 
 #include "gstrtpreceiver.h"
+#include "idr_scheduler.h"
+#include "rtp_fanout.h"
 #include "gst/gstparse.h"
 #include "gst/gstpipeline.h"
 #include "gst/net/gstnetaddressmeta.h"
@@ -31,6 +33,7 @@
 #include <netinet/in.h>
 #include <unistd.h>
 #include <sys/un.h>
+#include <poll.h>
 #include <fcntl.h>
 #include <pthread.h>
 #include <errno.h>
@@ -118,16 +121,10 @@ namespace {
     static constexpr int kIdrUdpPort = 11223;
     static constexpr int kIdrBurstCount = 3;
     static constexpr int kIdrBurstSpacingMs = 100;
-    static constexpr int kIdrRepeatCount = 3;
-    static constexpr int kIdrRepeatSpacingMs = 100;
-    static constexpr int kIdrRecordRepeatCount = 3;
-    static constexpr int kIdrRecordRepeatSpacingMs = 150;
+    static constexpr unsigned kIdrRefreshAttempts = 3; // stream up, record or restream start
     static constexpr uint64_t kStreamDownMs = 1200;
     static constexpr uint64_t kStreamTickMs = 200;
-    static constexpr uint64_t kIntegrityCooldownMs = 350;
-    static constexpr uint64_t kRtpGapCooldownMs = 500;
     static constexpr uint64_t kDecodeStallMs = 700;
-    static constexpr uint64_t kDecodeStallCooldownMs = 700;
     static constexpr uint64_t kDecodeStallPktWindowMs = 500;
     static constexpr uint64_t kRtpSeqResetMs = 1000;
 
@@ -142,43 +139,38 @@ namespace {
     static std::string g_restream_target_ip;
     static std::string g_restream_manual_ip; // user's active selection; empty = auto-discover
     static std::string g_restream_pinned_ip;  // always shown in dropdown, set from config
+    static RtpFanout* g_restream_fanout = nullptr;
+    static bool g_restream_forward = false;    // the received RTP goes to the fanout
+    static bool g_restream_viewer_added = false;
+    static constexpr uint16_t kRestreamViewerPort = 5600;
 
     static std::mutex g_last_hop_mutex;
     static std::string g_last_hop_ip;
     static std::atomic<uint64_t> g_last_pkt_ms{0};
     static std::atomic<bool> g_stream_up{false};
-    static std::atomic<bool> g_pending_rec_idr{false};
-    static std::atomic<uint64_t> g_last_integrity_idr_ms{0};
-    static std::atomic<uint64_t> g_last_rtp_gap_idr_ms{0};
-    static std::atomic<uint64_t> g_last_decode_stall_idr_ms{0};
     static std::atomic<uint64_t> g_last_decoded_ms{0};
     static std::atomic<uint64_t> g_last_rtp_seq_ms{0};
     static std::atomic<uint16_t> g_last_rtp_seq{0};
     static std::atomic<bool> g_last_rtp_seq_valid{false};
+    static std::atomic<uint32_t> g_last_rtp_ts{0};
+    static std::atomic<unsigned> g_rtp_lost_packets{0};
+    // Some of the lost packets may have held whole access units
+    static std::atomic<bool> g_rtp_lost_unconfined{false};
     static std::atomic<bool> g_idr_enabled{true};
-    static std::atomic<bool> g_stream_idr_pending{false};
-    static std::atomic<bool> g_record_idr_pending{false};
 
     static uint64_t now_ms() {
         const auto now = std::chrono::steady_clock::now().time_since_epoch();
         return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
     }
 
-    static void request_idr_bursts(const char* reason, int request_count, bool allow_pending);
+    static IdrScheduler& idr_scheduler();
+    static void request_idr(IdrTrigger trigger, unsigned attempts);
     static void maybe_update_restream_target(bool force);
 
     static bool contains_ip(const std::vector<std::string>& ips, const std::string& ip) {
         return !ip.empty() && std::find(ips.begin(), ips.end(), ip) != ips.end();
     }
 
-    static bool is_stream_idr_reason(const char* reason) {
-        return reason && !strcmp(reason, "stream-up");
-    }
-
-    static bool is_record_idr_reason(const char* reason) {
-        return reason && !strncmp(reason, "record-start", strlen("record-start"));
-    }
-
     static bool ensure_idr_socket() {
         if (g_idr_sock_ready.load(std::memory_order_acquire)) {
             return true;
@@ -207,15 +199,6 @@ namespace {
         g_object_set(G_OBJECT(g_restream_valve), "drop", enabled ? FALSE : TRUE, NULL);
     }
 
-    static void update_restream_valve(bool enabled) {
-        std::lock_guard<std::mutex> lock(g_restream_mutex);
-        // Only force-close when disabling. Opening is handled by maybe_update_restream_target
-        // once a valid target IP is confirmed, to avoid briefly streaming to 127.0.0.1.
-        if (!enabled) {
-            set_restream_valve_locked(false);
-        }
-    }
-
     static void clear_restream_valve() {
         std::lock_guard<std::mutex> lock(g_restream_mutex);
         if (!g_restream_valve) {
@@ -231,7 +214,26 @@ namespace {
             gst_object_unref(g_restream_sink);
             g_restream_sink = nullptr;
         }
-        g_restream_target_ip.clear();
+    }
+
+    static GstFlowReturn on_restream_sample(GstAppSink* sink, gpointer) {
+        GstSample* sample = gst_app_sink_pull_sample(sink);
+        if (!sample) {
+            return GST_FLOW_OK;
+        }
+        GstBuffer* buffer = gst_sample_get_buffer(sample);
+        GstMapInfo map;
+        if (buffer && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+            {
+                std::lock_guard<std::mutex> lock(g_restream_mutex);
+                if (g_restream_fanout) {
+                    g_restream_fanout->submit(map.data, map.size);
+                }
+            }
+            gst_buffer_unmap(buffer, &map);
+        }
+        gst_sample_unref(sample);
+        return GST_FLOW_OK;
     }
 
     static void bind_restream_valve(GstElement* pipeline) {
@@ -251,12 +253,15 @@ namespace {
             return;
         }
 
+        GstAppSinkCallbacks callbacks = {};
+        callbacks.new_sample = on_restream_sample;
+        gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, nullptr, nullptr);
+
         {
             std::lock_guard<std::mutex> lock(g_restream_mutex);
             g_restream_valve = valve;
             g_restream_sink = sink;
-            g_restream_target_ip.clear();
-            set_restream_valve_locked(false);
+            set_restream_valve_locked(g_restream_forward && g_restream_fanout);
         }
 
         maybe_update_restream_target(true);
@@ -264,9 +269,10 @@ namespace {
 
     static std::string create_restream_branch() {
         std::stringstream ss;
+        // The queue keeps the fanout off the tee's streaming thread
         ss << " rtp_tee. ! valve name=restream_valve drop=true"
               " ! queue leaky=downstream max-size-buffers=0 max-size-bytes=0 max-size-time=1000000000 silent=true"
-              " ! udpsink name=restream_sink host=0.0.0.0 port=5600 sync=false async=false qos=false";
+              " ! appsink name=restream_sink sync=false async=false";
         return ss.str();
     }
 
@@ -295,6 +301,29 @@ namespace {
         return clients.empty() ? "" : clients.front();
     }
 
+    // The hotspot viewer is one of the fanout's destinations; "" for none.
+    static void set_restream_viewer_locked(const std::string& ip) {
+        if (ip == g_restream_target_ip) {
+            return;
+        }
+        sockaddr_in addr;
+        const std::string port = ":" + std::to_string(kRestreamViewerPort);
+        if (g_restream_fanout && g_restream_viewer_added
+                && RtpFanout::parse_destination(g_restream_target_ip + port, addr)) {
+            g_restream_fanout->remove(addr);
+        }
+        g_restream_viewer_added = false;
+        g_restream_target_ip = ip;
+        if (g_restream_fanout && !ip.empty()) {
+            if (!RtpFanout::parse_destination(ip + port, addr)) {
+                spdlog::warn("[RESTREAM] Bad viewer address {}", ip);
+                return;
+            }
+            // Not ours to remove later when it was there already (--restream-dest)
+            g_restream_viewer_added = g_restream_fanout->add(addr);
+        }
+    }
+
     static void maybe_update_restream_target(bool force) {
         static uint64_t last_probe_ms = 0;
         const uint64_t now = now_ms();
@@ -303,45 +332,22 @@ namespace {
         }
         last_probe_ms = now;
 
-        bool new_target = false;
-        {
-            std::lock_guard<std::mutex> lock(g_restream_mutex);
-            if (!g_restream_valve || !g_restream_sink) {
-                return;
-            }
-            if (!g_restream_enabled.load(std::memory_order_relaxed)) {
-                set_restream_valve_locked(false);
-                return;
-            }
-
-            // If the user picked a specific IP use it, otherwise auto-discover.
-            const std::string next_ip = !g_restream_manual_ip.empty()
-                ? g_restream_manual_ip
-                : find_first_hotspot_client_ip();
-            if (next_ip.empty()) {
-                if (!g_restream_target_ip.empty()) {
-                    spdlog::info("[RESTREAM] No target client found; stopping unicast restream");
-                    g_restream_target_ip.clear();
-                }
-                set_restream_valve_locked(false);
-                return;
-            }
-
-            if (next_ip != g_restream_target_ip) {
-                g_restream_target_ip = next_ip;
-                g_object_set(G_OBJECT(g_restream_sink), "host", g_restream_target_ip.c_str(), NULL);
-                spdlog::info("[RESTREAM] Streaming to {}:{}",
-                             g_restream_target_ip,
-                             5600);
-                new_target = true;
-            }
-
-            set_restream_valve_locked(true);
+        std::lock_guard<std::mutex> lock(g_restream_mutex);
+        if (!g_restream_fanout) {
+            return;
         }
-
-        if (new_target) {
-            request_idr_bursts("restream-start", kIdrRepeatCount, false);
+        if (!g_restream_enabled.load(std::memory_order_relaxed)) {
+            set_restream_viewer_locked("");
+            return;
         }
+        // If the user picked a specific IP use it, otherwise auto-discover.
+        const std::string next_ip = !g_restream_manual_ip.empty()
+            ? g_restream_manual_ip
+            : find_first_hotspot_client_ip();
+        if (next_ip.empty() && !g_restream_target_ip.empty()) {
+            spdlog::info("[RESTREAM] No target client found; stopping unicast restream");
+        }
+        set_restream_viewer_locked(next_ip);
     }
 
     static uint32_t secure_random_u32() {
@@ -421,8 +427,8 @@ namespace {
         return g_last_hop_ip;
     }
 
-    static bool extract_rtp_sequence(GstBuffer* buf, uint16_t* out_seq) {
-        if (!buf || !out_seq) {
+    static bool extract_rtp_sequence(GstBuffer* buf, uint16_t* out_seq, uint32_t* out_ts) {
+        if (!buf || !out_seq || !out_ts) {
             return false;
         }
 
@@ -432,9 +438,11 @@ namespace {
         }
 
         bool ok = false;
-        if (map.size >= 4) {
+        if (map.size >= 8) {
             const uint8_t* data = map.data;
             *out_seq = static_cast<uint16_t>((data[2] << 8) | data[3]);
+            *out_ts = (static_cast<uint32_t>(data[4]) << 24) | (static_cast<uint32_t>(data[5]) << 16) |
+                      (static_cast<uint32_t>(data[6]) << 8) | data[7];
             ok = true;
         }
 
@@ -442,24 +450,21 @@ namespace {
         return ok;
     }
 
-    static void maybe_request_idr_for_rtp_gap(uint16_t gap_count) {
-        if (!g_idr_enabled.load(std::memory_order_relaxed)) {
-            return;
-        }
-
+    // A gap alone doesn't ask for a keyframe: the decoder side finds out
+    // whether it broke the reference chain (idr_take_rtp_losses()).
+    // Packets lost between two of the same RTP timestamp were all part of
+    // that one access unit; any other gap may have swallowed whole ones.
+    static void note_rtp_gap(uint16_t gap_count, bool within_unit) {
         if (!g_stream_up.load(std::memory_order_relaxed)) {
             return;
         }
 
-        const uint64_t now = now_ms();
-        const uint64_t last = g_last_rtp_gap_idr_ms.load(std::memory_order_relaxed);
-        if (last && (now - last) < kRtpGapCooldownMs) {
-            return;
+        spdlog::debug("[IDR] RTP gap detected (missing {} packet(s){})", gap_count,
+                      within_unit ? " within one access unit" : "");
+        g_rtp_lost_packets.fetch_add(gap_count, std::memory_order_relaxed);
+        if (!within_unit) {
+            g_rtp_lost_unconfined.store(true, std::memory_order_relaxed);
         }
-
-        g_last_rtp_gap_idr_ms.store(now, std::memory_order_relaxed);
-        spdlog::info("[IDR] RTP gap detected (missing {} packet(s)) -> request IDR", gap_count);
-        request_idr_bursts("rtp-gap", 1, false);
     }
 
     static void maybe_track_rtp_sequence(GstBuffer* buf) {
@@ -468,13 +473,15 @@ namespace {
         }
 
         uint16_t seq = 0;
-        if (!extract_rtp_sequence(buf, &seq)) {
+        uint32_t ts = 0;
+        if (!extract_rtp_sequence(buf, &seq, &ts)) {
             return;
         }
 
         const uint64_t now = now_ms();
         if (!g_last_rtp_seq_valid.load(std::memory_order_relaxed)) {
             g_last_rtp_seq.store(seq, std::memory_order_relaxed);
+            g_last_rtp_ts.store(ts, std::memory_order_relaxed);
             g_last_rtp_seq_ms.store(now, std::memory_order_relaxed);
             g_last_rtp_seq_valid.store(true, std::memory_order_relaxed);
             return;
@@ -490,19 +497,116 @@ namespace {
             const uint64_t last_ms = g_last_rtp_seq_ms.load(std::memory_order_relaxed);
             if (last_ms == 0 || (now - last_ms) > kRtpSeqResetMs) {
                 g_last_rtp_seq.store(seq, std::memory_order_relaxed);
+                g_last_rtp_ts.store(ts, std::memory_order_relaxed);
                 g_last_rtp_seq_ms.store(now, std::memory_order_relaxed);
             }
             return;
         }
 
         if (diff > 1) {
-            maybe_request_idr_for_rtp_gap(static_cast<uint16_t>(diff - 1));
+            note_rtp_gap(static_cast<uint16_t>(diff - 1),
+                         ts == g_last_rtp_ts.load(std::memory_order_relaxed));
         }
 
         g_last_rtp_seq.store(seq, std::memory_order_relaxed);
+        g_last_rtp_ts.store(ts, std::memory_order_relaxed);
         g_last_rtp_seq_ms.store(now, std::memory_order_relaxed);
     }
 
+    // RTP timestamps for the DVR. The depayloader output only carries the
+    // receive time of the packets (buffer PTS), so remember which RTP
+    // timestamp started at which PTS and map appsink buffers back through it.
+    static constexpr size_t kRtpTsMarks = 64;
+    static constexpr uint64_t kRtpClockRate = 90000;
+
+    struct RtpTsMark {
+        GstClockTime pts;
+        uint64_t rtp_ts;    // unwrapped to 64 bits
+    };
+
+    static std::mutex g_rtp_ts_mutex;
+    static RtpTsMark g_rtp_ts_marks[kRtpTsMarks];
+    static size_t g_rtp_ts_head = 0;     // next slot to fill
+    static size_t g_rtp_ts_count = 0;
+    static uint32_t g_rtp_ts_last = 0;
+    static uint64_t g_rtp_ts_unwrapped = 0;
+
+    static bool extract_rtp_timestamp(GstBuffer* buf, uint32_t* out_ts) {
+        GstMapInfo map;
+        if (!gst_buffer_map(buf, &map, GST_MAP_READ)) {
+            return false;
+        }
+
+        bool ok = false;
+        if (map.size >= RTP_HEADER_LEN && (map.data[0] >> 6) == 2) {
+            const uint8_t* data = map.data;
+            *out_ts = (static_cast<uint32_t>(data[4]) << 24) | (static_cast<uint32_t>(data[5]) << 16) |
+                      (static_cast<uint32_t>(data[6]) << 8) | data[7];
+            ok = true;
+        }
+
+        gst_buffer_unmap(buf, &map);
+        return ok;
+    }
+
+    static void track_rtp_timestamp(GstBuffer* buf) {
+        const GstClockTime pts = GST_BUFFER_PTS(buf);
+        uint32_t ts = 0;
+        if (!GST_CLOCK_TIME_IS_VALID(pts) || !extract_rtp_timestamp(buf, &ts)) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(g_rtp_ts_mutex);
+        if (g_rtp_ts_count) {
+            if (ts == g_rtp_ts_last) {
+                return;
+            }
+            // Signed difference handles both the 32-bit wrap and reordering
+            g_rtp_ts_unwrapped += static_cast<int64_t>(static_cast<int32_t>(ts - g_rtp_ts_last));
+        } else {
+            // Start high enough that a reordered packet can't go below zero
+            g_rtp_ts_unwrapped = (1ULL << 32) + ts;
+        }
+        g_rtp_ts_last = ts;
+        g_rtp_ts_marks[g_rtp_ts_head] = RtpTsMark{pts, g_rtp_ts_unwrapped};
+        g_rtp_ts_head = (g_rtp_ts_head + 1) % kRtpTsMarks;
+        if (g_rtp_ts_count < kRtpTsMarks) {
+            g_rtp_ts_count++;
+        }
+    }
+
+    static bool lookup_rtp_timestamp(GstClockTime pts, uint64_t* out_ts) {
+        std::lock_guard<std::mutex> lock(g_rtp_ts_mutex);
+        for (size_t i = 1; i <= g_rtp_ts_count; i++) {
+            const RtpTsMark& m = g_rtp_ts_marks[(g_rtp_ts_head + kRtpTsMarks - i) % kRtpTsMarks];
+            if (m.pts <= pts) {
+                *out_ts = m.rtp_ts;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void reset_rtp_timestamps() {
+        std::lock_guard<std::mutex> lock(g_rtp_ts_mutex);
+        g_rtp_ts_head = 0;
+        g_rtp_ts_count = 0;
+    }
+
+    // 90 kHz timestamp of an appsink buffer: its RTP timestamp when known,
+    // the receive time otherwise.
+    static uint64_t frame_timestamp_90k(GstBuffer* buf) {
+        const GstClockTime pts = GST_BUFFER_PTS(buf);
+        uint64_t ts = 0;
+        if (GST_CLOCK_TIME_IS_VALID(pts)) {
+            if (lookup_rtp_timestamp(pts, &ts)) {
+                return ts;
+            }
+            return gst_util_uint64_scale(pts, kRtpClockRate, GST_SECOND);
+        }
+        return now_ms() * (kRtpClockRate / 1000);
+    }
+
     static void for_each_nal(const uint8_t* data, size_t size,
                              const std::function<void(const uint8_t*, size_t)>& cb) {
         auto find_start = [&](size_t from, size_t& start_len) -> size_t {
@@ -569,21 +673,12 @@ namespace {
             return;
         }
 
-        if (!g_stream_idr_pending.load(std::memory_order_relaxed) &&
-            !g_record_idr_pending.load(std::memory_order_relaxed)) {
+        if (!idr_scheduler().awaiting_idr()) {
             return;
         }
 
-        if (!has_idr_frame(data, size, codec)) {
-            return;
-        }
-
-        if (g_stream_idr_pending.exchange(false, std::memory_order_relaxed)) {
-            spdlog::info("[IDR] Stream refresh confirmed (IDR received)");
-        }
-        if (g_record_idr_pending.exchange(false, std::memory_order_relaxed)) {
-            g_pending_rec_idr.store(false, std::memory_order_relaxed);
-            spdlog::info("[IDR] Record refresh confirmed (IDR received)");
+        if (has_idr_frame(data, size, codec)) {
+            idr_scheduler().idr_received(now_ms());
         }
     }
 
@@ -621,71 +716,43 @@ namespace {
         }
     }
 
-    static void request_idr_bursts(const char* reason, int request_count, bool allow_pending) {
-        if (!g_idr_enabled.load(std::memory_order_relaxed)) {
-            return;
-        }
-
-        const bool track_stream = is_stream_idr_reason(reason);
-        const bool track_record = is_record_idr_reason(reason);
-        if (track_stream) {
-            g_stream_idr_pending.store(true, std::memory_order_relaxed);
-        }
-        if (track_record) {
-            g_record_idr_pending.store(true, std::memory_order_relaxed);
-        }
-
+    // One request to the last hop; the scheduler decides when.
+    static bool send_idr_request(const char* reasons) {
         const std::string ip = get_last_hop_ip_copy();
         if (ip.empty()) {
-            spdlog::warn("[IDR] Cannot request IDR (last-hop unknown) reason={}", reason ? reason : "(null)");
-            if (allow_pending) {
-                g_pending_rec_idr.store(true, std::memory_order_relaxed);
-            }
-            return;
+            spdlog::debug("[IDR] Cannot request IDR (last-hop unknown) reason={}", reasons);
+            return false;
         }
 
         if (!ensure_idr_socket()) {
-            return;
+            return false;
         }
 
-        g_pending_rec_idr.store(false, std::memory_order_relaxed);
-        const std::string reason_str = reason ? reason : "";
+        spdlog::info("[IDR] Request to {}:{} ({})", ip, kIdrUdpPort, reasons);
+        send_idr_burst(ip);
+        return true;
+    }
 
-        if (track_record) {
-            std::thread([ip, reason_str, request_count]() {
-                const char* reason_c = reason_str.empty() ? "no-reason" : reason_str.c_str();
-                for (int r = 0; r < request_count; ++r) {
-                    if (!g_record_idr_pending.load(std::memory_order_relaxed)) {
-                        spdlog::info("[IDR] Record refresh confirmed; skipping remaining bursts");
-                        break;
-                    }
-                    spdlog::info("[IDR] Request 1 burst(s) to {}:{} ({} {}/{})",
-                                 ip, kIdrUdpPort, reason_c, r + 1, request_count);
-                    send_idr_burst(ip);
-                    if (r + 1 < request_count) {
-                        std::this_thread::sleep_for(
-                            std::chrono::milliseconds(kIdrRecordRepeatSpacingMs));
-                    }
-                }
-            }).detach();
+    // Lives, with its thread, as long as the process.
+    static IdrScheduler& idr_scheduler() {
+        static IdrScheduler* scheduler = [] {
+            IdrScheduler* sched = new IdrScheduler(send_idr_request);
+            pthread_t tid;
+            if (pthread_create(&tid, nullptr, &IdrScheduler::__THREAD__, sched) == 0) {
+                pthread_detach(tid);
+            } else {
+                spdlog::warn("[IDR] Cannot start the request scheduler thread");
+            }
+            return sched;
+        }();
+        return *scheduler;
+    }
+
+    static void request_idr(IdrTrigger trigger, unsigned attempts) {
+        if (!g_idr_enabled.load(std::memory_order_relaxed)) {
             return;
         }
-
-        std::thread([ip, reason_str, request_count]() {
-            const char* reason_c = reason_str.empty() ? "no-reason" : reason_str.c_str();
-            const bool track_stream = is_stream_idr_reason(reason_c);
-            spdlog::info("[IDR] Request {} burst(s) to {}:{} ({})", request_count, ip, kIdrUdpPort, reason_c);
-            for (int r = 0; r < request_count; ++r) {
-                if (track_stream && !g_stream_idr_pending.load(std::memory_order_relaxed)) {
-                    spdlog::info("[IDR] Stream refresh confirmed; skipping remaining bursts");
-                    break;
-                }
-                send_idr_burst(ip);
-                if (r + 1 < request_count) {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(kIdrRepeatSpacingMs));
-                }
-            }
-        }).detach();
+        idr_scheduler().trigger(trigger, attempts, now_ms());
     }
 
     static void on_incoming_stream_buffer(GstBuffer* buf, const char* tag) {
@@ -698,19 +765,7 @@ namespace {
 
         if (!g_stream_up.exchange(true)) {
             spdlog::info("[NET] Stream UP ({})", tag ? tag : "unknown");
-            request_idr_bursts("stream-up", kIdrRepeatCount, false);
-        }
-
-        if (g_pending_rec_idr.load(std::memory_order_relaxed)) {
-            if (!g_record_idr_pending.load(std::memory_order_relaxed)) {
-                g_pending_rec_idr.store(false, std::memory_order_relaxed);
-            } else {
-                const std::string ip = get_last_hop_ip_copy();
-                if (!ip.empty()) {
-                    g_pending_rec_idr.store(false, std::memory_order_relaxed);
-                    request_idr_bursts("record-start(pending)", kIdrRecordRepeatCount, false);
-                }
-            }
+            request_idr(IdrTrigger::STREAM_UP, kIdrRefreshAttempts);
         }
     }
 
@@ -734,12 +789,8 @@ namespace {
         }
 
         if (last_pkt > last_decoded && (now - last_decoded) > kDecodeStallMs) {
-            const uint64_t last_idr = g_last_decode_stall_idr_ms.load(std::memory_order_relaxed);
-            if (!last_idr || (now - last_idr) > kDecodeStallCooldownMs) {
-                g_last_decode_stall_idr_ms.store(now, std::memory_order_relaxed);
-                spdlog::info("[IDR] Decode stall (no frames for {} ms) -> request IDR", now - last_decoded);
-                request_idr_bursts("decode-stall", 1, false);
-            }
+            spdlog::debug("[IDR] Decode stall (no frames for {} ms) -> request IDR", now - last_decoded);
+            request_idr(IdrTrigger::DECODE_STALL, 1);
         }
     }
 
@@ -777,7 +828,10 @@ namespace {
         g_last_decoded_ms.store(0, std::memory_order_relaxed);
         g_last_rtp_seq_valid.store(false, std::memory_order_relaxed);
         g_last_rtp_seq_ms.store(0, std::memory_order_relaxed);
-        g_stream_idr_pending.store(false, std::memory_order_relaxed);
+        g_rtp_lost_packets.store(0, std::memory_order_relaxed);
+        g_rtp_lost_unconfined.store(false, std::memory_order_relaxed);
+        idr_scheduler().reset();
+        reset_rtp_timestamps();
         std::lock_guard<std::mutex> lock(g_last_hop_mutex);
         g_last_hop_ip.clear();
     }
@@ -797,6 +851,39 @@ namespace {
         return GST_PAD_PROBE_OK;
     }
 
+    static GstPadProbeReturn rtp_timestamp_probe(GstPad*, GstPadProbeInfo* info, gpointer) {
+        if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+            GstBuffer* buf = GST_PAD_PROBE_INFO_BUFFER(info);
+            if (buf) {
+                track_rtp_timestamp(buf);
+            }
+        } else if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+            // The unix socket reader pushes its batches as lists
+            GstBufferList* list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+            const guint n = list ? gst_buffer_list_length(list) : 0;
+            for (guint i = 0; i < n; i++) {
+                track_rtp_timestamp(gst_buffer_list_get(list, i));
+            }
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    // Covers both udpsrc and the unix socket appsrc, which feed the same tee.
+    static void attach_rtp_timestamp_probe(GstElement* pipeline) {
+        GstElement* tee = gst_bin_get_by_name(GST_BIN(pipeline), "rtp_tee");
+        if (!tee) {
+            return;
+        }
+        GstPad* sink_pad = gst_element_get_static_pad(tee, "sink");
+        if (sink_pad) {
+            gst_pad_add_probe(sink_pad,
+                              (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                              rtp_timestamp_probe, nullptr, nullptr);
+            gst_object_unref(sink_pad);
+        }
+        gst_object_unref(tee);
+    }
+
     static void attach_last_hop_probes(GstElement* pipeline) {
         if (!g_idr_enabled.load(std::memory_order_relaxed)) {
             return;
@@ -835,29 +922,13 @@ namespace {
         gst_iterator_free(it);
     }
 
-    static void maybe_request_idr_rate_limited(const char* reason, const char* context) {
-        if (!g_idr_enabled.load(std::memory_order_relaxed)) {
-            return;
-        }
-
+    static void maybe_request_idr_for_decoder(IdrTrigger trigger, const char* context) {
         if (!g_stream_up.load(std::memory_order_relaxed)) {
             return;
         }
 
-        const uint64_t now = now_ms();
-        const uint64_t last = g_last_integrity_idr_ms.load(std::memory_order_relaxed);
-        if (last && (now - last) < kIntegrityCooldownMs) {
-            return;
-        }
-
-        g_last_integrity_idr_ms.store(now, std::memory_order_relaxed);
-        if (context && context[0]) {
-            spdlog::info("[IDR] {} -> request IDR", context);
-        } else {
-            spdlog::info("[IDR] Decoder issue -> request IDR");
-        }
-
-        request_idr_bursts(reason ? reason : "decoder-issue", 1, false);
+        spdlog::debug("[IDR] {} -> request IDR", context);
+        request_idr(trigger, 1);
     }
 }
 
@@ -877,14 +948,15 @@ GstRtpReceiver::GstRtpReceiver(int udp_port, const VideoCodec& codec)
 
 }
 
-GstRtpReceiver::GstRtpReceiver(const char *s, const VideoCodec& codec) {
+GstRtpReceiver::GstRtpReceiver(const char *s, const VideoCodec& codec, const SocketIngestParams& ingest) {
     unix_socket = strdup(s);
     m_video_codec = codec;
+    m_ingest = SocketIngest(ingest).params();   // clamped
     initGstreamerOrThrow();
 
     spdlog::debug("Creating receiver socket on {}", unix_socket);
 
-    sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+    sock = socket(AF_UNIX, m_ingest.seqpacket ? SOCK_SEQPACKET : SOCK_DGRAM, 0);
     if (sock < 0) {
         throw std::runtime_error(std::string("socket() failed: ") + strerror(errno));
     }
@@ -905,26 +977,36 @@ GstRtpReceiver::GstRtpReceiver(const char *s, const VideoCodec& codec) {
         close(sock);
         throw std::runtime_error(std::string("bind() failed: ") + strerror(errno));
     }
+    if (m_ingest.seqpacket && listen(sock, 1) < 0) {
+        close(sock);
+        throw std::runtime_error(std::string("listen() failed: ") + strerror(errno));
+    }
 
     spdlog::debug("Bound successfully to abstract socket: @{}", unix_socket);
 }
 
 GstRtpReceiver::~GstRtpReceiver(){
+    stop_keyframe_index();
     if (sock >= 0) {
         close(sock);
     }
 }
 
-static std::shared_ptr<std::vector<uint8_t>> gst_copy_buffer(GstBuffer* buffer){
+// Keep the buffer mapped and referenced for as long as the frame lives,
+// instead of copying it out.
+static EncodedFramePtr gst_borrow_buffer(GstBuffer* buffer){
     assert(buffer);
-    const auto buff_size = gst_buffer_get_size(buffer);
-    auto ret = std::make_shared<std::vector<uint8_t>>(buff_size);
-    GstMapInfo map;
-    gst_buffer_map(buffer, &map, GST_MAP_READ);
-    assert(map.size == buff_size);
-    std::memcpy(ret->data(), map.data, buff_size);
-    gst_buffer_unmap(buffer, &map);
-    return ret;
+    GstMapInfo *map = new GstMapInfo;
+    if (!gst_buffer_map(buffer, map, GST_MAP_READ)) {
+        delete map;
+        return EncodedFrame::copy(nullptr, 0);
+    }
+    gst_buffer_ref(buffer);
+    return EncodedFrame::borrow(map->data, map->size, [buffer, map]() {
+        gst_buffer_unmap(buffer, map);
+        delete map;
+        gst_buffer_unref(buffer);
+    });
 }
 
 static void loop_pull_appsink_samples(bool& keep_looping,GstElement *app_sink_element,
@@ -940,8 +1022,7 @@ static void loop_pull_appsink_samples(bool& keep_looping,GstElement *app_sink_el
             GstBuffer* buffer = gst_sample_get_buffer(sample);
             if (buffer) {
                 on_incoming_stream_buffer(buffer, "appsink");
-                auto buff_copy=gst_copy_buffer(buffer);
-                out_cb(buff_copy);
+                out_cb(gst_borrow_buffer(buffer), frame_timestamp_90k(buffer));
             }
             gst_sample_unref(sample);
         }
@@ -970,20 +1051,20 @@ std::string GstRtpReceiver::construct_gstreamer_pipeline()
 void GstRtpReceiver::loop_pull_samples()
 {
     assert(m_app_sink_element);
-    auto cb=[this](std::shared_ptr<std::vector<uint8_t>> sample){
-        this->on_new_sample(sample);
+    auto cb=[this](EncodedFramePtr sample, uint64_t timestamp){
+        this->on_new_sample(sample, timestamp);
     };
     loop_pull_appsink_samples(m_pull_samples_run,m_app_sink_element,cb);
 }
 
-void GstRtpReceiver::on_new_sample(std::shared_ptr<std::vector<uint8_t> > sample)
+void GstRtpReceiver::on_new_sample(EncodedFramePtr sample, uint64_t timestamp)
 {
     if (sample && !sample->empty()) {
         maybe_mark_idr_received(sample->data(), sample->size(), m_video_codec);
     }
     if(m_cb){
         //debug_sample(sample);
-        m_cb(sample);
+        m_cb(sample, timestamp);
     }else{
     }
 }
@@ -991,66 +1072,137 @@ void GstRtpReceiver::on_new_sample(std::shared_ptr<std::vector<uint8_t> > sample
 /* socket → appsrc */
 static constexpr int SOCKET_POLL_TIMEOUT_MS = 100;
 
-static void loop_read_socket(bool& keep_looping, int sock_fd, GstAppSrc* appsrc) {
-    GstBufferPool* pool = GST_BUFFER_POOL(g_object_get_data(G_OBJECT(appsrc), "buffer-pool"));
-    uint64_t pkt_counter = 0;
-    auto last_report = std::chrono::steady_clock::now();
-
-    while (keep_looping) {
-        fd_set read_fds;
-        FD_ZERO(&read_fds);
-        FD_SET(sock_fd, &read_fds);
-
-        struct timeval timeout = { .tv_sec = 0, .tv_usec = SOCKET_POLL_TIMEOUT_MS * 1000 };
-        int ready = select(sock_fd + 1, &read_fds, nullptr, nullptr, &timeout);
-        if (ready <= 0) continue;
+// The pipeline's running time, as appsrc's do-timestamp would stamp it; one
+// for the whole batch, it arrived at once.
+static GstClockTime socket_batch_pts(GstElement* appsrc) {
+    GstClock* clock = gst_element_get_clock(appsrc);
+    if (!clock) {
+        return GST_CLOCK_TIME_NONE;
+    }
+    const GstClockTime now = gst_clock_get_time(clock);
+    const GstClockTime base = gst_element_get_base_time(appsrc);
+    gst_object_unref(clock);
+    return now > base ? now - base : 0;
+}
 
-        // Get buffer from pool
-        GstBuffer* buffer = nullptr;
-        GstFlowReturn ret = gst_buffer_pool_acquire_buffer(pool, &buffer, nullptr);
-        if (ret != GST_FLOW_OK || !buffer) {
-            spdlog::warn("Failed to acquire buffer from pool");
+enum class SocketRead { DRAINED, CLOSED, PUSH_ERROR };
+
+// Reads what the socket has, a batch at a time, until it runs dry or the
+// SOCK_SEQPACKET sender closes. PUSH_ERROR when appsrc refused a batch
+// (the pipeline is going down).
+static SocketRead read_socket_batches(int fd, GstBufferPool* pool, GstAppSrc* appsrc,
+                                      SocketIngest& ingest) {
+    const unsigned batch = ingest.params().batch;
+    std::vector<GstBuffer*> buffers(batch);
+    std::vector<GstMapInfo> maps(batch);
+    std::vector<uint8_t*> data(batch);
+    std::vector<size_t> lens(batch);
+    GstBufferPoolAcquireParams acquire = {};
+    acquire.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+
+    for (;;) {
+        unsigned have = 0;
+        while (have < batch) {
+            GstBuffer* buffer = nullptr;
+            if (gst_buffer_pool_acquire_buffer(pool, &buffer, &acquire) != GST_FLOW_OK || !buffer) {
+                break;
+            }
+            if (!gst_buffer_map(buffer, &maps[have], GST_MAP_WRITE)) {
+                gst_buffer_unref(buffer);
+                break;
+            }
+            buffers[have] = buffer;
+            data[have] = maps[have].data;
+            have++;
+        }
+        if (have == 0) {
+            // Pipeline behind: drop, rather than let the socket back up
+            const ssize_t n = ingest.discard(fd);
+            if (n < 0) {
+                return SocketRead::DRAINED;
+            }
+            if (n == 0 && ingest.params().seqpacket) {
+                return SocketRead::CLOSED;
+            }
             continue;
         }
 
-        // Map buffer for writing
-        GstMapInfo map;
-        if (!gst_buffer_map(buffer, &map, GST_MAP_WRITE)) {
-            spdlog::warn("Failed to map buffer");
-            gst_buffer_unref(buffer);
-            continue;
+        const int got = ingest.read(fd, data.data(), have, lens.data());
+        GstBufferList* list = gst_buffer_list_new_sized(got > 0 ? got : 1);
+        const GstClockTime pts = got > 0 ? socket_batch_pts(GST_ELEMENT(appsrc)) : GST_CLOCK_TIME_NONE;
+        unsigned kept = 0;
+        for (unsigned i = 0; i < have; i++) {
+            gst_buffer_unmap(buffers[i], &maps[i]);
+            if ((int)i < got && lens[i] > 0) {
+                gst_buffer_resize(buffers[i], 0, lens[i]);
+                GST_BUFFER_PTS(buffers[i]) = pts;
+                gst_buffer_list_add(list, buffers[i]);
+                kept++;
+            } else {
+                gst_buffer_unref(buffers[i]);
+            }
         }
-
-        // Read data directly into buffer
-        ssize_t n = recv(sock_fd, map.data, map.size, 0);
-        gst_buffer_unmap(buffer, &map);
-        
-        if (n <= RTP_HEADER_LEN) {
-            spdlog::warn("Invalid RTP packet size: {}", n);
-            gst_buffer_unref(buffer);
-            continue;
+        if (kept == 0) {
+            gst_buffer_list_unref(list);
+        } else {
+            const GstFlowReturn ret = gst_app_src_push_buffer_list(appsrc, list);
+            ingest.pushed(kept, ret == GST_FLOW_OK);
+            if (ret != GST_FLOW_OK) {
+                spdlog::warn("Appsrc push error: {}", gst_flow_get_name(ret));
+                return SocketRead::PUSH_ERROR;
+            }
         }
+        if (got == 0 && ingest.params().seqpacket) {
+            return SocketRead::CLOSED;
+        }
+        if (got < (int)have) {
+            return SocketRead::DRAINED;   // or an error poll will report
+        }
+    }
+}
 
-        // Resize buffer to actual data size
-        gst_buffer_resize(buffer, 0, n);
+static void loop_read_socket(bool& keep_looping, int sock_fd, GstAppSrc* appsrc,
+                             const SocketIngestParams& params) {
+    GstBufferPool* pool = GST_BUFFER_POOL(g_object_get_data(G_OBJECT(appsrc), "buffer-pool"));
+    SocketIngest ingest(params);
+    // SOCK_SEQPACKET: sock_fd listens, the data comes on the accepted one
+    const int listen_fd = params.seqpacket ? sock_fd : -1;
+    int fd = params.seqpacket ? -1 : sock_fd;
+
+    while (keep_looping && pool) {
+        struct pollfd fds[2] = {{fd, POLLIN, 0}, {listen_fd, POLLIN, 0}};
+        int ready = poll(fds, 2, SOCKET_POLL_TIMEOUT_MS);
+        ingest.publish_stats(now_ms());
+        if (ready <= 0) continue;
 
-        // Push to appsrc
-        ret = gst_app_src_push_buffer(appsrc, buffer);
-        if (ret != GST_FLOW_OK) {
-            spdlog::warn("Appsrc push error: {}", gst_flow_get_name(ret));
-            break;
+        if (fds[1].revents & POLLIN) {
+            int conn = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (conn >= 0) {
+                if (fd >= 0) close(fd);   // the newest sender wins
+                fd = conn;
+                spdlog::info("Socket sender connected");
+                continue;
+            }
         }
-
-        // Log packet rate (optional)
-        pkt_counter++;
-        auto now = std::chrono::steady_clock::now();
-        if (now - last_report >= std::chrono::seconds(1)) {
-            spdlog::debug("socket pkts/s {}", pkt_counter);
-            pkt_counter = 0;
-            last_report = now;
+        // A gone sender comes with POLLIN too: take what it left, then close
+        const bool hangup = listen_fd >= 0 && (fds[0].revents & (POLLHUP | POLLERR));
+        SocketRead res = SocketRead::DRAINED;
+        if (fds[0].revents & POLLIN) {
+            res = read_socket_batches(fd, pool, appsrc, ingest);
+            if (res == SocketRead::PUSH_ERROR) {
+                break;
+            }
+        }
+        if (hangup || res == SocketRead::CLOSED) {
+            spdlog::info("Socket sender disconnected");
+            close(fd);
+            fd = -1;
         }
     }
-    
+
+    if (listen_fd >= 0 && fd >= 0) {
+        close(fd);
+    }
     if (pool) {
         gst_buffer_pool_set_active(pool, FALSE);
         gst_object_unref(pool);
@@ -1090,6 +1242,7 @@ void GstRtpReceiver::stop_receiving() {
         gst_object_unref(m_gst_pipeline);
         m_gst_pipeline = nullptr;
     }
+    stop_keyframe_index();
     reset_stream_tracking();
     spdlog::info("GstRtpReceiver::stop_receiving end");
 }
@@ -1141,9 +1294,47 @@ VideoCodec GstRtpReceiver::switch_to_file_playback(const char * file_path) {
 
     m_pull_samples_run = true;
     m_pull_samples_thread = std::make_unique<std::thread>(&GstRtpReceiver::loop_pull_samples, this);
+    load_keyframe_index(file_path);
     return m_playback_codec;
 }
 
+void GstRtpReceiver::load_keyframe_index(const std::string &file_path) {
+    auto index = std::make_shared<DvrIndex>();
+    if (index->load(file_path)) {
+        spdlog::info("Loaded {} keyframes from {}", index->entries().size(), DvrIndex::sidecar_path(file_path));
+        std::lock_guard<std::mutex> lock(m_index_mutex);
+        m_index = index;
+        return;
+    }
+
+    // Older recording without a sidecar: build it once in the background,
+    // seeking falls back to accurate seeks until it is there.
+    m_index_cancel = false;
+    m_index_thread = std::make_unique<std::thread>([this, file_path]() {
+        pthread_setname_np(pthread_self(), "dvr-index");
+        if (!dvr_index_rebuild(file_path, &m_index_cancel)) {
+            return;
+        }
+        auto rebuilt = std::make_shared<DvrIndex>();
+        if (!rebuilt->load(file_path)) {
+            return;
+        }
+        spdlog::info("Rebuilt keyframe index of {}: {} keyframes", file_path, rebuilt->entries().size());
+        std::lock_guard<std::mutex> lock(m_index_mutex);
+        m_index = rebuilt;
+    });
+}
+
+void GstRtpReceiver::stop_keyframe_index() {
+    m_index_cancel = true;
+    if (m_index_thread) {
+        m_index_thread->join();
+        m_index_thread = nullptr;
+    }
+    std::lock_guard<std::mutex> lock(m_index_mutex);
+    m_index = nullptr;
+}
+
 void GstRtpReceiver::switch_to_stream() {
     stop_receiving();
     
@@ -1165,6 +1356,7 @@ void GstRtpReceiver::switch_to_stream() {
     }
 
     attach_last_hop_probes(m_gst_pipeline);
+    attach_rtp_timestamp_probe(m_gst_pipeline);
     bind_restream_valve(m_gst_pipeline);
 
     // If using Unix socket, setup appsrc with buffer pool
@@ -1184,7 +1376,7 @@ void GstRtpReceiver::switch_to_stream() {
             "is-live", TRUE,
             "format", GST_FORMAT_TIME,
             "block", FALSE,
-            "do-timestamp", TRUE,
+            "do-timestamp", FALSE,    // stamped per batch by the reader
             NULL);
             
         // Create buffer pool
@@ -1197,7 +1389,10 @@ void GstRtpReceiver::switch_to_stream() {
                 (m_video_codec == VideoCodec::H264) ? "H264" : "H265",
             NULL);
         
-        gst_buffer_pool_config_set_params(config, caps, MAX_PACKET_SIZE, 10, 20);
+        // At least a batch ready, at most pool_buffers: more means the
+        // pipeline is behind and the reader drops (ingest.pool_exhausted)
+        gst_buffer_pool_config_set_params(config, caps, m_ingest.packet_size,
+                                          m_ingest.batch, m_ingest.pool_buffers);
         gst_buffer_pool_set_config(pool, config);
         gst_caps_unref(caps);
         
@@ -1212,7 +1407,7 @@ void GstRtpReceiver::switch_to_stream() {
         m_read_socket_run = true;
         m_read_socket_thread = std::make_unique<std::thread>([this, appsrc]() {
             pthread_setname_np(pthread_self(), "socket-reader");
-            loop_read_socket(m_read_socket_run, this->sock, GST_APP_SRC(appsrc));
+            loop_read_socket(m_read_socket_run, this->sock, GST_APP_SRC(appsrc), m_ingest);
         });
     }
 
@@ -1366,6 +1561,11 @@ void GstRtpReceiver::skip_duration(int64_t skip_ms) {
                 current_pos / GST_MSECOND,
                 new_pos / GST_MSECOND);
 
+    if (seek_to_keyframe(current_pos, new_pos, skip_ms)) {
+        return;
+    }
+
+    // No keyframe index: decode from the previous keyframe up to the exact position
     // Create seek event
     GstEvent* seek_event = gst_event_new_seek(
         1.0,  // Normal playback rate
@@ -1380,6 +1580,100 @@ void GstRtpReceiver::skip_duration(int64_t skip_ms) {
     }
 }
 
+// Jump straight to an indexed keyframe: the seek lands on an IDR, so nothing
+// has to be decoded and thrown away, whatever the length of the recording.
+bool GstRtpReceiver::seek_to_keyframe(gint64 current_pos, gint64 target_pos, int64_t skip_ms) {
+    std::shared_ptr<DvrIndex> index;
+    {
+        std::lock_guard<std::mutex> lock(m_index_mutex);
+        index = m_index;
+    }
+    if (!index || index->entries().empty()) {
+        return false;
+    }
+
+    auto to_ticks = [](gint64 ns) {
+        return (uint64_t)gst_util_uint64_scale(ns, DvrIndex::TIMESCALE, GST_SECOND);
+    };
+    const uint64_t current = to_ticks(current_pos);
+    const DvrIndexEntry *key = index->at_or_before(to_ticks(target_pos));
+    if (skip_ms > 0 && (!key || key->time <= current)) {
+        // Skip shorter than the GOP: move on to the next keyframe
+        key = index->after(current);
+    }
+    if (!key) {
+        key = &index->entries().front();
+    }
+    return seek_to_entry(*key);
+}
+
+bool GstRtpReceiver::seek_to_entry(const DvrIndexEntry &key) {
+    const gint64 key_pos = (gint64)gst_util_uint64_scale(key.time, GST_SECOND, DvrIndex::TIMESCALE);
+    spdlog::debug("Seeking to keyframe at {} ms (offset {})", key_pos / GST_MSECOND, key.offset);
+
+    GstEvent* seek_event = gst_event_new_seek(
+        1.0,
+        GST_FORMAT_TIME,
+        (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE),
+        GST_SEEK_TYPE_SET, key_pos,
+        GST_SEEK_TYPE_NONE, 0
+    );
+    if (!gst_element_send_event(m_gst_pipeline, seek_event)) {
+        spdlog::warn("Failed to send keyframe seek event.");
+        return false;
+    }
+    if (m_is_paused) {
+        show_paused_frame();
+    }
+    return true;
+}
+
+void GstRtpReceiver::scrub(int keyframes) {
+    if (!m_gst_pipeline || keyframes == 0) {
+        return;
+    }
+    std::shared_ptr<DvrIndex> index;
+    {
+        std::lock_guard<std::mutex> lock(m_index_mutex);
+        index = m_index;
+    }
+    if (!index || index->entries().empty()) {
+        // Index still being rebuilt: step by a second instead
+        skip_duration(keyframes * 1000);
+        return;
+    }
+    gint64 current_pos;
+    if (!gst_element_query_position(m_gst_pipeline, GST_FORMAT_TIME, &current_pos)) {
+        spdlog::warn("Could not query current position");
+        return;
+    }
+    const auto &entries = index->entries();
+    const DvrIndexEntry *key = index->at_or_before(
+        (uint64_t)gst_util_uint64_scale(current_pos, DvrIndex::TIMESCALE, GST_SECOND));
+    ptrdiff_t i = key ? key - entries.data() : -1;
+    i = std::max<ptrdiff_t>(0, std::min<ptrdiff_t>(i + keyframes, entries.size() - 1));
+    seek_to_entry(entries[i]);
+}
+
+// While paused, a flushing seek prerolls the pipeline on the keyframe;
+// hand that frame to the decoder so scrubbing shows where it landed.
+void GstRtpReceiver::show_paused_frame() {
+    GstStateChangeReturn ret = gst_element_get_state(m_gst_pipeline, nullptr, nullptr, 500 * GST_MSECOND);
+    if (ret == GST_STATE_CHANGE_FAILURE || ret == GST_STATE_CHANGE_ASYNC) {
+        spdlog::debug("Pipeline did not preroll after seek");
+        return;
+    }
+    GstSample* sample = gst_app_sink_try_pull_preroll(GST_APP_SINK(m_app_sink_element), 0);
+    if (!sample) {
+        return;
+    }
+    GstBuffer* buffer = gst_sample_get_buffer(sample);
+    if (buffer) {
+        on_new_sample(gst_borrow_buffer(buffer), frame_timestamp_90k(buffer));
+    }
+    gst_sample_unref(sample);
+}
+
 void idr_set_enabled(bool enabled) {
     g_idr_enabled.store(enabled, std::memory_order_relaxed);
 }
@@ -1390,7 +1684,7 @@ bool idr_get_enabled() {
 
 void restream_set_enabled(bool enabled) {
     g_restream_enabled.store(enabled, std::memory_order_relaxed);
-    update_restream_valve(enabled);
+    maybe_update_restream_target(true);
 }
 
 bool restream_get_enabled() {
@@ -1432,6 +1726,19 @@ void restream_scan_clients(char* buf, size_t buf_len) {
     buf[buf_len - 1] = '\0';
 }
 
+void restream_set_fanout(RtpFanout* fanout, bool forward) {
+    {
+        std::lock_guard<std::mutex> lock(g_restream_mutex);
+        if (fanout != g_restream_fanout) {
+            set_restream_viewer_locked(""); // the new one gets it on the next probe
+        }
+        g_restream_fanout = fanout;
+        g_restream_forward = forward;
+        set_restream_valve_locked(forward && fanout);
+    }
+    maybe_update_restream_target(true);
+}
+
 void restream_set_manual_ip(const char* ip) {
     std::lock_guard<std::mutex> lock(g_restream_mutex);
     g_restream_manual_ip = (ip && ip[0] != '\0' && strcmp(ip, "Auto") != 0) ? ip : "";
@@ -1452,12 +1759,28 @@ const char* restream_get_manual_ip() {
 }
 
 void idr_request_record_start() {
-    request_idr_bursts("record-start", kIdrRecordRepeatCount, true);
+    request_idr(IdrTrigger::RECORD_START, kIdrRefreshAttempts);
+}
+
+void idr_request_restream_start() {
+    request_idr(IdrTrigger::RESTREAM_START, kIdrRefreshAttempts);
 }
 
 void idr_request_decoder_issue(const char* reason) {
-    const char* ctx = reason ? reason : "decoder-issue";
-    maybe_request_idr_rate_limited(reason, ctx);
+    maybe_request_idr_for_decoder(IdrTrigger::DECODER_ISSUE, reason ? reason : "decoder-issue");
+}
+
+void idr_request_reference_loss(const char* reason) {
+    maybe_request_idr_for_decoder(IdrTrigger::REFERENCE_LOSS, reason ? reason : "reference-loss");
+}
+
+unsigned idr_take_rtp_losses(bool* confined) {
+    const unsigned lost = g_rtp_lost_packets.exchange(0, std::memory_order_relaxed);
+    const bool unconfined = g_rtp_lost_unconfined.exchange(false, std::memory_order_relaxed);
+    if (confined) {
+        *confined = lost > 0 && !unconfined;
+    }
+    return lost;
 }
 
 void idr_notify_decoded_frame() {
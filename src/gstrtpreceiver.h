@@ -14,8 +14,14 @@
 #ifdef __cplusplus
 #include <thread>
 #include <memory>
+#include <mutex>
+#include <atomic>
 #include <vector>
 #include <functional>
+#include <string>
+#include "dvr_index.h"
+#include "encoded_frame.h"
+#include "socket_ingest.h"
 
 #define MAX_PACKET_SIZE 4096
 #define RTP_HEADER_LEN 12
@@ -46,12 +52,16 @@ public:
      * The constructor is delayed, remember to use start_receiving()
      */
     explicit GstRtpReceiver(int udp_port, const VideoCodec& codec);
-    explicit GstRtpReceiver(const char *s, const VideoCodec& codec);
+    GstRtpReceiver(const char *s, const VideoCodec& codec,
+                   const SocketIngestParams& ingest = SocketIngestParams());
     virtual ~GstRtpReceiver();
     // Depending on the codec, these are h264,h265 or mjpeg "frames" / frame buffers
     // The big advantage of gstreamer is that it seems to handle all those parsing quirks the best,
     // e.g. the frames on this cb should be easily passable to whatever decode api is available.
-    typedef std::function<void(std::shared_ptr<std::vector<uint8_t>> frame)> NEW_FRAME_CALLBACK;
+    // timestamp is in 90 kHz units: the (unwrapped) RTP timestamp of the frame when it could be
+    // recovered, the receive time otherwise. Only differences between frames are meaningful.
+    // The frame borrows the GstBuffer it came in; it stays valid as long as it's referenced.
+    typedef std::function<void(EncodedFramePtr frame, uint64_t timestamp)> NEW_FRAME_CALLBACK;
     void start_receiving(NEW_FRAME_CALLBACK cb);
     void stop_receiving();
     VideoCodec switch_to_file_playback(const char* file_path);
@@ -59,6 +69,9 @@ public:
     void fast_forward(double rate = 2.0);
     void fast_rewind(double rate = 2.0);
     void skip_duration(int64_t skip_ms);
+    // Step keyframes (negative: back) through the index; while paused each
+    // step shows the keyframe, so stepping works as scrubbing.
+    void scrub(int keyframes);
     void normal_playback();
     void pause();
     void resume();
@@ -66,7 +79,7 @@ private:
     std::string construct_gstreamer_pipeline();
     std::string construct_file_playback_pipeline(const char * file_path);
     void loop_pull_samples();
-    void on_new_sample(std::shared_ptr<std::vector<uint8_t>> sample);
+    void on_new_sample(EncodedFramePtr sample, uint64_t timestamp);
     // The gstreamer pipeline
     GstElement * m_gst_pipeline=nullptr;
     NEW_FRAME_CALLBACK m_cb;
@@ -80,15 +93,33 @@ private:
     // appsrc
     const char* unix_socket = nullptr;
     int sock = -1;
+    SocketIngestParams m_ingest;
     bool m_read_socket_run = false;
     std::unique_ptr<std::thread> m_read_socket_thread;
 
     // dvr
     void set_playback_rate(double rate);
+    void load_keyframe_index(const std::string &file_path);
+    void stop_keyframe_index();
+    bool seek_to_keyframe(gint64 current_pos, gint64 target_pos, int64_t skip_ms);
+    bool seek_to_entry(const DvrIndexEntry &key);
+    void show_paused_frame();
     double m_playback_rate = 1.0;
     bool m_is_paused = false;
     double m_pre_pause_rate = 1.0;
+    // keyframe index of the file being played, loaded or rebuilt in the background
+    std::shared_ptr<DvrIndex> m_index;
+    std::mutex m_index_mutex;
+    std::unique_ptr<std::thread> m_index_thread;
+    std::atomic<bool> m_index_cancel{false};
 };
+
+// The restream's destinations. The viewer the restream switch picks (the
+// manual IP or the first hotspot client) is added to it on port 5600; with
+// forward the received RTP is sent to all of them, otherwise something else
+// feeds it (the re-encoded restream). nullptr stops restreaming.
+class RtpFanout;
+void restream_set_fanout(RtpFanout* fanout, bool forward);
 #endif
 
 
@@ -104,7 +135,13 @@ void restream_set_manual_ip(const char* ip);
 const char* restream_get_manual_ip();
 void restream_set_pinned_ip(const char* ip);
 void idr_request_record_start();
+void idr_request_restream_start();
 void idr_request_decoder_issue(const char* reason);
+// The decoder found the reference chain broken (see RefLossTracker).
+void idr_request_reference_loss(const char* reason);
+// RTP packets lost since the last call; confined is set when every one of
+// them was inside a single access unit (same RTP timestamp either side).
+unsigned idr_take_rtp_losses(bool* confined);
 void idr_notify_decoded_frame();
 #ifdef __cplusplus
 }
@@ -0,0 +1,223 @@
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include "spdlog/spdlog.h"
+
+#include "idr_scheduler.h"
+extern "C" {
+#include "osd.h"
+}
+
+static uint64_t monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+const char *idr_trigger_name(IdrTrigger t) {
+    switch (t) {
+    case IdrTrigger::STREAM_UP:      return "stream-up";
+    case IdrTrigger::RECORD_START:   return "record-start";
+    case IdrTrigger::RESTREAM_START: return "restream-start";
+    case IdrTrigger::REFERENCE_LOSS: return "reference-loss";
+    case IdrTrigger::DECODE_STALL:   return "decode-stall";
+    case IdrTrigger::DECODER_ISSUE:  return "decoder-issue";
+    case IdrTrigger::COUNT:          break;
+    }
+    return "unknown";
+}
+
+static std::string reasons_str(unsigned bits) {
+    std::string s;
+    for (int i = 0; i < (int)IdrTrigger::COUNT; i++) {
+        if (!(bits & (1u << i)))
+            continue;
+        if (!s.empty())
+            s += '+';
+        s += idr_trigger_name((IdrTrigger)i);
+    }
+    return s;
+}
+
+IdrScheduler::IdrScheduler(Send send) : send_(std::move(send)) {}
+
+void IdrScheduler::set_state(State s) {
+    state_ = s;
+    awaiting_.store(state_ != IDLE || backoff_ms_ > RETRY_MS, std::memory_order_relaxed);
+}
+
+void IdrScheduler::trigger(IdrTrigger t, unsigned attempts, uint64_t now_ms) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    stats_.triggers[(int)t]++;
+    attempts = std::max(attempts, 1u);
+    reasons_ |= 1u << (int)t;
+    switch (state_) {
+    case IDLE:
+        attempts_left_ = attempts;
+        next_send_ms_ = std::max(now_ms, hold_until_ms_);
+        set_state(PENDING);
+        kick_ = true;
+        cv_.notify_one();
+        break;
+    case PENDING:
+        attempts_left_ = std::max(attempts_left_, attempts);
+        stats_.merged++;
+        break;
+    case WAITING:
+        // The request on its way counts as the first attempt
+        attempts_left_ = std::max(attempts_left_, attempts - 1);
+        stats_.merged++;
+        break;
+    }
+}
+
+void IdrScheduler::idr_received(uint64_t now_ms) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (state_ == WAITING) {
+        stats_.confirmed++;
+        spdlog::info("[IDR] Keyframe received {} ms after the request ({})",
+                     now_ms - sent_ms_,
+                     reasons_str(reasons_));
+    }
+    reasons_ = 0;
+    attempts_left_ = 0;
+    backoff_ms_ = RETRY_MS;
+    set_state(IDLE);
+}
+
+void IdrScheduler::reset() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    hold_until_ms_ = 0;
+    backoff_ms_ = RETRY_MS;
+    if (state_ == IDLE)
+        return;
+    // Whatever was asked for is asked again of the next stream
+    attempts_left_ = std::max(attempts_left_, 1u);
+    next_send_ms_ = 0;
+    set_state(PENDING);
+}
+
+uint64_t IdrScheduler::tick(uint64_t now_ms) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    uint64_t wait = IDLE_TICK_MS;
+
+    if (state_ == WAITING) {
+        if (now_ms < deadline_ms_) {
+            wait = deadline_ms_ - now_ms;
+        } else {
+            // Lost on the way there or back: ask again, later each time
+            backoff_ms_ = backoff_ms_ * 2 < BACKOFF_MAX_MS ? backoff_ms_ * 2 : BACKOFF_MAX_MS;
+            if (attempts_left_ > 0) {
+                next_send_ms_ = now_ms;
+                set_state(PENDING);
+            } else {
+                stats_.abandoned++;
+                spdlog::info("[IDR] No keyframe for {}, giving up (backoff now {} ms)",
+                             reasons_str(reasons_), backoff_ms_);
+                reasons_ = 0;
+                set_state(IDLE);
+            }
+        }
+    }
+
+    if (state_ == PENDING) {
+        if (now_ms < next_send_ms_) {
+            wait = next_send_ms_ - now_ms;
+        } else {
+            std::string reasons = reasons_str(reasons_);
+            lock.unlock();
+            bool sent = send_(reasons.c_str());
+            lock.lock();
+            if (state_ != PENDING) {
+                // Reset or answered while sending
+                wait = 0;
+            } else if (!sent) {
+                next_send_ms_ = now_ms + MIN_INTERVAL_MS;
+                wait = MIN_INTERVAL_MS;
+            } else {
+                stats_.requests++;
+                attempts_left_--;
+                sent_ms_ = now_ms;
+                hold_until_ms_ = now_ms + MIN_INTERVAL_MS;
+                deadline_ms_ = now_ms + (backoff_ms_ > MIN_INTERVAL_MS ? backoff_ms_ : MIN_INTERVAL_MS);
+                set_state(WAITING);
+                wait = deadline_ms_ - now_ms;
+            }
+        }
+    }
+    lock.unlock();
+
+    publish_stats(now_ms);
+    return wait;
+}
+
+IdrScheduler::State IdrScheduler::state() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return state_;
+}
+
+uint64_t IdrScheduler::backoff_ms() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return backoff_ms_;
+}
+
+IdrScheduler::Stats IdrScheduler::stats() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return stats_;
+}
+
+void IdrScheduler::publish_stats(uint64_t now_ms) {
+    if (now_ms - published_ms_ < 1000)
+        return;
+    published_ms_ = now_ms;
+    Stats s;
+    uint64_t backoff;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        s = stats_;
+        backoff = backoff_ms_;
+    }
+
+    void *batch = osd_batch_init(5 + (int)IdrTrigger::COUNT);
+    osd_add_uint_fact(batch, "idr.requests", NULL, 0, s.requests);
+    osd_add_uint_fact(batch, "idr.merged", NULL, 0, s.merged);
+    osd_add_uint_fact(batch, "idr.confirmed", NULL, 0, s.confirmed);
+    osd_add_uint_fact(batch, "idr.abandoned", NULL, 0, s.abandoned);
+    osd_add_uint_fact(batch, "idr.backoff_ms", NULL, 0, backoff);
+    for (int i = 0; i < (int)IdrTrigger::COUNT; i++) {
+        osd_tag tags[1];
+        strncpy(tags[0].key, "reason", TAG_MAX_LEN - 1);
+        strncpy(tags[0].val, idr_trigger_name((IdrTrigger)i), TAG_MAX_LEN - 1);
+        tags[0].key[TAG_MAX_LEN - 1] = '\0';
+        tags[0].val[TAG_MAX_LEN - 1] = '\0';
+        osd_add_uint_fact(batch, "idr.triggers", tags, 1, s.triggers[i]);
+    }
+    osd_publish_batch(batch);
+}
+
+void IdrScheduler::shutdown() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    stop_ = true;
+    cv_.notify_one();
+}
+
+void *IdrScheduler::__THREAD__(void *context) {
+    pthread_setname_np(pthread_self(), "__IDR");
+    ((IdrScheduler *)context)->loop();
+    return nullptr;
+}
+
+void IdrScheduler::loop() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (!stop_) {
+        kick_ = false;
+        lock.unlock();
+        uint64_t wait = tick(monotonic_ms());
+        lock.lock();
+        cv_.wait_for(lock, std::chrono::milliseconds(wait), [this] { return stop_ || kick_; });
+    }
+}
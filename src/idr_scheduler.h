@@ -0,0 +1,105 @@
+#ifndef IDR_SCHEDULER_H
+#define IDR_SCHEDULER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+// ---------------------------------------------------------------------------
+// IdrScheduler: asks the air unit for keyframes, one request at a time.
+//
+//  Triggers (stream up, reference loss, decode stall, ...) only raise a pending
+//  request; the scheduler thread sends it and waits for an IDR.  While one
+//  is outstanding further triggers are merged into it, so a loss burst
+//  costs one request, not one per gap.  An unanswered request is repeated
+//  up to the largest number of attempts any of its triggers asked for;
+//  every unanswered one doubles the wait before the next, from RETRY_MS up
+//  to BACKOFF_MAX_MS, and a keyframe arriving resets it.  Requests are
+//  never closer than MIN_INTERVAL_MS.
+//
+//  Without a destination (the last hop unknown) the request stays pending
+//  and is sent once there is one.  Counters are published once a second
+//  as idr.* facts.
+// ---------------------------------------------------------------------------
+
+enum class IdrTrigger {
+    STREAM_UP,
+    RECORD_START,
+    RESTREAM_START,
+    REFERENCE_LOSS,
+    DECODE_STALL,
+    DECODER_ISSUE,
+    COUNT
+};
+
+const char *idr_trigger_name(IdrTrigger t);
+
+class IdrScheduler {
+public:
+    // Sends one request (a burst of tokens); false when there is nowhere to
+    // send it. reasons: the merged trigger names, "stream-up+decode-stall".
+    using Send = std::function<bool(const char *reasons)>;
+
+    enum State { IDLE, PENDING, WAITING };
+
+    explicit IdrScheduler(Send send);
+
+    // Any thread.
+    void trigger(IdrTrigger t, unsigned attempts, uint64_t now_ms);
+    void idr_received(uint64_t now_ms);
+    // The stream went away: forget the backoff; an outstanding request is
+    // sent again once there is a destination.
+    void reset();
+    // Cheap test for the receiver: is a keyframe worth looking for.
+    bool awaiting_idr() const { return awaiting_.load(std::memory_order_relaxed); }
+
+    // Sends what is due; returns how long to wait before the next call.
+    uint64_t tick(uint64_t now_ms);
+    State state() const;
+    uint64_t backoff_ms() const;
+
+    struct Stats {
+        uint64_t triggers[(int)IdrTrigger::COUNT] = {};
+        uint64_t requests = 0;      // requests sent
+        uint64_t merged = 0;        // triggers folded into an outstanding request
+        uint64_t confirmed = 0;     // requests answered by a keyframe
+        uint64_t abandoned = 0;     // requests out of attempts
+    };
+    Stats stats() const;
+
+    void shutdown();
+    static void *__THREAD__(void *context);
+
+    static constexpr uint64_t MIN_INTERVAL_MS = 300;
+    static constexpr uint64_t RETRY_MS = 500;
+    static constexpr uint64_t BACKOFF_MAX_MS = 4000;
+    static constexpr uint64_t IDLE_TICK_MS = 1000;
+
+private:
+    void loop();
+    void publish_stats(uint64_t now_ms);
+    void set_state(State s);
+
+    Send send_;
+    mutable std::mutex mtx_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    bool kick_ = false;             // a new request to look at
+
+    State state_ = IDLE;
+    unsigned reasons_ = 0;          // IdrTrigger bits of the outstanding request
+    unsigned attempts_left_ = 0;
+    uint64_t next_send_ms_ = 0;     // PENDING: not before
+    uint64_t sent_ms_ = 0;          // WAITING: request sent at
+    uint64_t deadline_ms_ = 0;      // WAITING: give up waiting at
+    uint64_t hold_until_ms_ = 0;    // no new request before
+    uint64_t backoff_ms_ = RETRY_MS;
+    std::atomic<bool> awaiting_{false};
+
+    Stats stats_;
+    uint64_t published_ms_ = 0;
+};
+
+#endif // IDR_SCHEDULER_H
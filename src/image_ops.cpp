@@ -0,0 +1,101 @@
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+#include "spdlog/spdlog.h"
+
+#include "image_ops.h"
+
+// ── Fallback ────────────────────────────────────────────────────────────────
+
+class FallbackImageOps : public ImageOps {
+public:
+    FallbackImageOps(std::unique_ptr<ImageOps> primary, std::unique_ptr<ImageOps> fallback)
+        : primary_(std::move(primary)), fallback_(std::move(fallback)) {
+        name_ = std::string(primary_->name()) + "+" + fallback_->name();
+    }
+
+    const char *name() const override { return name_.c_str(); }
+
+    bool copy(const ImageBuffer &src, const ImageBuffer &dst) override {
+        if (use_primary(COPY) && done(COPY, "copy", primary_->copy(src, dst)))
+            return true;
+        return fallback_->copy(src, dst);
+    }
+
+    bool resize(const ImageBuffer &src, const ImageBuffer &dst) override {
+        if (use_primary(RESIZE) && done(RESIZE, "resize", primary_->resize(src, dst)))
+            return true;
+        return fallback_->resize(src, dst);
+    }
+
+    bool convert(const ImageBuffer &src, const ImageBuffer &dst) override {
+        if (use_primary(CONVERT) && done(CONVERT, "convert", primary_->convert(src, dst)))
+            return true;
+        return fallback_->convert(src, dst);
+    }
+
+    bool blend(const ImageBuffer &osd, bool premultiplied,
+               const BlendRect &osd_rect, const ImageBuffer &frame) override {
+        if (use_primary(BLEND) &&
+            done(BLEND, "blend", primary_->blend(osd, premultiplied, osd_rect, frame)))
+            return true;
+        return fallback_->blend(osd, premultiplied, osd_rect, frame);
+    }
+
+private:
+    enum Op { COPY, RESIZE, CONVERT, BLEND, OP_COUNT };
+
+    // Per operation: how many more calls go to the fallback, and how many
+    // the next failure sends there.
+    struct Backoff {
+        unsigned skip = 0;
+        unsigned next = FALLBACK_RETRY_FIRST;
+        bool failing = false;
+    };
+
+    bool use_primary(Op op) {
+        if (!backoff_[op].skip)
+            return true;
+        backoff_[op].skip--;
+        return false;
+    }
+
+    bool done(Op op, const char *what, bool ok) {
+        Backoff &b = backoff_[op];
+        if (ok) {
+            if (b.failing)
+                spdlog::info("{} {} works again", primary_->name(), what);
+            b = Backoff();
+            return true;
+        }
+        if (!b.failing)
+            spdlog::warn("{} {} failed, using {} for a while", primary_->name(), what,
+                         fallback_->name());
+        b.failing = true;
+        b.skip = b.next;
+        b.next = std::min(b.next * 2, FALLBACK_RETRY_MAX);
+        return false;
+    }
+
+    std::unique_ptr<ImageOps> primary_;
+    std::unique_ptr<ImageOps> fallback_;
+    std::string name_;
+    Backoff backoff_[OP_COUNT];
+};
+
+// ---------------------------------------------------------------------------
+
+std::unique_ptr<ImageOps> image_ops_fallback(std::unique_ptr<ImageOps> primary,
+                                             std::unique_ptr<ImageOps> fallback) {
+    return std::unique_ptr<ImageOps>(new FallbackImageOps(std::move(primary),
+                                                          std::move(fallback)));
+}
+
+bool image_backend_parse(const char *name, ImageBackend &backend) {
+    if (strcmp(name, "auto") == 0) backend = ImageBackend::AUTO;
+    else if (strcmp(name, "rga") == 0) backend = ImageBackend::RGA;
+    else if (strcmp(name, "cpu") == 0) backend = ImageBackend::CPU;
+    else return false;
+    return true;
+}
@@ -0,0 +1,86 @@
+#ifndef IMAGE_OPS_H
+#define IMAGE_OPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+
+#include "osd_blend.h"
+
+// ---------------------------------------------------------------------------
+// ImageOps: the image operations of the re-encode path behind one interface.
+//
+//  image_ops_rga() drives the RGA through DMA-buf fds, image_ops_cpu()
+//  works on the CPU mappings, with NEON on ARM and plain C elsewhere (or
+//  when simd is false).  The CPU backend scales bilinearly, converts with
+//  BT.601 limited range and blends like nv12_blend(); 10-bit frames are
+//  only copied, stride for stride.
+//
+//  image_ops_create(AUTO) is the RGA backing onto the CPU one: an
+//  operation the RGA fails is done on the CPU for a while, and the RGA
+//  tried again after FALLBACK_RETRY_FIRST calls, twice as many after each
+//  failed retry up to FALLBACK_RETRY_MAX; a board with a broken RGA driver
+//  still records, one with a passing hiccup gets the RGA back.  CPU is
+//  also what runs the re-encode path on a machine without a Rockchip SoC.
+//  An instance is used by one thread at a time.
+//
+//  Only image_ops_rga() and image_ops_create() need librga
+//  (image_ops_rga.cpp); the rest builds without it.
+// ---------------------------------------------------------------------------
+
+enum class ImageFormat {
+    NV12,
+    NV12_10,    // Rockchip packed 10-bit 4:2:0
+    BGRA,       // little-endian, alpha in the top byte
+};
+
+struct ImageBuffer {
+    int         fd         = -1;        // DMA-buf, for the RGA
+    uint8_t    *ptr        = nullptr;   // CPU mapping
+    size_t      size       = 0;         // bytes mapped, 0 if unknown
+    uint32_t    width      = 0;
+    uint32_t    height     = 0;
+    uint32_t    hor_stride = 0;         // pixels (bytes for NV12)
+    uint32_t    ver_stride = 0;         // rows
+    ImageFormat fmt        = ImageFormat::NV12;
+};
+
+class ImageOps {
+public:
+    virtual ~ImageOps() {}
+    virtual const char *name() const = 0;
+
+    // Same format and size.
+    virtual bool copy(const ImageBuffer &src, const ImageBuffer &dst) = 0;
+    // Same format, any size.
+    virtual bool resize(const ImageBuffer &src, const ImageBuffer &dst) = 0;
+    // NV12 to BGRA or back, same size.
+    virtual bool convert(const ImageBuffer &src, const ImageBuffer &dst) = 0;
+    // Composite osd_rect of a BGRA osd over the matching part of an NV12
+    // frame (see osd_rect_on_frame), scaling the OSD to the frame size.
+    virtual bool blend(const ImageBuffer &osd, bool premultiplied,
+                       const BlendRect &osd_rect, const ImageBuffer &frame) = 0;
+};
+
+enum class ImageBackend {
+    AUTO,       // RGA, falling back to the CPU
+    RGA,
+    CPU,
+};
+
+std::unique_ptr<ImageOps> image_ops_rga();
+std::unique_ptr<ImageOps> image_ops_cpu(bool simd = true);
+// Each operation primary fails is handed to fallback for a while.
+static constexpr unsigned FALLBACK_RETRY_FIRST = 60;      // calls, about a second
+static constexpr unsigned FALLBACK_RETRY_MAX = 60 * 60;
+std::unique_ptr<ImageOps> image_ops_fallback(std::unique_ptr<ImageOps> primary,
+                                             std::unique_ptr<ImageOps> fallback);
+std::unique_ptr<ImageOps> image_ops_create(ImageBackend backend);
+
+// "auto", "rga" or "cpu". Returns false on anything else.
+bool image_backend_parse(const char *name, ImageBackend &backend);
+
+// Both views of an NV12 buffer, as osd_blend.h wants it.
+Nv12Image nv12_image_of(const ImageBuffer &buf);
+
+#endif // IMAGE_OPS_H
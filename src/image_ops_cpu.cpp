@@ -0,0 +1,435 @@
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define IMAGE_OPS_NEON 1
+#endif
+
+#include "image_ops.h"
+
+// Every NEON kernel gives the same bytes as the C one next to it, so the
+// two can be compared on an ARM build, and either is a reference for the
+// other.  The C versions also do the tails of the rows.
+
+namespace {
+
+inline uint8_t clamp_u8(int v) {
+    return v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+}
+
+// ── Vertical interpolation of two rows ──────────────────────────────────────
+// out = (a * (256 - f) + b * f + 128) >> 8, f 1..255
+
+void lerp_row_c(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n, unsigned f) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = (uint8_t)((a[i] * (256 - f) + b[i] * f + 128) >> 8);
+}
+
+#ifdef IMAGE_OPS_NEON
+void lerp_row_neon(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n, unsigned f) {
+    uint8x8_t wa = vdup_n_u8((uint8_t)(256 - f));
+    uint8x8_t wb = vdup_n_u8((uint8_t)f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t va = vld1q_u8(a + i);
+        uint8x16_t vb = vld1q_u8(b + i);
+        uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(va), wa), vget_low_u8(vb), wb);
+        uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(va), wa), vget_high_u8(vb), wb);
+        vst1q_u8(out + i, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+    }
+    lerp_row_c(a + i, b + i, out + i, n - i, f);
+}
+#endif
+
+// ── NV12 -> BGRA ────────────────────────────────────────────────────────────
+// BT.601 limited range in 16 bits: luma * 149/128, chroma * 1/64.  Luma
+// below 16 counts as black.
+
+void nv12_to_bgra_row_c(const uint8_t *y, const uint8_t *uv, uint8_t *bgra,
+                        uint32_t from, uint32_t width) {
+    for (uint32_t x = from; x < width; x++) {
+        int yt = (std::max(y[x] - 16, 0) * 149) >> 1;
+        int d = uv[x & ~1u] - 128;
+        int e = uv[(x & ~1u) + 1] - 128;
+        uint8_t *px = bgra + (size_t)x * 4;
+        px[0] = clamp_u8((yt + 129 * d + 32) >> 6);
+        px[1] = clamp_u8((yt - 25 * d - 52 * e + 32) >> 6);
+        px[2] = clamp_u8((yt + 102 * e + 32) >> 6);
+        px[3] = 255;
+    }
+}
+
+#ifdef IMAGE_OPS_NEON
+inline void yuv_to_bgr8(uint8x8_t y, uint8x8_t u, uint8x8_t v,
+                        uint8x8_t &b, uint8x8_t &g, uint8x8_t &r) {
+    int16x8_t yt = vreinterpretq_s16_u16(
+        vshrq_n_u16(vmull_u8(vqsub_u8(y, vdup_n_u8(16)), vdup_n_u8(149)), 1));
+    int16x8_t d = vreinterpretq_s16_u16(vsubl_u8(u, vdup_n_u8(128)));
+    int16x8_t e = vreinterpretq_s16_u16(vsubl_u8(v, vdup_n_u8(128)));
+    // Only yt + 129 * d can leave 16 bits, and then it is white anyway
+    b = vqmovun_s16(vrshrq_n_s16(vqaddq_s16(yt, vmulq_n_s16(d, 129)), 6));
+    g = vqmovun_s16(vrshrq_n_s16(
+        vsubq_s16(vsubq_s16(yt, vmulq_n_s16(d, 25)), vmulq_n_s16(e, 52)), 6));
+    r = vqmovun_s16(vrshrq_n_s16(vaddq_s16(yt, vmulq_n_s16(e, 102)), 6));
+}
+
+void nv12_to_bgra_row_neon(const uint8_t *y, const uint8_t *uv, uint8_t *bgra, uint32_t width) {
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t yy = vld1q_u8(y + x);
+        uint8x8x2_t c = vld2_u8(uv + x);
+        uint8x8x2_t u = vzip_u8(c.val[0], c.val[0]);
+        uint8x8x2_t v = vzip_u8(c.val[1], c.val[1]);
+        uint8x8_t b0, g0, r0, b1, g1, r1;
+        yuv_to_bgr8(vget_low_u8(yy), u.val[0], v.val[0], b0, g0, r0);
+        yuv_to_bgr8(vget_high_u8(yy), u.val[1], v.val[1], b1, g1, r1);
+        uint8x16x4_t out;
+        out.val[0] = vcombine_u8(b0, b1);
+        out.val[1] = vcombine_u8(g0, g1);
+        out.val[2] = vcombine_u8(r0, r1);
+        out.val[3] = vdupq_n_u8(255);
+        vst4q_u8(bgra + (size_t)x * 4, out);
+    }
+    nv12_to_bgra_row_c(y, uv, bgra, x, width);
+}
+#endif
+
+// ── BGRA -> NV12 ────────────────────────────────────────────────────────────
+// Same coefficients as nv12_blend(); chroma from the average of 2x2 pixels.
+
+void bgra_to_y_row_c(const uint8_t *bgra, uint8_t *y, uint32_t from, uint32_t width) {
+    for (uint32_t x = from; x < width; x++) {
+        const uint8_t *px = bgra + (size_t)x * 4;
+        y[x] = (uint8_t)(((66 * px[2] + 129 * px[1] + 25 * px[0] + 128) >> 8) + 16);
+    }
+}
+
+#ifdef IMAGE_OPS_NEON
+inline uint8x8_t bgr_to_y8(uint8x8_t b, uint8x8_t g, uint8x8_t r) {
+    uint16x8_t s = vmull_u8(r, vdup_n_u8(66));
+    s = vmlal_u8(s, g, vdup_n_u8(129));
+    s = vmlal_u8(s, b, vdup_n_u8(25));
+    return vadd_u8(vrshrn_n_u16(s, 8), vdup_n_u8(16));
+}
+
+void bgra_to_y_row_neon(const uint8_t *bgra, uint8_t *y, uint32_t width) {
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x16x4_t px = vld4q_u8(bgra + (size_t)x * 4);
+        uint8x8_t lo = bgr_to_y8(vget_low_u8(px.val[0]), vget_low_u8(px.val[1]),
+                                 vget_low_u8(px.val[2]));
+        uint8x8_t hi = bgr_to_y8(vget_high_u8(px.val[0]), vget_high_u8(px.val[1]),
+                                 vget_high_u8(px.val[2]));
+        vst1q_u8(y + x, vcombine_u8(lo, hi));
+    }
+    bgra_to_y_row_c(bgra, y, x, width);
+}
+#endif
+
+void bgra_to_uv_row(const uint8_t *row0, const uint8_t *row1, uint8_t *uv, uint32_t width) {
+    for (uint32_t x = 0; x < width; x += 2) {
+        uint32_t x1 = x + 1 < width ? x + 1 : x;
+        const uint8_t *px[4] = {row0 + (size_t)x * 4, row0 + (size_t)x1 * 4,
+                                row1 + (size_t)x * 4, row1 + (size_t)x1 * 4};
+        int rs = 0, gs = 0, bs = 0;
+        for (const uint8_t *p : px) {
+            bs += p[0];
+            gs += p[1];
+            rs += p[2];
+        }
+        uv[x]     = clamp_u8(((-38 * rs - 74 * gs + 112 * bs + 512) >> 10) + 128);
+        uv[x + 1] = clamp_u8(((112 * rs - 94 * gs - 18 * bs + 512) >> 10) + 128);
+    }
+}
+
+// ── OSD blend, OSD and frame the same size ──────────────────────────────────
+// The luma of nv12_blend() 16 pixels at a time; chroma stays scalar, it is
+// a quarter of the work.
+
+#ifdef IMAGE_OPS_NEON
+// x / 255 for x <= 65152, rounded down
+inline uint16x8_t div255(uint16x8_t x) {
+    return vshrq_n_u16(vaddq_u16(vaddq_u16(x, vdupq_n_u16(1)), vshrq_n_u16(x, 8)), 8);
+}
+
+inline uint8x8_t blend_y8(uint8x8_t y, uint8x8_t b, uint8x8_t g, uint8x8_t r, uint8x8_t a,
+                          bool premultiplied) {
+    uint16x8_t half = vdupq_n_u16(127);
+    if (!premultiplied) {
+        b = vmovn_u16(div255(vaddq_u16(vmull_u8(b, a), half)));
+        g = vmovn_u16(div255(vaddq_u16(vmull_u8(g, a), half)));
+        r = vmovn_u16(div255(vaddq_u16(vmull_u8(r, a), half)));
+    }
+    uint16x8_t s = vmull_u8(r, vdup_n_u8(66));
+    s = vmlal_u8(s, g, vdup_n_u8(129));
+    s = vmlal_u8(s, b, vdup_n_u8(25));
+    uint8x8_t luma = vadd_u8(vrshrn_n_u16(s, 8),
+                             vmovn_u16(div255(vaddq_u16(vmull_u8(a, vdup_n_u8(16)), half))));
+    uint8x8_t under = vmovn_u16(div255(vaddq_u16(
+        vmull_u8(y, vsub_u8(vdup_n_u8(255), a)), half)));
+    // Transparent pixels keep the frame as it is
+    return vbsl_u8(vceq_u8(a, vdup_n_u8(0)), y, vqadd_u8(under, luma));
+}
+
+void blend_y_row_neon(uint8_t *y, const uint8_t *bgra, uint32_t n, bool premultiplied) {
+    uint32_t x = 0;
+    for (; x + 16 <= n; x += 16) {
+        uint8x16_t yy = vld1q_u8(y + x);
+        uint8x16x4_t px = vld4q_u8(bgra + (size_t)x * 4);
+        uint8x8_t lo = blend_y8(vget_low_u8(yy), vget_low_u8(px.val[0]),
+                                vget_low_u8(px.val[1]), vget_low_u8(px.val[2]),
+                                vget_low_u8(px.val[3]), premultiplied);
+        uint8x8_t hi = blend_y8(vget_high_u8(yy), vget_high_u8(px.val[0]),
+                                vget_high_u8(px.val[1]), vget_high_u8(px.val[2]),
+                                vget_high_u8(px.val[3]), premultiplied);
+        vst1q_u8(y + x, vcombine_u8(lo, hi));
+    }
+    for (; x < n; x++) {
+        const uint8_t *p = bgra + (size_t)x * 4;
+        int a = p[3];
+        if (!a)
+            continue;
+        int b = p[0], g = p[1], r = p[2];
+        if (!premultiplied) {
+            b = (b * a + 127) / 255;
+            g = (g * a + 127) / 255;
+            r = (r * a + 127) / 255;
+        }
+        int luma = ((66 * r + 129 * g + 25 * b + 128) >> 8) + (16 * a + 127) / 255;
+        y[x] = clamp_u8((y[x] * (255 - a) + 127) / 255 + luma);
+    }
+}
+
+void blend_uv_row(uint8_t *uv, const uint8_t *row0, const uint8_t *row1, uint32_t n,
+                  bool premultiplied) {
+    for (uint32_t x = 0; x < n; x += 2) {
+        const uint8_t *px[4] = {row0 + (size_t)x * 4, row0 + (size_t)x * 4 + 4,
+                                row1 + (size_t)x * 4, row1 + (size_t)x * 4 + 4};
+        int a_sum = 0, r_sum = 0, g_sum = 0, b_sum = 0;
+        for (const uint8_t *p : px) {
+            int a = p[3];
+            if (!a)
+                continue;
+            int b = p[0], g = p[1], r = p[2];
+            if (!premultiplied) {
+                b = (b * a + 127) / 255;
+                g = (g * a + 127) / 255;
+                r = (r * a + 127) / 255;
+            }
+            a_sum += a;
+            r_sum += r;
+            g_sum += g;
+            b_sum += b;
+        }
+        if (!a_sum)
+            continue;
+        int cb = (-38 * r_sum - 74 * g_sum + 112 * b_sum) / 1024 + (128 * a_sum + 510) / 1020;
+        int cr = (112 * r_sum - 94 * g_sum - 18 * b_sum) / 1024 + (128 * a_sum + 510) / 1020;
+        uv[x]     = clamp_u8((uv[x] * (1020 - a_sum) + 510) / 1020 + cb);
+        uv[x + 1] = clamp_u8((uv[x + 1] * (1020 - a_sum) + 510) / 1020 + cr);
+    }
+}
+#endif
+
+// ── Bilinear scaling of one plane ───────────────────────────────────────────
+
+// Source position of each of n destination samples, 24.8 fixed point,
+// sample centres lined up.
+void scale_positions(uint32_t src, uint32_t dst, std::vector<uint32_t> &pos) {
+    pos.resize(dst);
+    int64_t last = (int64_t)(src - 1) * 256;
+    for (uint32_t i = 0; i < dst; i++) {
+        int64_t p = ((int64_t)(2 * i + 1) * src * 256) / (2 * (int64_t)dst) - 128;
+        pos[i] = (uint32_t)std::min(std::max(p, (int64_t)0), last);
+    }
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------------
+
+class CpuImageOps : public ImageOps {
+public:
+    explicit CpuImageOps(bool simd) {
+#ifdef IMAGE_OPS_NEON
+        simd_ = simd;
+#else
+        (void)simd;
+#endif
+    }
+
+    const char *name() const override { return simd_ ? "cpu-neon" : "cpu"; }
+
+    bool copy(const ImageBuffer &src, const ImageBuffer &dst) override {
+        if (!src.ptr || !dst.ptr || src.fmt != dst.fmt ||
+            src.width != dst.width || src.height != dst.height)
+            return false;
+        if (src.fmt == ImageFormat::NV12_10) {
+            if (src.hor_stride != dst.hor_stride || src.ver_stride != dst.ver_stride)
+                return false;
+            size_t n = (size_t)src.hor_stride * src.ver_stride * 3 / 2;
+            if (src.size) n = std::min(n, src.size);
+            if (dst.size) n = std::min(n, dst.size);
+            memcpy(dst.ptr, src.ptr, n);
+            return true;
+        }
+        if (src.fmt == ImageFormat::BGRA) {
+            for (uint32_t y = 0; y < src.height; y++)
+                memcpy(dst.ptr + (size_t)y * dst.hor_stride * 4,
+                       src.ptr + (size_t)y * src.hor_stride * 4, (size_t)src.width * 4);
+            return true;
+        }
+        Nv12Image s = nv12_image_of(src), d = nv12_image_of(dst);
+        for (uint32_t y = 0; y < src.height; y++)
+            memcpy(d.y + (size_t)y * d.stride, s.y + (size_t)y * s.stride, src.width);
+        for (uint32_t y = 0; y < (src.height + 1) / 2; y++)
+            memcpy(d.uv + (size_t)y * d.stride, s.uv + (size_t)y * s.stride,
+                   (src.width + 1) & ~1u);
+        return true;
+    }
+
+    bool resize(const ImageBuffer &src, const ImageBuffer &dst) override {
+        if (src.fmt != ImageFormat::NV12 || dst.fmt != ImageFormat::NV12 ||
+            !src.ptr || !dst.ptr || !src.width || !src.height || !dst.width || !dst.height)
+            return false;
+        if (src.width == dst.width && src.height == dst.height)
+            return copy(src, dst);
+        Nv12Image s = nv12_image_of(src), d = nv12_image_of(dst);
+        scale_plane(s.y, s.stride, src.width, src.height,
+                    d.y, d.stride, dst.width, dst.height, 1);
+        scale_plane(s.uv, s.stride, (src.width + 1) / 2, (src.height + 1) / 2,
+                    d.uv, d.stride, (dst.width + 1) / 2, (dst.height + 1) / 2, 2);
+        return true;
+    }
+
+    bool convert(const ImageBuffer &src, const ImageBuffer &dst) override {
+        if (!src.ptr || !dst.ptr || src.width != dst.width || src.height != dst.height)
+            return false;
+        if (src.fmt == ImageFormat::NV12 && dst.fmt == ImageFormat::BGRA) {
+            Nv12Image s = nv12_image_of(src);
+            for (uint32_t y = 0; y < src.height; y++) {
+                const uint8_t *yr = s.y + (size_t)y * s.stride;
+                const uint8_t *uvr = s.uv + (size_t)(y / 2) * s.stride;
+                uint8_t *out = dst.ptr + (size_t)y * dst.hor_stride * 4;
+#ifdef IMAGE_OPS_NEON
+                if (simd_) {
+                    nv12_to_bgra_row_neon(yr, uvr, out, src.width);
+                    continue;
+                }
+#endif
+                nv12_to_bgra_row_c(yr, uvr, out, 0, src.width);
+            }
+            return true;
+        }
+        if (src.fmt == ImageFormat::BGRA && dst.fmt == ImageFormat::NV12) {
+            Nv12Image d = nv12_image_of(dst);
+            for (uint32_t y = 0; y < src.height; y++) {
+                const uint8_t *row = src.ptr + (size_t)y * src.hor_stride * 4;
+                uint8_t *out = d.y + (size_t)y * d.stride;
+#ifdef IMAGE_OPS_NEON
+                if (simd_) {
+                    bgra_to_y_row_neon(row, out, src.width);
+                    continue;
+                }
+#endif
+                bgra_to_y_row_c(row, out, 0, src.width);
+            }
+            for (uint32_t y = 0; y < src.height; y += 2) {
+                uint32_t y1 = y + 1 < src.height ? y + 1 : y;
+                bgra_to_uv_row(src.ptr + (size_t)y * src.hor_stride * 4,
+                               src.ptr + (size_t)y1 * src.hor_stride * 4,
+                               d.uv + (size_t)(y / 2) * d.stride, src.width);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    bool blend(const ImageBuffer &osd, bool premultiplied,
+               const BlendRect &osd_rect, const ImageBuffer &frame) override {
+        if (osd.fmt != ImageFormat::BGRA || frame.fmt != ImageFormat::NV12 ||
+            !osd.ptr || !frame.ptr)
+            return false;
+        Nv12Image f = nv12_image_of(frame);
+#ifdef IMAGE_OPS_NEON
+        if (simd_ && osd.width == frame.width && osd.height == frame.height) {
+            BlendRect r = osd_rect_on_frame(osd_rect, osd.width, osd.height,
+                                            frame.width, frame.height);
+            for (uint32_t y = r.y; y < r.y + r.h; y += 2) {
+                const uint8_t *row0 = osd.ptr + (size_t)y * osd.hor_stride * 4 + (size_t)r.x * 4;
+                const uint8_t *row1 = row0 + (size_t)osd.hor_stride * 4;
+                blend_y_row_neon(f.y + (size_t)y * f.stride + r.x, row0, r.w, premultiplied);
+                blend_y_row_neon(f.y + (size_t)(y + 1) * f.stride + r.x, row1, r.w, premultiplied);
+                blend_uv_row(f.uv + (size_t)(y / 2) * f.stride + r.x, row0, row1, r.w,
+                             premultiplied);
+            }
+            return true;
+        }
+#endif
+        BgraImage img;
+        img.data          = osd.ptr;
+        img.width         = osd.width;
+        img.height        = osd.height;
+        img.stride        = osd.hor_stride * 4;
+        img.premultiplied = premultiplied;
+        nv12_blend(f, img, osd_rect);
+        return true;
+    }
+
+private:
+    // channels 1 for luma, 2 for interleaved chroma; widths in samples.
+    void scale_plane(const uint8_t *src, uint32_t src_stride, uint32_t src_w, uint32_t src_h,
+                     uint8_t *dst, uint32_t dst_stride, uint32_t dst_w, uint32_t dst_h,
+                     int channels) {
+        scale_positions(src_w, dst_w, xpos_);
+        scale_positions(src_h, dst_h, ypos_);
+        size_t row_bytes = (size_t)src_w * channels;
+        row_.resize(row_bytes);
+
+        for (uint32_t dy = 0; dy < dst_h; dy++) {
+            uint32_t sy = ypos_[dy] >> 8;
+            unsigned fy = ypos_[dy] & 255;
+            const uint8_t *row = src + (size_t)sy * src_stride;
+            if (fy) {
+                const uint8_t *below = row + src_stride;
+#ifdef IMAGE_OPS_NEON
+                if (simd_)
+                    lerp_row_neon(row, below, row_.data(), row_bytes, fy);
+                else
+#endif
+                    lerp_row_c(row, below, row_.data(), row_bytes, fy);
+                row = row_.data();
+            }
+            uint8_t *out = dst + (size_t)dy * dst_stride;
+            for (uint32_t dx = 0; dx < dst_w; dx++) {
+                uint32_t sx = xpos_[dx] >> 8;
+                unsigned fx = xpos_[dx] & 255;
+                uint32_t sx1 = sx + 1 < src_w ? sx + 1 : sx;
+                for (int c = 0; c < channels; c++) {
+                    unsigned a = row[sx * channels + c], b = row[sx1 * channels + c];
+                    out[dx * channels + c] = (uint8_t)((a * (256 - fx) + b * fx + 128) >> 8);
+                }
+            }
+        }
+    }
+
+    bool simd_ = false;
+    std::vector<uint32_t> xpos_, ypos_;
+    std::vector<uint8_t> row_;
+};
+
+std::unique_ptr<ImageOps> image_ops_cpu(bool simd) {
+    return std::unique_ptr<ImageOps>(new CpuImageOps(simd));
+}
+
+Nv12Image nv12_image_of(const ImageBuffer &buf) {
+    Nv12Image img;
+    img.y      = buf.ptr;
+    img.uv     = buf.ptr ? buf.ptr + (size_t)buf.hor_stride * buf.ver_stride : nullptr;
+    img.width  = buf.width;
+    img.height = buf.height;
+    img.stride = buf.hor_stride;
+    return img;
+}
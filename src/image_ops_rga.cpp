@@ -0,0 +1,84 @@
+// The RGA backend, the only part of ImageOps that needs librga.
+
+#include <rga/im2d.h>
+#include <rga/rga.h>
+
+#include "image_ops.h"
+
+static int rga_format(ImageFormat fmt) {
+    switch (fmt) {
+    case ImageFormat::NV12:    return RK_FORMAT_YCbCr_420_SP;
+    case ImageFormat::NV12_10: return RK_FORMAT_YCbCr_420_SP_10B;
+    case ImageFormat::BGRA:    return RK_FORMAT_BGRA_8888;
+    }
+    return RK_FORMAT_YCbCr_420_SP;
+}
+
+static rga_buffer_t rga_wrap(const ImageBuffer &b) {
+    return wrapbuffer_fd_t(b.fd, b.width, b.height, b.hor_stride, b.ver_stride,
+                           rga_format(b.fmt));
+}
+
+// ── RGA ─────────────────────────────────────────────────────────────────────
+
+class RgaImageOps : public ImageOps {
+public:
+    const char *name() const override { return "rga"; }
+
+    bool copy(const ImageBuffer &src, const ImageBuffer &dst) override {
+        if (src.fd < 0 || dst.fd < 0)
+            return false;
+        return imcopy(rga_wrap(src), rga_wrap(dst)) == IM_STATUS_SUCCESS;
+    }
+
+    bool resize(const ImageBuffer &src, const ImageBuffer &dst) override {
+        if (src.fd < 0 || dst.fd < 0)
+            return false;
+        if (src.width == dst.width && src.height == dst.height)
+            return copy(src, dst);
+        return imresize(rga_wrap(src), rga_wrap(dst)) == IM_STATUS_SUCCESS;
+    }
+
+    bool convert(const ImageBuffer &src, const ImageBuffer &dst) override {
+        if (src.fd < 0 || dst.fd < 0)
+            return false;
+        return imcvtcolor(rga_wrap(src), rga_wrap(dst), rga_format(src.fmt),
+                          rga_format(dst.fmt)) == IM_STATUS_SUCCESS;
+    }
+
+    // Blends over the frame in one pass, using it as both background and
+    // destination.  RGA takes the OSD as straight alpha unless told
+    // otherwise.
+    bool blend(const ImageBuffer &osd, bool premultiplied,
+               const BlendRect &osd_rect, const ImageBuffer &frame) override {
+        if (osd.fd < 0 || frame.fd < 0)
+            return false;
+        BlendRect f = osd_rect_on_frame(osd_rect, osd.width, osd.height,
+                                        frame.width, frame.height);
+        if (!f.w || !f.h)
+            return true;
+        rga_buffer_t src = rga_wrap(osd);
+        rga_buffer_t nv12 = rga_wrap(frame);
+        im_rect srect = {(int)osd_rect.x, (int)osd_rect.y, (int)osd_rect.w, (int)osd_rect.h};
+        im_rect drect = {(int)f.x, (int)f.y, (int)f.w, (int)f.h};
+        int usage = IM_ALPHA_BLEND_SRC_OVER;
+        if (premultiplied)
+            usage |= IM_ALPHA_BLEND_PRE_MUL;
+        return improcess(src, nv12, nv12, srect, drect, drect, usage) == IM_STATUS_SUCCESS;
+    }
+};
+
+// ---------------------------------------------------------------------------
+
+std::unique_ptr<ImageOps> image_ops_rga() {
+    return std::unique_ptr<ImageOps>(new RgaImageOps());
+}
+
+std::unique_ptr<ImageOps> image_ops_create(ImageBackend backend) {
+    switch (backend) {
+    case ImageBackend::RGA: return image_ops_rga();
+    case ImageBackend::CPU: return image_ops_cpu();
+    case ImageBackend::AUTO: break;
+    }
+    return image_ops_fallback(image_ops_rga(), image_ops_cpu());
+}
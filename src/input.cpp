@@ -28,7 +28,7 @@ lv_timer_t * timer = NULL;
 #endif
 #ifndef USE_SIMULATOR
 extern bool menu_active;
-#define MAX_GPIO_BUTTONS 6  // Adjust based on your hardware
+#define MAX_GPIO_BUTTONS 7  // Adjust based on your hardware
 #define DEBOUNCE_DELAY_MS 50 // Debounce delay in milliseconds
 #define INITIAL_REPEAT_DELAY_MS 500  // Time before repeat starts
 #define REPEAT_RATE_MS 100           // Time between repeated events
@@ -166,6 +166,7 @@ void init_gpio_buttons_from_config(YAML::Node& config) {
     init_button_from_config(gpio_config, "right", button_index);
     init_button_from_config(gpio_config, "center", button_index);
     init_button_from_config(gpio_config, "rec", button_index);
+    init_button_from_config(gpio_config, "snap", button_index);
 }
 
 // Function to initialize GPIO buttons
@@ -203,8 +204,22 @@ void setup_gpio(YAML::Node& config) {
     }
 }
 
+// Buttons with a long press action fire on release, or once held long enough.
+static bool has_long_press(const char *name) {
+    return strcmp(name, "right") == 0 || strcmp(name, "left") == 0 ||
+           strcmp(name, "snap") == 0;
+}
+
 void send_long_press_event(size_t button_index) {
-    if (strcmp(gpio_buttons[button_index].name, "right") == 0) {
+    if (strcmp(gpio_buttons[button_index].name, "snap") == 0) {
+        snapshot_trigger(true);
+
+        printf("GPIO Long Press: %s (snapshot burst) (Pin: %d, Chip: %s)\n",
+               gpio_buttons[button_index].name,
+               gpio_buttons[button_index].pin_number,
+               gpio_buttons[button_index].chip_name);
+    }
+    else if (strcmp(gpio_buttons[button_index].name, "right") == 0) {
         next_key = LV_KEY_ENTER;
         next_key_pressed = true;
 
@@ -226,6 +241,15 @@ void send_long_press_event(size_t button_index) {
 void send_button_event(size_t button_index) {
     if (gpio_buttons[button_index].name == NULL) return;
 
+    // Works in every control mode, menu open or not
+    if (strcmp(gpio_buttons[button_index].name, "snap") == 0) {
+        snapshot_trigger(false);
+        printf("GPIO Pressed: snap (Pin: %d, Chip: %s)\n",
+               gpio_buttons[button_index].pin_number,
+               gpio_buttons[button_index].chip_name);
+        return;
+    }
+
     // Adjust for control_mode
     switch (control_mode) {
         case GSMENU_CONTROL_MODE_NAV:
@@ -337,18 +361,16 @@ void handle_gpio_input(void) {
                     gpio_buttons[i].long_press_sent = false;
                     gpio_buttons[i].repeat_time = current_time + INITIAL_REPEAT_DELAY_MS;
                     
-                    // Fire event immediately for all buttons EXCEPT 'right' and 'left'.
+                    // Fire event immediately for all buttons EXCEPT 'right', 'left' and 'snap'.
                     // For those, we wait to see if it's a short or long press.
-                    if (strcmp(gpio_buttons[i].name, "right") != 0 &&
-                        strcmp(gpio_buttons[i].name, "left") != 0) {
+                    if (!has_long_press(gpio_buttons[i].name)) {
                         send_button_event(i);
                     }
                 } else { // Button released
                     gpio_buttons[i].is_holding = false;
                     
-                    // If 'right' or 'left' was released without a long press, send the normal event now.
-                    if ((strcmp(gpio_buttons[i].name, "right") == 0 ||
-                         strcmp(gpio_buttons[i].name, "left") == 0) &&
+                    // If 'right', 'left' or 'snap' was released without a long press, send the normal event now.
+                    if (has_long_press(gpio_buttons[i].name) &&
                         !gpio_buttons[i].long_press_sent) {
                         send_button_event(i);
                     } else {
@@ -363,9 +385,8 @@ void handle_gpio_input(void) {
             if (gpio_buttons[i].is_holding && current_state == 1 && 
                 current_time >= gpio_buttons[i].repeat_time) {
                 
-                // Special long-press handling for 'right' and 'left'
-                if (strcmp(gpio_buttons[i].name, "right") == 0 ||
-                    strcmp(gpio_buttons[i].name, "left") == 0) {
+                // Special long-press handling for 'right', 'left' and 'snap'
+                if (has_long_press(gpio_buttons[i].name)) {
                     if (!gpio_buttons[i].long_press_sent) {
                         send_long_press_event(i);
                         gpio_buttons[i].long_press_sent = true;
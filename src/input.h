@@ -29,6 +29,9 @@ void handle_keyboard_input(void);
 
 void toggle_rec_enabled(void);
 
+// Take a snapshot, or a burst of them (--snapshot)
+void snapshot_trigger(bool burst);
+
 // Custom function to simulate keyboard input
 static void virtual_keyboard_read(lv_indev_t * indev, lv_indev_data_t * data);
 
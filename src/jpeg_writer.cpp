@@ -0,0 +1,339 @@
+#include <math.h>
+
+#include "jpeg_writer.h"
+
+static const uint8_t ZIGZAG[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// Annex K.1, natural order
+static const uint8_t STD_LUMA_QT[64] = {
+    16, 11, 10, 16,  24,  40,  51,  61,
+    12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,
+    14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,
+    24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103,  99,
+};
+static const uint8_t STD_CHROMA_QT[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+};
+
+// Annex K.3: code counts per length 1..16, then the symbols
+static const uint8_t DC_LUMA_BITS[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t DC_CHROMA_BITS[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const uint8_t DC_VALS[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const uint8_t AC_LUMA_BITS[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const uint8_t AC_LUMA_VALS[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+static const uint8_t AC_CHROMA_BITS[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const uint8_t AC_CHROMA_VALS[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+static const float AAN_SCALE[8] = {
+    1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+    1.0f, 0.785694958f, 0.541196100f, 0.275899379f,
+};
+
+namespace {
+
+struct HuffTable {
+    uint16_t code[256] = {};
+    uint8_t size[256] = {};
+
+    HuffTable(const uint8_t *bits, const uint8_t *vals) {
+        uint16_t c = 0;
+        int k = 0;
+        for (int len = 1; len <= 16; len++) {
+            for (int i = 0; i < bits[len - 1]; i++, k++) {
+                code[vals[k]] = c++;
+                size[vals[k]] = (uint8_t)len;
+            }
+            c <<= 1;
+        }
+    }
+};
+
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t> &out) : out_(out) {}
+
+    void put(uint32_t bits, int n) {
+        acc_ = (acc_ << n) | (bits & ((1u << n) - 1));
+        count_ += n;
+        while (count_ >= 8) {
+            uint8_t b = (uint8_t)(acc_ >> (count_ - 8));
+            out_.push_back(b);
+            if (b == 0xff)
+                out_.push_back(0);   // byte stuffing
+            count_ -= 8;
+        }
+    }
+    void flush() {
+        if (count_ > 0)
+            put(0x7f, 8 - count_);   // pad with ones
+    }
+
+private:
+    std::vector<uint8_t> &out_;
+    uint32_t acc_ = 0;
+    int count_ = 0;
+};
+
+struct Component {
+    float fdtbl[64];            // 1 / (quantiser * AAN scaling), natural order
+    const HuffTable *dc, *ac;
+    int prev_dc = 0;
+};
+
+} // namespace
+
+static void scale_quant(const uint8_t *std_qt, int quality, uint8_t *qt) {
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    for (int i = 0; i < 64; i++) {
+        int q = (std_qt[i] * scale + 50) / 100;
+        qt[i] = (uint8_t)(q < 1 ? 1 : q > 255 ? 255 : q);
+    }
+}
+
+// AAN forward DCT, in place; the output is scaled by AAN_SCALE[u] *
+// AAN_SCALE[v] * 8, which fdtbl takes out again.
+static void fdct(float *d) {
+    for (int pass = 0; pass < 2; pass++) {
+        int step = pass == 0 ? 1 : 8;      // rows, then columns
+        int next = pass == 0 ? 8 : 1;
+        for (int i = 0; i < 8; i++) {
+            float *p = d + i * next;
+            float tmp0 = p[0 * step] + p[7 * step], tmp7 = p[0 * step] - p[7 * step];
+            float tmp1 = p[1 * step] + p[6 * step], tmp6 = p[1 * step] - p[6 * step];
+            float tmp2 = p[2 * step] + p[5 * step], tmp5 = p[2 * step] - p[5 * step];
+            float tmp3 = p[3 * step] + p[4 * step], tmp4 = p[3 * step] - p[4 * step];
+
+            float tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+            float tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+            p[0 * step] = tmp10 + tmp11;
+            p[4 * step] = tmp10 - tmp11;
+            float z1 = (tmp12 + tmp13) * 0.707106781f;
+            p[2 * step] = tmp13 + z1;
+            p[6 * step] = tmp13 - z1;
+
+            tmp10 = tmp4 + tmp5;
+            tmp11 = tmp5 + tmp6;
+            tmp12 = tmp6 + tmp7;
+            float z5 = (tmp10 - tmp12) * 0.382683433f;
+            float z2 = 0.541196100f * tmp10 + z5;
+            float z4 = 1.306562965f * tmp12 + z5;
+            float z3 = tmp11 * 0.707106781f;
+            float z11 = tmp7 + z3, z13 = tmp7 - z3;
+            p[5 * step] = z13 + z2;
+            p[3 * step] = z13 - z2;
+            p[1 * step] = z11 + z4;
+            p[7 * step] = z11 - z4;
+        }
+    }
+}
+
+static void put_value(BitWriter &bw, const HuffTable &t, int symbol, int value, int nbits) {
+    bw.put(t.code[symbol], t.size[symbol]);
+    if (nbits)
+        bw.put(value < 0 ? value - 1 : value, nbits);
+}
+
+static int bit_count(int v) {
+    v = v < 0 ? -v : v;
+    int n = 0;
+    while (v) {
+        n++;
+        v >>= 1;
+    }
+    return n;
+}
+
+static void encode_block(BitWriter &bw, float *block, Component &c) {
+    fdct(block);
+    int q[64];
+    for (int i = 0; i < 64; i++) {
+        float v = block[ZIGZAG[i]] * c.fdtbl[ZIGZAG[i]];
+        q[i] = (int)lrintf(v);
+    }
+
+    int diff = q[0] - c.prev_dc;
+    c.prev_dc = q[0];
+    int n = bit_count(diff);
+    put_value(bw, *c.dc, n, diff, n);
+
+    int run = 0;
+    for (int i = 1; i < 64; i++) {
+        if (q[i] == 0) {
+            run++;
+            continue;
+        }
+        while (run >= 16) {
+            put_value(bw, *c.ac, 0xf0, 0, 0);   // ZRL
+            run -= 16;
+        }
+        n = bit_count(q[i]);
+        put_value(bw, *c.ac, (run << 4) | n, q[i], n);
+        run = 0;
+    }
+    if (run)
+        put_value(bw, *c.ac, 0x00, 0, 0);       // EOB
+}
+
+static void put_u16(std::vector<uint8_t> &out, unsigned v) {
+    out.push_back((uint8_t)(v >> 8));
+    out.push_back((uint8_t)v);
+}
+
+static void put_dht(std::vector<uint8_t> &out, int cls_id, const uint8_t *bits, const uint8_t *vals) {
+    int n = 0;
+    for (int i = 0; i < 16; i++)
+        n += bits[i];
+    out.push_back(0xff);
+    out.push_back(0xc4);
+    put_u16(out, 2 + 1 + 16 + n);
+    out.push_back((uint8_t)cls_id);
+    out.insert(out.end(), bits, bits + 16);
+    out.insert(out.end(), vals, vals + n);
+}
+
+bool jpeg_encode_nv12(const Nv12Image &img, int quality, std::vector<uint8_t> &out,
+                      bool video_range) {
+    if (!img.y || !img.uv || !img.width || !img.height || (img.width | img.height) & 1)
+        return false;
+    quality = quality < 1 ? 1 : quality > 100 ? 100 : quality;
+
+    uint8_t luma_qt[64], chroma_qt[64];
+    scale_quant(STD_LUMA_QT, quality, luma_qt);
+    scale_quant(STD_CHROMA_QT, quality, chroma_qt);
+
+    static const HuffTable dc_luma(DC_LUMA_BITS, DC_VALS), dc_chroma(DC_CHROMA_BITS, DC_VALS);
+    static const HuffTable ac_luma(AC_LUMA_BITS, AC_LUMA_VALS), ac_chroma(AC_CHROMA_BITS, AC_CHROMA_VALS);
+    Component comp[3];
+    for (int c = 0; c < 3; c++) {
+        const uint8_t *qt = c == 0 ? luma_qt : chroma_qt;
+        for (int i = 0; i < 64; i++)
+            comp[c].fdtbl[i] = 1.0f / (qt[i] * AAN_SCALE[i / 8] * AAN_SCALE[i % 8] * 8.0f);
+        comp[c].dc = c == 0 ? &dc_luma : &dc_chroma;
+        comp[c].ac = c == 0 ? &ac_luma : &ac_chroma;
+    }
+
+    // Level shifted samples, stretched from video range if needed
+    float y_lut[256], c_lut[256];
+    for (int i = 0; i < 256; i++) {
+        float y = video_range ? (i - 16) * 255.0f / 219.0f : (float)i;
+        float c = video_range ? (i - 128) * 255.0f / 224.0f + 128.0f : (float)i;
+        y_lut[i] = (y < 0 ? 0 : y > 255 ? 255 : y) - 128.0f;
+        c_lut[i] = (c < 0 ? 0 : c > 255 ? 255 : c) - 128.0f;
+    }
+
+    out.clear();
+    out.reserve((size_t)img.width * img.height / 4);
+    // SOI, JFIF APP0
+    static const uint8_t HEADER[] = {
+        0xff, 0xd8,
+        0xff, 0xe0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00, 0x01, 0x01, 0x00,
+        0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+    };
+    out.insert(out.end(), HEADER, HEADER + sizeof(HEADER));
+    // DQT, zigzag order
+    for (int t = 0; t < 2; t++) {
+        const uint8_t *qt = t == 0 ? luma_qt : chroma_qt;
+        out.push_back(0xff);
+        out.push_back(0xdb);
+        put_u16(out, 2 + 1 + 64);
+        out.push_back((uint8_t)t);
+        for (int i = 0; i < 64; i++)
+            out.push_back(qt[ZIGZAG[i]]);
+    }
+    // SOF0: Y 2x2, Cb and Cr 1x1
+    out.push_back(0xff);
+    out.push_back(0xc0);
+    put_u16(out, 8 + 3 * 3);
+    out.push_back(8);
+    put_u16(out, img.height);
+    put_u16(out, img.width);
+    out.push_back(3);
+    static const uint8_t SOF_COMPONENTS[] = {1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1};
+    out.insert(out.end(), SOF_COMPONENTS, SOF_COMPONENTS + sizeof(SOF_COMPONENTS));
+    put_dht(out, 0x00, DC_LUMA_BITS, DC_VALS);
+    put_dht(out, 0x10, AC_LUMA_BITS, AC_LUMA_VALS);
+    put_dht(out, 0x01, DC_CHROMA_BITS, DC_VALS);
+    put_dht(out, 0x11, AC_CHROMA_BITS, AC_CHROMA_VALS);
+    // SOS
+    static const uint8_t SOS[] = {
+        0xff, 0xda, 0x00, 0x0c, 3, 1, 0x00, 2, 0x11, 3, 0x11, 0x00, 0x3f, 0x00,
+    };
+    out.insert(out.end(), SOS, SOS + sizeof(SOS));
+
+    BitWriter bw(out);
+    uint32_t cw = img.width / 2, ch = img.height / 2;
+    float block[64];
+    for (uint32_t my = 0; my < img.height; my += 16) {
+        for (uint32_t mx = 0; mx < img.width; mx += 16) {
+            // Four luma blocks; the edges repeat the last row and column
+            for (int b = 0; b < 4; b++) {
+                uint32_t bx = mx + (b & 1) * 8, by = my + (b >> 1) * 8;
+                for (int r = 0; r < 8; r++) {
+                    uint32_t y = by + r < img.height ? by + r : img.height - 1;
+                    const uint8_t *row = img.y + (size_t)y * img.stride;
+                    for (int c = 0; c < 8; c++) {
+                        uint32_t x = bx + c < img.width ? bx + c : img.width - 1;
+                        block[r * 8 + c] = y_lut[row[x]];
+                    }
+                }
+                encode_block(bw, block, comp[0]);
+            }
+            for (int k = 0; k < 2; k++) {
+                for (int r = 0; r < 8; r++) {
+                    uint32_t y = my / 2 + r < ch ? my / 2 + r : ch - 1;
+                    const uint8_t *row = img.uv + (size_t)y * img.stride;
+                    for (int c = 0; c < 8; c++) {
+                        uint32_t x = mx / 2 + c < cw ? mx / 2 + c : cw - 1;
+                        block[r * 8 + c] = c_lut[row[x * 2 + k]];
+                    }
+                }
+                encode_block(bw, block, comp[1 + k]);
+            }
+        }
+    }
+    bw.flush();
+    out.push_back(0xff);
+    out.push_back(0xd9);
+    return true;
+}
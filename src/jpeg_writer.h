@@ -0,0 +1,24 @@
+#ifndef JPEG_WRITER_H
+#define JPEG_WRITER_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "osd_blend.h"
+
+// ---------------------------------------------------------------------------
+// Baseline JPEG encoder for NV12 frames, used for snapshots when the MPP
+// JPEG encoder isn't available.
+//
+//  The planes are coded as 4:2:0 as they are, no colour conversion: video
+//  range samples are only stretched to the full range JFIF expects.  The
+//  Annex K quantisation tables are scaled by quality like libjpeg does,
+//  the Huffman tables are the standard ones and the DCT is the AAN float
+//  one.  Much slower than the hardware, but a still only needs it once.
+// ---------------------------------------------------------------------------
+
+// quality 1..100. Returns false on an empty or odd-sized image.
+bool jpeg_encode_nv12(const Nv12Image &img, int quality, std::vector<uint8_t> &out,
+                      bool video_range = true);
+
+#endif // JPEG_WRITER_H
@@ -16,10 +16,12 @@
 #include <inttypes.h>
 #include <signal.h>
 #include <fstream>
+#include <sstream>
 #include <atomic>
 #include <queue>
 #include <mutex>
 #include <condition_variable>
+#include <filesystem>
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -50,8 +52,14 @@ extern "C" {
 #include "osd.hpp"
 #include "wfbcli.hpp"
 #include "dvr.h"
+#include "dvr_health.h"
 #include "mpp_encoder.h"
 #include "frame_processor.h"
+#include "snapshot.h"
+#include "rtp_fanout.h"
+#include "rtp_restream.h"
+#include "ref_loss.h"
+#include "nal_view.h"
 #include "gstrtpreceiver.h"
 #include "scheduling_helper.hpp"
 #include "time_util.h"
@@ -74,6 +82,8 @@ extern "C" {
 YAML::Node config;
 
 #define MSG_FIFO_NAME "/run/pixelpilot.msg"
+#define SNAPSHOT_FIFO_NAME "/run/pixelpilot.snap"
+#define RESTREAM_FIFO_NAME "/run/pixelpilot.restream"
 
 struct {
 	MppCtx		  ctx;
@@ -105,6 +115,7 @@ static pthread_mutex_t mpp_reinit_mutex = PTHREAD_MUTEX_INITIALIZER;
 static std::atomic<bool> mpp_reinit_pending{false};
 
 bool mavlink_dvr_on_arm = false;
+bool mavlink_dvr_segment_on_arm = false;
 bool osd_custom_message = false;
 bool disable_vsync = false;
 bool disable_gregidr = false;
@@ -113,23 +124,82 @@ uint32_t refresh_frequency_ms = 1000;
 VideoCodec codec = VideoCodec::H265;
 uint16_t listen_port = 5600;
 const char* unix_socket = NULL;
+SocketIngestParams socket_ingest;
 char* dvr_template = NULL;
 Dvr *dvr_raw = NULL;
 Dvr *dvr_reenc_inst = NULL;
 MppEncoder *reencoder = NULL;
 MppEncoderParams reenc_params;
+// Low-bitrate proxy recorded next to the re-encoded stream (--dvr-proxy),
+// a second rendition of the same frames.
+Dvr *dvr_proxy_inst = NULL;
+MppEncoder *proxy_encoder = NULL;
+static bool dvr_proxy = false;
+static EncResolution dvr_proxy_resolution(854, 480);
+static int dvr_proxy_bitrate_kbps = 1000;
 DvrMode dvr_mode = DVR_MODE_RAW;
 bool dvr_osd   = false;
+static ImageBackend dvr_image_backend = ImageBackend::AUTO;
 static int video_framerate = -1;
 static bool dvr_filenames_with_sequence = false;
 static int mp4_fragmentation_mode = 0;
 static int64_t dvr_max_file_size = 4000000000LL;  // 4 GB (decimal), safe margin for VFAT 4 GiB limit
+static size_t dvr_preroll_max_bytes = 64 * 1024 * 1024;
+static int dvr_segment_s = 0;
+static bool dvr_segment_align = false;
+static bool dvr_segment_on_link_loss = false;
+static DvrTelemetry::Format dvr_telemetry_format = DvrTelemetry::CSV;
 FrameProcessor *frame_proc = nullptr;
 // Thread handles for the encoder and pacer — file-scope so live mode toggle can join them.
 static pthread_t g_tid_enc   = 0;
 static pthread_t g_tid_fproc = 0;
 static pthread_t g_tid_dvr_raw   = 0;
 static pthread_t g_tid_dvr_reenc = 0;
+static pthread_t g_tid_proxy_enc = 0;
+static pthread_t g_tid_dvr_proxy = 0;
+static DvrRecovery *dvr_recovery = nullptr;
+static DvrRetention *dvr_retention = nullptr;
+static uint64_t dvr_min_free_bytes = 0;
+static uint64_t dvr_quota_bytes = 0;
+static pthread_t g_tid_dvr_recover = 0;
+static DvrHealth *dvr_health = nullptr;
+static bool dvr_degrade = true;
+static int dvr_health_base_kbps = 0;   // configured re-encode bitrate while lowered
+// Held by whatever starts, stops or rebuilds the DVR pipeline, or reads or
+// changes its settings (the dvr_* functions): gsmenu, MAVLink and DvrHealth
+// all do, from their own threads, and dvr_set_mode() hands the re-encode
+// objects to dvr_shutdown_worker() to be deleted.  Recursive as
+// dvr_set_mode() stops the recordings itself.
+static std::recursive_mutex dvr_control_mtx;
+static pthread_t g_tid_dvr_health = 0;
+// Still snapshots (--snapshot), taken independently of the DVR.
+Snapshot *snapshot = nullptr;
+static Snapshot::Params snapshot_params;
+static pthread_t g_tid_snapshot = 0;
+// Restream destinations: the hotspot viewer, --restream-dest and whatever
+// is added through RESTREAM_FIFO_NAME, all sent to by one thread.
+static RtpFanout *restream_fanout = nullptr;
+static std::vector<std::pair<std::string, unsigned>> restream_dests;   // host:port, kbps
+static pthread_t g_tid_restream_fanout = 0;
+// Re-encoded restream (--restream-reenc): a FrameProcessor and encoder of
+// its own, sent as RTP to the fanout instead of the received stream.
+static MppEncoderParams restream_default_params() {
+    MppEncoderParams p;
+    p.resolution = EncResolution(854, 480);
+    p.bitrate_kbps = 1500;
+    p.in_flight = 1;    // latency over throughput for a live view
+    p.name = "restream";
+    return p;
+}
+static bool restream_reenc = false;
+static MppEncoderParams restream_params = restream_default_params();
+static RtpRestream *restream = nullptr;
+static MppEncoder *restream_encoder = nullptr;
+static FrameProcessor *restream_proc = nullptr;
+static pthread_t g_tid_restream_enc = 0;
+static pthread_t g_tid_restream_proc = 0;
+// Decides which decoder errors and RTP losses are worth a keyframe
+static RefLossTracker ref_loss;
 
 // Decoded frame geometry – updated in init_buffer(), used in __FRAME_THREAD__
 uint32_t decoded_hor_stride = 0;
@@ -152,10 +222,12 @@ float live_colortrans_offset = -0.15f;
 float live_colortrans_gain = 2.5f;
 gamma_lut_controller lut_ctrl;
 
-// Helper: get target width/height for the current re-encode resolution setting.
-static void reenc_target_dims(uint32_t &w, uint32_t &h) {
-    if (reenc_params.resolution == EncResolution::Res720p) { w = 1280; h = 720; }
-    else { w = 1920; h = 1080; }
+// Helper: get target width/height of a re-encoded rendition, fitted to the
+// decoded frames once their size is known.
+static void reenc_target_dims(const EncResolution &res, uint32_t &w, uint32_t &h) {
+    uint32_t src_w = output_list ? output_list->video_frm_width : 0;
+    uint32_t src_h = output_list ? output_list->video_frm_height : 0;
+    res.fit(src_w, src_h, w, h);
 }
 
 void init_buffer(MppFrame frame) {
@@ -184,6 +256,7 @@ void init_buffer(MppFrame frame) {
 	// the group.  Without this the group teardown races with the pacer's copy
 	// loop and the buffer fds become invalid while still in use.
 	if (frame_proc) frame_proc->drain_decoder_refs();
+	if (restream_proc) restream_proc->drain_decoder_refs();
 
 	if (mpi.frm_grp) {
 		spdlog::debug("Freeing current mpp_buffer_group");
@@ -281,9 +354,13 @@ void init_buffer(MppFrame frame) {
 		dvr_raw->set_video_params(output_list->video_frm_width, output_list->video_frm_height, codec);
 	}
 	if (dvr_reenc_inst != NULL) {
-		uint32_t rw, rh; reenc_target_dims(rw, rh);
+		uint32_t rw, rh; reenc_target_dims(reenc_params.resolution, rw, rh);
 		dvr_reenc_inst->set_video_params(rw, rh, reenc_params.codec);
 	}
+	if (dvr_proxy_inst != NULL) {
+		uint32_t rw, rh; reenc_target_dims(dvr_proxy_resolution, rw, rh);
+		dvr_proxy_inst->set_video_params(rw, rh, reenc_params.codec);
+	}
 }
 
 // __FRAME_THREAD__
@@ -331,8 +408,11 @@ void *__FRAME_THREAD__(void *param)
 				idr_notify_decoded_frame();
 				const RK_U32 errinfo = mpp_frame_get_errinfo(frame);
 				const RK_U32 discard = mpp_frame_get_discard(frame);
-				if (errinfo || discard) {
-					const char* reason = "decoder-issue";
+				// Only a broken reference chain is worth a keyframe; a concealed
+				// non-reference loss waits for the next natural one.
+				if (ref_loss.decoded(mpp_frame_get_pts(frame), errinfo || discard,
+				                     get_time_ms()) == RefLossTracker::BROKEN) {
+					const char* reason = "reference-loss";
 					if (errinfo && discard) {
 						reason = "decoder-errinfo+discard";
 					} else if (errinfo) {
@@ -340,7 +420,7 @@ void *__FRAME_THREAD__(void *param)
 					} else if (discard) {
 						reason = "decoder-discard";
 					}
-					idr_request_decoder_issue(reason);
+					idr_request_reference_loss(reason);
 				}
 				if (!mpi.first_frame_ts.tv_sec) {
 					ts = ats;
@@ -380,7 +460,23 @@ void *__FRAME_THREAD__(void *param)
 						                       output_list->video_frm_width,
 						                       output_list->video_frm_height,
 						                       decoded_hor_stride,
-						                       decoded_ver_stride, fmt);
+						                       decoded_ver_stride, fmt, feed_data_ts);
+					}
+					if (restream_proc != nullptr &&
+					    decoded_hor_stride > 0 && decoded_ver_stride > 0) {
+						restream_proc->push_latest(buffer,
+						                          output_list->video_frm_width,
+						                          output_list->video_frm_height,
+						                          decoded_hor_stride, decoded_ver_stride,
+						                          mpp_frame_get_fmt(frame), feed_data_ts);
+					}
+					if (snapshot != nullptr &&
+					    decoded_hor_stride > 0 && decoded_ver_stride > 0) {
+						snapshot->offer(buffer,
+						                output_list->video_frm_width,
+						                output_list->video_frm_height,
+						                decoded_hor_stride, decoded_ver_stride,
+						                mpp_frame_get_fmt(frame));
 					}
 				}
 			}
@@ -475,15 +571,44 @@ void sig_handler(int signum)
 	if (dvr_reenc_inst != NULL) {
 		dvr_reenc_inst->shutdown();
 	}
+	if (dvr_proxy_inst != NULL) {
+		dvr_proxy_inst->shutdown();
+	}
 	if (frame_proc != NULL) {
 		frame_proc->shutdown();
 	}
 	if (reencoder != NULL) {
 		reencoder->shutdown();
 	}
+	if (proxy_encoder != NULL) {
+		proxy_encoder->shutdown();
+	}
+	if (dvr_recovery != NULL) {
+		dvr_recovery->cancel();
+	}
+	if (dvr_health != NULL) {
+		dvr_health->shutdown();
+	}
+	if (snapshot != NULL) {
+		snapshot->shutdown();
+	}
+	if (restream_proc != NULL) {
+		restream_proc->shutdown();
+	}
+	if (restream_encoder != NULL) {
+		restream_encoder->shutdown();
+	}
+	if (restream_fanout != NULL) {
+		restream_fanout->shutdown();
+	}
 	return_value = signum;
 }
 
+// SIGRTMIN takes a snapshot, SIGRTMIN+1 a burst.
+void snapshot_signal_handler(int signum) {
+	if (snapshot) snapshot->trigger_from_signal(signum != SIGRTMIN);
+}
+
 void sigusr1_handler(int signum) {
 	spdlog::info("Received signal {}", signum);
 	bool was_enabled = dvr_enabled;
@@ -491,6 +616,7 @@ void sigusr1_handler(int signum) {
 		// Stopping
 		if (dvr_raw) dvr_raw->stop_recording();
 		if (dvr_reenc_inst) dvr_reenc_inst->stop_recording();
+		if (dvr_proxy_inst) dvr_proxy_inst->stop_recording();
 		dvr_enabled = 0;
 		osd_publish_bool_fact("dvr.recording", NULL, 0, false);
 	} else {
@@ -499,7 +625,9 @@ void sigusr1_handler(int signum) {
 		osd_publish_bool_fact("dvr.recording", NULL, 0, true);
 		if (dvr_raw) dvr_raw->start_recording();
 		if (dvr_reenc_inst) dvr_reenc_inst->start_recording();
+		if (dvr_proxy_inst) dvr_proxy_inst->start_recording();
 		if (reencoder) reencoder->request_idr();
+		if (proxy_encoder) proxy_encoder->request_idr();
 	}
 }
 
@@ -540,59 +668,211 @@ struct DvrShutdownCtx {
     FrameProcessor *p;
     MppEncoder   *e;
     pthread_t     td, tp, te;
+    // Proxy rendition, fed by p
+    Dvr          *proxy_dvr;
+    MppEncoder   *proxy_e;
+    pthread_t     tpd, tpe;
 };
 
 static void *dvr_shutdown_worker(void *arg) {
     auto *ctx = static_cast<DvrShutdownCtx *>(arg);
     if (ctx->tp) pthread_join(ctx->tp, nullptr);
     if (ctx->te) pthread_join(ctx->te, nullptr);
+    if (ctx->tpe) pthread_join(ctx->tpe, nullptr);
     if (ctx->td) pthread_join(ctx->td, nullptr);
+    if (ctx->tpd) pthread_join(ctx->tpd, nullptr);
     delete ctx->p;
     delete ctx->e;
+    delete ctx->proxy_e;
     delete ctx->dvr_inst;
+    delete ctx->proxy_dvr;
     delete ctx;
     return nullptr;
 }
 
+// Proxy recorder and its encoder, as a second rendition of frame_proc.
+// Called after frame_proc is created and before its thread starts.
+static void dvr_proxy_create() {
+    if (!dvr_proxy || !frame_proc || !dvr_template)
+        return;
+    char *tpl = dvr_template_with_suffix(dvr_template, "_proxy");
+    dvr_thread_params args;
+    args.filename_template = tpl;
+    args.mp4_fragmentation_mode = mp4_fragmentation_mode;
+    args.dvr_filenames_with_sequence = dvr_filenames_with_sequence;
+    args.video_framerate = reenc_params.fps;
+    args.max_file_size = dvr_max_file_size;
+    args.segment_s = dvr_segment_s;
+    args.segment_align = dvr_segment_align;
+    args.segment_on_link_loss = dvr_segment_on_link_loss;
+    args.preroll_ms = dvr_preroll_ms;
+    args.preroll_max_bytes = dvr_preroll_max_bytes;
+    args.retention = dvr_retention;
+    args.telemetry_format = dvr_telemetry_format;
+    uint32_t rw, rh; reenc_target_dims(dvr_proxy_resolution, rw, rh);
+    args.video_p.video_frm_width = rw;
+    args.video_p.video_frm_height = rh;
+    args.video_p.codec = reenc_params.codec;
+    dvr_proxy_inst = new Dvr(args);
+    pthread_create(&g_tid_dvr_proxy, NULL, &Dvr::__THREAD__, dvr_proxy_inst);
+
+    MppEncoderParams params = reenc_params;
+    params.resolution = dvr_proxy_resolution;
+    params.bitrate_kbps = dvr_proxy_bitrate_kbps;
+    params.name = "proxy";
+    proxy_encoder = new MppEncoder(params, [](EncodedFramePtr nal, uint64_t pts_ms) {
+        if (dvr_frames_wanted() && dvr_proxy_inst) dvr_proxy_inst->frame(nal, pts_ms * 90);
+    });
+    pthread_create(&g_tid_proxy_enc, NULL, &MppEncoder::__THREAD__, proxy_encoder);
+    frame_proc->add_rendition(proxy_encoder, dvr_proxy_resolution);
+    dvr_proxy_inst->on_start_cb = []() { if (proxy_encoder) proxy_encoder->request_idr(); };
+    spdlog::info("DVR proxy: {}x{} at {}kbps", dvr_proxy_resolution.width,
+                 dvr_proxy_resolution.height, dvr_proxy_bitrate_kbps);
+}
+
+// Encoder and frame processor of the re-encoded restream; they only run
+// while somebody is watching.
+static void restream_start() {
+    RtpRestream::Params rp;
+    rp.codec = restream_params.codec;
+    restream = new RtpRestream(rp, *restream_fanout);
+    restream_encoder = new MppEncoder(restream_params, [](EncodedFramePtr nal, uint64_t pts_ms) {
+        restream->frame(nal, pts_ms);
+    });
+    pthread_create(&g_tid_restream_enc, NULL, &MppEncoder::__THREAD__, restream_encoder);
+    restream_proc = new FrameProcessor(restream_encoder, restream_params.fps,
+                                       restream_params.resolution, dvr_image_backend);
+    restream_proc->set_frames_wanted([]() { return restream_fanout->active() > 0; });
+    restream_proc->set_name("restream");
+    pthread_create(&g_tid_restream_proc, NULL, &FrameProcessor::__THREAD__, restream_proc);
+
+    restream_set_fanout(restream_fanout, false);
+    spdlog::info("Re-encoded restream: {}x{} at {}kbps {}", restream_params.resolution.width,
+                 restream_params.resolution.height, restream_params.bitrate_kbps,
+                 restream_params.codec == VideoCodec::H265 ? "h265" : "h264");
+}
+
+static void restream_stop() {
+    restream_set_fanout(nullptr, false);
+    if (g_tid_restream_proc) pthread_join(g_tid_restream_proc, NULL);
+    if (g_tid_restream_enc) pthread_join(g_tid_restream_enc, NULL);
+    delete restream_proc;
+    restream_proc = nullptr;
+    delete restream_encoder;
+    restream_encoder = nullptr;
+    delete restream;
+    restream = nullptr;
+}
+
+// Forwarded or re-encoded, every new destination starts with a keyframe.
+static void restream_fanout_start() {
+    RtpFanout::Params fp;
+    fp.fifo = RESTREAM_FIFO_NAME;
+    restream_fanout = new RtpFanout(fp);
+    restream_fanout->on_added = []() {
+        if (restream_encoder) restream_encoder->request_idr();
+        else idr_request_restream_start();
+    };
+    pthread_create(&g_tid_restream_fanout, NULL, &RtpFanout::__THREAD__, restream_fanout);
+
+    if (restream_reenc)
+        restream_start();
+    else
+        restream_set_fanout(restream_fanout, true);
+    for (const auto &d : restream_dests) {
+        sockaddr_in addr;
+        if (RtpFanout::parse_destination(d.first, addr))
+            restream_fanout->add(addr, d.second);
+        else
+            spdlog::warn("Restream: can't resolve destination {}", d.first);
+    }
+}
+
+static void restream_fanout_stop() {
+    if (restream)
+        restream_stop();
+    else
+        restream_set_fanout(nullptr, false);
+    restream_fanout->shutdown();
+    pthread_join(g_tid_restream_fanout, NULL);
+    delete restream_fanout;
+    restream_fanout = nullptr;
+}
+
+// Caller holds dvr_control_mtx.
+static void dvr_reenc_apply_rc() {
+    if (reencoder) reencoder->set_rate_control(reenc_params.rc);
+    if (proxy_encoder) proxy_encoder->set_rate_control(reenc_params.rc);
+}
+
 // C-compatible interface for gsmenu live control of the DVR.
 extern "C" {
     void dvr_reenc_set_fps(int fps) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
         if (dvr_reenc_inst) dvr_reenc_inst->stop_recording();
+        if (dvr_proxy_inst) dvr_proxy_inst->stop_recording();
         reenc_params.fps = fps;
         if (dvr_reenc_inst) dvr_reenc_inst->set_video_framerate(fps);
+        if (dvr_proxy_inst) dvr_proxy_inst->set_video_framerate(fps);
         if (frame_proc) frame_proc->set_fps(fps);
         if (reencoder) reencoder->set_fps(fps);
+        if (proxy_encoder) proxy_encoder->set_fps(fps);
     }
     void dvr_reenc_set_osd(int enabled) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
         dvr_osd = (bool)enabled;
         if (!enabled && frame_proc)
-            frame_proc->set_osd_blend(-1, 0, 0, 0);
+            frame_proc->set_osd_blend(-1, nullptr, 0, 0, 0, true);
     }
 
     void dvr_reenc_notify_colortrans(int enabled) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
         if (!frame_proc) return;
         if (enabled)
             frame_proc->set_color_correction(live_colortrans_gain, live_colortrans_offset, drm_fd);
         else
             frame_proc->set_color_correction_enabled(false);
     }
-    int dvr_reenc_get_fps(void)     { return reenc_params.fps; }
-    int dvr_reenc_get_bitrate(void) { return reenc_params.bitrate_kbps; }
-    int dvr_reenc_get_osd(void)     { return (int)dvr_osd; }
-    int dvr_reenc_get_codec(void)   { return (int)reenc_params.codec - 1; } // 0=h264, 1=h265
-    int dvr_reenc_get_resolution(void) { return (int)reenc_params.resolution; } // 0=720p, 1=1080p
+    int dvr_reenc_get_fps(void) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        return reenc_params.fps;
+    }
+    int dvr_reenc_get_bitrate(void) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        return reenc_params.bitrate_kbps;
+    }
+    int dvr_reenc_get_osd(void) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        return (int)dvr_osd;
+    }
+    int dvr_reenc_get_codec(void) { // 0=h264, 1=h265
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        return (int)reenc_params.codec - 1;
+    }
+    int dvr_reenc_get_resolution(void) { // 0=720p, 1=1080p
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        return reenc_params.resolution.height > 720 ? 1 : 0;
+    }
 
-    int  dvr_get_mode(void)  { return (int)dvr_mode; }
+    int  dvr_get_mode(void) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        return (int)dvr_mode;
+    }
     // Deprecated — use dvr_get_mode() instead
-    int  dvr_reenc_is_reenc(void) { return dvr_mode != DVR_MODE_RAW; }
+    int  dvr_reenc_is_reenc(void) { return dvr_get_mode() != DVR_MODE_RAW; }
 
     void dvr_set_max_size(int mb) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
         dvr_max_file_size = (int64_t)mb * 1000000LL;
         if (dvr_raw) dvr_raw->set_max_file_size(dvr_max_file_size);
         if (dvr_reenc_inst) dvr_reenc_inst->set_max_file_size(dvr_max_file_size);
+        if (dvr_proxy_inst) dvr_proxy_inst->set_max_file_size(dvr_max_file_size);
         spdlog::info("DVR max file size set to {} MB", mb);
     }
-    int dvr_get_max_size(void) { return (int)(dvr_max_file_size / 1000000LL); }
+    int dvr_get_max_size(void) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        return (int)(dvr_max_file_size / 1000000LL);
+    }
 
     void drm_set_video_scale(float factor) {
         if (output_list) {
@@ -602,49 +882,136 @@ extern "C" {
     }
 
     void dvr_reenc_set_resolution(int idx) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
         if (dvr_reenc_inst) dvr_reenc_inst->stop_recording();
-        reenc_params.resolution = (EncResolution)idx;
+        reenc_params.resolution = idx == 0 ? EncResolution(1280, 720) : EncResolution(1920, 1080);
         if (frame_proc) frame_proc->set_resolution(reenc_params.resolution);
         if (dvr_reenc_inst) {
-            uint32_t rw, rh; reenc_target_dims(rw, rh);
+            uint32_t rw, rh; reenc_target_dims(reenc_params.resolution, rw, rh);
             dvr_reenc_inst->set_video_params(rw, rh, reenc_params.codec);
         }
     }
 
     void dvr_reenc_set_bitrate(int kbps) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        // Lowered by DvrHealth: this is what it goes back to
+        if (dvr_health_base_kbps)
+            dvr_health_base_kbps = kbps;
         reenc_params.bitrate_kbps = kbps;
         if (reencoder) reencoder->set_bitrate(kbps);
     }
 
+    // Rate control of the re-encoder (and the proxy), applied live.
+    // mode: 0=cbr, 1=vbr, 2=avbr, 3=fixqp
+    void dvr_reenc_set_rc_mode(int mode) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        if (mode < (int)EncRcMode::CBR || mode > (int)EncRcMode::FIXQP) return;
+        reenc_params.rc.mode = (EncRcMode)mode;
+        dvr_reenc_apply_rc();
+    }
+    int dvr_reenc_get_rc_mode(void) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        return (int)reenc_params.rc.mode;
+    }
+
+    void dvr_reenc_set_qp_range(int qp_min, int qp_max) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        if (qp_min < 1 || qp_max > 51 || qp_min > qp_max) return;
+        reenc_params.rc.qp_min = qp_min;
+        reenc_params.rc.qp_max = qp_max;
+        dvr_reenc_apply_rc();
+    }
+    void dvr_reenc_get_qp_range(int *qp_min, int *qp_max) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        if (qp_min) *qp_min = reenc_params.rc.qp_min;
+        if (qp_max) *qp_max = reenc_params.rc.qp_max;
+    }
+    void dvr_reenc_set_fixed_qp(int qp) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        if (qp < 1 || qp > 51) return;
+        reenc_params.rc.qp_fixed = qp;
+        dvr_reenc_apply_rc();
+    }
+    int dvr_reenc_get_fixed_qp(void) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        return reenc_params.rc.qp_fixed;
+    }
+
+    // frames: 0 = two seconds
+    void dvr_reenc_set_gop(int frames) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        if (frames < 0) return;
+        reenc_params.rc.gop = frames;
+        dvr_reenc_apply_rc();
+    }
+    int dvr_reenc_get_gop(void) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        return reenc_params.rc.gop;
+    }
+
+    // rows: macroblock rows intra coded per frame, 0 = off
+    void dvr_reenc_set_intra_refresh(int rows) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        if (rows < 0) return;
+        reenc_params.rc.intra_refresh = rows;
+        dvr_reenc_apply_rc();
+    }
+    int dvr_reenc_get_intra_refresh(void) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        return reenc_params.rc.intra_refresh;
+    }
+
     void dvr_reenc_set_codec(int idx) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
         if (dvr_reenc_inst) dvr_reenc_inst->stop_recording();
+        if (dvr_proxy_inst) dvr_proxy_inst->stop_recording();
         VideoCodec vc = (idx == 1) ? VideoCodec::H265 : VideoCodec::H264;
         reenc_params.codec = vc;
         if (reencoder) reencoder->set_codec(vc);
+        if (proxy_encoder) proxy_encoder->set_codec(vc);
         if (dvr_reenc_inst) {
-            uint32_t rw, rh; reenc_target_dims(rw, rh);
+            uint32_t rw, rh; reenc_target_dims(reenc_params.resolution, rw, rh);
             dvr_reenc_inst->set_video_params(rw, rh, vc);
         }
+        if (dvr_proxy_inst) {
+            uint32_t rw, rh; reenc_target_dims(dvr_proxy_resolution, rw, rh);
+            dvr_proxy_inst->set_video_params(rw, rh, vc);
+        }
     }
 
     void dvr_start_all(void) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
         dvr_enabled = 1;
         osd_publish_bool_fact("dvr.recording", NULL, 0, true);
         if (dvr_raw) dvr_raw->start_recording();
         if (dvr_reenc_inst) dvr_reenc_inst->start_recording();
+        if (dvr_proxy_inst) dvr_proxy_inst->start_recording();
         if (reencoder) reencoder->request_idr();
+        if (proxy_encoder) proxy_encoder->request_idr();
     }
 
     void dvr_stop_all(void) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
         if (dvr_raw) dvr_raw->stop_recording();
         if (dvr_reenc_inst) dvr_reenc_inst->stop_recording();
+        if (dvr_proxy_inst) dvr_proxy_inst->stop_recording();
         dvr_enabled = 0;
         osd_publish_bool_fact("dvr.recording", NULL, 0, false);
     }
 
+    // Start a new segment in every recording DVR at its next IDR.
+    // reason must be a string literal.
+    void dvr_segment_all(const char *reason) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        if (dvr_raw) dvr_raw->segment(reason);
+        if (dvr_reenc_inst) dvr_reenc_inst->segment(reason);
+        if (dvr_proxy_inst) dvr_proxy_inst->segment(reason);
+    }
+
     // Switch DVR mode at runtime. Stops any active recording.
     // mode: 0=raw, 1=reencode, 2=both
     void dvr_set_mode(int mode) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
         DvrMode new_mode = (DvrMode)mode;
         if (new_mode == dvr_mode) return;
 
@@ -664,16 +1031,26 @@ extern "C" {
             pthread_t       tp = g_tid_fproc;
             pthread_t       te = g_tid_enc;
             pthread_t       td = g_tid_dvr_reenc;
+            Dvr            *pd  = dvr_proxy_inst;
+            MppEncoder     *pe  = proxy_encoder;
+            pthread_t       tpd = g_tid_dvr_proxy;
+            pthread_t       tpe = g_tid_proxy_enc;
             frame_proc      = nullptr;
             reencoder       = nullptr;
             dvr_reenc_inst  = nullptr;
+            dvr_proxy_inst  = nullptr;
+            proxy_encoder   = nullptr;
             g_tid_fproc     = 0;
             g_tid_enc       = 0;
             g_tid_dvr_reenc = 0;
+            g_tid_dvr_proxy = 0;
+            g_tid_proxy_enc = 0;
             if (p) p->shutdown();
             if (e) e->shutdown();
+            if (pe) pe->shutdown();
             if (d) d->shutdown();
-            auto *ctx = new DvrShutdownCtx{d, p, e, td, tp, te};
+            if (pd) pd->shutdown();
+            auto *ctx = new DvrShutdownCtx{d, p, e, td, tp, te, pd, pe, tpd, tpe};
             pthread_t cleanup_tid;
             pthread_create(&cleanup_tid, NULL, dvr_shutdown_worker, ctx);
             pthread_detach(cleanup_tid);
@@ -702,6 +1079,13 @@ extern "C" {
             args.dvr_filenames_with_sequence = dvr_filenames_with_sequence;
             args.video_framerate = video_framerate;
             args.max_file_size = dvr_max_file_size;
+            args.segment_s = dvr_segment_s;
+            args.segment_align = dvr_segment_align;
+            args.segment_on_link_loss = dvr_segment_on_link_loss;
+            args.preroll_ms = dvr_preroll_ms;
+            args.preroll_max_bytes = dvr_preroll_max_bytes;
+            args.retention = dvr_retention;
+            args.telemetry_format = dvr_telemetry_format;
             args.video_p.video_frm_width = output_list ? output_list->video_frm_width : 0;
             args.video_p.video_frm_height = output_list ? output_list->video_frm_height : 0;
             args.video_p.codec = codec;
@@ -719,7 +1103,14 @@ extern "C" {
             args.dvr_filenames_with_sequence = dvr_filenames_with_sequence;
             args.video_framerate = reenc_params.fps;
             args.max_file_size = dvr_max_file_size;
-            uint32_t rw, rh; reenc_target_dims(rw, rh);
+            args.segment_s = dvr_segment_s;
+            args.segment_align = dvr_segment_align;
+            args.segment_on_link_loss = dvr_segment_on_link_loss;
+            args.preroll_ms = dvr_preroll_ms;
+            args.preroll_max_bytes = dvr_preroll_max_bytes;
+            args.retention = dvr_retention;
+            args.telemetry_format = dvr_telemetry_format;
+            uint32_t rw, rh; reenc_target_dims(reenc_params.resolution, rw, rh);
             args.video_p.video_frm_width = rw;
             args.video_p.video_frm_height = rh;
             args.video_p.codec = reenc_params.codec;
@@ -727,14 +1118,16 @@ extern "C" {
             pthread_create(&g_tid_dvr_reenc, NULL, &Dvr::__THREAD__, dvr_reenc_inst);
 
             reencoder = new MppEncoder(reenc_params,
-                             [](std::shared_ptr<std::vector<uint8_t>> nal) {
-                                 if (dvr_enabled && dvr_reenc_inst) dvr_reenc_inst->frame(nal);
+                             [](EncodedFramePtr nal, uint64_t pts_ms) {
+                                 if (dvr_frames_wanted() && dvr_reenc_inst) dvr_reenc_inst->frame(nal, pts_ms * 90);
                              });
             pthread_create(&g_tid_enc, NULL, &MppEncoder::__THREAD__, reencoder);
-            frame_proc = new FrameProcessor(reencoder, reenc_params.fps, reenc_params.resolution);
+            frame_proc = new FrameProcessor(reencoder, reenc_params.fps, reenc_params.resolution,
+                                            dvr_image_backend);
             if (enable_live_colortrans)
                 frame_proc->set_color_correction(live_colortrans_gain,
                                                 live_colortrans_offset, drm_fd);
+            dvr_proxy_create();
             pthread_create(&g_tid_fproc, NULL, &FrameProcessor::__THREAD__, frame_proc);
             dvr_reenc_inst->on_start_cb = []() { if (reencoder) reencoder->request_idr(); };
         }
@@ -747,15 +1140,55 @@ extern "C" {
     void dvr_reenc_set_mode(int enabled) {
         dvr_set_mode(enabled ? DVR_MODE_REENCODE : DVR_MODE_RAW);
     }
+
+    // GPIO button and menu; a no-op without --snapshot.
+    void snapshot_trigger(bool burst) {
+        if (snapshot) snapshot->trigger(burst);
+    }
+}
+
+// What DvrHealth may change when the card can't keep up.
+static DvrHealth::Actions dvr_health_actions() {
+    DvrHealth::Actions a;
+    a.set_bitrate = [](unsigned pct) {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        // Back to 100% also after the re-encoder is gone, so a later switch
+        // to re-encoding starts from the configured bitrate
+        if (pct < 100 && !reencoder)
+            return false;
+        int base = dvr_health_base_kbps ? dvr_health_base_kbps : reenc_params.bitrate_kbps;
+        reenc_params.bitrate_kbps = base * (int)pct / 100;
+        if (reencoder) reencoder->set_bitrate(reenc_params.bitrate_kbps);
+        dvr_health_base_kbps = pct >= 100 ? 0 : base;
+        return true;
+    };
+    // Only in both-mode: re-encoding alone usually writes less than the raw
+    // stream would
+    a.raw_only = []() {
+        std::lock_guard<std::recursive_mutex> lock(dvr_control_mtx);
+        if (dvr_mode != DVR_MODE_BOTH)
+            return false;
+        bool recording = dvr_enabled;
+        dvr_set_mode(DVR_MODE_RAW);
+        if (recording)
+            dvr_start_all();
+        return true;
+    };
+    a.drop_non_reference = [](bool on) {
+        dvr_drop_non_reference = on;
+        return true;
+    };
+    return a;
 }
 
 int decoder_stalled_count=0;
-bool feed_packet_to_decoder(MppPacket *packet,void* data_p,int data_len){
+// pts: the decoder hands it back on the frame; also when it was fed
+bool feed_packet_to_decoder(MppPacket *packet,void* data_p,int data_len,uint64_t pts){
     mpp_packet_set_data(packet, data_p);
     mpp_packet_set_size(packet, data_len);
     mpp_packet_set_pos(packet, data_p);
     mpp_packet_set_length(packet, data_len);
-    mpp_packet_set_pts(packet,(RK_S64) get_time_ms());
+    mpp_packet_set_pts(packet,(RK_S64) pts);
     // Feed the data to mpp until either timeout (in which case the decoder might have stalled)
     // or success
     uint64_t data_feed_begin = get_time_ms();
@@ -800,6 +1233,7 @@ static void reinit_mpp_decoder(MppCodingType new_type) {
     ret = mpi.mpi->control(mpi.ctx, MPP_SET_OUTPUT_BLOCK, &param);
     assert(!ret);
     current_mpp_type = new_type;
+    ref_loss.reset();
 
     mpp_reinit_pending.store(false, std::memory_order_release);
     pthread_mutex_unlock(&mpp_reinit_mutex);
@@ -831,6 +1265,10 @@ void skip_duration(int64_t skip_ms){
         receiver->skip_duration(skip_ms);
 }
 
+void scrub_playback(int keyframes){
+        receiver->scrub(keyframes);
+}
+
 void normal_playback() { 
         receiver->normal_playback();
 }
@@ -975,13 +1413,13 @@ void main_loop() {
 uint64_t first_frame_ms=0;
 void read_gstreamerpipe_stream(MppPacket *packet, int gst_udp_port, const char *sock ,const VideoCodec& codec){
 	if (sock) {
-		receiver = std::make_unique<GstRtpReceiver>(sock, codec);
+		receiver = std::make_unique<GstRtpReceiver>(sock, codec, socket_ingest);
 	} else {
 		receiver = std::make_unique<GstRtpReceiver>(gst_udp_port, codec);
 	}
 	long long bytes_received = 0; 
 	uint64_t period_start=0;
-    auto cb=[&packet,/*&decoder_stalled_count,*/ &bytes_received, &period_start](std::shared_ptr<std::vector<uint8_t>> frame){
+    auto cb=[&packet,/*&decoder_stalled_count,*/ &bytes_received, &period_start](EncodedFramePtr frame, uint64_t timestamp){
         // Let the gst pull thread run at quite high priority
         static bool first= false;
         static int stall_count = 0;
@@ -993,7 +1431,15 @@ void read_gstreamerpipe_stream(MppPacket *packet, int gst_udp_port, const char *
 		bytes_received += frame->size();
 		uint64_t now = get_time_ms();
 		osd_publish_uint_fact("gstreamer.received_bytes", NULL, 0, frame->size());
-        const bool fed_ok = feed_packet_to_decoder(packet,frame->data(),frame->size());
+        // Which access units the RTP losses came before, and whether the
+        // decoder's reference chain depends on them
+        static NalView nals;
+        nals.scan(frame->data(), frame->size(), current_mpp_type == MPP_VIDEO_CodingHEVC);
+        bool loss_confined = false;
+        const unsigned lost_packets = idr_take_rtp_losses(&loss_confined);
+        ref_loss.fed(now, nals.has_reference(), nals.has_irap(), lost_packets, loss_confined);
+        // MPP only reads the packet data
+        const bool fed_ok = feed_packet_to_decoder(packet,const_cast<uint8_t*>(frame->data()),frame->size(),now);
         if (!fed_ok) {
             stall_count++;
             if (stall_count >= 3 && (now - last_stall_idr_ms) > 500) {
@@ -1004,8 +1450,8 @@ void read_gstreamerpipe_stream(MppPacket *packet, int gst_udp_port, const char *
         } else {
             stall_count = 0;
         }
-        if (dvr_enabled && dvr_raw != NULL) {
-			dvr_raw->frame(frame);
+        if (dvr_frames_wanted() && dvr_raw != NULL) {
+			dvr_raw->frame(frame, timestamp);
         }
     };
     receiver->start_receiving(cb);
@@ -1081,10 +1527,20 @@ void printHelp() {
     "\n"
     "    --socket <socket>      - read data from socket\n"
     "\n"
+    "    --socket-seqpacket     - The socket is SOCK_SEQPACKET rather than SOCK_DGRAM\n"
+    "\n"
+    "    --socket-batch <n>     - Datagrams read from the socket per call   (Default: 32)\n"
+    "\n"
+    "    --socket-pool <n>      - Packet buffers for the socket; drops when they run out (Default: 128)\n"
+    "\n"
+    "    --socket-packet-size <bytes> - Largest datagram on the socket, up to 65535 (Default: 4096)\n"
+    "\n"
     "    --mavlink-port <port>  - UDP port for mavlink telemetry        (Default: 14550)\n"
     "\n"
     "    --mavlink-dvr-on-arm   - Start recording when armed\n"
     "\n"
+    "    --mavlink-rate <hz>    - Most times per second each mavlink message type is published, 0 for all (Default: 0)\n"
+    "\n"
     "    --codec <codec>        - Video codec, should be the same as on VTX  (Default: h265 <h264|h265>)\n"
     "\n"
     "    --log-level <level>    - Log verbosity level, debug|info|warn|error (Default: info)\n"
@@ -1106,10 +1562,33 @@ void printHelp() {
     "\n"
     "    --dvr-start            - Start DVR immediately\n"
     "\n"
-    "    --dvr-framerate <rate> - Force the dvr framerate for smoother dvr, ex: 60\n"
+    "    --dvr-framerate <rate> - Nominal dvr framerate (optional, sample timing comes from the stream), ex: 60\n"
     "\n"
     "    --dvr-max-size <MB>    - Split DVR files at <MB> megabytes (Default: 4000, for VFAT)\n"
     "\n"
+    "    --dvr-segment <s>      - Start a new DVR file every <s> seconds, on an IDR (Default: 0, off)\n"
+    "\n"
+    "    --dvr-segment-align    - Put segment boundaries on multiples of --dvr-segment of the clock\n"
+    "\n"
+    "    --dvr-segment-on <events> - Also start a new DVR file on these events, comma separated:\n"
+    "                             arm (arm/disarm transitions), link-loss (video lost for 1 s or more)\n"
+    "\n"
+    "    --dvr-telemetry <facts> - Record these OSD facts next to the DVR video, comma separated,\n"
+    "                             a trailing * matches a prefix. Ex: mavlink.*,wfbcli.rx.ant_stats.rssi_avg\n"
+    "\n"
+    "    --dvr-telemetry-format <fmt> - Telemetry sidecar format: csv or srt (Default: csv)\n"
+    "\n"
+    "    --dvr-preroll <s>      - Start recordings with the <s> seconds before the start (Default: 0, off)\n"
+    "\n"
+    "    --dvr-preroll-max-mb <MB> - Memory used for the pre-roll at most (Default: 64)\n"
+    "\n"
+    "    --dvr-min-free <MB>    - Delete the oldest recordings to keep <MB> megabytes free (Default: 0, off)\n"
+    "\n"
+    "    --dvr-quota <MB>       - Delete the oldest recordings to keep them under <MB> megabytes in total (Default: 0, off)\n"
+    "                             Recordings with a <file>.keep file next to them are never deleted\n"
+    "\n"
+    "    --dvr-no-degrade       - Only report a DVR card that can't keep up, don't lower the recording quality\n"
+    "\n"
     "    --dvr-fmp4             - Save the video feed as a fragmented mp4\n"
     "\n"
     "    --dvr-mode <mode>      - DVR recording mode: raw, reencode, or both (Default: raw)\n"
@@ -1120,10 +1599,54 @@ void printHelp() {
     "\n"
     "    --dvr-reenc-fps <fps>  - Re-encode output FPS            (Default: 30)\n"
     "\n"
-    "    --dvr-reenc-resolution <r> - Re-encode resolution: 720p or 1080p (Default: 1080p)\n"
+    "    --dvr-reenc-resolution <r> - Re-encode resolution: <h>p (16:9, e.g. 720p) or <w>x<h> (Default: 1080p)\n"
+    "                             Frames are fitted into it keeping the aspect ratio of the source\n"
+    "\n"
+    "    --dvr-proxy <r>        - Also record a small proxy of the re-encoded stream, <file>_proxy.mp4,\n"
+    "                             at resolution <r> (same forms as above, e.g. 480p)\n"
+    "\n"
+    "    --dvr-proxy-bitrate <k>- Proxy bitrate in kbps            (Default: 1000)\n"
+    "\n"
+    "    --dvr-reenc-in-flight <n> - Frames the re-encoder works on at once, 1-8 (Default: 2)\n"
+    "\n"
+    "    --dvr-reenc-rc <mode>  - Re-encode rate control: cbr, vbr, avbr or fixqp (Default: cbr)\n"
+    "                             vbr/avbr spend the bits on motion instead of static scenes\n"
+    "\n"
+    "    --dvr-reenc-qp <min>-<max> - QP bounds for cbr/vbr/avbr, 1-51   (Default: 10-51)\n"
+    "\n"
+    "    --dvr-reenc-fixed-qp <qp>  - QP of every frame with fixqp       (Default: 26)\n"
+    "\n"
+    "    --dvr-reenc-gop <frames>   - Frames between IDRs               (Default: 2 seconds)\n"
+    "\n"
+    "    --dvr-reenc-intra-refresh <rows> - Intra code this many macroblock rows per frame (Default: off)\n"
     "\n"
     "    --dvr-osd              - Blend the OSD into the DVR recording\n"
     "\n"
+    "    --dvr-image-ops <b>    - Copy, scale and blend re-encoded frames with: auto (RGA, the CPU\n"
+    "                             taking over what it fails), rga or cpu     (Default: auto)\n"
+    "\n"
+    "    --restream-reenc <r>   - Restream a re-encoded video at resolution <r> (<h>p or <w>x<h>)\n"
+    "                             instead of forwarding the received RTP\n"
+    "\n"
+    "    --restream-bitrate <k> - Re-encoded restream bitrate in kbps (Default: 1500)\n"
+    "\n"
+    "    --restream-codec <c>   - Re-encoded restream codec: h264 or h265 (Default: h264)\n"
+    "\n"
+    "    --restream-dest <host:port>[@<kbps>][,...] - Also restream there, always, paced to\n"
+    "                             <kbps> if given. Destinations can be changed at runtime by writing\n"
+    "                             \"add <host:port> [kbps]\", \"remove|enable|disable <host:port>\" or\n"
+    "                             \"pace <host:port> <kbps>\" to " RESTREAM_FIFO_NAME "\n"
+    "\n"
+    "    --snapshot <dir>       - Enable JPEG snapshots of the video, written to <dir>. Taken by\n"
+    "                             SIGRTMIN (a burst by SIGRTMIN+1), the \"snap\" GPIO button (long\n"
+    "                             press for a burst), or writing \"snap\" / \"burst [n]\" to " SNAPSHOT_FIFO_NAME "\n"
+    "\n"
+    "    --snapshot-quality <q> - JPEG quality 1-100                 (Default: 90)\n"
+    "\n"
+    "    --snapshot-osd         - Blend the OSD into snapshots\n"
+    "\n"
+    "    --snapshot-burst <n>   - Frames per burst, 100 ms apart     (Default: 5)\n"
+    "\n"
     "    --screen-mode <mode>   - Override default screen mode. <width>x<heigth>@<fps> ex: 1920x1080@120\n"
     "\n"
     "    --video-plane-id       - Override default drm plane used for video by plane-id\n"
@@ -1188,6 +1711,26 @@ int main(int argc, char **argv)
 		continue;
 	}
 
+	__OnArgument("--socket-seqpacket") {
+		socket_ingest.seqpacket = true;
+		continue;
+	}
+
+	__OnArgument("--socket-batch") {
+		socket_ingest.batch = atoi(__ArgValue);
+		continue;
+	}
+
+	__OnArgument("--socket-pool") {
+		socket_ingest.pool_buffers = atoi(__ArgValue);
+		continue;
+	}
+
+	__OnArgument("--socket-packet-size") {
+		socket_ingest.packet_size = atoi(__ArgValue);
+		continue;
+	}
+
 	__OnArgument("--config") {
 		// Already handled above, just skip
 		config_file_path = const_cast<char*>(__ArgValue);
@@ -1234,6 +1777,99 @@ int main(int argc, char **argv)
 		continue;
 	}
 
+	__OnArgument("--dvr-segment") {
+		int sec = atoi(__ArgValue);
+		if (sec < 0) {
+			fprintf(stderr, "invalid --dvr-segment value\n");
+			return -1;
+		}
+		dvr_segment_s = sec;
+		continue;
+	}
+
+	__OnArgument("--dvr-segment-align") {
+		dvr_segment_align = true;
+		continue;
+	}
+
+	__OnArgument("--dvr-segment-on") {
+		char* events = const_cast<char*>(__ArgValue);
+		for (char *event = strtok(events, ","); event; event = strtok(NULL, ",")) {
+			if (!strcmp(event, "arm")) {
+				mavlink_dvr_segment_on_arm = true;
+			} else if (!strcmp(event, "link-loss")) {
+				dvr_segment_on_link_loss = true;
+			} else {
+				fprintf(stderr, "invalid --dvr-segment-on event: %s\n", event);
+				return -1;
+			}
+		}
+		continue;
+	}
+
+	__OnArgument("--dvr-telemetry") {
+		DvrTelemetry::select(__ArgValue);
+		continue;
+	}
+
+	__OnArgument("--dvr-telemetry-format") {
+		const char *fmt = __ArgValue;
+		if (!strcmp(fmt, "csv")) {
+			dvr_telemetry_format = DvrTelemetry::CSV;
+		} else if (!strcmp(fmt, "srt")) {
+			dvr_telemetry_format = DvrTelemetry::SRT;
+		} else {
+			fprintf(stderr, "invalid --dvr-telemetry-format value\n");
+			return -1;
+		}
+		continue;
+	}
+
+	__OnArgument("--dvr-preroll") {
+		int sec = atoi(__ArgValue);
+		if (sec < 0) {
+			fprintf(stderr, "invalid --dvr-preroll value\n");
+			return -1;
+		}
+		dvr_preroll_ms = sec * 1000;
+		continue;
+	}
+
+	__OnArgument("--dvr-preroll-max-mb") {
+		int mb = atoi(__ArgValue);
+		if (mb <= 0) {
+			fprintf(stderr, "invalid --dvr-preroll-max-mb value\n");
+			return -1;
+		}
+		dvr_preroll_max_bytes = (size_t)mb * 1024 * 1024;
+		continue;
+	}
+
+	__OnArgument("--dvr-min-free") {
+		int mb = atoi(__ArgValue);
+		if (mb < 0) {
+			fprintf(stderr, "invalid --dvr-min-free value\n");
+			return -1;
+		}
+		dvr_min_free_bytes = (uint64_t)mb * 1000000ULL;
+		continue;
+	}
+
+	__OnArgument("--dvr-quota") {
+		int mb = atoi(__ArgValue);
+		if (mb < 0) {
+			fprintf(stderr, "invalid --dvr-quota value\n");
+			return -1;
+		}
+		dvr_quota_bytes = (uint64_t)mb * 1000000ULL;
+		continue;
+	}
+
+	__OnArgument("--dvr-no-degrade") {
+		dvr_degrade = false;
+		continue;
+	}
+
 	__OnArgument("--dvr-fmp4") {
 		mp4_fragmentation_mode = 1;
 		continue;
@@ -1271,22 +1907,91 @@ int main(int argc, char **argv)
 		continue;
 	}
 
+	__OnArgument("--dvr-reenc-in-flight") {
+		int n = atoi(__ArgValue);
+		if (n < 1 || n > 8) {
+			fprintf(stderr, "invalid --dvr-reenc-in-flight value (1-8)\n");
+			return -1;
+		}
+		reenc_params.in_flight = n;
+		continue;
+	}
+
+	__OnArgument("--dvr-reenc-rc") {
+		if (!EncRateControl::parse_mode(__ArgValue, reenc_params.rc.mode)) {
+			fprintf(stderr, "unsupported --dvr-reenc-rc (use cbr, vbr, avbr or fixqp)\n");
+			return -1;
+		}
+		continue;
+	}
+
+	__OnArgument("--dvr-reenc-qp") {
+		int qp_min = 0, qp_max = 0;
+		if (sscanf(__ArgValue, "%d-%d", &qp_min, &qp_max) != 2 ||
+		    qp_min < 1 || qp_max > 51 || qp_min > qp_max) {
+			fprintf(stderr, "invalid --dvr-reenc-qp value (<min>-<max>, 1-51)\n");
+			return -1;
+		}
+		reenc_params.rc.qp_min = qp_min;
+		reenc_params.rc.qp_max = qp_max;
+		continue;
+	}
+
+	__OnArgument("--dvr-reenc-fixed-qp") {
+		int qp = atoi(__ArgValue);
+		if (qp < 1 || qp > 51) {
+			fprintf(stderr, "invalid --dvr-reenc-fixed-qp value (1-51)\n");
+			return -1;
+		}
+		reenc_params.rc.qp_fixed = qp;
+		continue;
+	}
+
+	__OnArgument("--dvr-reenc-gop") {
+		reenc_params.rc.gop = atoi(__ArgValue);
+		continue;
+	}
+
+	__OnArgument("--dvr-reenc-intra-refresh") {
+		reenc_params.rc.intra_refresh = atoi(__ArgValue);
+		continue;
+	}
+
 	__OnArgument("--dvr-reenc-resolution") {
-		const char *v = __ArgValue;
-		if (!strcmp(v, "720p")) reenc_params.resolution = EncResolution::Res720p;
-		else if (!strcmp(v, "1080p")) reenc_params.resolution = EncResolution::Res1080p;
-		else {
-			fprintf(stderr, "unsupported resolution for --dvr-reenc-resolution (use 720p or 1080p)\n");
+		if (!EncResolution::parse(__ArgValue, reenc_params.resolution)) {
+			fprintf(stderr, "unsupported resolution for --dvr-reenc-resolution (use <h>p or <w>x<h>, even sizes)\n");
 			return -1;
 		}
 		continue;
 	}
 
+	__OnArgument("--dvr-proxy") {
+		if (!EncResolution::parse(__ArgValue, dvr_proxy_resolution)) {
+			fprintf(stderr, "unsupported resolution for --dvr-proxy (use <h>p or <w>x<h>, even sizes)\n");
+			return -1;
+		}
+		dvr_proxy = true;
+		continue;
+	}
+
+	__OnArgument("--dvr-proxy-bitrate") {
+		dvr_proxy_bitrate_kbps = atoi(__ArgValue);
+		continue;
+	}
+
 	__OnArgument("--dvr-osd") {
 		dvr_osd = true;
 		continue;
 	}
 
+	__OnArgument("--dvr-image-ops") {
+		if (!image_backend_parse(__ArgValue, dvr_image_backend)) {
+			fprintf(stderr, "--dvr-image-ops must be auto, rga or cpu\n");
+			return -1;
+		}
+		continue;
+	}
+
 	__OnArgument("--log-level") {
 		std::string log_l = std::string(__ArgValue);
 		if (log_l == "info") {
@@ -1316,6 +2021,11 @@ int main(int argc, char **argv)
 		continue;
 	}
 
+	__OnArgument("--mavlink-rate") {
+		mavlink_max_rate = atoi(__ArgValue);
+		continue;
+	}
+
 	__OnArgument("--osd") {
 		enable_osd = 1;
 		mavlink_thread = 1;
@@ -1346,6 +2056,83 @@ int main(int argc, char **argv)
 		continue;
 	}
 
+	__OnArgument("--restream-reenc") {
+		if (!EncResolution::parse(__ArgValue, restream_params.resolution)) {
+			fprintf(stderr, "unsupported resolution for --restream-reenc (use <h>p or <w>x<h>, even sizes)\n");
+			return -1;
+		}
+		restream_reenc = true;
+		continue;
+	}
+
+	__OnArgument("--restream-bitrate") {
+		restream_params.bitrate_kbps = atoi(__ArgValue);
+		continue;
+	}
+
+	__OnArgument("--restream-codec") {
+		VideoCodec c = video_codec(const_cast<char*>(__ArgValue));
+		if (c == VideoCodec::UNKNOWN) {
+			fprintf(stderr, "unsupported codec for --restream-codec (use h264 or h265)\n");
+			return -1;
+		}
+		restream_params.codec = c;
+		continue;
+	}
+
+	__OnArgument("--restream-dest") {
+		std::stringstream ss(__ArgValue);
+		std::string dest;
+		while (std::getline(ss, dest, ',')) {
+			sockaddr_in addr;
+			std::string spec = dest;
+			long kbps = 0;
+			size_t at = dest.find('@');
+			if (at != std::string::npos) {
+				char *end = nullptr;
+				kbps = strtol(dest.c_str() + at + 1, &end, 10);
+				if (*end || kbps < 1) kbps = -1;
+				dest.resize(at);
+			}
+			if (kbps < 0 || !RtpFanout::parse_destination(dest, addr)) {
+				fprintf(stderr, "invalid --restream-dest %s (use <host>:<port>[@<kbps>])\n", spec.c_str());
+				return -1;
+			}
+			restream_dests.emplace_back(dest, (unsigned)kbps);
+		}
+		continue;
+	}
+
+	__OnArgument("--snapshot") {
+		snapshot_params.dir = __ArgValue;
+		continue;
+	}
+
+	__OnArgument("--snapshot-quality") {
+		int q = atoi(__ArgValue);
+		if (q < 1 || q > 100) {
+			fprintf(stderr, "--snapshot-quality must be 1-100\n");
+			return -1;
+		}
+		snapshot_params.quality = q;
+		continue;
+	}
+
+	__OnArgument("--snapshot-osd") {
+		snapshot_params.with_osd = true;
+		continue;
+	}
+
+	__OnArgument("--snapshot-burst") {
+		int n = atoi(__ArgValue);
+		if (n < 1 || n > (int)Snapshot::MAX_BURST) {
+			fprintf(stderr, "--snapshot-burst must be 1-%u\n", Snapshot::MAX_BURST);
+			return -1;
+		}
+		snapshot_params.burst = n;
+		continue;
+	}
+
 	__OnArgument("--screen-mode") {
 		char* mode = const_cast<char*>(__ArgValue);
 		mode_width = atoi(strtok(mode, "x"));
@@ -1412,12 +2199,6 @@ int main(int argc, char **argv)
 	spdlog::set_level(log_level);
 	idr_set_enabled(!disable_gregidr);
 
-	if (dvr_template != NULL && (dvr_mode == DVR_MODE_RAW || dvr_mode == DVR_MODE_BOTH) && video_framerate < 0) {
-		printf("--dvr-framerate must be provided when raw DVR is enabled.\n"
-		       "Use --dvr-mode reencode with --dvr-reenc-fps for hardware re-encoding only.\n");
-		return 0;
-	}
-
 	printf("PixelPilot Rockchip %d.%d\n", APP_VERSION_MAJOR, APP_VERSION_MINOR);
 
 	// Load yaml config
@@ -1602,6 +2383,10 @@ int main(int argc, char **argv)
 		signal(SIGUSR1, sigusr1_handler);
 	}
 	signal(SIGUSR2, sigusr2_handler);
+	if (!snapshot_params.dir.empty()) {
+		signal(SIGRTMIN, snapshot_signal_handler);
+		signal(SIGRTMIN + 1, snapshot_signal_handler);
+	}
  	//////////////////// THREADS SETUP
 	
 	ret = pthread_mutex_init(&video_mutex, NULL);
@@ -1611,6 +2396,15 @@ int main(int argc, char **argv)
 
 	pthread_t tid_frame, tid_display, tid_osd, tid_mavlink, tid_wfbcli;
 	if (dvr_template != NULL) {
+		// Look for recordings cut short by a crash before anything new is written
+		dvr_recovery = new DvrRecovery(std::filesystem::path(dvr_template).parent_path().string());
+		if (dvr_recovery->pending()) {
+			ret = pthread_create(&g_tid_dvr_recover, NULL, &DvrRecovery::__THREAD__, dvr_recovery);
+			assert(!ret);
+		}
+		dvr_retention = new DvrRetention(std::filesystem::path(dvr_template).parent_path().string(),
+										 dvr_min_free_bytes, dvr_quota_bytes);
+
 		bool has_raw   = (dvr_mode == DVR_MODE_RAW || dvr_mode == DVR_MODE_BOTH);
 		bool has_reenc = (dvr_mode == DVR_MODE_REENCODE || dvr_mode == DVR_MODE_BOTH);
 		bool both      = (dvr_mode == DVR_MODE_BOTH);
@@ -1623,6 +2417,13 @@ int main(int argc, char **argv)
 			args.dvr_filenames_with_sequence = dvr_filenames_with_sequence;
 			args.video_framerate = video_framerate;
 			args.max_file_size = dvr_max_file_size;
+			args.segment_s = dvr_segment_s;
+			args.segment_align = dvr_segment_align;
+			args.segment_on_link_loss = dvr_segment_on_link_loss;
+			args.preroll_ms = dvr_preroll_ms;
+			args.preroll_max_bytes = dvr_preroll_max_bytes;
+			args.retention = dvr_retention;
+			args.telemetry_format = dvr_telemetry_format;
 			args.video_p.video_frm_width = output_list->video_frm_width;
 			args.video_p.video_frm_height = output_list->video_frm_height;
 			args.video_p.codec = codec;
@@ -1639,7 +2440,14 @@ int main(int argc, char **argv)
 			args.dvr_filenames_with_sequence = dvr_filenames_with_sequence;
 			args.video_framerate = reenc_params.fps;
 			args.max_file_size = dvr_max_file_size;
-			uint32_t rw, rh; reenc_target_dims(rw, rh);
+			args.segment_s = dvr_segment_s;
+			args.segment_align = dvr_segment_align;
+			args.segment_on_link_loss = dvr_segment_on_link_loss;
+			args.preroll_ms = dvr_preroll_ms;
+			args.preroll_max_bytes = dvr_preroll_max_bytes;
+			args.retention = dvr_retention;
+			args.telemetry_format = dvr_telemetry_format;
+			uint32_t rw, rh; reenc_target_dims(reenc_params.resolution, rw, rh);
 			args.video_p.video_frm_width = rw;
 			args.video_p.video_frm_height = rh;
 			args.video_p.codec = reenc_params.codec;
@@ -1647,28 +2455,31 @@ int main(int argc, char **argv)
 			ret = pthread_create(&g_tid_dvr_reenc, NULL, &Dvr::__THREAD__, dvr_reenc_inst);
 			assert(!ret);
 
-			reencoder = new MppEncoder(reenc_params, [](std::shared_ptr<std::vector<uint8_t>> nal) {
-				if (dvr_enabled && dvr_reenc_inst != NULL) {
-					dvr_reenc_inst->frame(nal);
+			reencoder = new MppEncoder(reenc_params, [](EncodedFramePtr nal, uint64_t pts_ms) {
+				if (dvr_frames_wanted() && dvr_reenc_inst != NULL) {
+					dvr_reenc_inst->frame(nal, pts_ms * 90);
 				}
 			});
 			ret = pthread_create(&g_tid_enc, NULL, &MppEncoder::__THREAD__, reencoder);
 			assert(!ret);
-			frame_proc = new FrameProcessor(reencoder, reenc_params.fps, reenc_params.resolution);
+			frame_proc = new FrameProcessor(reencoder, reenc_params.fps, reenc_params.resolution,
+			                                dvr_image_backend);
 			if (enable_live_colortrans) {
 				frame_proc->set_color_correction(live_colortrans_gain,
 				                                live_colortrans_offset, drm_fd);
 				spdlog::info("Encoder color correction enabled: gain={} offset={}",
 				             live_colortrans_gain, live_colortrans_offset);
 			}
+			dvr_proxy_create();
 			ret = pthread_create(&g_tid_fproc, NULL, &FrameProcessor::__THREAD__, frame_proc);
 			assert(!ret);
 			dvr_reenc_inst->on_start_cb = []() {
 				if (reencoder) reencoder->request_idr();
 			};
-			spdlog::info("Re-encoding recorder: codec={} fps={} bitrate={}kbps",
+			spdlog::info("Re-encoding recorder: codec={} fps={} bitrate={}kbps rc={}",
 			             reenc_params.codec == VideoCodec::H265 ? "h265" : "h264",
-			             reenc_params.fps, reenc_params.bitrate_kbps);
+			             reenc_params.fps, reenc_params.bitrate_kbps,
+			             EncRateControl::mode_name(reenc_params.rc.mode));
 		}
 
 		if (dvr_autostart) {
@@ -1676,8 +2487,21 @@ int main(int argc, char **argv)
 			osd_publish_bool_fact("dvr.recording", NULL, 0, true);
 			if (dvr_raw) dvr_raw->start_recording();
 			if (dvr_reenc_inst) dvr_reenc_inst->start_recording();
+			if (dvr_proxy_inst) dvr_proxy_inst->start_recording();
 			if (reencoder) reencoder->request_idr();
+			if (proxy_encoder) proxy_encoder->request_idr();
 		}
+
+		dvr_health = new DvrHealth(dvr_health_actions(), dvr_degrade);
+		ret = pthread_create(&g_tid_dvr_health, NULL, &DvrHealth::__THREAD__, dvr_health);
+		assert(!ret);
+	}
+	restream_fanout_start();
+	if (!snapshot_params.dir.empty()) {
+		snapshot_params.fifo = SNAPSHOT_FIFO_NAME;
+		snapshot = new Snapshot(snapshot_params);
+		ret = pthread_create(&g_tid_snapshot, NULL, &Snapshot::__THREAD__, snapshot);
+		assert(!ret);
 	}
 	ret = pthread_create(&tid_frame, NULL, __FRAME_THREAD__, NULL);
 	assert(!ret);
@@ -1746,6 +2570,13 @@ int main(int argc, char **argv)
 		ret = pthread_join(tid_osd, NULL);
 		assert(!ret);
 	}
+	restream_fanout_stop();
+	if (snapshot) {
+		ret = pthread_join(g_tid_snapshot, NULL);
+		assert(!ret);
+		delete snapshot;
+		snapshot = nullptr;
+	}
 	if (dvr_template != NULL) {
 		if (g_tid_fproc) {
 			ret = pthread_join(g_tid_fproc, NULL);
@@ -1755,6 +2586,10 @@ int main(int argc, char **argv)
 			ret = pthread_join(g_tid_enc, NULL);
 			assert(!ret);
 		}
+		if (g_tid_proxy_enc) {
+			ret = pthread_join(g_tid_proxy_enc, NULL);
+			assert(!ret);
+		}
 		if (g_tid_dvr_raw) {
 			ret = pthread_join(g_tid_dvr_raw, NULL);
 			assert(!ret);
@@ -1763,6 +2598,24 @@ int main(int argc, char **argv)
 			ret = pthread_join(g_tid_dvr_reenc, NULL);
 			assert(!ret);
 		}
+		if (g_tid_dvr_proxy) {
+			ret = pthread_join(g_tid_dvr_proxy, NULL);
+			assert(!ret);
+		}
+		if (g_tid_dvr_recover) {
+			ret = pthread_join(g_tid_dvr_recover, NULL);
+			assert(!ret);
+		}
+		if (g_tid_dvr_health) {
+			ret = pthread_join(g_tid_dvr_health, NULL);
+			assert(!ret);
+		}
+		delete dvr_health;
+		dvr_health = nullptr;
+		delete dvr_recovery;
+		dvr_recovery = nullptr;
+		delete dvr_retention;
+		dvr_retention = nullptr;
 	}
 
 	ret = mpi.mpi->reset(mpi.ctx);
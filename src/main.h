@@ -6,6 +6,7 @@ void switch_pipeline_source(const char * source_type, const char * source_path);
 void fast_forward(double rate);
 void fast_rewind(double rate);
 void skip_duration(int64_t skip_ms);
+void scrub_playback(int keyframes);
 void normal_playback();
 void pause_playback();
 void resume_playback();
@@ -17,6 +17,8 @@
 #include <pthread.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <sys/epoll.h>
+#include <time.h>
 
 #include <sys/prctl.h>
 #include <sys/sem.h>
@@ -28,6 +30,7 @@
 // C-compatible interface to DVR control (defined in main.cpp)
 void dvr_start_all(void);
 void dvr_stop_all(void);
+void dvr_segment_all(const char *reason);
 
 #define earthRadiusKm 6371.0
 #define BILLION 1000000000L
@@ -81,12 +84,280 @@ char* insertString(char s1[], const char s2[], size_t pos) {
 
 int mavlink_port = 14550;
 int mavlink_thread_signal = 0;
+int mavlink_max_rate = 0;
+
+#define MAVLINK_BATCH 16
+#define MAVLINK_DGRAM_SIZE 2048
+
+static uint64_t mavlink_now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Tags of each sender, formatted the first time it is heard from. The third
+// tag is left to the messages that have one (imu_id, battery_id).
+#define MAVLINK_SOURCES 16
+static struct {
+  int used;
+  uint8_t sysid, compid;
+  osd_tag tags[3];
+} sources[MAVLINK_SOURCES];
+static int sources_next;
+
+static osd_tag *source_tags(uint8_t sysid, uint8_t compid) {
+  for (int i = 0; i < MAVLINK_SOURCES && sources[i].used; i++) {
+    if (sources[i].sysid == sysid && sources[i].compid == compid)
+      return sources[i].tags;
+  }
+  // New sender; when all slots are taken the oldest one goes
+  int i = sources_next;
+  sources_next = (sources_next + 1) % MAVLINK_SOURCES;
+  sources[i].used = 1;
+  sources[i].sysid = sysid;
+  sources[i].compid = compid;
+  strcpy(sources[i].tags[0].key, "sysid");
+  snprintf(sources[i].tags[0].val, sizeof(sources[i].tags[0].val), "%d", sysid);
+  strcpy(sources[i].tags[1].key, "compid");
+  snprintf(sources[i].tags[1].val, sizeof(sources[i].tags[1].val), "%d", compid);
+  return sources[i].tags;
+}
+
+// Last time each message type was published, per sender and sub-id
+#define MAVLINK_RATE_SLOTS 128
+static struct {
+  int used;
+  uint32_t msgid;
+  uint8_t sysid, compid, subid;
+  uint64_t last_ms;
+} rates[MAVLINK_RATE_SLOTS];
+
+bool mavlink_rate_allow(uint32_t msgid, uint8_t sysid, uint8_t compid, uint8_t subid, uint64_t now_ms) {
+  if (mavlink_max_rate <= 0)
+    return true;
+  uint32_t h = (msgid * 31 + sysid) * 31 + compid;
+  h = (h * 31 + subid) % MAVLINK_RATE_SLOTS;
+  for (int n = 0; n < MAVLINK_RATE_SLOTS; n++, h = (h + 1) % MAVLINK_RATE_SLOTS) {
+    if (!rates[h].used) {
+      rates[h].used = 1;
+      rates[h].msgid = msgid;
+      rates[h].sysid = sysid;
+      rates[h].compid = compid;
+      rates[h].subid = subid;
+      rates[h].last_ms = now_ms;
+      return true;
+    }
+    if (rates[h].msgid == msgid && rates[h].sysid == sysid &&
+        rates[h].compid == compid && rates[h].subid == subid) {
+      if (now_ms - rates[h].last_ms < (uint64_t)(1000 / mavlink_max_rate))
+        return false;
+      rates[h].last_ms = now_ms;
+      return true;
+    }
+  }
+  // Table full: no throttling for the newcomers
+  return true;
+}
+
+static void handle_message(const mavlink_message_t *message, uint64_t now_ms) {
+  static int current_arm_state = -1;
+  uint8_t subid = 0;
+  if (message->msgid == MAVLINK_MSG_ID_RAW_IMU) {
+    subid = mavlink_msg_raw_imu_get_id(message);
+  } else if (message->msgid == MAVLINK_MSG_ID_BATTERY_STATUS) {
+    subid = mavlink_msg_battery_status_get_id(message);
+  }
+  // Heartbeats drive the arm state, they are never skipped
+  if (message->msgid != MAVLINK_MSG_ID_HEARTBEAT &&
+      !mavlink_rate_allow(message->msgid, message->sysid, message->compid, subid, now_ms)) {
+    return;
+  }
+
+  osd_tag *tags = source_tags(message->sysid, message->compid);
+  switch (message->msgid) {
+    case MAVLINK_MSG_ID_HEARTBEAT:
+      {
+        mavlink_heartbeat_t heartbeat = {};
+        mavlink_msg_heartbeat_decode(message, &heartbeat);
+        int received_arm_state = (heartbeat.base_mode & MAV_MODE_FLAG_SAFETY_ARMED) != 0;
+        if (current_arm_state != received_arm_state) {
+            int prev_arm_state = current_arm_state;
+            osd_publish_bool_fact("mavlink.heartbeet.base_mode.armed", tags, 2, received_arm_state);
+            current_arm_state = received_arm_state;
+            if (mavlink_dvr_on_arm) {
+              if (received_arm_state) {
+                dvr_start_all();
+              } else {
+                dvr_stop_all();
+              }
+            } else if (mavlink_dvr_segment_on_arm && prev_arm_state != -1) {
+              dvr_segment_all(received_arm_state ? "arm" : "disarm");
+            }
+        }
+      }
+      break;
+    case MAVLINK_MSG_ID_RAW_IMU:
+      {
+        mavlink_raw_imu_t imu;
+        void *batch = osd_batch_init(7);
+        mavlink_msg_raw_imu_decode(message, &imu);
+        strcpy(tags[2].key, "imu_id");
+        snprintf(tags[2].val, sizeof(tags[2].val), "%d", imu.id);
+        osd_add_int_fact(batch, "mavlink.raw_imu.xacc", tags, 3, (long) imu.xacc);
+        osd_add_int_fact(batch, "mavlink.raw_imu.yacc", tags, 3, (long) imu.yacc);
+        osd_add_int_fact(batch, "mavlink.raw_imu.zacc", tags, 3, (long) imu.zacc);
+        osd_add_int_fact(batch, "mavlink.raw_imu.xgyro", tags, 3, (long) imu.xgyro);
+        osd_add_int_fact(batch, "mavlink.raw_imu.ygyro", tags, 3, (long) imu.ygyro);
+        osd_add_int_fact(batch, "mavlink.raw_imu.zgyro", tags, 3, (long) imu.zgyro);
+        osd_add_int_fact(batch, "mavlink.raw_imu.temperature", tags, 3, (long) imu.temperature);
+        osd_publish_batch(batch);
+      }
+      break;
+		
+    case MAVLINK_MSG_ID_SYS_STATUS:
+      {
+        mavlink_sys_status_t bat;
+        void *batch = osd_batch_init(2);
+        mavlink_msg_sys_status_decode(message, &bat);
+        osd_add_uint_fact(batch, "mavlink.sys_status.voltage_battery", tags, 2, (ulong) bat.voltage_battery);
+        osd_add_int_fact(batch, "mavlink.sys_status.current_battery", tags, 2, (long) bat.current_battery);
+        osd_publish_batch(batch);
+      }
+      break;
+
+    case MAVLINK_MSG_ID_BATTERY_STATUS:
+      {
+        mavlink_battery_status_t batt;
+        void *batch = osd_batch_init(2);
+        mavlink_msg_battery_status_decode(message, &batt);
+        strcpy(tags[2].key, "battery_id");
+        snprintf(tags[2].val, sizeof(tags[2].val), "%d", batt.id);
+        osd_add_int_fact(batch, "mavlink.battery_status.current_consumed", tags, 3, (long) batt.current_consumed);
+        osd_add_int_fact(batch, "mavlink.battery_status.energy_consumed", tags, 3, (long) batt.energy_consumed);
+        osd_publish_batch(batch);
+      }
+      break;
+
+    case MAVLINK_MSG_ID_RC_CHANNELS_RAW:
+      {
+        mavlink_rc_channels_raw_t rc_channels_raw;
+        void *batch = osd_batch_init(8);
+        mavlink_msg_rc_channels_raw_decode( message, &rc_channels_raw);
+        osd_add_uint_fact(batch, "mavlink.rc_channels_raw.chan1", tags, 2, (ulong) rc_channels_raw.chan1_raw);
+        osd_add_uint_fact(batch, "mavlink.rc_channels_raw.chan2", tags, 2, (ulong) rc_channels_raw.chan2_raw);
+        osd_add_uint_fact(batch, "mavlink.rc_channels_raw.chan3", tags, 2, (ulong) rc_channels_raw.chan3_raw);
+        osd_add_uint_fact(batch, "mavlink.rc_channels_raw.chan4", tags, 2, (ulong) rc_channels_raw.chan4_raw);
+        osd_add_uint_fact(batch, "mavlink.rc_channels_raw.chan5", tags, 2, (ulong) rc_channels_raw.chan5_raw);
+        osd_add_uint_fact(batch, "mavlink.rc_channels_raw.chan6", tags, 2, (ulong) rc_channels_raw.chan6_raw);
+        osd_add_uint_fact(batch, "mavlink.rc_channels_raw.chan7", tags, 2, (ulong) rc_channels_raw.chan7_raw);
+        osd_add_uint_fact(batch, "mavlink.rc_channels_raw.chan8", tags, 2, (ulong) rc_channels_raw.chan8_raw);
+        osd_publish_batch(batch);
+      }
+      break;
+
+    case MAVLINK_MSG_ID_GPS_RAW_INT:
+      {
+        mavlink_gps_raw_int_t gps;
+        void *batch = osd_batch_init(7);
+        mavlink_msg_gps_raw_int_decode(message, &gps);
+        osd_add_int_fact(batch, "mavlink.gps_raw.lat", tags, 2, (long) gps.lat); //degE7
+        osd_add_int_fact(batch, "mavlink.gps_raw.lon", tags, 2, (long) gps.lon); //degE7
+        osd_add_int_fact(batch, "mavlink.gps_raw.alt", tags, 2, (long) gps.alt); //mm
+        osd_add_uint_fact(batch, "mavlink.gps_raw.vel", tags, 2, (ulong) gps.vel); //cm/s
+        osd_add_uint_fact(batch, "mavlink.gps_raw.cog", tags, 2, (ulong) gps.cog); //cdeg
+        osd_add_uint_fact(batch, "mavlink.gps_raw.satellites_visible", tags, 2, (ulong) gps.satellites_visible);
+        // Fix type: https://mavlink.io/en/messages/common.html#GPS_FIX_TYPE
+        osd_add_uint_fact(batch, "mavlink.gps_raw.fix_type", tags, 2, (ulong) gps.fix_type);
+        osd_publish_batch(batch);
+      }
+      break;
+
+    case MAVLINK_MSG_ID_VFR_HUD:
+      {
+        mavlink_vfr_hud_t vfr;
+        void *batch = osd_batch_init(6);
+        mavlink_msg_vfr_hud_decode(message, &vfr);
+        osd_add_double_fact(batch, "mavlink.vfr_hud.airspeed", tags, 2, (double) vfr.airspeed);
+        osd_add_double_fact(batch, "mavlink.vfr_hud.groundspeed", tags, 2, (double) vfr.groundspeed);
+        osd_add_double_fact(batch, "mavlink.vfr_hud.alt", tags, 2, (double) vfr.alt);
+        osd_add_double_fact(batch, "mavlink.vfr_hud.climb", tags, 2, (double) vfr.climb);
+        osd_add_int_fact(batch, "mavlink.vfr_hud.heading", tags, 2, (long) vfr.heading);
+        osd_add_uint_fact(batch, "mavlink.vfr_hud.throttle", tags, 2, (ulong) vfr.throttle);
+        osd_publish_batch(batch);
+      }
+      break;
+
+    case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
+      {
+        mavlink_global_position_int_t global_position_int;
+        void *batch = osd_batch_init(8);
+        mavlink_msg_global_position_int_decode( message, &global_position_int);
+        osd_add_int_fact(batch, "mavlink.global_position_int.lat", tags, 2, (long) global_position_int.lat); //degE7
+        osd_add_int_fact(batch, "mavlink.global_position_int.lon", tags, 2, (long) global_position_int.lon); //degE7
+        osd_add_int_fact(batch, "mavlink.global_position_int.alt", tags, 2, (long) global_position_int.alt); //mm
+        osd_add_int_fact(batch, "mavlink.global_position_int.relative_alt", tags, 2, (long) global_position_int.relative_alt); //mm
+        osd_add_int_fact(batch, "mavlink.global_position_int.vx", tags, 2, (long) global_position_int.vx); //cm/s
+        osd_add_int_fact(batch, "mavlink.global_position_int.vy", tags, 2, (long) global_position_int.vy); //cm/s
+        osd_add_int_fact(batch, "mavlink.global_position_int.vz", tags, 2, (long) global_position_int.vz); //cm/s
+        osd_add_uint_fact(batch, "mavlink.global_position_int.hdg", tags, 2, (ulong) global_position_int.hdg); //cdeg
+        osd_publish_batch(batch);
+      }
+      break;
+
+    case MAVLINK_MSG_ID_ATTITUDE:
+      {
+        mavlink_attitude_t att;
+        void *batch = osd_batch_init(6);
+        mavlink_msg_attitude_decode(message, &att);
+        osd_add_double_fact(batch, "mavlink.attitude.roll", tags, 2, (double) att.roll);
+        osd_add_double_fact(batch, "mavlink.attitude.pitch", tags, 2, (double) att.pitch);
+        osd_add_double_fact(batch, "mavlink.attitude.yaw", tags, 2, (double) att.yaw);
+        osd_add_double_fact(batch, "mavlink.attitude.rollspeed", tags, 2, (double) att.rollspeed);
+        osd_add_double_fact(batch, "mavlink.attitude.pitchpeed", tags, 2, (double) att.pitchspeed);
+        osd_add_double_fact(batch, "mavlink.attitude.yawspeed", tags, 2, (double) att.yawspeed);
+        osd_publish_batch(batch);
+      }
+      break;
+
+    case MAVLINK_MSG_ID_RADIO_STATUS:
+      {
+          mavlink_radio_status_t radio;
+          mavlink_msg_radio_status_decode(message, &radio);
+          // In mavlink `radio_status` packets rssi and noise are defined as unsigned while
+          // in fact they are signed (they are in dBm):
+          // https://github.com/svpcom/wfb-ng/discussions/367
+          // So, converting them back.
+          int8_t rssi = (int8_t) radio.rssi;
+          int8_t noise = (int8_t) radio.noise;
+          int8_t snr = rssi - noise;
+          void *batch = osd_batch_init(7);
+          osd_add_uint_fact(batch, "mavlink.radio_status.rxerrors", tags, 2, (ulong) radio.rxerrors);
+          osd_add_uint_fact(batch, "mavlink.radio_status.fixed", tags, 2, (ulong) radio.fixed);
+          osd_add_int_fact(batch, "mavlink.radio_status.rssi", tags, 2, rssi);
+          osd_add_int_fact(batch, "mavlink.radio_status.remrssi", tags, 2, (long) radio.remrssi); // is type correct?
+          osd_add_int_fact(batch, "mavlink.radio_status.noise", tags, 2, noise);
+          osd_add_uint_fact(batch, "mavlink.radio_status.remnoise", tags, 2, (ulong) radio.remnoise);
+          osd_add_int_fact(batch, "mavlink.calculated.radio_status.snr", tags, 2, snr);
+          osd_publish_batch(batch);
+          
+          if ((message->sysid != 3) || (message->compid != 68)) {
+              break;
+          }
+      }
+      break;
+
+    default:
+      // printf("> MavLink message %d from %d/%d\n",
+      //   message->msgid, message->sysid, message->compid);
+      break;
+  }
+}
 
 void* __MAVLINK_THREAD__(void* arg) {
   pthread_setname_np(pthread_self(), "__MAVLINK");
   printf("Starting mavlink thread...\n");
   // Create socket
-  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
   if (fd < 0) {
     printf("ERROR: Unable to create MavLink socket: %s\n", strerror(errno));
     return 0;
@@ -101,221 +372,68 @@ void* __MAVLINK_THREAD__(void* arg) {
 
   if (bind(fd, (struct sockaddr*)(&addr), sizeof(addr)) != 0) {
     printf("ERROR: Unable to bind MavLink port: %s\n", strerror(errno));
+    close(fd);
     return 0;
   }
 
-  // Set Rx timeout
-  struct timeval tv;
-  tv.tv_sec = 0;
-  tv.tv_usec = 100000;
-  if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
-    printf("ERROR: Unable to bind MavLink rx timeout: %s\n", strerror(errno));
+  // Wait for datagrams; the timeout is only there to notice mavlink_thread_signal
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    printf("ERROR: Unable to poll MavLink socket: %s\n", strerror(errno));
+    if (epfd >= 0)
+      close(epfd);
+    close(fd);
     return 0;
   }
 
-  char buffer[2048];
+  static uint8_t buffers[MAVLINK_BATCH][MAVLINK_DGRAM_SIZE];
+  struct mmsghdr msgs[MAVLINK_BATCH];
+  struct iovec iov[MAVLINK_BATCH];
+  // Credit to openIPC:https://github.com/OpenIPC/silicon_research/blob/master/vdec/main.c#L1020
+  mavlink_message_t message;
+  mavlink_status_t status;
   while (!mavlink_thread_signal) {
-    memset(buffer, 0x00, sizeof(buffer));
-    int ret = recv(fd, buffer, sizeof(buffer), 0);
-    if (ret < 0) {
+    struct epoll_event events[1];
+    int n = epoll_wait(epfd, events, 1, 100);
+    if (n <= 0) {
       continue;
-    } else if (ret == 0) {
-      // peer has done an orderly shutdown
-      return 0;
     }
 
-    // Parse
-    // Credit to openIPC:https://github.com/OpenIPC/silicon_research/blob/master/vdec/main.c#L1020
-    mavlink_message_t message;
-    mavlink_status_t status;
-    static int current_arm_state = -1;
-    for (int i = 0; i < ret; ++i) {
-      if (mavlink_parse_char(MAVLINK_COMM_0, buffer[i], &message, &status) == 1) {
-        osd_tag tags[3];
-        strcpy(tags[0].key, "sysid");
-        snprintf(tags[0].val, sizeof(tags[0].val), "%d", message.sysid);
-        strcpy(tags[1].key, "compid");
-        snprintf(tags[1].val, sizeof(tags[1].val), "%d", message.compid);
-        switch (message.msgid) {
-          case MAVLINK_MSG_ID_HEARTBEAT:
-            {
-              mavlink_heartbeat_t heartbeat = {};
-              mavlink_msg_heartbeat_decode(&message, &heartbeat);
-              int received_arm_state = (heartbeat.base_mode & MAV_MODE_FLAG_SAFETY_ARMED) != 0;
-              if (current_arm_state != received_arm_state) {
-                  osd_publish_bool_fact("mavlink.heartbeet.base_mode.armed", tags, 2, received_arm_state);
-                  current_arm_state = received_arm_state;
-                  if (mavlink_dvr_on_arm) {
-                    if (received_arm_state) {
-                      dvr_start_all();
-                    } else {
-                      dvr_stop_all();
-                    }
-                  }
-              }
-            }
-            break;
-	      case MAVLINK_MSG_ID_RAW_IMU:
-            {
-              mavlink_raw_imu_t imu;
-              void *batch = osd_batch_init(7);
-              mavlink_msg_raw_imu_decode(&message, &imu);
-              strcpy(tags[2].key, "imu_id");
-              snprintf(tags[2].val, sizeof(tags[2].val), "%d", imu.id);
-              osd_add_int_fact(batch, "mavlink.raw_imu.xacc", tags, 3, (long) imu.xacc);
-              osd_add_int_fact(batch, "mavlink.raw_imu.yacc", tags, 3, (long) imu.yacc);
-              osd_add_int_fact(batch, "mavlink.raw_imu.zacc", tags, 3, (long) imu.zacc);
-              osd_add_int_fact(batch, "mavlink.raw_imu.xgyro", tags, 3, (long) imu.xgyro);
-              osd_add_int_fact(batch, "mavlink.raw_imu.ygyro", tags, 3, (long) imu.ygyro);
-              osd_add_int_fact(batch, "mavlink.raw_imu.zgyro", tags, 3, (long) imu.zgyro);
-              osd_add_int_fact(batch, "mavlink.raw_imu.temperature", tags, 3, (long) imu.temperature);
-              osd_publish_batch(batch);
-            }
-            break;
-		
-          case MAVLINK_MSG_ID_SYS_STATUS:
-            {
-              mavlink_sys_status_t bat;
-              void *batch = osd_batch_init(2);
-              mavlink_msg_sys_status_decode(&message, &bat);
-              osd_add_uint_fact(batch, "mavlink.sys_status.voltage_battery", tags, 2, (ulong) bat.voltage_battery);
-              osd_add_int_fact(batch, "mavlink.sys_status.current_battery", tags, 2, (long) bat.current_battery);
-              osd_publish_batch(batch);
-            }
-            break;
-
-          case MAVLINK_MSG_ID_BATTERY_STATUS:
-            {
-              mavlink_battery_status_t batt;
-              void *batch = osd_batch_init(2);
-              mavlink_msg_battery_status_decode(&message, &batt);
-              strcpy(tags[2].key, "battery_id");
-              snprintf(tags[2].val, sizeof(tags[2].val), "%d", batt.id);
-              osd_add_int_fact(batch, "mavlink.battery_status.current_consumed", tags, 3, (long) batt.current_consumed);
-              osd_add_int_fact(batch, "mavlink.battery_status.energy_consumed", tags, 3, (long) batt.energy_consumed);
-              osd_publish_batch(batch);
-            }
-            break;
-
-          case MAVLINK_MSG_ID_RC_CHANNELS_RAW:
-            {
-              mavlink_rc_channels_raw_t rc_channels_raw;
-              void *batch = osd_batch_init(8);
-              mavlink_msg_rc_channels_raw_decode( &message, &rc_channels_raw);
-              osd_add_uint_fact(batch, "mavlink.rc_channels_raw.chan1", tags, 2, (ulong) rc_channels_raw.chan1_raw);
-              osd_add_uint_fact(batch, "mavlink.rc_channels_raw.chan2", tags, 2, (ulong) rc_channels_raw.chan2_raw);
-              osd_add_uint_fact(batch, "mavlink.rc_channels_raw.chan3", tags, 2, (ulong) rc_channels_raw.chan3_raw);
-              osd_add_uint_fact(batch, "mavlink.rc_channels_raw.chan4", tags, 2, (ulong) rc_channels_raw.chan4_raw);
-              osd_add_uint_fact(batch, "mavlink.rc_channels_raw.chan5", tags, 2, (ulong) rc_channels_raw.chan5_raw);
-              osd_add_uint_fact(batch, "mavlink.rc_channels_raw.chan6", tags, 2, (ulong) rc_channels_raw.chan6_raw);
-              osd_add_uint_fact(batch, "mavlink.rc_channels_raw.chan7", tags, 2, (ulong) rc_channels_raw.chan7_raw);
-              osd_add_uint_fact(batch, "mavlink.rc_channels_raw.chan8", tags, 2, (ulong) rc_channels_raw.chan8_raw);
-              osd_publish_batch(batch);
-            }
-            break;
-
-          case MAVLINK_MSG_ID_GPS_RAW_INT:
-            {
-              mavlink_gps_raw_int_t gps;
-              void *batch = osd_batch_init(7);
-              mavlink_msg_gps_raw_int_decode(&message, &gps);
-              osd_add_int_fact(batch, "mavlink.gps_raw.lat", tags, 2, (long) gps.lat); //degE7
-              osd_add_int_fact(batch, "mavlink.gps_raw.lon", tags, 2, (long) gps.lon); //degE7
-              osd_add_int_fact(batch, "mavlink.gps_raw.alt", tags, 2, (long) gps.alt); //mm
-              osd_add_uint_fact(batch, "mavlink.gps_raw.vel", tags, 2, (ulong) gps.vel); //cm/s
-              osd_add_uint_fact(batch, "mavlink.gps_raw.cog", tags, 2, (ulong) gps.cog); //cdeg
-              osd_add_uint_fact(batch, "mavlink.gps_raw.satellites_visible", tags, 2, (ulong) gps.satellites_visible);
-              // Fix type: https://mavlink.io/en/messages/common.html#GPS_FIX_TYPE
-              osd_add_uint_fact(batch, "mavlink.gps_raw.fix_type", tags, 2, (ulong) gps.fix_type);
-              osd_publish_batch(batch);
-            }
-            break;
-
-          case MAVLINK_MSG_ID_VFR_HUD:
-            {
-              mavlink_vfr_hud_t vfr;
-              void *batch = osd_batch_init(6);
-              mavlink_msg_vfr_hud_decode(&message, &vfr);
-              osd_add_double_fact(batch, "mavlink.vfr_hud.airspeed", tags, 2, (double) vfr.airspeed);
-              osd_add_double_fact(batch, "mavlink.vfr_hud.groundspeed", tags, 2, (double) vfr.groundspeed);
-              osd_add_double_fact(batch, "mavlink.vfr_hud.alt", tags, 2, (double) vfr.alt);
-              osd_add_double_fact(batch, "mavlink.vfr_hud.climb", tags, 2, (double) vfr.climb);
-              osd_add_int_fact(batch, "mavlink.vfr_hud.heading", tags, 2, (long) vfr.heading);
-              osd_add_uint_fact(batch, "mavlink.vfr_hud.throttle", tags, 2, (ulong) vfr.throttle);
-              osd_publish_batch(batch);
-            }
-            break;
-
-          case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
-            {
-              mavlink_global_position_int_t global_position_int;
-              void *batch = osd_batch_init(8);
-              mavlink_msg_global_position_int_decode( &message, &global_position_int);
-              osd_add_int_fact(batch, "mavlink.global_position_int.lat", tags, 2, (long) global_position_int.lat); //degE7
-              osd_add_int_fact(batch, "mavlink.global_position_int.lon", tags, 2, (long) global_position_int.lon); //degE7
-              osd_add_int_fact(batch, "mavlink.global_position_int.alt", tags, 2, (long) global_position_int.alt); //mm
-              osd_add_int_fact(batch, "mavlink.global_position_int.relative_alt", tags, 2, (long) global_position_int.relative_alt); //mm
-              osd_add_int_fact(batch, "mavlink.global_position_int.vx", tags, 2, (long) global_position_int.vx); //cm/s
-              osd_add_int_fact(batch, "mavlink.global_position_int.vy", tags, 2, (long) global_position_int.vy); //cm/s
-              osd_add_int_fact(batch, "mavlink.global_position_int.vz", tags, 2, (long) global_position_int.vz); //cm/s
-              osd_add_uint_fact(batch, "mavlink.global_position_int.hdg", tags, 2, (ulong) global_position_int.hdg); //cdeg
-              osd_publish_batch(batch);
-            }
-            break;
-
-          case MAVLINK_MSG_ID_ATTITUDE:
-            {
-              mavlink_attitude_t att;
-              void *batch = osd_batch_init(6);
-              mavlink_msg_attitude_decode(&message, &att);
-              osd_add_double_fact(batch, "mavlink.attitude.roll", tags, 2, (double) att.roll);
-              osd_add_double_fact(batch, "mavlink.attitude.pitch", tags, 2, (double) att.pitch);
-              osd_add_double_fact(batch, "mavlink.attitude.yaw", tags, 2, (double) att.yaw);
-              osd_add_double_fact(batch, "mavlink.attitude.rollspeed", tags, 2, (double) att.rollspeed);
-              osd_add_double_fact(batch, "mavlink.attitude.pitchpeed", tags, 2, (double) att.pitchspeed);
-              osd_add_double_fact(batch, "mavlink.attitude.yawspeed", tags, 2, (double) att.yawspeed);
-              osd_publish_batch(batch);
-            }
-            break;
-
-          case MAVLINK_MSG_ID_RADIO_STATUS:
-            {
-                mavlink_radio_status_t radio;
-                mavlink_msg_radio_status_decode(&message, &radio);
-                // In mavlink `radio_status` packets rssi and noise are defined as unsigned while
-                // in fact they are signed (they are in dBm):
-                // https://github.com/svpcom/wfb-ng/discussions/367
-                // So, converting them back.
-                int8_t rssi = (int8_t) radio.rssi;
-                int8_t noise = (int8_t) radio.noise;
-                int8_t snr = rssi - noise;
-                void *batch = osd_batch_init(7);
-                osd_add_uint_fact(batch, "mavlink.radio_status.rxerrors", tags, 2, (ulong) radio.rxerrors);
-                osd_add_uint_fact(batch, "mavlink.radio_status.fixed", tags, 2, (ulong) radio.fixed);
-                osd_add_int_fact(batch, "mavlink.radio_status.rssi", tags, 2, rssi);
-                osd_add_int_fact(batch, "mavlink.radio_status.remrssi", tags, 2, (long) radio.remrssi); // is type correct?
-                osd_add_int_fact(batch, "mavlink.radio_status.noise", tags, 2, noise);
-                osd_add_uint_fact(batch, "mavlink.radio_status.remnoise", tags, 2, (ulong) radio.remnoise);
-                osd_add_int_fact(batch, "mavlink.calculated.radio_status.snr", tags, 2, snr);
-                osd_publish_batch(batch);
-                
-                if ((message.sysid != 3) || (message.compid != 68)) {
-                    break;
-                }
-            }
-            break;
+    // Drain the socket a batch at a time
+    for (;;) {
+      for (int i = 0; i < MAVLINK_BATCH; i++) {
+        iov[i].iov_base = buffers[i];
+        iov[i].iov_len = MAVLINK_DGRAM_SIZE;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+      int got = recvmmsg(fd, msgs, MAVLINK_BATCH, MSG_DONTWAIT, NULL);
+      if (got <= 0) {
+        break;
+      }
 
-          default:
-            // printf("> MavLink message %d from %d/%d\n",
-            //   message.msgid, message.sysid, message.compid);
-            break;
+      uint64_t now_ms = mavlink_now_ms();
+      for (int d = 0; d < got; d++) {
+        const uint8_t *p = buffers[d];
+        const uint8_t *end = p + msgs[d].msg_len;
+        for (; p < end; p++) {
+          if (mavlink_parse_char(MAVLINK_COMM_0, *p, &message, &status) == 1) {
+            handle_message(&message, now_ms);
+          }
         }
       }
+      if (got < MAVLINK_BATCH) {
+        break;
+      }
     }
-
-    usleep(1);
   }
-  
+
+  close(epfd);
+  close(fd);
 	printf("Mavlink thread done.\n");
   return 0;
 }
@@ -1,12 +1,23 @@
 #ifndef MVLINK_H
 #define MVLINK_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 extern int mavlink_port;
 extern bool mavlink_dvr_on_arm;
+extern bool mavlink_dvr_segment_on_arm;
 extern int mavlink_thread_signal;
+// Most times per second a message type is published for each sender, 0 for every message
+extern int mavlink_max_rate;
 
 void* __MAVLINK_THREAD__(void* arg);
 
+// Whether a message may be published now under mavlink_max_rate. subid
+// tells apart instances within a sender (imu id, battery id).
+bool mavlink_rate_allow(uint32_t msgid, uint8_t sysid, uint8_t compid, uint8_t subid, uint64_t now_ms);
+
 size_t numOfChars(const char s[]);
 
 char* insertString(char s1[], const char s2[], size_t pos);
@@ -344,6 +344,10 @@ typedef struct mp4_h26x_writer_tag
 int mp4_h26x_write_init(mp4_h26x_writer_t *h, MP4E_mux_t *mux, int width, int height, int is_hevc);
 void mp4_h26x_write_close(mp4_h26x_writer_t *h);
 int mp4_h26x_write_nal(mp4_h26x_writer_t *h, const unsigned char *nal, int length, unsigned timeStamp90kHz_next);
+// Write one NAL unit without start code. In non-sequential mode the payload is
+// passed to the write callback in place (length prefix and NAL as two pieces of
+// the same sample), so no per-NAL copy is made.
+int mp4_h26x_write_nal_unit(mp4_h26x_writer_t *h, const unsigned char *nal, int sizeof_nal, unsigned duration);
 
 /************************************************************************/
 /*          API                                                         */
@@ -695,6 +699,8 @@ typedef struct MP4E_mux_tag
     int sequential_mode_flag;
     int enable_fragmentation; // flag, indicating streaming-friendly 'fragmentation' mode
     int fragments_count;      // # of fragments in 'fragmentation' mode
+    uint64_t fragment_dts;    // decode time of the current sample in 'fragmentation' mode
+    unsigned fragment_duration; // and its duration
 
 } MP4E_mux_t;
 
@@ -816,6 +822,8 @@ MP4E_mux_t *MP4E_open(int sequential_mode_flag, int enable_fragmentation, void *
     mux->sequential_mode_flag = sequential_mode_flag || enable_fragmentation;
     mux->enable_fragmentation = enable_fragmentation;
     mux->fragments_count = 0;
+    mux->fragment_dts = 0;
+    mux->fragment_duration = 0;
     mux->write_callback = write_callback;
     mux->token = token;
     mux->text_comment = NULL;
@@ -1102,9 +1110,14 @@ int MP4E_put_sample(MP4E_mux_t *mux, int track_num, const void *data, int data_b
     tr = ((track_t*)mux->tracks.data) + track_num;
     if (mux->enable_fragmentation)
     {
+        // Durations may vary from sample to sample: accumulate them
+        if (kind != MP4E_SAMPLE_CONTINUATION)
+        {
+            mux->fragment_dts += mux->fragment_duration;
+            mux->fragment_duration = duration;
+        }
         #if MP4D_TFDT_SUPPORT
-        // NOTE: assume a constant `duration` to calculate current timestamp
-        uint64_t timestamp = (uint64_t)mux->fragments_count * duration;
+        uint64_t timestamp = mux->fragment_dts;
         #endif
         if (!mux->fragments_count++)
             ERR(mp4e_flush_index(mux)); // write file headers before 1st sample
@@ -2319,6 +2332,94 @@ static int mp4_h265_write_nal(mp4_h26x_writer_t *h, const unsigned char *nal, in
     return err;
 }
 
+int mp4_h26x_write_nal_unit(mp4_h26x_writer_t *h, const unsigned char *nal, int sizeof_nal, unsigned duration)
+{
+    int payload_type, is_intra, sample_kind = MP4E_SAMPLE_DEFAULT, err = MP4E_STATUS_OK;
+    unsigned char len_prefix[4];
+    if (sizeof_nal <= 0)
+        return MP4E_STATUS_BAD_ARGUMENTS;
+    if (h->is_hevc)
+    {
+        payload_type = (nal[0] >> 1) & 0x3f;
+        is_intra = payload_type >= HEVC_NAL_BLA_W_LP && payload_type <= HEVC_NAL_CRA_NUT;
+        if (is_intra && !h->need_sps && !h->need_pps && !h->need_vps)
+            h->need_idr = 0;
+        switch (payload_type)
+        {
+        case HEVC_NAL_VPS:
+            MP4E_set_vps(h->mux, h->mux_track_id, nal, sizeof_nal);
+            h->need_vps = 0;
+            return MP4E_STATUS_OK;
+        case HEVC_NAL_SPS:
+            MP4E_set_sps(h->mux, h->mux_track_id, nal, sizeof_nal);
+            h->need_sps = 0;
+            return MP4E_STATUS_OK;
+        case HEVC_NAL_PPS:
+            MP4E_set_pps(h->mux, h->mux_track_id, nal, sizeof_nal);
+            h->need_pps = 0;
+            return MP4E_STATUS_OK;
+        }
+        if (h->need_vps || h->need_sps || h->need_pps || h->need_idr)
+            return MP4E_STATUS_BAD_ARGUMENTS;
+        if (is_intra)
+            sample_kind = MP4E_SAMPLE_RANDOM_ACCESS;
+    } else
+    {
+        payload_type = nal[0] & 31;
+        switch (payload_type)
+        {
+        case 9:
+            return MP4E_STATUS_OK; // access unit delimiter
+        case 7:
+            MP4E_set_sps(h->mux, h->mux_track_id, nal, sizeof_nal);
+            h->need_sps = 0;
+            return MP4E_STATUS_OK;
+        case 8:
+            MP4E_set_pps(h->mux, h->mux_track_id, nal, sizeof_nal);
+            h->need_pps = 0;
+            return MP4E_STATUS_OK;
+        case 5:
+            if (h->need_sps)
+                return MP4E_STATUS_BAD_ARGUMENTS;
+            h->need_idr = 0;
+            break;
+        }
+        if (h->need_sps)
+            return MP4E_STATUS_BAD_ARGUMENTS;
+        if (h->need_pps || h->need_idr)
+            return MP4E_STATUS_OK;
+        {
+            bit_reader_t bs[1];
+            init_bits(bs, nal + 1, sizeof_nal - 1);
+            if (ue_bits(bs))
+                sample_kind = MP4E_SAMPLE_CONTINUATION; // first_mb_in_slice != 0
+            else if (payload_type == 5)
+                sample_kind = MP4E_SAMPLE_RANDOM_ACCESS;
+        }
+    }
+
+    len_prefix[0] = (unsigned char)(sizeof_nal >> 24);
+    len_prefix[1] = (unsigned char)(sizeof_nal >> 16);
+    len_prefix[2] = (unsigned char)(sizeof_nal >>  8);
+    len_prefix[3] = (unsigned char)(sizeof_nal);
+    if (!h->mux->sequential_mode_flag)
+    {
+        ERR(MP4E_put_sample(h->mux, h->mux_track_id, len_prefix, 4, duration, sample_kind));
+        return MP4E_put_sample(h->mux, h->mux_track_id, nal, sizeof_nal, duration, MP4E_SAMPLE_CONTINUATION);
+    }
+    {
+        // Sequential/fragmented mode needs each sample in one piece
+        unsigned char *tmp = (unsigned char *)malloc(4 + sizeof_nal);
+        if (!tmp)
+            return MP4E_STATUS_NO_MEMORY;
+        memcpy(tmp, len_prefix, 4);
+        memcpy(tmp + 4, nal, sizeof_nal);
+        err = MP4E_put_sample(h->mux, h->mux_track_id, tmp, 4 + sizeof_nal, duration, sample_kind);
+        free(tmp);
+    }
+    return err;
+}
+
 uint64_t last_ms = 0;
 
 int mp4_h26x_write_nal(mp4_h26x_writer_t *h, const unsigned char *nal, int length, int timeStamp90kHz_next)
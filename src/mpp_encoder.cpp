@@ -1,20 +1,91 @@
 #include "mpp_encoder.h"
 
 #include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
 
 #include "spdlog/spdlog.h"
 
+extern "C" {
+#include "osd.h"
+}
+
+static uint64_t monotonic_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool EncResolution::parse(const char *s, EncResolution &out) {
+    unsigned w = 0, h = 0;
+    char p = 0, extra = 0;
+    if (sscanf(s, "%ux%u%c", &w, &h, &extra) == 2) {
+        // "<w>x<h>"
+    } else if (sscanf(s, "%u%c%c", &h, &p, &extra) == 2 && (p == 'p' || p == 'P')) {
+        // 16:9, rounded to the nearest even width
+        w = ((h * 16 + 9) / 18) * 2;
+    } else {
+        return false;
+    }
+    if (w < MIN_SIZE || h < MIN_SIZE || w > MAX_SIZE || h > MAX_SIZE || (w | h) & 1)
+        return false;
+    out = EncResolution(w, h);
+    return true;
+}
+
+void EncResolution::fit(uint32_t src_w, uint32_t src_h, uint32_t &w, uint32_t &h) const {
+    w = width;
+    h = height;
+    if (!src_w || !src_h)
+        return;
+    if ((uint64_t)src_w * height >= (uint64_t)width * src_h) {
+        // Source as wide or wider: full width
+        uint32_t scaled = (uint32_t)(((uint64_t)src_h * width + src_w / 2) / src_w);
+        h = (scaled + 1) & ~1u;
+    } else {
+        uint32_t scaled = (uint32_t)(((uint64_t)src_w * height + src_h / 2) / src_h);
+        w = (scaled + 1) & ~1u;
+    }
+    if (w < 2) w = 2;
+    if (h < 2) h = 2;
+    if (w > width) w = width;
+    if (h > height) h = height;
+}
+
+bool EncRateControl::parse_mode(const char *s, EncRcMode &out) {
+    for (int m = (int)EncRcMode::CBR; m <= (int)EncRcMode::FIXQP; m++) {
+        if (!strcmp(s, mode_name((EncRcMode)m))) {
+            out = (EncRcMode)m;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *EncRateControl::mode_name(EncRcMode mode) {
+    switch (mode) {
+    case EncRcMode::VBR:   return "vbr";
+    case EncRcMode::AVBR:  return "avbr";
+    case EncRcMode::FIXQP: return "fixqp";
+    default:               return "cbr";
+    }
+}
+
 MppEncoder::MppEncoder(MppEncoderParams p, FrameCallback cb)
-    : params(p), output_cb(cb) {}
+    : params(p), output_cb(cb), max_in_flight(p.in_flight > 0 ? p.in_flight : 1) {}
 
 MppEncoder::~MppEncoder() {
     cleanup_encoder();
 }
 
-void MppEncoder::push_frame(MppBuffer buffer,
+bool MppEncoder::push_frame(MppBuffer buffer,
                              uint32_t width, uint32_t height,
                              uint32_t hor_stride, uint32_t ver_stride,
                              MppFrameFormat fmt, uint64_t pts) {
+    // Only the timer thread pushes frames, so check-then-add doesn't race
+    if (outstanding.load(std::memory_order_acquire) >= max_in_flight)
+        return false;
+    outstanding.fetch_add(1, std::memory_order_acq_rel);
     EncRpc rpc;
     rpc.command    = EncRpc::RPC_FRAME;
     rpc.buffer     = buffer;
@@ -25,6 +96,7 @@ void MppEncoder::push_frame(MppBuffer buffer,
     rpc.fmt        = fmt;
     rpc.pts        = pts;
     enqueue(std::move(rpc));
+    return true;
 }
 
 void MppEncoder::request_idr() {
@@ -60,6 +132,13 @@ void MppEncoder::set_fps(int fps) {
     enqueue(std::move(rpc));
 }
 
+void MppEncoder::set_rate_control(const EncRateControl &rc) {
+    EncRpc rpc;
+    rpc.command = EncRpc::RPC_SET_RATE_CONTROL;
+    rpc.new_rc  = rc;
+    enqueue(std::move(rpc));
+}
+
 void MppEncoder::enqueue(EncRpc rpc) {
     {
         std::lock_guard<std::mutex> lock(mtx);
@@ -94,19 +173,22 @@ void MppEncoder::loop() {
             break;
 
         case EncRpc::RPC_SET_BITRATE:
-            params.bitrate_kbps = rpc.new_bitrate;
+        case EncRpc::RPC_SET_RATE_CONTROL:
+            if (rpc.command == EncRpc::RPC_SET_BITRATE)
+                params.bitrate_kbps = rpc.new_bitrate;
+            else
+                params.rc = rpc.new_rc;
             if (initialized && ctx) {
                 MppEncCfg cfg = nullptr;
                 mpp_enc_cfg_init(&cfg);
                 if (mpi->control(ctx, MPP_ENC_GET_CFG, cfg) == MPP_OK) {
-                    int bps = rpc.new_bitrate * 1000;
-                    mpp_enc_cfg_set_s32(cfg, "rc:bps_target", bps);
-                    mpp_enc_cfg_set_s32(cfg, "rc:bps_max",    bps * 12 / 10);
-                    mpp_enc_cfg_set_s32(cfg, "rc:bps_min",    bps * 8  / 10);
+                    apply_rate_control(cfg);
                     mpi->control(ctx, MPP_ENC_SET_CFG, cfg);
                 }
                 mpp_enc_cfg_deinit(cfg);
-                spdlog::info("Encoder bitrate updated to {}kbps", rpc.new_bitrate);
+                spdlog::info("Encoder rate control updated: {} {}kbps qp {}-{} gop {}",
+                             EncRateControl::mode_name(params.rc.mode), params.bitrate_kbps,
+                             params.rc.qp_min, params.rc.qp_max, params.rc.gop);
             }
             break;
 
@@ -124,18 +206,167 @@ void MppEncoder::loop() {
             break;
 
         case EncRpc::RPC_SHUTDOWN:
-            // Release any buffer that was in-flight at shutdown
-            if (rpc.buffer) {
-                mpp_buffer_put(rpc.buffer);
-            }
             goto end;
         }
     }
 end:
     cleanup_encoder();
+    // Frames queued behind the shutdown never reach the encoder
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        while (!queue.empty()) {
+            if (queue.front().buffer) {
+                mpp_buffer_put(queue.front().buffer);
+                outstanding--;
+            }
+            queue.pop();
+        }
+    }
     spdlog::info("Encoder thread done.");
 }
 
+// ── Output side ─────────────────────────────────────────────────────────────
+
+void *MppEncoder::__OUTPUT_THREAD__(void *param) {
+    pthread_setname_np(pthread_self(), "__ENCOUT");
+    ((MppEncoder *)param)->output_loop();
+    return nullptr;
+}
+
+void MppEncoder::start_output() {
+    output_stop = false;
+    if (pthread_create(&output_tid, NULL, &MppEncoder::__OUTPUT_THREAD__, this) == 0)
+        output_running = true;
+    else
+        spdlog::error("MPP encoder: unable to start output thread");
+}
+
+// Let the frames in flight come out (bounded by DRAIN_TIMEOUT_MS), then stop
+// the collector; whatever didn't make it is released.
+void MppEncoder::stop_output() {
+    if (output_running) {
+        {
+            std::unique_lock<std::mutex> lock(flight_mtx);
+            flight_cv.wait_for(lock, std::chrono::milliseconds(DRAIN_TIMEOUT_MS),
+                               [this] { return in_flight.empty(); });
+            output_stop = true;
+        }
+        flight_cv.notify_all();
+        pthread_join(output_tid, NULL);
+        output_running = false;
+    }
+    std::lock_guard<std::mutex> lock(flight_mtx);
+    if (!in_flight.empty())
+        spdlog::warn("MPP encoder: {} frames lost in flight", in_flight.size());
+    for (InFlight &f : in_flight)
+        finish(f);
+    in_flight.clear();
+}
+
+void MppEncoder::finish(InFlight &f) {
+    if (f.buffer) {
+        mpp_buffer_put(f.buffer);
+        f.buffer = nullptr;
+    }
+    outstanding.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+// Hand the packet on by reference (packet is taken over) while few are out,
+// copy it otherwise.
+EncodedFramePtr MppEncoder::wrap_packet(MppPacket &packet) {
+    const uint8_t *data = static_cast<const uint8_t *>(mpp_packet_get_pos(packet));
+    size_t len = mpp_packet_get_length(packet);
+    if (held_packets->load(std::memory_order_relaxed) >= MAX_HELD_PACKETS)
+        return EncodedFrame::copy(data, len);
+    held_packets->fetch_add(1, std::memory_order_relaxed);
+    MppPacket held = packet;
+    packet = nullptr;
+    std::shared_ptr<std::atomic<int>> count = held_packets;
+    return EncodedFrame::borrow(data, len, [held, count]() mutable {
+        mpp_packet_deinit(&held);
+        count->fetch_sub(1, std::memory_order_relaxed);
+    }, true);
+}
+
+void MppEncoder::output_loop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(flight_mtx);
+            flight_cv.wait(lock, [this] { return output_stop || !in_flight.empty(); });
+            if (output_stop)
+                break;
+        }
+        MppPacket packet = nullptr;
+        MPP_RET ret = mpi->encode_get_packet(ctx, &packet);
+        if (ret != MPP_OK || !packet) {
+            if (ret != MPP_OK && ret != MPP_ERR_TIMEOUT)
+                spdlog::warn("MPP encoder: encode_get_packet failed ret={}", (int)ret);
+            continue;
+        }
+
+        // Packets come out in submission order (no B-frames); frames ahead
+        // of the matching one were dropped by the encoder.  Headers due
+        // before a dropped frame go out before the matching one instead.
+        uint64_t pts = (uint64_t)mpp_packet_get_pts(packet);
+        InFlight f;
+        bool matched = false;
+        {
+            std::lock_guard<std::mutex> lock(flight_mtx);
+            bool known = false;
+            for (const InFlight &i : in_flight)
+                known = known || i.pts == pts;
+            bool headers = false;
+            while (!in_flight.empty()) {
+                f = in_flight.front();
+                in_flight.pop_front();
+                if (!known || f.pts == pts) {
+                    matched = true;
+                    f.headers = f.headers || headers;
+                    break;
+                }
+                spdlog::debug("MPP encoder: no packet for frame pts={}", f.pts);
+                headers = headers || f.headers;
+                finish(f);
+            }
+        }
+        flight_cv.notify_all();
+
+        if (matched && f.headers && extra_data && output_cb) {
+            spdlog::info("MPP encoder: sending headers {}B to DVR", extra_data->size());
+            std::shared_ptr<const std::vector<uint8_t>> hdr = extra_data;
+            output_cb(EncodedFrame::borrow(hdr->data(), hdr->size(), [hdr]() {}), f.pts);
+        }
+        size_t length = mpp_packet_get_length(packet);
+        if (matched && length > 0) {
+            stats_bytes += length;
+            RK_S32 qp = 0;
+            MppMeta meta = mpp_packet_get_meta(packet);
+            if (meta && mpp_meta_get_s32(meta, KEY_ENC_AVERAGE_QP, &qp) == MPP_OK) {
+                stats_qp_sum += qp;
+                stats_qp_count++;
+            }
+        }
+        if (matched && length > 0 && output_cb)
+            output_cb(wrap_packet(packet), f.pts);
+        publish_stats(monotonic_us());
+        if (packet)
+            mpp_packet_deinit(&packet);
+        if (!matched)
+            continue;
+
+        latency_sum_us += monotonic_us() - f.submit_us;
+        if (++latency_count >= 300) {
+            spdlog::debug("MPP encoder: avg encode latency {} us, {} in flight max",
+                          latency_sum_us / latency_count, max_in_flight);
+            latency_sum_us = 0;
+            latency_count = 0;
+        }
+        // Encoding done — release the extra ref taken in the frame thread
+        std::lock_guard<std::mutex> lock(flight_mtx);
+        finish(f);
+    }
+}
+
 bool MppEncoder::init_encoder(uint32_t width, uint32_t height,
                                uint32_t hor_stride, uint32_t ver_stride,
                                MppFrameFormat fmt) {
@@ -171,19 +402,13 @@ bool MppEncoder::init_encoder(uint32_t width, uint32_t height,
     mpp_enc_cfg_set_s32(cfg, "prep:ver_stride", (int)ver_stride);
     mpp_enc_cfg_set_s32(cfg, "prep:format",     (int)fmt);
 
-    int bps = params.bitrate_kbps * 1000;
-    mpp_enc_cfg_set_s32(cfg, "rc:mode",       MPP_ENC_RC_MODE_CBR);
-    mpp_enc_cfg_set_s32(cfg, "rc:bps_target", bps);
-    mpp_enc_cfg_set_s32(cfg, "rc:bps_max",    bps * 12 / 10);
-    mpp_enc_cfg_set_s32(cfg, "rc:bps_min",    bps * 8 / 10);
-
     mpp_enc_cfg_set_s32(cfg, "rc:fps_in_flex",   0);
     mpp_enc_cfg_set_s32(cfg, "rc:fps_in_num",    params.fps);
     mpp_enc_cfg_set_s32(cfg, "rc:fps_in_denorm", 1);
     mpp_enc_cfg_set_s32(cfg, "rc:fps_out_flex",  0);
     mpp_enc_cfg_set_s32(cfg, "rc:fps_out_num",   params.fps);
     mpp_enc_cfg_set_s32(cfg, "rc:fps_out_denorm",1);
-    mpp_enc_cfg_set_s32(cfg, "rc:gop",           params.fps * 2);
+    apply_rate_control(cfg);
 
     if (mpi->control(ctx, MPP_ENC_SET_CFG, cfg) != MPP_OK) {
         spdlog::error("MPP encoder: MPP_ENC_SET_CFG failed");
@@ -194,9 +419,16 @@ bool MppEncoder::init_encoder(uint32_t width, uint32_t height,
     }
     mpp_enc_cfg_deinit(cfg);
 
+    // Input blocks only when MPP's own queue is full (we stay under
+    // in_flight anyway); output wakes up regularly so the collector can stop.
+    RK_S64 input_timeout = MPP_POLL_BLOCK;
+    RK_S64 output_timeout = OUTPUT_TIMEOUT_MS;
+    mpi->control(ctx, MPP_SET_INPUT_TIMEOUT, &input_timeout);
+    mpi->control(ctx, MPP_SET_OUTPUT_TIMEOUT, &output_timeout);
+
     // Fetch VPS/SPS/PPS so we can send them explicitly before the first frame.
     // MPP_ENC_GET_HDR_SYNC is the current API (GET_EXTRA_INFO is deprecated/unsafe).
-    extra_data.clear();
+    extra_data.reset();
     headers_sent = false;
     {
         MppBuffer hdr_buf = nullptr;
@@ -209,14 +441,14 @@ bool MppEncoder::init_encoder(uint32_t width, uint32_t height,
                 void *ptr = mpp_packet_get_pos(hdr_pkt);
                 size_t len = mpp_packet_get_length(hdr_pkt);
                 if (ptr && len > 0) {
-                    extra_data.assign(static_cast<uint8_t *>(ptr),
-                                      static_cast<uint8_t *>(ptr) + len);
+                    extra_data = std::make_shared<const std::vector<uint8_t>>(
+                        static_cast<uint8_t *>(ptr), static_cast<uint8_t *>(ptr) + len);
                 }
             }
             mpp_packet_deinit(&hdr_pkt);
         }
     }
-    if (extra_data.empty()) {
+    if (!extra_data) {
         spdlog::warn("MPP encoder: MPP_ENC_GET_HDR_SYNC returned no data");
     }
 
@@ -226,22 +458,94 @@ bool MppEncoder::init_encoder(uint32_t width, uint32_t height,
     enc_ver_stride = ver_stride;
     initialized    = true;
     idr_pending    = true;
+    start_output();
 
-    spdlog::info("MPP encoder initialized: {}x{} @ {}fps {}kbps codec={} headers={}B",
-                 width, height, params.fps, params.bitrate_kbps,
+    spdlog::info("MPP encoder initialized: {}x{} @ {}fps {} {}kbps codec={} headers={}B in_flight={}",
+                 width, height, params.fps,
+                 EncRateControl::mode_name(params.rc.mode), params.bitrate_kbps,
                  params.codec == VideoCodec::H265 ? "h265" : "h264",
-                 extra_data.size());
+                 extra_data ? extra_data->size() : 0, max_in_flight);
     return true;
 }
 
+// Rate control, QP and GOP settings from params, for init and live changes.
+void MppEncoder::apply_rate_control(MppEncCfg cfg) {
+    const EncRateControl &rc = params.rc;
+    int bps = params.bitrate_kbps * 1000;
+    int bps_max = bps * 12 / 10;
+    int bps_min = bps * 8 / 10;
+    MppEncRcMode mode = MPP_ENC_RC_MODE_CBR;
+    switch (rc.mode) {
+    case EncRcMode::VBR:
+    case EncRcMode::AVBR:
+        mode = rc.mode == EncRcMode::VBR ? MPP_ENC_RC_MODE_VBR : MPP_ENC_RC_MODE_AVBR;
+        bps_max = bps * 3 / 2;
+        bps_min = bps / 16;
+        break;
+    case EncRcMode::FIXQP:
+        mode = MPP_ENC_RC_MODE_FIXQP;
+        break;
+    default:
+        break;
+    }
+    mpp_enc_cfg_set_s32(cfg, "rc:mode",       mode);
+    mpp_enc_cfg_set_s32(cfg, "rc:bps_target", bps);
+    mpp_enc_cfg_set_s32(cfg, "rc:bps_max",    bps_max);
+    mpp_enc_cfg_set_s32(cfg, "rc:bps_min",    bps_min);
+
+    int qp_min = rc.mode == EncRcMode::FIXQP ? rc.qp_fixed : rc.qp_min;
+    int qp_max = rc.mode == EncRcMode::FIXQP ? rc.qp_fixed : rc.qp_max;
+    int qp_init = rc.mode == EncRcMode::FIXQP ? rc.qp_fixed : -1;
+    mpp_enc_cfg_set_s32(cfg, "rc:qp_init",  qp_init);
+    mpp_enc_cfg_set_s32(cfg, "rc:qp_min",   qp_min);
+    mpp_enc_cfg_set_s32(cfg, "rc:qp_max",   qp_max);
+    mpp_enc_cfg_set_s32(cfg, "rc:qp_min_i", qp_min);
+    mpp_enc_cfg_set_s32(cfg, "rc:qp_max_i", qp_max);
+    mpp_enc_cfg_set_s32(cfg, "rc:qp_ip",    rc.mode == EncRcMode::FIXQP ? 0 : 2);
+
+    mpp_enc_cfg_set_s32(cfg, "rc:gop", rc.gop > 0 ? rc.gop : params.fps * 2);
+
+    // Intra refresh: a band of rows is intra coded in every frame, so the
+    // picture recovers from losses without the bitrate spikes of IDRs.
+    mpp_enc_cfg_set_s32(cfg, "rc:refresh_en",   rc.intra_refresh > 0);
+    mpp_enc_cfg_set_s32(cfg, "rc:refresh_mode", 0);   // by rows
+    mpp_enc_cfg_set_s32(cfg, "rc:refresh_num",  rc.intra_refresh > 0 ? rc.intra_refresh : 1);
+}
+
+// dvr.reenc_kbps / dvr.reenc_qp about once a second.
+void MppEncoder::publish_stats(uint64_t now_us) {
+    if (stats_start_us == 0) {
+        stats_start_us = now_us;
+        return;
+    }
+    uint64_t elapsed = now_us - stats_start_us;
+    if (elapsed < 1000000)
+        return;
+    osd_tag tags[1];
+    strncpy(tags[0].key, "encoder", TAG_MAX_LEN - 1);
+    strncpy(tags[0].val, params.name, TAG_MAX_LEN - 1);
+    tags[0].key[TAG_MAX_LEN - 1] = '\0';
+    tags[0].val[TAG_MAX_LEN - 1] = '\0';
+    void *batch = osd_batch_init(2);
+    osd_add_uint_fact(batch, "dvr.reenc_kbps", tags, 1, stats_bytes * 8000 / elapsed);
+    if (stats_qp_count)
+        osd_add_uint_fact(batch, "dvr.reenc_qp", tags, 1, stats_qp_sum / stats_qp_count);
+    osd_publish_batch(batch);
+    stats_start_us = now_us;
+    stats_bytes = 0;
+    stats_qp_sum = 0;
+    stats_qp_count = 0;
+}
+
 void MppEncoder::cleanup_encoder() {
+    stop_output();
     if (ctx) {
         mpp_destroy(ctx);
         ctx = nullptr;
         mpi = nullptr;
     }
     initialized = false;
-    extra_data.clear();
+    extra_data.reset();
     headers_sent = false;
 }
 
@@ -253,6 +557,7 @@ void MppEncoder::encode_frame(EncRpc &rpc) {
                           rpc.hor_stride, rpc.ver_stride, rpc.fmt)) {
             mpp_buffer_put(rpc.buffer);
             rpc.buffer = nullptr;
+            outstanding--;
             return;
         }
     }
@@ -268,12 +573,13 @@ void MppEncoder::encode_frame(EncRpc &rpc) {
 
     // Send VPS/SPS/PPS headers before the first encoded frame (or after re-init
     // / IDR request). This is more reliable than MPP_ENC_HEADER_MODE_EACH_IDR,
-    // especially for H265 which also needs VPS.
-    if (!headers_sent && !extra_data.empty() && output_cb) {
-        spdlog::info("MPP encoder: sending headers {}B to DVR", extra_data.size());
-        output_cb(std::make_shared<std::vector<uint8_t>>(extra_data));
-        headers_sent = true;
-    }
+    // especially for H265 which also needs VPS. The collector emits them
+    // right before this frame's packet, keeping the stream order.
+    InFlight f;
+    f.buffer = rpc.buffer;
+    f.pts = rpc.pts;
+    f.headers = !headers_sent;
+    headers_sent = true;
 
     // Zero-copy: build encoder input frame directly from the decoded DRM buffer
     MppFrame mpp_frame = nullptr;
@@ -294,34 +600,29 @@ void MppEncoder::encode_frame(EncRpc &rpc) {
         mpp_frame_set_buf_size(mpp_frame, (RK_U32)(expected <= actual ? expected : actual));
     }
 
-    if (mpi->encode_put_frame(ctx, mpp_frame) != MPP_OK) {
-        spdlog::warn("MPP encoder: encode_put_frame failed");
-        mpp_frame_deinit(&mpp_frame);
-        mpp_buffer_put(rpc.buffer);
-        rpc.buffer = nullptr;
-        return;
+    // Queue the frame before submitting it so the collector can match a
+    // packet that comes back right away. The buffer ref is released once the
+    // packet is out.
+    f.submit_us = monotonic_us();
+    {
+        std::lock_guard<std::mutex> lock(flight_mtx);
+        in_flight.push_back(f);
     }
-    mpp_frame_deinit(&mpp_frame);
+    flight_cv.notify_all();
+    rpc.buffer = nullptr;
 
-    // Blocking wait: one frame in → one packet out in synchronous MPP encoding.
-    MppPacket packet = nullptr;
-    MPP_RET get_ret = mpi->encode_get_packet(ctx, &packet);
-    if (get_ret != MPP_OK) {
-        spdlog::warn("MPP encoder: encode_get_packet failed ret={}", (int)get_ret);
-    } else if (!packet) {
-        spdlog::warn("MPP encoder: encode_get_packet returned null packet");
-    } else {
-        void *data = mpp_packet_get_pos(packet);
-        size_t len  = mpp_packet_get_length(packet);
-        if (len > 0 && output_cb) {
-            output_cb(std::make_shared<std::vector<uint8_t>>(
-                static_cast<uint8_t *>(data),
-                static_cast<uint8_t *>(data) + len));
+    if (mpi->encode_put_frame(ctx, mpp_frame) != MPP_OK) {
+        spdlog::warn("MPP encoder: encode_put_frame failed");
+        std::lock_guard<std::mutex> lock(flight_mtx);
+        for (auto it = in_flight.begin(); it != in_flight.end(); ++it) {
+            if (it->buffer == f.buffer && it->pts == f.pts) {
+                if (it->headers)
+                    headers_sent = false;
+                finish(*it);
+                in_flight.erase(it);
+                break;
+            }
         }
-        mpp_packet_deinit(&packet);
     }
-
-    // Encoding done — release the extra ref taken in the frame thread
-    mpp_buffer_put(rpc.buffer);
-    rpc.buffer = nullptr;
+    mpp_frame_deinit(&mpp_frame);
 }
@@ -2,6 +2,9 @@
 #define MPP_ENCODER_H
 
 #include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include <deque>
 #include <queue>
 #include <mutex>
 #include <condition_variable>
@@ -12,14 +15,61 @@
 #include <rockchip/rk_mpi.h>
 
 #include "gstrtpreceiver.h"
+#include "encoded_frame.h"
 
-enum class EncResolution { Res720p = 0, Res1080p = 1 };
+// Output size of a re-encoded rendition: frames are scaled to fit in
+// width x height with the aspect ratio of the source kept.
+struct EncResolution {
+    uint32_t width = 1920;
+    uint32_t height = 1080;
+
+    EncResolution() = default;
+    EncResolution(uint32_t w, uint32_t h) : width(w), height(h) {}
+
+    // "<h>p" (a 16:9 box, "480p" is 854x480) or "<w>x<h>"; even sizes
+    // between MIN_SIZE and MAX_SIZE only.
+    static bool parse(const char *s, EncResolution &out);
+    // Even size of a src_w x src_h frame scaled into the box.
+    void fit(uint32_t src_w, uint32_t src_h, uint32_t &w, uint32_t &h) const;
+
+    bool operator==(const EncResolution &o) const { return width == o.width && height == o.height; }
+    bool operator!=(const EncResolution &o) const { return !(*this == o); }
+
+    static const uint32_t MIN_SIZE = 64;
+    static const uint32_t MAX_SIZE = 4096;
+};
+
+enum class EncRcMode { CBR = 0, VBR = 1, AVBR = 2, FIXQP = 3 };
+
+// Rate control and GOP structure of a re-encoder.
+//  CBR   holds the bitrate steady (bitrate_kbps +-20%)
+//  VBR   lets it go up to 1.5x on motion and far lower on static scenes
+//  AVBR  like VBR, but also lowers the quality of static scenes to save bits
+//  FIXQP every frame at qp_fixed, bitrate unbounded
+struct EncRateControl {
+    EncRcMode mode = EncRcMode::CBR;
+    int qp_min = QP_MIN_DEFAULT;     // QP bounds of CBR / VBR / AVBR
+    int qp_max = QP_MAX_DEFAULT;
+    int qp_fixed = 26;               // FIXQP
+    int gop = 0;                     // frames between IDRs, 0 = two seconds
+    int intra_refresh = 0;           // macroblock rows intra coded per frame, 0 = off
+
+    // "cbr", "vbr", "avbr" or "fixqp"
+    static bool parse_mode(const char *s, EncRcMode &out);
+    static const char *mode_name(EncRcMode mode);
+
+    static const int QP_MIN_DEFAULT = 10;
+    static const int QP_MAX_DEFAULT = 51;
+};
 
 struct MppEncoderParams {
     VideoCodec codec = VideoCodec::H264;
     int fps = 30;
     int bitrate_kbps = 8000;
-    EncResolution resolution = EncResolution::Res1080p;
+    EncResolution resolution;
+    EncRateControl rc;
+    int in_flight = 2;   // frames handed to the VEPU before the first comes back
+    const char *name = "reenc";   // "encoder" tag of its facts
 };
 
 struct EncRpc {
@@ -29,6 +79,7 @@ struct EncRpc {
         RPC_SET_BITRATE,  // live bitrate change (no reinit)
         RPC_SET_CODEC,    // codec change (forces reinit on next frame)
         RPC_SET_FPS,      // fps change (forces reinit on next frame)
+        RPC_SET_RATE_CONTROL, // rc mode / QP / GOP change (no reinit)
         RPC_SHUTDOWN
     } command;
 
@@ -46,16 +97,44 @@ struct EncRpc {
     int new_fps     = 0;
     // For RPC_SET_CODEC
     VideoCodec new_codec = VideoCodec::UNKNOWN;
+    // For RPC_SET_RATE_CONTROL
+    EncRateControl new_rc;
 };
 
+// ---------------------------------------------------------------------------
+// MppEncoder: hardware re-encoder for the DVR.
+//
+//  Input and output are pipelined: the encoder thread submits frames with
+//  encode_put_frame() while a collector thread waits in encode_get_packet(),
+//  so up to params.in_flight frames are in the VEPU at once instead of the
+//  hardware idling through every round trip.  Each submitted frame keeps its
+//  buffer reference and pts in a FIFO until its packet comes out; packets
+//  are matched to it by pts and reported with it.  push_frame() refuses
+//  frames while the pipeline is full, which is the backpressure the caller
+//  sees.
+//
+//  Rate control follows params.rc and can be changed live.  Every second
+//  the collector publishes the bitrate and average QP it actually got
+//  (dvr.reenc_kbps, dvr.reenc_qp, tagged with params.name).
+//
+//  Packets are handed on without copying: the EncodedFrame keeps the
+//  MppPacket until the DVR is done with it.  MPP allocates packets from a
+//  limited pool, so at most MAX_HELD_PACKETS are out at a time; beyond that
+//  (a consumer falling behind) packets are copied into pooled buffers.
+// ---------------------------------------------------------------------------
+
 class MppEncoder {
 public:
-    using FrameCallback = std::function<void(std::shared_ptr<std::vector<uint8_t>>)>;
+    // pts is the one given to push_frame() for the frame the packet encodes.
+    using FrameCallback = std::function<void(EncodedFramePtr, uint64_t pts)>;
 
     explicit MppEncoder(MppEncoderParams params, FrameCallback cb);
     ~MppEncoder();
 
-    void push_frame(MppBuffer buffer,
+    // Takes over the caller's buffer reference. False when params.in_flight
+    // frames are already queued or being encoded: the caller keeps the
+    // reference and should drop or retry the frame.
+    bool push_frame(MppBuffer buffer,
                     uint32_t width, uint32_t height,
                     uint32_t hor_stride, uint32_t ver_stride,
                     MppFrameFormat fmt, uint64_t pts);
@@ -66,19 +145,43 @@ public:
     void set_bitrate(int kbps);   // update RC bitrate without reinit
     void set_codec(VideoCodec c); // change codec — forces reinit on next frame
     void set_fps(int fps);        // change fps — forces reinit on next frame
+    void set_rate_control(const EncRateControl &rc);   // applied without reinit
 
     VideoCodec get_codec() const { return params.codec; }
 
     static void *__THREAD__(void *context);
+    static void *__OUTPUT_THREAD__(void *context);
+
+    // How long the drain on reinit/shutdown waits for frames in flight.
+    static constexpr int DRAIN_TIMEOUT_MS = 500;
+    // encode_get_packet() timeout, so the collector notices a stop request.
+    static constexpr int OUTPUT_TIMEOUT_MS = 100;
+    // MppPackets handed out by reference at a time.
+    static constexpr int MAX_HELD_PACKETS = 4;
 
 private:
+    // A frame submitted to MPP whose packet hasn't come back yet.
+    struct InFlight {
+        MppBuffer buffer = nullptr;
+        uint64_t pts = 0;
+        uint64_t submit_us = 0;
+        bool headers = false;   // emit extra_data before this frame's packet
+    };
+
     void loop();
+    void output_loop();
+    void start_output();
+    void stop_output();
+    void finish(InFlight &f);
+    EncodedFramePtr wrap_packet(MppPacket &packet);
     bool init_encoder(uint32_t width, uint32_t height,
                       uint32_t hor_stride, uint32_t ver_stride,
                       MppFrameFormat fmt);
     void cleanup_encoder();
     void encode_frame(EncRpc &rpc);
     void enqueue(EncRpc rpc);
+    void apply_rate_control(MppEncCfg cfg);
+    void publish_stats(uint64_t now_us);
 
 private:
     MppEncoderParams params;
@@ -90,7 +193,8 @@ private:
     bool initialized = false;
     bool idr_pending = true;
     bool headers_sent = false;
-    std::vector<uint8_t> extra_data; // VPS/SPS/PPS from MPP_ENC_GET_EXTRA_INFO
+    // VPS/SPS/PPS from MPP_ENC_GET_HDR_SYNC, shared by every header frame
+    std::shared_ptr<const std::vector<uint8_t>> extra_data;
     uint32_t enc_width = 0;
     uint32_t enc_height = 0;
     uint32_t enc_hor_stride = 0;
@@ -99,6 +203,28 @@ private:
     std::queue<EncRpc> queue;
     std::mutex mtx;
     std::condition_variable cv;
+
+    // Frames accepted by push_frame() and not done yet (queued + in flight)
+    std::atomic<int> outstanding{0};
+    const int max_in_flight;
+
+    // Submission (encoder thread) and collection (output thread) side
+    std::deque<InFlight> in_flight;
+    std::mutex flight_mtx;
+    std::condition_variable flight_cv;
+    pthread_t output_tid;
+    bool output_running = false;
+    bool output_stop = false;          // under flight_mtx
+    uint64_t latency_sum_us = 0;       // output thread only
+    unsigned latency_count = 0;
+    // Achieved bitrate / QP over the current second, output thread only
+    uint64_t stats_start_us = 0;
+    uint64_t stats_bytes = 0;
+    int64_t  stats_qp_sum = 0;
+    unsigned stats_qp_count = 0;
+    // Packets out by reference; shared with their frames, which can
+    // outlive the encoder
+    std::shared_ptr<std::atomic<int>> held_packets = std::make_shared<std::atomic<int>>(0);
 };
 
 #endif // MPP_ENCODER_H
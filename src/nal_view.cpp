@@ -0,0 +1,69 @@
+#include <string.h>
+
+#include "nal_view.h"
+
+// Position just past the next 00 00 01 at or after p, or end if none.
+static const uint8_t *next_start_code(const uint8_t *p, const uint8_t *end) {
+    while (end - p >= 3) {
+        const uint8_t *one = (const uint8_t *)memchr(p + 2, 0x01, end - p - 2);
+        if (!one)
+            return end;
+        if (one[-1] == 0 && one[-2] == 0)
+            return one + 1;
+        p = one - 1;
+    }
+    return end;
+}
+
+void NalView::scan(const uint8_t *data, size_t len, bool hevc) {
+    data_ = data;
+    hevc_ = hevc;
+    spans_.clear();
+    const uint8_t *end = data + len;
+    const uint8_t *p = next_start_code(data, end);
+    while (p < end) {
+        const uint8_t *next = next_start_code(p, end);
+        // next points past the following start code; back up over it and over
+        // the zero bytes of a 4-byte start code / trailing_zero_8bits.
+        const uint8_t *stop = next == end ? end : next - 3;
+        while (stop > p && stop[-1] == 0)
+            stop--;
+        if (stop > p) {
+            NalSpan s;
+            s.offset = (uint32_t)(p - data);
+            s.length = (uint32_t)(stop - p);
+            s.type = hevc ? (p[0] >> 1) & 0x3f : p[0] & 0x1f;
+            spans_.push_back(s);
+        }
+        p = next;
+    }
+}
+
+bool NalView::has_irap() const {
+    for (const NalSpan &s : spans_)
+        if (is_irap(hevc_, s.type))
+            return true;
+    return false;
+}
+
+bool NalView::has_vcl() const {
+    for (const NalSpan &s : spans_)
+        if (is_vcl(hevc_, s.type))
+            return true;
+    return false;
+}
+
+bool NalView::has_reference() const {
+    for (const NalSpan &s : spans_)
+        if (is_vcl(hevc_, s.type) && is_reference(hevc_, nal(s), s.type))
+            return true;
+    return false;
+}
+
+size_t NalView::muxable_count() const {
+    size_t n = 0;
+    for (const NalSpan &s : spans_)
+        if (!is_supplemental(hevc_, s.type))
+            n++;
+    return n;
+}
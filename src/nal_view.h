@@ -0,0 +1,67 @@
+#ifndef NAL_VIEW_H
+#define NAL_VIEW_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// NalView: one-pass index of the NAL units in an Annex-B access unit.
+//
+//  scan() walks the buffer once and records (offset, length, type) for every
+//  NAL; nothing is copied.  Callers then filter, cache parameter sets and
+//  detect keyframes from the span list instead of re-parsing the bitstream,
+//  and hand the wanted spans to the muxer in place.
+// ---------------------------------------------------------------------------
+
+struct NalSpan {
+    uint32_t offset;   // first byte of the NAL header (start code skipped)
+    uint32_t length;   // NAL size, start code and trailing zero bytes excluded
+    uint8_t  type;     // nal_unit_type
+};
+
+class NalView {
+public:
+    // Index data[0..len). The span storage is reused between calls.
+    void scan(const uint8_t *data, size_t len, bool hevc);
+
+    const std::vector<NalSpan> &spans() const { return spans_; }
+    const uint8_t *data() const { return data_; }
+    const uint8_t *nal(const NalSpan &s) const { return data_ + s.offset; }
+    bool hevc() const { return hevc_; }
+
+    // Contains an IDR (H.264) or IRAP (H.265) slice.
+    bool has_irap() const;
+    // Contains at least one slice, i.e. is a picture and not just headers.
+    bool has_vcl() const;
+    // Contains a slice other pictures may reference (nal_ref_idc != 0 on
+    // H.264, not a sub-layer non-reference type on H.265).
+    bool has_reference() const;
+    // Number of spans the DVR muxes (everything but AUD/SEI on H.265, AUD on H.264).
+    size_t muxable_count() const;
+
+    static bool is_irap(bool hevc, uint8_t type) {
+        return hevc ? (type >= 16 && type <= 23) : type == 5;
+    }
+    static bool is_vcl(bool hevc, uint8_t type) {
+        return hevc ? type < 32 : (type >= 1 && type <= 5);
+    }
+    // nal points at the NAL header. Non-VCL NALs count as references.
+    static bool is_reference(bool hevc, const uint8_t *nal, uint8_t type) {
+        if (hevc)
+            return type > 14 || (type & 1);   // TRAIL_N, TSA_N, ... RSV_VCL_N14
+        return (nal[0] >> 5) & 3;
+    }
+    // NALs minimp4 can't store: AUD, PREFIX_SEI and SUFFIX_SEI on H.265,
+    // AUD on H.264.
+    static bool is_supplemental(bool hevc, uint8_t type) {
+        return hevc ? (type == 35 || type == 39 || type == 40) : type == 9;
+    }
+
+private:
+    const uint8_t *data_ = nullptr;
+    bool hevc_ = false;
+    std::vector<NalSpan> spans_;
+};
+
+#endif // NAL_VIEW_H
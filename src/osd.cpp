@@ -47,6 +47,7 @@ extern "C" {
 #include <fmt/ranges.h>
 #include "../lvgl/lvgl.h"
 #include "osd_gl.hpp"
+#include "dvr_telemetry.h"
 
 #ifdef BUILD_TESTS
 #include <catch2/catch.hpp>
@@ -80,6 +81,8 @@ extern float live_colortrans_gain;
 
 #include "frame_processor.h"
 extern FrameProcessor *frame_proc;
+#include "snapshot.h"
+extern Snapshot *snapshot;
 extern bool dvr_osd;
 
 osd_thread_params *p;
@@ -1992,8 +1995,11 @@ void my_flush_cb(lv_display_t * display, const lv_area_t * area, uint8_t * px_ma
 	{
 		struct modeset_buf *osd_buf = &p->out->osd_bufs[p->out->osd_buf_switch];
 		if (dvr_osd && frame_proc)
-			frame_proc->set_osd_blend(osd_buf->prime_fd, osd_buf->width, osd_buf->height,
-			                         osd_buf->stride / 4);
+			frame_proc->set_osd_blend(osd_buf->prime_fd, osd_buf->map, osd_buf->width,
+			                         osd_buf->height, osd_buf->stride / 4, false);
+		if (snapshot)
+			snapshot->set_osd(osd_buf->map, osd_buf->width, osd_buf->height,
+			                  osd_buf->stride / 4, false);
 	}
 
 	// tell the display thread that we have a update
@@ -2118,8 +2124,11 @@ void *__OSD_THREAD__(void *param) {
 				assert(!ret);
 
 				if (dvr_osd && frame_proc)
-					frame_proc->set_osd_blend(buf->prime_fd, buf->width, buf->height,
-					                         buf->stride / 4);
+					frame_proc->set_osd_blend(buf->prime_fd, buf->map, buf->width,
+					                         buf->height, buf->stride / 4, true);
+				if (snapshot)
+					snapshot->set_osd(buf->map, buf->width, buf->height,
+					                  buf->stride / 4, true);
 
 				// tell the display thread that we have a update
 				ret = pthread_mutex_lock(&video_mutex);
@@ -2148,7 +2157,25 @@ void mk_tags(osd_tag *tags, int n_tags, FactTags *fact_tags) {
 	}
 }
 
+// Facts selected with --dvr-telemetry also go to the DVR sidecars,
+// whether the OSD is enabled or not.
+static void record_telemetry(const Fact &fact) {
+	if (!DvrTelemetry::active())
+		return;
+	std::string name = fact.getName();
+	if (!DvrTelemetry::wanted(name))
+		return;
+	std::string tags;
+	for (const auto &tag : fact.getTags()) {
+		if (!tags.empty())
+			tags += ";";
+		tags += tag.first + "=" + tag.second;
+	}
+	DvrTelemetry::record(name, tags, fact.asString());
+}
+
 void publish(Fact fact) {
+	record_telemetry(fact);
 	if (!enable_osd) return;
 	//SPDLOG_DEBUG("post fact {}({})", fact.getName(), fact.getTags());
 	{
@@ -2171,6 +2198,8 @@ void *osd_batch_init(uint n) {
 }
 void osd_publish_batch(void *batch) {
 	std::vector<Fact> *facts = static_cast<std::vector<Fact> *>(batch);
+	for (const Fact& fact : *facts)
+		record_telemetry(fact);
 	if (enable_osd) {
 		{
 			std::lock_guard<std::mutex> lock(mtx);
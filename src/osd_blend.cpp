@@ -0,0 +1,165 @@
+#include <string.h>
+#include <algorithm>
+
+#include "osd_blend.h"
+
+void OsdTiles::clear() {
+    rects_.clear();
+    coverage_pct_ = 0;
+}
+
+void OsdTiles::scan(const uint8_t *bgra, uint32_t width, uint32_t height, uint32_t stride) {
+    clear();
+    if (!bgra || !width || !height)
+        return;
+
+    uint32_t cols = (width + TILE - 1) / TILE;
+    uint32_t rows = (height + TILE - 1) / TILE;
+    std::vector<bool> visible(cols);
+    // Rectangles still open from the previous tile row, to be grown downwards
+    std::vector<size_t> open, still_open;
+    uint64_t covered = 0;
+
+    for (uint32_t ty = 0; ty < rows; ty++) {
+        std::fill(visible.begin(), visible.end(), false);
+        uint32_t y_end = ty * TILE + TILE < height ? ty * TILE + TILE : height;
+        uint32_t left = cols;   // tiles not known to be visible yet
+        for (uint32_t y = ty * TILE; y < y_end && left; y++) {
+            const uint8_t *row = bgra + (size_t)y * stride;
+            for (uint32_t tx = 0; tx < cols; tx++) {
+                if (visible[tx])
+                    continue;
+                uint32_t x_end = tx * TILE + TILE < width ? tx * TILE + TILE : width;
+                uint32_t alpha = 0;
+                for (uint32_t x = tx * TILE; x < x_end; x++) {
+                    uint32_t px;
+                    memcpy(&px, row + (size_t)x * 4, 4);
+                    alpha |= px;
+                }
+                if (alpha & 0xff000000u) {
+                    visible[tx] = true;
+                    left--;
+                }
+            }
+        }
+
+        // Runs of visible tiles; a run with the same extent as one in the
+        // row above extends that rectangle.
+        still_open.clear();
+        for (uint32_t tx = 0; tx < cols;) {
+            if (!visible[tx]) {
+                tx++;
+                continue;
+            }
+            uint32_t start = tx;
+            while (tx < cols && visible[tx])
+                tx++;
+            BlendRect r;
+            r.x = start * TILE;
+            r.y = ty * TILE;
+            r.w = (tx * TILE < width ? tx * TILE : width) - r.x;
+            r.h = y_end - r.y;
+            covered += (uint64_t)r.w * r.h;
+
+            bool grown = false;
+            for (size_t i : open) {
+                BlendRect &above = rects_[i];
+                if (above.x == r.x && above.w == r.w && above.y + above.h == r.y) {
+                    above.h += r.h;
+                    still_open.push_back(i);
+                    grown = true;
+                    break;
+                }
+            }
+            if (!grown) {
+                rects_.push_back(r);
+                still_open.push_back(rects_.size() - 1);
+            }
+        }
+        open.swap(still_open);
+    }
+    coverage_pct_ = (unsigned)(covered * 100 / ((uint64_t)width * height));
+}
+
+BlendRect osd_rect_on_frame(const BlendRect &osd_rect, uint32_t osd_w, uint32_t osd_h,
+                            uint32_t frame_w, uint32_t frame_h) {
+    BlendRect r;
+    if (!osd_w || !osd_h)
+        return r;
+    uint32_t x0 = (uint32_t)((uint64_t)osd_rect.x * frame_w / osd_w) & ~1u;
+    uint32_t y0 = (uint32_t)((uint64_t)osd_rect.y * frame_h / osd_h) & ~1u;
+    uint32_t x1 = (uint32_t)(((uint64_t)(osd_rect.x + osd_rect.w) * frame_w + osd_w - 1) / osd_w);
+    uint32_t y1 = (uint32_t)(((uint64_t)(osd_rect.y + osd_rect.h) * frame_h + osd_h - 1) / osd_h);
+    x1 = (x1 + 1) & ~1u;
+    y1 = (y1 + 1) & ~1u;
+    if (x1 > frame_w) x1 = frame_w;
+    if (y1 > frame_h) y1 = frame_h;
+    if (x1 <= x0 || y1 <= y0)
+        return r;
+    r.x = x0;
+    r.y = y0;
+    r.w = x1 - x0;
+    r.h = y1 - y0;
+    return r;
+}
+
+static inline uint8_t clamp_u8(int v) {
+    return v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+}
+
+void nv12_blend(const Nv12Image &frame, const BgraImage &osd, const BlendRect &osd_rect) {
+    BlendRect r = osd_rect_on_frame(osd_rect, osd.width, osd.height, frame.width, frame.height);
+    if (!r.w || !r.h || !osd.data)
+        return;
+
+    // OSD column of every frame column in the rectangle
+    std::vector<uint32_t> osd_x(r.w);
+    for (uint32_t i = 0; i < r.w; i++)
+        osd_x[i] = (uint32_t)((uint64_t)(r.x + i) * osd.width / frame.width);
+
+    for (uint32_t fy = r.y; fy < r.y + r.h; fy += 2) {
+        const uint8_t *src[2];
+        for (int k = 0; k < 2; k++) {
+            uint32_t oy = (uint32_t)((uint64_t)(fy + k) * osd.height / frame.height);
+            src[k] = osd.data + (size_t)oy * osd.stride;
+        }
+        uint8_t *y_row[2] = {frame.y + (size_t)fy * frame.stride,
+                             frame.y + (size_t)(fy + 1) * frame.stride};
+        uint8_t *uv_row = frame.uv + (size_t)(fy / 2) * frame.stride;
+
+        for (uint32_t i = 0; i < r.w; i += 2) {
+            uint32_t fx = r.x + i;
+            // Premultiplied colour and coverage of the block's 4 pixels
+            int a_sum = 0, r_sum = 0, g_sum = 0, b_sum = 0;
+            for (int k = 0; k < 2; k++) {
+                for (int j = 0; j < 2; j++) {
+                    const uint8_t *px = src[k] + (size_t)osd_x[i + j] * 4;
+                    int a = px[3];
+                    if (!a)
+                        continue;
+                    int b = px[0], g = px[1], rr = px[2];
+                    if (!osd.premultiplied) {
+                        b = (b * a + 127) / 255;
+                        g = (g * a + 127) / 255;
+                        rr = (rr * a + 127) / 255;
+                    }
+                    uint8_t &y = y_row[k][fx + j];
+                    int luma = ((66 * rr + 129 * g + 25 * b + 128) >> 8) + (16 * a + 127) / 255;
+                    y = clamp_u8((y * (255 - a) + 127) / 255 + luma);
+                    a_sum += a;
+                    r_sum += rr;
+                    g_sum += g;
+                    b_sum += b;
+                }
+            }
+            if (!a_sum)
+                continue;
+            uint8_t &u = uv_row[fx];
+            uint8_t &v = uv_row[fx + 1];
+            int cb = (-38 * r_sum - 74 * g_sum + 112 * b_sum) / 1024 + (128 * a_sum + 510) / 1020;
+            int cr = (112 * r_sum - 94 * g_sum - 18 * b_sum) / 1024 + (128 * a_sum + 510) / 1020;
+            u = clamp_u8((u * (1020 - a_sum) + 510) / 1020 + cb);
+            v = clamp_u8((v * (1020 - a_sum) + 510) / 1020 + cr);
+        }
+    }
+}
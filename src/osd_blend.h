@@ -0,0 +1,69 @@
+#ifndef OSD_BLEND_H
+#define OSD_BLEND_H
+
+#include <stdint.h>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// OSD blending straight into NV12 video frames.
+//
+//  OsdTiles finds the TILE x TILE blocks of a BGRA OSD buffer that hold any
+//  visible pixel and merges them into a few rectangles, so only those parts
+//  of the frame are touched: an OSD with a handful of widgets covers a few
+//  percent of it.  The map is rebuilt when a new OSD frame is first
+//  blended, not for every video frame nor for OSD frames nobody records.
+//
+//  nv12_blend() is the portable path.  It composites one OSD rectangle
+//  into an NV12 frame in place, scaling the OSD to the frame size (nearest
+//  neighbour) and converting to BT.601 limited range on the fly.  Chroma is
+//  blended per 2x2 block with the average coverage of its four pixels.
+// ---------------------------------------------------------------------------
+
+struct BlendRect {
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t w = 0;
+    uint32_t h = 0;
+};
+
+class OsdTiles {
+public:
+    // bgra: little-endian BGRA (alpha in the top byte), stride in bytes.
+    void scan(const uint8_t *bgra, uint32_t width, uint32_t height, uint32_t stride);
+    void clear();
+
+    const std::vector<BlendRect> &rects() const { return rects_; }
+    // Share of the OSD in visible tiles.
+    unsigned coverage_pct() const { return coverage_pct_; }
+
+    static const uint32_t TILE = 32;
+
+private:
+    std::vector<BlendRect> rects_;
+    unsigned coverage_pct_ = 0;
+};
+
+struct Nv12Image {
+    uint8_t *y = nullptr;
+    uint8_t *uv = nullptr;
+    uint32_t width = 0;    // even
+    uint32_t height = 0;   // even
+    uint32_t stride = 0;   // bytes per row, both planes
+};
+
+struct BgraImage {
+    const uint8_t *data = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t stride = 0;          // bytes per row
+    bool premultiplied = true;    // Cairo is, LVGL isn't
+};
+
+// The even aligned frame rectangle an OSD rectangle lands on.
+BlendRect osd_rect_on_frame(const BlendRect &osd_rect, uint32_t osd_w, uint32_t osd_h,
+                            uint32_t frame_w, uint32_t frame_h);
+
+// Composite osd_rect of osd over the matching part of frame.
+void nv12_blend(const Nv12Image &frame, const BgraImage &osd, const BlendRect &osd_rect);
+
+#endif // OSD_BLEND_H
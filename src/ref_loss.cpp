@@ -0,0 +1,91 @@
+#include "ref_loss.h"
+
+extern "C" {
+#include "osd.h"
+}
+
+void RefLossTracker::fed(uint64_t pts, bool reference, bool keyframe, unsigned lost_packets, bool loss_confined) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    stats_.lost_packets += lost_packets;
+    Loss loss = lost_packets == 0 ? NO_LOSS : loss_confined ? LOSS_CONFINED : LOSS_UNCONFINED;
+    in_flight_.push_back({pts, reference, keyframe, loss});
+    if (in_flight_.size() > MAX_IN_FLIGHT)
+        in_flight_.pop_front();
+}
+
+RefLossTracker::Verdict RefLossTracker::judge(const Fed &au, bool error) {
+    if (au.keyframe && !error) {
+        broken_ = false;
+        return OK;
+    }
+    if (!error && au.loss == NO_LOSS) {
+        // Until a keyframe, clean looking pictures still refer to what was lost
+        return broken_ ? BROKEN : OK;
+    }
+    if (au.reference || au.loss == LOSS_UNCONFINED) {
+        if (!broken_)
+            stats_.breaks++;
+        broken_ = true;
+        return BROKEN;
+    }
+    stats_.concealed++;
+    return broken_ ? BROKEN : CONCEALED;
+}
+
+RefLossTracker::Verdict RefLossTracker::decoded(uint64_t pts, bool error, uint64_t now_ms) {
+    Verdict verdict = OK;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        // Access units that never came out: only matter after a loss
+        while (!in_flight_.empty() && in_flight_.front().pts < pts) {
+            const Fed &lost = in_flight_.front();
+            if (lost.loss != NO_LOSS) {
+                Verdict v = judge(lost, true);
+                if (v > verdict)
+                    verdict = v;
+            }
+            in_flight_.pop_front();
+        }
+        Verdict v;
+        if (!in_flight_.empty() && in_flight_.front().pts == pts) {
+            v = judge(in_flight_.front(), error);
+            in_flight_.pop_front();
+        } else {
+            // Not one we know (fed before a reset): assume the worst of errors
+            Fed unknown = {pts, true, false, NO_LOSS};
+            v = judge(unknown, error);
+        }
+        if (v > verdict)
+            verdict = v;
+    }
+    publish_stats(now_ms);
+    return verdict;
+}
+
+void RefLossTracker::reset() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    in_flight_.clear();
+    broken_ = false;
+}
+
+bool RefLossTracker::broken() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return broken_;
+}
+
+RefLossTracker::Stats RefLossTracker::stats() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return stats_;
+}
+
+void RefLossTracker::publish_stats(uint64_t now_ms) {
+    if (now_ms - published_ms_ < 1000)
+        return;
+    published_ms_ = now_ms;
+    Stats s = stats();
+    void *batch = osd_batch_init(3);
+    osd_add_uint_fact(batch, "video.lost_packets", NULL, 0, s.lost_packets);
+    osd_add_uint_fact(batch, "video.reference_breaks", NULL, 0, s.breaks);
+    osd_add_uint_fact(batch, "video.losses_concealed", NULL, 0, s.concealed);
+    osd_publish_batch(batch);
+}
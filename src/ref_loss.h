@@ -0,0 +1,68 @@
+#ifndef REF_LOSS_H
+#define REF_LOSS_H
+
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+
+// ---------------------------------------------------------------------------
+// RefLossTracker: tells a broken reference chain from a loss the decoder
+//  concealed, so keyframes are only asked for when they are needed.
+//
+//  The feed side reports every access unit it hands to the decoder: its
+//  pts, whether other pictures may reference it, whether it is a keyframe,
+//  how many RTP packets were lost just before it, and whether all of them
+//  were provably inside that access unit.  The output side reports every
+//  decoded frame with MPP's error flags; frames are matched to their
+//  access unit by pts (the decoder echoes it, in feed order as there is no
+//  reordering in these streams).
+//
+//  Damage to a reference picture, flagged or not (MPP conceals quietly),
+//  breaks the chain: BROKEN, until a keyframe decodes clean.  So does a
+//  loss that may have spanned access units, as it may have taken a whole
+//  reference picture with it.  Only damage confined to a non-reference
+//  picture is CONCEALED: nothing depends on it and the next natural
+//  keyframe will do.
+// ---------------------------------------------------------------------------
+
+class RefLossTracker {
+public:
+    enum Verdict { OK, CONCEALED, BROKEN };
+
+    // Feed thread
+    void fed(uint64_t pts, bool reference, bool keyframe, unsigned lost_packets, bool loss_confined);
+    // Decoder output thread; error is errinfo or discard on the frame.
+    Verdict decoded(uint64_t pts, bool error, uint64_t now_ms);
+    // New stream or decoder: nothing in flight any more.
+    void reset();
+
+    bool broken() const;
+
+    struct Stats {
+        uint64_t lost_packets = 0;   // RTP packets lost before fed access units
+        uint64_t breaks = 0;         // reference chain broken
+        uint64_t concealed = 0;      // losses and errors confined to non-reference pictures
+    };
+    Stats stats() const;
+
+    static const size_t MAX_IN_FLIGHT = 64;
+
+private:
+    enum Loss { NO_LOSS, LOSS_CONFINED, LOSS_UNCONFINED };
+    struct Fed {
+        uint64_t pts;
+        bool reference;
+        bool keyframe;
+        Loss loss;
+    };
+    Verdict judge(const Fed &au, bool error);
+    void publish_stats(uint64_t now_ms);
+
+    mutable std::mutex mtx_;
+    std::deque<Fed> in_flight_;
+    bool broken_ = false;
+    Stats stats_;
+    uint64_t published_ms_ = 0;
+};
+
+#endif // REF_LOSS_H
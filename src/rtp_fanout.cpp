@@ -0,0 +1,455 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+#include "spdlog/spdlog.h"
+
+#include "rtp_fanout.h"
+extern "C" {
+#include "osd.h"
+}
+
+static uint64_t monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool same_addr(const sockaddr_in &a, const sockaddr_in &b) {
+    return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+static std::string addr_str(const sockaddr_in &a) {
+    char ip[INET_ADDRSTRLEN] = "";
+    inet_ntop(AF_INET, &a.sin_addr, ip, sizeof(ip));
+    return std::string(ip) + ":" + std::to_string(ntohs(a.sin_port));
+}
+
+// Bytes a paced destination may send at once: 20 ms of its rate, and never
+// less than two full packets.
+static double bucket_size(unsigned kbps) {
+    return std::max(kbps / 8.0 * 20, 3000.0);
+}
+
+RtpFanout::RtpFanout(const Params &params) : params_(params) {
+    if (params_.backlog < BATCH) params_.backlog = BATCH;
+    sock_ = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock_ < 0)
+        spdlog::error("RTP fanout: socket failed: {}", strerror(errno));
+    if (pipe2(wake_, O_NONBLOCK | O_CLOEXEC) != 0)
+        spdlog::error("RTP fanout: pipe failed: {}", strerror(errno));
+
+    if (!params_.fifo.empty()) {
+        const char *path = params_.fifo.c_str();
+        unlink(path);
+        if (mkfifo(path, 0622) != 0 || chmod(path, 0622) != 0) {
+            spdlog::error("RTP fanout: failed to create FIFO {}: {}", path, strerror(errno));
+        } else {
+            // Opened read-write so it never reports a hang-up between writers
+            fifo_fd_ = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+            if (fifo_fd_ < 0)
+                spdlog::error("RTP fanout: failed to open FIFO {}: {}", path, strerror(errno));
+        }
+    }
+}
+
+RtpFanout::~RtpFanout() {
+    shutdown();
+    if (fifo_fd_ >= 0) {
+        close(fifo_fd_);
+        unlink(params_.fifo.c_str());
+    }
+    for (int fd : wake_)
+        if (fd >= 0) close(fd);
+    if (sock_ >= 0)
+        close(sock_);
+}
+
+bool RtpFanout::parse_destination(const std::string &s, sockaddr_in &out) {
+    size_t colon = s.rfind(':');
+    if (colon == std::string::npos || colon == 0)
+        return false;
+    std::string host = s.substr(0, colon);
+    char *end = nullptr;
+    long port = strtol(s.c_str() + colon + 1, &end, 10);
+    if (*end || port < 1 || port > 65535)
+        return false;
+
+    memset(&out, 0, sizeof(out));
+    out.sin_family = AF_INET;
+    out.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, host.c_str(), &out.sin_addr) == 1)
+        return true;
+
+    struct addrinfo hints = {}, *res = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &res) != 0 || !res)
+        return false;
+    out.sin_addr = ((sockaddr_in *)res->ai_addr)->sin_addr;
+    freeaddrinfo(res);
+    return true;
+}
+
+RtpFanout::Target *RtpFanout::find(const sockaddr_in &addr) {
+    for (auto &t : targets_)
+        if (same_addr(t->addr, addr))
+            return t.get();
+    return nullptr;
+}
+
+void RtpFanout::update_active() {
+    size_t n = 0;
+    for (auto &t : targets_)
+        if (t->d.enabled) n++;
+    active_.store(n, std::memory_order_relaxed);
+}
+
+bool RtpFanout::add(const sockaddr_in &addr, unsigned pace_kbps) {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (find(addr))
+            return false;
+        std::unique_ptr<Target> t(new Target);
+        t->addr = addr;
+        t->d.name = addr_str(addr);
+        t->d.pace_kbps = pace_kbps;
+        t->tokens = bucket_size(pace_kbps);
+        targets_.push_back(std::move(t));
+        update_active();
+    }
+    if (pace_kbps)
+        spdlog::info("[RESTREAM] Streaming to {} at {} kbps at most", addr_str(addr), pace_kbps);
+    else
+        spdlog::info("[RESTREAM] Streaming to {}", addr_str(addr));
+    if (on_added)
+        on_added();
+    return true;
+}
+
+bool RtpFanout::remove(const sockaddr_in &addr) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = std::find_if(targets_.begin(), targets_.end(),
+                           [&](const std::unique_ptr<Target> &t) { return same_addr(t->addr, addr); });
+    if (it == targets_.end())
+        return false;
+    spdlog::info("[RESTREAM] Stopped streaming to {} ({} packets, {} errors, {} dropped)",
+                 (*it)->d.name, (*it)->d.packets, (*it)->d.send_errors, (*it)->d.dropped);
+    targets_.erase(it);
+    removed_ = true;
+    update_active();
+    return true;
+}
+
+bool RtpFanout::set_enabled(const sockaddr_in &addr, bool enabled) {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        Target *t = find(addr);
+        if (!t)
+            return false;
+        if (t->d.enabled == enabled)
+            return true;
+        t->d.enabled = enabled;
+        t->backlog.clear();
+        t->tokens = bucket_size(t->d.pace_kbps);
+        update_active();
+    }
+    spdlog::info("[RESTREAM] {} {}", enabled ? "Resumed" : "Paused", addr_str(addr));
+    if (enabled && on_added)
+        on_added();
+    return true;
+}
+
+bool RtpFanout::set_pacing(const sockaddr_in &addr, unsigned pace_kbps) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    Target *t = find(addr);
+    if (!t)
+        return false;
+    t->d.pace_kbps = pace_kbps;
+    t->tokens = std::min(t->tokens, bucket_size(pace_kbps));
+    return true;
+}
+
+std::vector<RtpFanout::Destination> RtpFanout::destinations() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    std::vector<Destination> out;
+    for (auto &t : targets_)
+        out.push_back(t->d);
+    return out;
+}
+
+bool RtpFanout::command(const std::string &line) {
+    std::istringstream iss(line);
+    std::string cmd, dest;
+    iss >> cmd >> dest;
+    if (cmd.empty())
+        return true;
+    sockaddr_in addr;
+    if (!parse_destination(dest, addr)) {
+        spdlog::warn("RTP fanout: bad destination in '{}'", line);
+        return false;
+    }
+    long kbps = 0;
+    std::string arg;
+    if (iss >> arg) {
+        char *end = nullptr;
+        kbps = strtol(arg.c_str(), &end, 10);
+        if (*end || kbps < 0) {
+            spdlog::warn("RTP fanout: bad bitrate in '{}'", line);
+            return false;
+        }
+    }
+
+    if (cmd == "add")
+        return add(addr, (unsigned)kbps);
+    if (cmd == "remove")
+        return remove(addr);
+    if (cmd == "enable")
+        return set_enabled(addr, true);
+    if (cmd == "disable")
+        return set_enabled(addr, false);
+    if (cmd == "pace" && !arg.empty())
+        return set_pacing(addr, (unsigned)kbps);
+    spdlog::warn("RTP fanout: unknown command '{}'", line);
+    return false;
+}
+
+void RtpFanout::submit(const uint8_t *packet, size_t len) {
+    if (active() == 0 || len == 0)
+        return;
+    PacketPtr p = std::make_shared<const std::vector<uint8_t>>(packet, packet + len);
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (auto &t : targets_) {
+            if (!t->d.enabled)
+                continue;
+            if (t->backlog.size() >= params_.backlog) {
+                // Behind: live video, the oldest is the least useful
+                t->backlog.pop_front();
+                t->d.dropped++;
+            }
+            t->backlog.push_back(p);
+        }
+    }
+    // One byte per wake up, not per packet
+    if (!wake_pending_.exchange(true) && wake_[1] >= 0 && write(wake_[1], "p", 1) < 0) {}
+}
+
+// With mtx_ held. Moves the packets t may send now into b; returns the ms
+// until it may send again when that is none, IDLE_TICK_MS for an empty
+// backlog.
+uint64_t RtpFanout::take_batch(Target &t, uint64_t now_ms, Batch &b) {
+    double rate = t.d.pace_kbps / 8.0;          // bytes per ms
+    if (rate > 0) {
+        t.tokens = std::min(t.tokens + (now_ms - t.refilled_ms) * rate, bucket_size(t.d.pace_kbps));
+        t.refilled_ms = now_ms;
+    }
+
+    b.addr = t.addr;
+    b.count = 0;
+    double budget = t.tokens;
+    while (b.count < BATCH && !t.backlog.empty() && (rate == 0 || budget > 0)) {
+        budget -= t.backlog.front()->size();
+        b.packets[b.count++] = std::move(t.backlog.front());
+        t.backlog.pop_front();
+    }
+    if (b.count == 0 && !t.backlog.empty()) {
+        // Out of tokens until enough trickle in for a packet
+        return std::max((uint64_t)(-t.tokens / rate) + 1, (uint64_t)1);
+    }
+    return IDLE_TICK_MS;
+}
+
+// Without the lock: producers keep submitting while the socket is busy.
+void RtpFanout::send_batch(Batch &b) {
+    struct mmsghdr msgs[BATCH];
+    struct iovec iov[BATCH];
+    for (unsigned i = 0; i < b.count; i++) {
+        iov[i].iov_base = (void *)b.packets[i]->data();
+        iov[i].iov_len = b.packets[i]->size();
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &b.addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(b.addr);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    b.sent = sock_ >= 0 ? sendmmsg(sock_, msgs, b.count, 0) : -1;
+    b.error = b.sent < 0 ? errno : 0;
+}
+
+// With mtx_ held. Accounts for what b sent and puts the rest back in front
+// of t's backlog. Returns 0 when t may go on right away, else the ms until
+// it may send again.
+uint64_t RtpFanout::settle_batch(Target &t, Batch &b) {
+    unsigned done = 0;
+    uint64_t wait = 0;
+    if (b.sent < 0) {
+        if (b.error == EAGAIN || b.error == EWOULDBLOCK || b.error == ENOBUFS) {
+            wait = RETRY_MS;
+        } else {
+            // Unreachable and the like: this one is lost, go on with the rest
+            if (t.d.send_errors++ % 100 == 0)
+                spdlog::debug("RTP fanout: sendmmsg to {} failed: {}", t.d.name, strerror(b.error));
+            done = 1;
+        }
+    } else {
+        for (int i = 0; i < b.sent; i++) {
+            t.d.packets++;
+            t.d.bytes += b.packets[i]->size();
+            t.tokens -= b.packets[i]->size();
+        }
+        done = b.sent;
+        // A short count: the next call reports what stopped it
+    }
+    for (unsigned i = b.count; i-- > done;)
+        t.backlog.push_front(std::move(b.packets[i]));
+    while (t.backlog.size() > params_.backlog) {
+        t.backlog.pop_front();
+        t.d.dropped++;
+    }
+    for (unsigned i = 0; i < b.count; i++)
+        b.packets[i].reset();
+    if (t.backlog.empty())
+        return IDLE_TICK_MS;
+    return wait;
+}
+
+uint64_t RtpFanout::tick(uint64_t now_ms) {
+    uint64_t wait = IDLE_TICK_MS;
+    bool more = true;
+    while (more) {
+        more = false;
+        size_t n = 0;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (batches_.size() < targets_.size())
+                batches_.resize(targets_.size());
+            for (auto &t : targets_) {
+                if (!t->d.enabled)
+                    continue;
+                uint64_t w = take_batch(*t, now_ms, batches_[n]);
+                if (batches_[n].count)
+                    n++;
+                else
+                    wait = std::min(wait, w);
+            }
+        }
+        for (size_t i = 0; i < n; i++)
+            send_batch(batches_[i]);
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (size_t i = 0; i < n; i++) {
+            Batch &b = batches_[i];
+            Target *t = find(b.addr);
+            if (!t || !t->d.enabled) {
+                // Removed or paused meanwhile
+                for (unsigned j = 0; j < b.count; j++)
+                    b.packets[j].reset();
+                continue;
+            }
+            uint64_t w = settle_batch(*t, b);
+            if (w == 0)
+                more = true;
+            else
+                wait = std::min(wait, w);
+        }
+    }
+    publish_stats(now_ms);
+    if (published_ms_ + IDLE_TICK_MS > now_ms)
+        wait = std::min(wait, published_ms_ + IDLE_TICK_MS - now_ms);
+    return wait;
+}
+
+void RtpFanout::publish_stats(uint64_t now_ms) {
+    uint64_t elapsed = now_ms - published_ms_;
+    if (elapsed < 1000)
+        return;
+    bool first = published_ms_ == 0;
+    published_ms_ = now_ms;
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (targets_.empty() && !removed_)
+        return;   // another restream may be publishing, leave its facts alone
+    removed_ = false;
+
+    uint64_t total = 0;
+    void *batch = osd_batch_init(2 + 6 * targets_.size());
+    for (auto &t : targets_) {
+        uint64_t bytes = t->d.bytes - t->published_bytes;
+        t->published_bytes = t->d.bytes;
+        total += bytes;
+
+        osd_tag tags[1];
+        strncpy(tags[0].key, "dest", TAG_MAX_LEN - 1);
+        strncpy(tags[0].val, t->d.name.c_str(), TAG_MAX_LEN - 1);
+        tags[0].key[TAG_MAX_LEN - 1] = '\0';
+        tags[0].val[TAG_MAX_LEN - 1] = '\0';
+        osd_add_uint_fact(batch, "restream.dest.enabled", tags, 1, t->d.enabled);
+        osd_add_uint_fact(batch, "restream.dest.kbps", tags, 1, first ? 0 : bytes * 8 / elapsed);
+        osd_add_uint_fact(batch, "restream.dest.packets", tags, 1, t->d.packets);
+        osd_add_uint_fact(batch, "restream.dest.bytes", tags, 1, t->d.bytes);
+        osd_add_uint_fact(batch, "restream.dest.send_errors", tags, 1, t->d.send_errors);
+        osd_add_uint_fact(batch, "restream.dest.dropped", tags, 1, t->d.dropped);
+    }
+    osd_add_uint_fact(batch, "restream.kbps", NULL, 0, first ? 0 : total * 8 / elapsed);
+    osd_add_uint_fact(batch, "restream.viewers", NULL, 0, active());
+    osd_publish_batch(batch);
+}
+
+void RtpFanout::shutdown() {
+    stop_ = true;
+    if (wake_[1] >= 0 && write(wake_[1], "q", 1) < 0) {}
+}
+
+void *RtpFanout::__THREAD__(void *context) {
+    pthread_setname_np(pthread_self(), "__RESTREAM");
+    ((RtpFanout *)context)->loop();
+    return nullptr;
+}
+
+void RtpFanout::loop() {
+    uint64_t wait = 0;
+    while (!stop_) {
+        struct pollfd fds[2] = {{wake_[0], POLLIN, 0}, {fifo_fd_, POLLIN, 0}};
+        int n = poll(fds, fifo_fd_ >= 0 ? 2 : 1, (int)wait);
+        if (n < 0 && errno != EINTR) {
+            spdlog::error("RTP fanout: poll failed: {}", strerror(errno));
+            break;
+        }
+        char drain[64];
+        while (read(wake_[0], drain, sizeof(drain)) > 0) {}
+        wake_pending_ = false;
+        if (fifo_fd_ >= 0 && (fds[1].revents & POLLIN))
+            read_fifo();
+        wait = tick(monotonic_ms());
+    }
+    spdlog::info("RTP fanout thread done.");
+}
+
+void RtpFanout::read_fifo() {
+    char chunk[128];
+    ssize_t n;
+    while ((n = read(fifo_fd_, chunk, sizeof(chunk))) > 0)
+        fifo_buf_.append(chunk, n);
+
+    size_t nl;
+    while ((nl = fifo_buf_.find('\n')) != std::string::npos) {
+        std::string cmd = fifo_buf_.substr(0, nl);
+        fifo_buf_.erase(0, nl + 1);
+        if (!cmd.empty() && cmd.back() == '\r')
+            cmd.pop_back();
+        command(cmd);
+    }
+    if (fifo_buf_.size() > 256)
+        fifo_buf_.clear();
+}
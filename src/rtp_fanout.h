@@ -0,0 +1,137 @@
+#ifndef RTP_FANOUT_H
+#define RTP_FANOUT_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// RtpFanout: sends the restream's RTP packets to all its destinations.
+//
+//  Producers (the forwarding appsink or the restream encoder) submit()
+//  packets; each enabled destination queues a reference to them, at most
+//  params.backlog, dropping the oldest when a slow one falls behind.  One
+//  thread drains the queues with sendmmsg(), BATCH packets per call, from a
+//  single socket; the batches are taken out under the lock and sent
+//  without it, so a blocked socket never holds up the producers.
+//
+//  Every destination can be enabled or disabled and paced to a bitrate (a
+//  token bucket, 0 for no pacing) without touching the others; all of it
+//  at runtime, from any thread or by lines written to the control FIFO:
+//
+//      add <host:port> [kbps]     remove <host:port>
+//      enable <host:port>         disable <host:port>
+//      pace <host:port> <kbps>
+//
+//  Once a second the total bitrate and the number of enabled destinations
+//  are published as restream.kbps and restream.viewers, and per destination
+//  (tagged dest) the restream.dest.* facts.
+// ---------------------------------------------------------------------------
+
+class RtpFanout {
+public:
+    struct Params {
+        size_t backlog = 256;              // packets queued per destination at most
+        std::string fifo;                  // control FIFO, none when empty
+    };
+
+    struct Destination {
+        std::string name;                  // "ip:port"
+        bool enabled = true;
+        unsigned pace_kbps = 0;
+        uint64_t packets = 0;
+        uint64_t bytes = 0;
+        uint64_t send_errors = 0;
+        uint64_t dropped = 0;              // fell out of the backlog
+    };
+
+    explicit RtpFanout(const Params &params);
+    ~RtpFanout();
+
+    // Producer threads. The packet is copied.
+    void submit(const uint8_t *packet, size_t len);
+
+    // "host:port"; the host a name or an IPv4 address.
+    static bool parse_destination(const std::string &s, sockaddr_in &out);
+    // Any thread. false when already there / not there.
+    bool add(const sockaddr_in &addr, unsigned pace_kbps = 0);
+    bool remove(const sockaddr_in &addr);
+    bool set_enabled(const sockaddr_in &addr, bool enabled);
+    bool set_pacing(const sockaddr_in &addr, unsigned pace_kbps);
+    // One control FIFO line.
+    bool command(const std::string &line);
+
+    // Enabled destinations.
+    size_t active() const { return active_.load(std::memory_order_relaxed); }
+    std::vector<Destination> destinations() const;
+
+    // Called, outside the lock, whenever a destination is added or
+    // enabled, so its stream can start with a keyframe. Set it before the
+    // first one.
+    std::function<void()> on_added;
+
+    // Sender thread: sends what is due, returns the ms until more may be.
+    uint64_t tick(uint64_t now_ms);
+
+    void shutdown();
+    static void *__THREAD__(void *context);
+
+    static constexpr unsigned BATCH = 32;
+    static constexpr uint64_t IDLE_TICK_MS = 1000;
+    static constexpr uint64_t RETRY_MS = 2;      // socket buffer full
+
+private:
+    using PacketPtr = std::shared_ptr<const std::vector<uint8_t>>;
+
+    struct Target {
+        sockaddr_in addr;
+        Destination d;
+        double tokens = 0;                 // bytes, for pacing
+        uint64_t refilled_ms = 0;
+        uint64_t published_bytes = 0;
+        std::deque<PacketPtr> backlog;
+    };
+
+    // Up to BATCH packets of one destination, on their way out.
+    struct Batch {
+        sockaddr_in addr;
+        PacketPtr packets[BATCH];
+        unsigned count = 0;
+        int sent = 0;
+        int error = 0;
+    };
+
+    Target *find(const sockaddr_in &addr);
+    void update_active();
+    uint64_t take_batch(Target &t, uint64_t now_ms, Batch &b);
+    void send_batch(Batch &b);
+    uint64_t settle_batch(Target &t, Batch &b);
+    void loop();
+    void read_fifo();
+    void publish_stats(uint64_t now_ms);
+
+    Params params_;
+    int sock_ = -1;
+    std::atomic<bool> stop_{false};
+    std::atomic<bool> wake_pending_{false};
+    std::atomic<size_t> active_{0};
+    int wake_[2] = {-1, -1};               // self-pipe waking the thread
+    int fifo_fd_ = -1;
+    std::string fifo_buf_;
+
+    mutable std::mutex mtx_;               // guards targets_
+    std::vector<std::unique_ptr<Target>> targets_;
+    bool removed_ = false;                 // publish once more after the last one
+
+    // Sender thread only
+    uint64_t published_ms_ = 0;
+    std::vector<Batch> batches_;
+};
+
+#endif // RTP_FANOUT_H
@@ -0,0 +1,99 @@
+#include <string.h>
+#include <algorithm>
+#include <random>
+
+#include "rtp_restream.h"
+
+static uint32_t random_u32() {
+    static std::random_device rd;
+    return ((uint32_t)rd() << 16) ^ (uint32_t)rd();
+}
+
+// ── RtpPacketizer ───────────────────────────────────────────────────────────
+
+RtpPacketizer::RtpPacketizer(bool hevc, uint32_t ssrc, uint8_t payload_type, size_t mtu)
+    : hevc_(hevc), ssrc_(ssrc), payload_type_(payload_type & 0x7f),
+      mtu_(std::max(mtu, (size_t)64)), seq_((uint16_t)(ssrc ^ (ssrc >> 16))) {}
+
+void RtpPacketizer::packetize(const uint8_t *data, size_t len, uint32_t ts_90k,
+                              const Emit &emit) {
+    nals_.scan(data, len, hevc_);
+    const std::vector<NalSpan> &spans = nals_.spans();
+    bool picture = nals_.has_vcl();
+    size_t max_payload = mtu_ - RTP_HEADER_LEN;
+
+    for (size_t i = 0; i < spans.size(); i++) {
+        const uint8_t *nal = nals_.nal(spans[i]);
+        size_t n = spans[i].length;
+        bool last = picture && i + 1 == spans.size();
+        if (n <= max_payload) {
+            send(nullptr, 0, nal, n, ts_90k, last, emit);
+            continue;
+        }
+
+        // Fragmentation units: the NAL header is folded into the FU
+        // indicator / payload header and the FU header.
+        uint8_t prefix[3];
+        size_t prefix_len, nal_header_len;
+        if (hevc_) {
+            prefix[0] = (nal[0] & 0x81) | (49 << 1);
+            prefix[1] = nal[1];
+            prefix[2] = (nal[0] >> 1) & 0x3f;
+            prefix_len = 3;
+            nal_header_len = 2;
+        } else {
+            prefix[0] = (nal[0] & 0xe0) | 28;
+            prefix[1] = nal[0] & 0x1f;
+            prefix_len = 2;
+            nal_header_len = 1;
+        }
+        uint8_t type = prefix[prefix_len - 1];
+        size_t chunk = max_payload - prefix_len;
+        for (size_t off = nal_header_len; off < n; off += chunk) {
+            size_t take = std::min(chunk, n - off);
+            bool end = off + take == n;
+            prefix[prefix_len - 1] = type | (off == nal_header_len ? 0x80 : 0) | (end ? 0x40 : 0);
+            send(prefix, prefix_len, nal + off, take, ts_90k, last && end, emit);
+        }
+    }
+}
+
+void RtpPacketizer::send(const uint8_t *prefix, size_t prefix_len,
+                         const uint8_t *payload, size_t len,
+                         uint32_t ts_90k, bool marker, const Emit &emit) {
+    packet_.resize(RTP_HEADER_LEN + prefix_len + len);
+    uint8_t *p = packet_.data();
+    p[0]  = 0x80;   // version 2
+    p[1]  = (marker ? 0x80 : 0) | payload_type_;
+    p[2]  = seq_ >> 8;
+    p[3]  = seq_ & 0xff;
+    p[4]  = ts_90k >> 24;
+    p[5]  = (ts_90k >> 16) & 0xff;
+    p[6]  = (ts_90k >> 8) & 0xff;
+    p[7]  = ts_90k & 0xff;
+    p[8]  = ssrc_ >> 24;
+    p[9]  = (ssrc_ >> 16) & 0xff;
+    p[10] = (ssrc_ >> 8) & 0xff;
+    p[11] = ssrc_ & 0xff;
+    if (prefix_len)
+        memcpy(p + RTP_HEADER_LEN, prefix, prefix_len);
+    memcpy(p + RTP_HEADER_LEN + prefix_len, payload, len);
+    seq_++;
+    emit(p, packet_.size());
+}
+
+// ── RtpRestream ─────────────────────────────────────────────────────────────
+
+RtpRestream::RtpRestream(const Params &params, RtpFanout &fanout)
+    : fanout_(fanout),
+      packetizer_(params.codec == VideoCodec::H265, random_u32(), params.payload_type,
+                  params.mtu),
+      ts_origin_(random_u32()) {}
+
+void RtpRestream::frame(const EncodedFramePtr &frame, uint64_t pts_ms) {
+    if (fanout_.active() == 0 || !frame || frame->empty())
+        return;
+    uint32_t ts = ts_origin_ + (uint32_t)(pts_ms * 90);
+    packetizer_.packetize(frame->data(), frame->size(), ts,
+                          [this](const uint8_t *p, size_t n) { fanout_.submit(p, n); });
+}
@@ -0,0 +1,80 @@
+#ifndef RTP_RESTREAM_H
+#define RTP_RESTREAM_H
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "gstrtpreceiver.h"
+#include "encoded_frame.h"
+#include "nal_view.h"
+#include "rtp_fanout.h"
+
+// ---------------------------------------------------------------------------
+// RtpPacketizer: Annex-B access units into RTP packets.
+//
+//  H.264 as RFC 6184 and H.265 as RFC 7798: a NAL that fits in the MTU
+//  goes in a packet of its own, a bigger one is split into fragmentation
+//  units (FU-A / FU).  The marker bit is set on the last packet of an
+//  access unit with a picture in it, not on header-only ones.
+// ---------------------------------------------------------------------------
+
+class RtpPacketizer {
+public:
+    using Emit = std::function<void(const uint8_t *packet, size_t len)>;
+
+    RtpPacketizer(bool hevc, uint32_t ssrc, uint8_t payload_type = 96,
+                  size_t mtu = DEFAULT_MTU);
+
+    // ts_90k is the RTP timestamp of the whole access unit.
+    void packetize(const uint8_t *data, size_t len, uint32_t ts_90k, const Emit &emit);
+
+    uint16_t next_seq() const { return seq_; }
+
+    static const size_t DEFAULT_MTU = 1400;   // RTP header and payload
+
+private:
+    void send(const uint8_t *prefix, size_t prefix_len, const uint8_t *payload, size_t len,
+              uint32_t ts_90k, bool marker, const Emit &emit);
+
+    bool hevc_;
+    uint32_t ssrc_;
+    uint8_t payload_type_;
+    size_t mtu_;
+    uint16_t seq_;
+    NalView nals_;
+    std::vector<uint8_t> packet_;
+};
+
+// ---------------------------------------------------------------------------
+// RtpRestream: sends an encoder's output as RTP to the restream viewers.
+//
+//  Fed by a dedicated MppEncoder, so a phone on the hotspot gets a stream
+//  sized for it rather than the full-rate one from the air unit.  The
+//  packets go to the RtpFanout that holds the viewers, whose on_added is
+//  expected to ask the encoder for an IDR.
+//
+//  Timestamps are the encoder pts at 90 kHz from a random origin.
+// ---------------------------------------------------------------------------
+
+class RtpRestream {
+public:
+    struct Params {
+        VideoCodec codec = VideoCodec::H264;
+        uint8_t payload_type = 96;
+        size_t mtu = RtpPacketizer::DEFAULT_MTU;
+    };
+
+    RtpRestream(const Params &params, RtpFanout &fanout);
+
+    // Encoder output thread.
+    void frame(const EncodedFramePtr &frame, uint64_t pts_ms);
+
+private:
+    RtpFanout &fanout_;
+    RtpPacketizer packetizer_;
+    uint32_t ts_origin_;
+};
+
+#endif // RTP_RESTREAM_H
@@ -31,6 +31,8 @@ int dvr_reenc_get_fps(void)     { return 30; }
 int dvr_reenc_get_bitrate(void) { return 8000; }
 int dvr_reenc_get_codec(void)   { return 0; }
 int dvr_reenc_get_resolution(void) { return 1; }
+int dvr_reenc_get_rc_mode(void) { return 0; }
+int dvr_reenc_get_gop(void)     { return 0; }
 int dvr_get_max_size(void)      { return 4000; }
 void my_log_cb(lv_log_level_t level, const char * buf)
 {
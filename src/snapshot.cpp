@@ -0,0 +1,359 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdlib>
+
+#include "spdlog/spdlog.h"
+
+#include <rga/im2d.h>
+#include <rga/rga.h>
+
+#include "jpeg_writer.h"
+#include "osd_blend.h"
+#include "snapshot.h"
+extern "C" {
+#include "osd.h"
+}
+
+static uint64_t monotonic_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Snapshot::Snapshot(const Params &params) : params_(params) {
+    if (params_.burst < 1) params_.burst = 1;
+    if (params_.burst > MAX_BURST) params_.burst = MAX_BURST;
+    mpp_buffer_group_get_internal(&grp_, MPP_BUFFER_TYPE_DRM);
+    if (pipe2(wake_, O_NONBLOCK | O_CLOEXEC) != 0)
+        spdlog::error("Snapshot: pipe failed: {}", strerror(errno));
+
+    if (!params_.fifo.empty()) {
+        const char *path = params_.fifo.c_str();
+        unlink(path);
+        if (mkfifo(path, 0622) != 0 || chmod(path, 0622) != 0) {
+            spdlog::error("Snapshot: failed to create FIFO {}: {}", path, strerror(errno));
+        } else {
+            // Opened read-write so it never reports a hang-up between writers
+            fifo_fd_ = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+            if (fifo_fd_ < 0)
+                spdlog::error("Snapshot: failed to open FIFO {}: {}", path, strerror(errno));
+        }
+    }
+}
+
+Snapshot::~Snapshot() {
+    shutdown();
+    for (auto &shot : queue_)
+        mpp_buffer_put(shot.buffer);
+    queue_.clear();
+    close_mpp();
+    if (fifo_fd_ >= 0) {
+        close(fifo_fd_);
+        unlink(params_.fifo.c_str());
+    }
+    for (int fd : wake_)
+        if (fd >= 0) close(fd);
+    if (grp_) mpp_buffer_group_put(grp_);
+}
+
+void Snapshot::trigger(bool burst) {
+    trigger_from_signal(burst);
+}
+
+void Snapshot::trigger_from_signal(bool burst) {
+    // Only lock-free atomics here
+    due_.fetch_add(burst ? params_.burst : 1);
+}
+
+void Snapshot::set_osd(const uint8_t *map, uint32_t w, uint32_t h, uint32_t stride_px,
+                       bool premultiplied) {
+    std::lock_guard<std::mutex> lock(osd_mtx_);
+    osd_map_ = map;
+    osd_width_ = w;
+    osd_height_ = h;
+    osd_stride_px_ = stride_px;
+    osd_premultiplied_ = premultiplied;
+}
+
+void Snapshot::offer(MppBuffer buf, uint32_t w, uint32_t h,
+                     uint32_t hs, uint32_t vs, MppFrameFormat fmt) {
+    if (due_.load(std::memory_order_relaxed) == 0 || stop_)
+        return;
+    uint64_t now = monotonic_ms();
+    if (now < next_shot_ms_)
+        return;
+    if (fmt != MPP_FMT_YUV420SP) {
+        spdlog::warn("Snapshot: only 8-bit frames can be captured");
+        due_ = 0;
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (queue_.size() >= MAX_QUEUED)
+            return;   // encoder behind, the burst goes on with a later frame
+    }
+
+    Shot shot;
+    size_t sz = (size_t)hs * vs * 3 / 2;
+    if (!grp_ || mpp_buffer_get(grp_, &shot.buffer, sz) != MPP_OK || !shot.buffer)
+        return;
+    rga_buffer_t src = wrapbuffer_fd_t(mpp_buffer_get_fd(buf), w, h, hs, vs,
+                                       RK_FORMAT_YCbCr_420_SP);
+    rga_buffer_t dst = wrapbuffer_fd_t(mpp_buffer_get_fd(shot.buffer), w, h, hs, vs,
+                                       RK_FORMAT_YCbCr_420_SP);
+    if (imcopy(src, dst) != IM_STATUS_SUCCESS) {
+        void *sp = mpp_buffer_get_ptr(buf);
+        void *dp = mpp_buffer_get_ptr(shot.buffer);
+        if (!sp || !dp) {
+            mpp_buffer_put(shot.buffer);
+            return;
+        }
+        memcpy(dp, sp, sz);
+    }
+    shot.width = w;
+    shot.height = h;
+    shot.hor_stride = hs;
+    shot.ver_stride = vs;
+    shot.time = time(nullptr);
+
+    // A concurrent trigger may have raised it, never let it wrap
+    unsigned due = due_.load();
+    while (due > 0 && !due_.compare_exchange_weak(due, due - 1)) {}
+    next_shot_ms_ = now + params_.burst_interval_ms;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        queue_.push_back(shot);
+    }
+    if (write(wake_[1], "s", 1) < 0) {}   // a full pipe wakes the thread as well
+}
+
+void Snapshot::shutdown() {
+    stop_ = true;
+    if (wake_[1] >= 0 && write(wake_[1], "q", 1) < 0) {}
+}
+
+void *Snapshot::__THREAD__(void *context) {
+    pthread_setname_np(pthread_self(), "__SNAPSHOT");
+    ((Snapshot *)context)->loop();
+    return nullptr;
+}
+
+void Snapshot::loop() {
+    while (!stop_) {
+        struct pollfd fds[2] = {{wake_[0], POLLIN, 0}, {fifo_fd_, POLLIN, 0}};
+        int n = poll(fds, fifo_fd_ >= 0 ? 2 : 1, 1000);
+        if (n < 0 && errno != EINTR) {
+            spdlog::error("Snapshot: poll failed: {}", strerror(errno));
+            break;
+        }
+        char drain[64];
+        while (read(wake_[0], drain, sizeof(drain)) > 0) {}
+        if (fifo_fd_ >= 0 && (fds[1].revents & POLLIN))
+            read_fifo();
+
+        while (!stop_) {
+            Shot shot;
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                if (queue_.empty())
+                    break;
+                shot = queue_.front();
+                queue_.pop_front();
+            }
+            write_shot(shot);
+            mpp_buffer_put(shot.buffer);
+        }
+    }
+    spdlog::info("Snapshot thread done.");
+}
+
+// One command per line: "snap" (or an empty line) for a frame, "burst [n]"
+// for n frames, the configured burst by default.
+void Snapshot::read_fifo() {
+    char chunk[128];
+    ssize_t n;
+    while ((n = read(fifo_fd_, chunk, sizeof(chunk))) > 0)
+        fifo_buf_.append(chunk, n);
+
+    size_t nl;
+    while ((nl = fifo_buf_.find('\n')) != std::string::npos) {
+        std::string cmd = fifo_buf_.substr(0, nl);
+        fifo_buf_.erase(0, nl + 1);
+        if (!cmd.empty() && cmd.back() == '\r')
+            cmd.pop_back();
+        if (cmd.empty() || cmd == "snap") {
+            trigger(false);
+        } else if (cmd.compare(0, 5, "burst") == 0) {
+            unsigned count = params_.burst;
+            if (cmd.size() > 5) {
+                long v = strtol(cmd.c_str() + 5, nullptr, 10);
+                if (v > 0) count = v < (long)MAX_BURST ? (unsigned)v : MAX_BURST;
+            }
+            due_.fetch_add(count);
+        } else {
+            spdlog::warn("Snapshot: unknown command '{}'", cmd);
+        }
+    }
+    if (fifo_buf_.size() > 256)
+        fifo_buf_.clear();
+}
+
+void Snapshot::write_shot(Shot &shot) {
+    uint8_t *base = (uint8_t *)mpp_buffer_get_ptr(shot.buffer);
+    Nv12Image img;
+    img.y      = base;
+    img.uv     = base ? base + (size_t)shot.hor_stride * shot.ver_stride : nullptr;
+    img.width  = shot.width;
+    img.height = shot.height;
+    img.stride = shot.hor_stride;
+
+    if (params_.with_osd && base) {
+        std::lock_guard<std::mutex> lock(osd_mtx_);
+        if (osd_map_) {
+            BgraImage osd;
+            osd.data          = osd_map_;
+            osd.width         = osd_width_;
+            osd.height        = osd_height_;
+            osd.stride        = osd_stride_px_ * 4;
+            osd.premultiplied = osd_premultiplied_;
+            OsdTiles tiles;
+            tiles.scan(osd.data, osd.width, osd.height, osd.stride);
+            for (const BlendRect &r : tiles.rects())
+                nv12_blend(img, osd, r);
+        }
+    }
+
+    std::vector<uint8_t> jpeg;
+    bool ok = !mpp_failed_ && encode_mpp(shot, jpeg);
+    if (!ok && !mpp_failed_) {
+        spdlog::warn("Snapshot: MPP JPEG encoder unavailable, encoding in software");
+        mpp_failed_ = true;
+        close_mpp();
+    }
+    if (!ok && !jpeg_encode_nv12(img, params_.quality, jpeg)) {
+        spdlog::error("Snapshot: unable to encode {}x{}", shot.width, shot.height);
+        return;
+    }
+
+    char stamp[32];
+    struct tm tm;
+    localtime_r(&shot.time, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    std::string path = params_.dir + "/snapshot_" + stamp + "_" + std::to_string(count_ + 1) + ".jpg";
+    std::string tmp = path + ".part";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        spdlog::error("Snapshot: unable to write {}: {}", tmp, strerror(errno));
+        return;
+    }
+    bool written = fwrite(jpeg.data(), 1, jpeg.size(), f) == jpeg.size();
+    written = fclose(f) == 0 && written;
+    if (!written || rename(tmp.c_str(), path.c_str()) != 0) {
+        spdlog::error("Snapshot: unable to write {}: {}", path, strerror(errno));
+        unlink(tmp.c_str());
+        return;
+    }
+    count_++;
+    spdlog::info("Snapshot {} ({} KB)", path, jpeg.size() / 1024);
+
+    void *batch = osd_batch_init(2);
+    osd_add_str_fact(batch, "snapshot.last", NULL, 0, path.c_str());
+    osd_add_uint_fact(batch, "snapshot.count", NULL, 0, count_);
+    osd_publish_batch(batch);
+}
+
+// ── MPP JPEG encoder ────────────────────────────────────────────────────────
+
+bool Snapshot::open_mpp(const Shot &shot) {
+    if (mpp_create(&ctx_, &mpi_) != MPP_OK) {
+        ctx_ = nullptr;
+        return false;
+    }
+    if (mpp_init(ctx_, MPP_CTX_ENC, MPP_VIDEO_CodingMJPEG) != MPP_OK) {
+        close_mpp();
+        return false;
+    }
+    MppEncCfg cfg = nullptr;
+    mpp_enc_cfg_init(&cfg);
+    mpi_->control(ctx_, MPP_ENC_GET_CFG, cfg);
+    mpp_enc_cfg_set_s32(cfg, "prep:width",      (int)shot.width);
+    mpp_enc_cfg_set_s32(cfg, "prep:height",     (int)shot.height);
+    mpp_enc_cfg_set_s32(cfg, "prep:hor_stride", (int)shot.hor_stride);
+    mpp_enc_cfg_set_s32(cfg, "prep:ver_stride", (int)shot.ver_stride);
+    mpp_enc_cfg_set_s32(cfg, "prep:format",     (int)MPP_FMT_YUV420SP);
+    mpp_enc_cfg_set_s32(cfg, "rc:mode",         MPP_ENC_RC_MODE_FIXQP);
+    int qf = params_.quality > 99 ? 99 : params_.quality;
+    mpp_enc_cfg_set_s32(cfg, "jpeg:q_factor",   qf);
+    mpp_enc_cfg_set_s32(cfg, "jpeg:qf_max",     qf);
+    mpp_enc_cfg_set_s32(cfg, "jpeg:qf_min",     qf);
+    bool ok = mpi_->control(ctx_, MPP_ENC_SET_CFG, cfg) == MPP_OK;
+    mpp_enc_cfg_deinit(cfg);
+    if (!ok) {
+        close_mpp();
+        return false;
+    }
+    mpp_width_ = shot.width;
+    mpp_height_ = shot.height;
+    mpp_hor_stride_ = shot.hor_stride;
+    mpp_ver_stride_ = shot.ver_stride;
+    return true;
+}
+
+void Snapshot::close_mpp() {
+    if (ctx_) {
+        mpi_->reset(ctx_);
+        mpp_destroy(ctx_);
+    }
+    ctx_ = nullptr;
+    mpi_ = nullptr;
+    mpp_width_ = mpp_height_ = mpp_hor_stride_ = mpp_ver_stride_ = 0;
+}
+
+bool Snapshot::encode_mpp(const Shot &shot, std::vector<uint8_t> &jpeg) {
+    if (ctx_ && (shot.width != mpp_width_ || shot.height != mpp_height_ ||
+                 shot.hor_stride != mpp_hor_stride_ || shot.ver_stride != mpp_ver_stride_))
+        close_mpp();
+    if (!ctx_ && !open_mpp(shot))
+        return false;
+
+    // The encoder writes into a buffer of ours, as large as the frame's
+    // luma plane: more than any JPEG of it
+    MppBuffer out_buf = nullptr;
+    if (mpp_buffer_get(grp_, &out_buf, (size_t)shot.hor_stride * shot.ver_stride) != MPP_OK)
+        return false;
+    MppPacket packet = nullptr;
+    mpp_packet_init_with_buffer(&packet, out_buf);
+    mpp_packet_set_length(packet, 0);
+
+    MppFrame frame = nullptr;
+    mpp_frame_init(&frame);
+    mpp_frame_set_width(frame,      shot.width);
+    mpp_frame_set_height(frame,     shot.height);
+    mpp_frame_set_hor_stride(frame, shot.hor_stride);
+    mpp_frame_set_ver_stride(frame, shot.ver_stride);
+    mpp_frame_set_fmt(frame,        MPP_FMT_YUV420SP);
+    mpp_frame_set_buffer(frame,     shot.buffer);
+    mpp_meta_set_packet(mpp_frame_get_meta(frame), KEY_OUTPUT_PACKET, packet);
+
+    bool ok = false;
+    MppPacket result = nullptr;
+    if (mpi_->encode_put_frame(ctx_, frame) == MPP_OK &&
+        mpi_->encode_get_packet(ctx_, &result) == MPP_OK && result) {
+        const uint8_t *pos = (const uint8_t *)mpp_packet_get_pos(result);
+        size_t len = mpp_packet_get_length(result);
+        ok = pos && len > 4;
+        if (ok)
+            jpeg.assign(pos, pos + len);
+        if (result != packet)
+            mpp_packet_deinit(&result);
+    }
+    mpp_packet_deinit(&packet);
+    mpp_frame_deinit(&frame);
+    mpp_buffer_put(out_buf);
+    return ok;
+}
@@ -0,0 +1,109 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <rockchip/rk_mpi.h>
+
+// ---------------------------------------------------------------------------
+// Snapshot: still JPEGs of the decoded video, without recording.
+//
+//  trigger() asks for one frame, or a burst of them.  The decoder thread
+//  offers every decoded frame; while shots are due the next one is copied
+//  by RGA into a buffer of our own, so the decoder's is released at once.
+//  Burst frames are taken at least burst_interval_ms apart, and at most
+//  MAX_QUEUED wait for the encoder.
+//
+//  The snapshot thread blends the OSD in if asked, encodes with the MPP
+//  JPEG encoder (with jpeg_writer.h as fallback when that fails) and writes
+//  <dir>/snapshot_<date>-<time>_<n>.jpg, so neither the display nor the
+//  decoder wait for the encoder or the card.
+//
+//  Triggers: trigger() from any thread (GPIO button, menu),
+//  trigger_from_signal() from a signal handler, and lines written to the
+//  control FIFO: "snap", or "burst [n]".  The last file written and the
+//  number of snapshots are published as snapshot.last and snapshot.count.
+// ---------------------------------------------------------------------------
+
+class Snapshot {
+public:
+    struct Params {
+        std::string dir;
+        int quality = 90;                  // 1..100
+        bool with_osd = false;
+        unsigned burst = 5;                // frames of a burst trigger
+        unsigned burst_interval_ms = 100;
+        std::string fifo;                  // control FIFO, none when empty
+    };
+
+    explicit Snapshot(const Params &params);
+    ~Snapshot();
+
+    // Any thread. burst takes params.burst frames.
+    void trigger(bool burst = false);
+    // Async-signal-safe version.
+    void trigger_from_signal(bool burst);
+
+    // From the decoder thread, for every decoded frame.
+    void offer(MppBuffer buf, uint32_t w, uint32_t h,
+               uint32_t hs, uint32_t vs, MppFrameFormat fmt);
+
+    // From the OSD thread each time a new OSD frame is ready; see
+    // FrameProcessor::set_osd_blend.
+    void set_osd(const uint8_t *map, uint32_t w, uint32_t h, uint32_t stride_px,
+                 bool premultiplied);
+
+    void shutdown();
+    static void *__THREAD__(void *context);
+
+    static const unsigned MAX_QUEUED = 4;
+    static const unsigned MAX_BURST = 100;
+
+private:
+    struct Shot {
+        MppBuffer buffer = nullptr;
+        uint32_t  width = 0, height = 0, hor_stride = 0, ver_stride = 0;
+        time_t    time = 0;
+    };
+
+    void loop();
+    void read_fifo();
+    void write_shot(Shot &shot);
+    bool encode_mpp(const Shot &shot, std::vector<uint8_t> &jpeg);
+    bool open_mpp(const Shot &shot);
+    void close_mpp();
+
+    Params params_;
+    std::atomic<unsigned> due_{0};       // frames still to take
+    std::atomic<bool> stop_{false};
+    int wake_[2] = {-1, -1};             // self-pipe waking the thread
+    int fifo_fd_ = -1;
+    std::string fifo_buf_;
+
+    // Decoder thread only
+    MppBufferGroup grp_ = nullptr;
+    uint64_t next_shot_ms_ = 0;
+
+    std::mutex mtx_;                     // guards queue_
+    std::deque<Shot> queue_;
+
+    std::mutex osd_mtx_;
+    const uint8_t *osd_map_ = nullptr;
+    uint32_t osd_width_ = 0, osd_height_ = 0, osd_stride_px_ = 0;
+    bool osd_premultiplied_ = true;
+
+    // Snapshot thread only
+    MppCtx ctx_ = nullptr;
+    MppApi *mpi_ = nullptr;
+    uint32_t mpp_width_ = 0, mpp_height_ = 0, mpp_hor_stride_ = 0, mpp_ver_stride_ = 0;
+    bool mpp_failed_ = false;            // use the software encoder from now on
+    unsigned count_ = 0;
+};
+
+#endif // SNAPSHOT_H
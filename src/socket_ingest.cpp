@@ -0,0 +1,94 @@
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+#include "socket_ingest.h"
+extern "C" {
+#include "osd.h"
+}
+
+static constexpr size_t RTP_HEADER = 12;
+
+SocketIngest::SocketIngest(const SocketIngestParams &params) : params_(params) {
+    params_.packet_size = std::min(std::max(params_.packet_size, RTP_HEADER + 1), MAX_PACKET_SIZE);
+    params_.batch = std::min(std::max(params_.batch, 1u), MAX_BATCH);
+    params_.pool_buffers = std::max(params_.pool_buffers, params_.batch);
+    msgs_.resize(params_.batch);
+    iov_.resize(params_.batch);
+    scratch_.resize(params_.packet_size);
+}
+
+int SocketIngest::read(int fd, uint8_t *const *bufs, unsigned n, size_t *lens) {
+    n = std::min(n, params_.batch);
+    for (unsigned i = 0; i < n; i++) {
+        iov_[i].iov_base = bufs[i];
+        iov_[i].iov_len = params_.packet_size;
+        memset(&msgs_[i], 0, sizeof(msgs_[i]));
+        msgs_[i].msg_hdr.msg_iov = &iov_[i];
+        msgs_[i].msg_hdr.msg_iovlen = 1;
+    }
+    int got = recvmmsg(fd, msgs_.data(), n, MSG_DONTWAIT, nullptr);
+    if (got <= 0)
+        return got;
+    if (params_.seqpacket) {
+        // A closed peer reads as empty datagrams: the batch ends at the first
+        for (int i = 0; i < got; i++) {
+            if (msgs_[i].msg_len == 0) {
+                got = i;
+                break;
+            }
+        }
+        if (got == 0)
+            return 0;
+    }
+
+    stats_.batches++;
+    for (int i = 0; i < got; i++) {
+        size_t len = msgs_[i].msg_len;
+        if (msgs_[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            stats_.truncated++;
+            len = 0;
+        } else if (len <= RTP_HEADER) {
+            stats_.runts++;
+            len = 0;
+        } else {
+            stats_.packets++;
+            stats_.bytes += len;
+        }
+        lens[i] = len;
+    }
+    return got;
+}
+
+ssize_t SocketIngest::discard(int fd) {
+    ssize_t n = recv(fd, scratch_.data(), scratch_.size(), MSG_DONTWAIT);
+    if (n > 0 || (n == 0 && !params_.seqpacket))
+        stats_.pool_exhausted++;
+    return n;
+}
+
+void SocketIngest::pushed(unsigned packets, bool ok) {
+    if (!ok)
+        stats_.push_errors += packets;
+}
+
+void SocketIngest::publish_stats(uint64_t now_ms) {
+    uint64_t elapsed = now_ms - published_ms_;
+    if (elapsed < 1000)
+        return;
+    published_ms_ = now_ms;
+    Stats s = stats_, p = published_;
+    published_ = stats_;
+    uint64_t batches = s.batches - p.batches;
+
+    void *batch = osd_batch_init(7);
+    osd_add_uint_fact(batch, "ingest.packets_per_s", NULL, 0, (s.packets - p.packets) * 1000 / elapsed);
+    osd_add_uint_fact(batch, "ingest.kbps", NULL, 0, (s.bytes - p.bytes) * 8 / elapsed);
+    osd_add_double_fact(batch, "ingest.batch_avg", NULL, 0,
+                        batches ? (double)(s.packets - p.packets) / batches : 0.0);
+    osd_add_uint_fact(batch, "ingest.truncated", NULL, 0, s.truncated);
+    osd_add_uint_fact(batch, "ingest.runts", NULL, 0, s.runts);
+    osd_add_uint_fact(batch, "ingest.pool_exhausted", NULL, 0, s.pool_exhausted);
+    osd_add_uint_fact(batch, "ingest.push_errors", NULL, 0, s.push_errors);
+    osd_publish_batch(batch);
+}
@@ -0,0 +1,73 @@
+#ifndef SOCKET_INGEST_H
+#define SOCKET_INGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// SocketIngest: batched reads of RTP datagrams from the unix socket.
+//
+//  With wfb-ng on the same box the socket carries all of the video, so
+//  the reader takes up to params.batch datagrams per recvmmsg() into
+//  buffers of the appsrc pool, and the whole batch is pushed as one
+//  buffer list.  Datagrams up to params.packet_size are taken (jumbo ones
+//  too, up to MAX_PACKET_SIZE); longer ones are truncated by the kernel
+//  and dropped here, as are runts with no room for an RTP header.
+//
+//  When the pool has no buffer left the datagram is read anyway, so the
+//  socket doesn't back up into wfb-ng, and dropped.  All of it is
+//  published once a second as the ingest.* facts.
+// ---------------------------------------------------------------------------
+
+struct SocketIngestParams {
+    unsigned pool_buffers = 128;       // packet buffers in the appsrc pool
+    size_t packet_size = 4096;         // largest datagram expected
+    unsigned batch = 32;               // datagrams per recvmmsg
+    bool seqpacket = false;            // SOCK_SEQPACKET instead of SOCK_DGRAM
+};
+
+class SocketIngest {
+public:
+    explicit SocketIngest(const SocketIngestParams &params);
+
+    // Reads up to n datagrams, without blocking, into bufs (of
+    // params.packet_size each). lens[i] is the length of datagram i, 0 if
+    // it was dropped. Returns the datagrams read, -1 with errno set when
+    // none could be, 0 when the SOCK_SEQPACKET peer has closed.
+    int read(int fd, uint8_t *const *bufs, unsigned n, size_t *lens);
+    // No buffer to read into: reads one datagram and drops it. Returns
+    // what recv() does (0 for a closed SOCK_SEQPACKET peer too).
+    ssize_t discard(int fd);
+    // The batch went to appsrc, or it refused it.
+    void pushed(unsigned packets, bool ok);
+
+    struct Stats {
+        uint64_t packets = 0;          // read and kept for the pipeline
+        uint64_t bytes = 0;
+        uint64_t batches = 0;          // recvmmsg calls that got something
+        uint64_t truncated = 0;        // longer than params.packet_size
+        uint64_t runts = 0;            // too short for RTP
+        uint64_t pool_exhausted = 0;   // read and dropped for want of a buffer
+        uint64_t push_errors = 0;      // packets appsrc refused
+    };
+    Stats stats() const { return stats_; }
+    void publish_stats(uint64_t now_ms);
+
+    const SocketIngestParams &params() const { return params_; }
+
+    static constexpr size_t MAX_PACKET_SIZE = 65535;
+    static constexpr unsigned MAX_BATCH = 256;
+
+private:
+    SocketIngestParams params_;
+    std::vector<struct mmsghdr> msgs_;
+    std::vector<struct iovec> iov_;
+    std::vector<uint8_t> scratch_;
+    Stats stats_;
+    Stats published_;
+    uint64_t published_ms_ = 0;
+};
+
+#endif // SOCKET_INGEST_H
@@ -0,0 +1,408 @@
+#include <string.h>
+
+#include "wfb_stats.h"
+
+const char *const WFB_RX_COUNTERS[WFB_RX_COUNT] = {
+    "all", "all_bytes", "dec_err", "session", "data", "uniq",
+    "fec_rec", "lost", "bad", "out", "out_bytes",
+};
+
+const char *const WFB_TX_COUNTERS[WFB_TX_COUNT] = {
+    "fec_timeouts", "incoming", "incoming_bytes", "injected",
+    "injected_bytes", "dropped", "truncated",
+};
+
+static bool key_is(const char *s, uint32_t len, const char *lit) {
+    return strlen(lit) == len && memcmp(s, lit, len) == 0;
+}
+
+static void copy_str(char *dst, size_t size, const char *s, uint32_t len) {
+    size_t n = len < size - 1 ? len : size - 1;
+    memcpy(dst, s, n);
+    dst[n] = '\0';
+}
+
+// ── MsgpackReader ───────────────────────────────────────────────────────────
+
+bool MsgpackReader::take(size_t n, const uint8_t *&out) {
+    if (!ok_ || (size_t)(end_ - p_) < n)
+        return fail();
+    out = p_;
+    p_ += n;
+    return true;
+}
+
+bool MsgpackReader::read_be(size_t n, uint64_t &v) {
+    const uint8_t *b;
+    if (!take(n, b))
+        return false;
+    v = 0;
+    for (size_t i = 0; i < n; i++)
+        v = v << 8 | b[i];
+    return true;
+}
+
+bool MsgpackReader::read_map(uint32_t &n) {
+    const uint8_t *b;
+    if (!take(1, b))
+        return false;
+    uint64_t v;
+    if ((*b & 0xf0) == 0x80) {
+        n = *b & 0x0f;
+        return true;
+    }
+    if (*b == 0xde && read_be(2, v)) { n = (uint32_t)v; return true; }
+    if (*b == 0xdf && read_be(4, v)) { n = (uint32_t)v; return true; }
+    return fail();
+}
+
+bool MsgpackReader::read_array(uint32_t &n) {
+    const uint8_t *b;
+    if (!take(1, b))
+        return false;
+    uint64_t v;
+    if ((*b & 0xf0) == 0x90) {
+        n = *b & 0x0f;
+        return true;
+    }
+    if (*b == 0xdc && read_be(2, v)) { n = (uint32_t)v; return true; }
+    if (*b == 0xdd && read_be(4, v)) { n = (uint32_t)v; return true; }
+    return fail();
+}
+
+bool MsgpackReader::read_str(const char *&s, uint32_t &len) {
+    const uint8_t *b;
+    if (!take(1, b))
+        return false;
+    uint64_t v;
+    if ((*b & 0xe0) == 0xa0) {
+        v = *b & 0x1f;
+    } else if (*b == 0xd9 || *b == 0xc4) {
+        if (!read_be(1, v)) return false;
+    } else if (*b == 0xda || *b == 0xc5) {
+        if (!read_be(2, v)) return false;
+    } else if (*b == 0xdb || *b == 0xc6) {
+        if (!read_be(4, v)) return false;
+    } else {
+        return fail();
+    }
+    const uint8_t *data;
+    if (!take(v, data))
+        return false;
+    s = (const char *)data;
+    len = (uint32_t)v;
+    return true;
+}
+
+bool MsgpackReader::read_integer(uint64_t &bits, bool &negative) {
+    const uint8_t *b;
+    if (!take(1, b))
+        return false;
+    uint8_t t = *b;
+    negative = false;
+    if (t <= 0x7f) {
+        bits = t;
+        return true;
+    }
+    if (t >= 0xe0) {
+        bits = (uint64_t)(int64_t)(int8_t)t;
+        negative = true;
+        return true;
+    }
+    if (t >= 0xcc && t <= 0xcf)
+        return read_be((size_t)1 << (t - 0xcc), bits);
+    if (t >= 0xd0 && t <= 0xd3) {
+        size_t n = (size_t)1 << (t - 0xd0);
+        if (!read_be(n, bits))
+            return false;
+        if (n < 8 && (bits >> (n * 8 - 1)) & 1)
+            bits |= ~(uint64_t)0 << (n * 8);   // sign extend
+        negative = (int64_t)bits < 0;
+        return true;
+    }
+    return fail();
+}
+
+bool MsgpackReader::read_uint(uint64_t &v) {
+    bool negative;
+    if (!read_integer(v, negative))
+        return false;
+    return negative ? fail() : true;
+}
+
+bool MsgpackReader::read_int(int64_t &v) {
+    uint64_t bits;
+    bool negative;
+    if (!read_integer(bits, negative))
+        return false;
+    if (!negative && bits > (uint64_t)INT64_MAX)
+        return fail();
+    v = (int64_t)bits;
+    return true;
+}
+
+bool MsgpackReader::read_bool(bool &v) {
+    const uint8_t *b;
+    if (!take(1, b))
+        return false;
+    if (*b != 0xc2 && *b != 0xc3)
+        return fail();
+    v = *b == 0xc3;
+    return true;
+}
+
+bool MsgpackReader::skip() {
+    uint64_t pending = 1;
+    while (pending > 0) {
+        // Every object takes a byte at least: more than that is garbage
+        if (pending > (uint64_t)(end_ - p_))
+            return fail();
+        pending--;
+        const uint8_t *b;
+        if (!take(1, b))
+            return false;
+        uint8_t t = *b;
+        uint64_t n = 0;
+        if (t <= 0x7f || t >= 0xe0 || t == 0xc0 || t == 0xc2 || t == 0xc3)
+            continue;
+        if ((t & 0xf0) == 0x80) { pending += 2 * (uint64_t)(t & 0x0f); continue; }
+        if ((t & 0xf0) == 0x90) { pending += t & 0x0f; continue; }
+        if ((t & 0xe0) == 0xa0) { n = t & 0x1f; }
+        else switch (t) {
+        case 0xc4: case 0xd9: if (!read_be(1, n)) return false; break;
+        case 0xc5: case 0xda: if (!read_be(2, n)) return false; break;
+        case 0xc6: case 0xdb: if (!read_be(4, n)) return false; break;
+        case 0xc7: if (!read_be(1, n)) return false; n += 1; break;   // ext: type byte
+        case 0xc8: if (!read_be(2, n)) return false; n += 1; break;
+        case 0xc9: if (!read_be(4, n)) return false; n += 1; break;
+        case 0xca: n = 4; break;
+        case 0xcb: n = 8; break;
+        case 0xcc: case 0xd0: n = 1; break;
+        case 0xcd: case 0xd1: n = 2; break;
+        case 0xce: case 0xd2: n = 4; break;
+        case 0xcf: case 0xd3: n = 8; break;
+        case 0xd4: n = 2; break;
+        case 0xd5: n = 3; break;
+        case 0xd6: n = 5; break;
+        case 0xd7: n = 9; break;
+        case 0xd8: n = 17; break;
+        case 0xdc: if (!read_be(2, n)) return false; pending += n; n = 0; break;
+        case 0xdd: if (!read_be(4, n)) return false; pending += n; n = 0; break;
+        case 0xde: if (!read_be(2, n)) return false; pending += 2 * n; n = 0; break;
+        case 0xdf: if (!read_be(4, n)) return false; pending += 2 * n; n = 0; break;
+        default: return fail();   // 0xc1, never used
+        }
+        const uint8_t *data;
+        if (n && !take(n, data))
+            return false;
+    }
+    return true;
+}
+
+// ── WfbStatsDecoder ─────────────────────────────────────────────────────────
+
+WfbStatsDecoder::Type WfbStatsDecoder::decode(const uint8_t *data, size_t len) {
+    error_[0] = '\0';
+
+    // The type may be anywhere in the map: look for it first
+    MsgpackReader scan(data, len);
+    uint32_t n;
+    const char *type = nullptr;
+    uint32_t type_len = 0;
+    if (scan.read_map(n)) {
+        for (uint32_t i = 0; i < n && scan.ok(); i++) {
+            const char *key;
+            uint32_t key_len;
+            if (!scan.read_str(key, key_len))
+                break;
+            if (key_is(key, key_len, "type")) {
+                scan.read_str(type, type_len);
+                break;
+            }
+            scan.skip();
+        }
+    }
+    if (!scan.ok() || !type) {
+        copy_str(error_, sizeof(error_), "no type", 7);
+        return INVALID;
+    }
+
+    MsgpackReader r(data, len);
+    Type t;
+    bool ok;
+    if (key_is(type, type_len, "rx")) {
+        t = RX;
+        ok = decode_rx(r);
+    } else if (key_is(type, type_len, "tx")) {
+        t = TX;
+        ok = decode_tx(r);
+    } else if (key_is(type, type_len, "cli_title")) {
+        t = TITLE;
+        ok = decode_title(r);
+    } else {
+        copy_str(error_, sizeof(error_), type, type_len);
+        return UNKNOWN;
+    }
+    if (!ok || !r.ok()) {
+        copy_str(error_, sizeof(error_), type, type_len);
+        return INVALID;
+    }
+    return t;
+}
+
+// {name: [delta, total], ...}
+bool WfbStatsDecoder::read_counters(MsgpackReader &r, const char *const *names, unsigned count,
+                                    WfbCounter *out) {
+    uint32_t n;
+    if (!r.read_map(n))
+        return false;
+    for (uint32_t i = 0; i < n; i++) {
+        const char *key;
+        uint32_t key_len;
+        if (!r.read_str(key, key_len))
+            return false;
+        unsigned k = 0;
+        while (k < count && !key_is(key, key_len, names[k]))
+            k++;
+        if (k == count) {
+            r.skip();
+            continue;
+        }
+        uint32_t m;
+        if (!r.read_array(m) || m < 2 || !r.read_uint(out[k].delta) || !r.read_uint(out[k].total))
+            return false;
+        for (uint32_t j = 2; j < m; j++)
+            r.skip();
+        out[k].present = true;
+    }
+    return r.ok();
+}
+
+// {[[freq, mcs, bw], ant_id]: [pkt_recv, rssi_min, rssi_avg, rssi_max, snr_min, snr_avg, snr_max]}
+bool WfbStatsDecoder::read_ant_stats(MsgpackReader &r) {
+    uint32_t n;
+    if (!r.read_map(n))
+        return false;
+    for (uint32_t i = 0; i < n; i++) {
+        WfbAntStats a;
+        uint32_t key_n, radio_n, val_n;
+        uint64_t freq, mcs, bw;
+        if (!r.read_array(key_n) || key_n < 2 || !r.read_array(radio_n) || radio_n < 3 ||
+            !r.read_uint(freq) || !r.read_uint(mcs) || !r.read_uint(bw))
+            return false;
+        for (uint32_t j = 3; j < radio_n; j++)
+            r.skip();
+        if (!r.read_uint(a.ant_id))
+            return false;
+        for (uint32_t j = 2; j < key_n; j++)
+            r.skip();
+        a.freq = (uint32_t)freq;
+        a.mcs = (uint32_t)mcs;
+        a.bw = (uint32_t)bw;
+
+        int64_t *vals[] = {&a.pkt_recv, &a.rssi_min, &a.rssi_avg, &a.rssi_max,
+                           &a.snr_min, &a.snr_avg, &a.snr_max};
+        if (!r.read_array(val_n) || val_n < 7)
+            return false;
+        for (int64_t *v : vals)
+            if (!r.read_int(*v))
+                return false;
+        for (uint32_t j = 7; j < val_n; j++)
+            r.skip();
+        if (rx_.n_ants < WFB_MAX_ANTENNAS)
+            rx_.ants[rx_.n_ants++] = a;
+    }
+    return r.ok();
+}
+
+bool WfbStatsDecoder::decode_rx(MsgpackReader &r) {
+    rx_.id[0] = '\0';
+    for (WfbCounter &c : rx_.packets)
+        c = WfbCounter();
+    rx_.n_ants = 0;
+
+    uint32_t n;
+    if (!r.read_map(n))
+        return false;
+    for (uint32_t i = 0; i < n && r.ok(); i++) {
+        const char *key, *s;
+        uint32_t key_len, len;
+        if (!r.read_str(key, key_len))
+            return false;
+        if (key_is(key, key_len, "id") && r.read_str(s, len))
+            copy_str(rx_.id, sizeof(rx_.id), s, len);
+        else if (key_is(key, key_len, "packets"))
+            read_counters(r, WFB_RX_COUNTERS, WFB_RX_COUNT, rx_.packets);
+        else if (key_is(key, key_len, "rx_ant_stats"))
+            read_ant_stats(r);
+        else
+            r.skip();
+    }
+    return r.ok();
+}
+
+// {ant_id: temperature}
+bool WfbStatsDecoder::read_rf_temperature(MsgpackReader &r) {
+    uint32_t n;
+    if (!r.read_map(n))
+        return false;
+    for (uint32_t i = 0; i < n; i++) {
+        WfbRfTemperature t;
+        if (!r.read_int(t.ant_id) || !r.read_int(t.temperature))
+            return false;
+        if (tx_.n_rf_temperature < WFB_MAX_ANTENNAS)
+            tx_.rf_temperature[tx_.n_rf_temperature++] = t;
+    }
+    return r.ok();
+}
+
+bool WfbStatsDecoder::decode_tx(MsgpackReader &r) {
+    tx_.id[0] = '\0';
+    for (WfbCounter &c : tx_.packets)
+        c = WfbCounter();
+    tx_.n_rf_temperature = 0;
+
+    uint32_t n;
+    if (!r.read_map(n))
+        return false;
+    for (uint32_t i = 0; i < n && r.ok(); i++) {
+        const char *key, *s;
+        uint32_t key_len, len;
+        if (!r.read_str(key, key_len))
+            return false;
+        if (key_is(key, key_len, "id") && r.read_str(s, len))
+            copy_str(tx_.id, sizeof(tx_.id), s, len);
+        else if (key_is(key, key_len, "packets"))
+            read_counters(r, WFB_TX_COUNTERS, WFB_TX_COUNT, tx_.packets);
+        else if (key_is(key, key_len, "rf_temperature"))
+            read_rf_temperature(r);
+        else
+            r.skip();
+    }
+    return r.ok();
+}
+
+bool WfbStatsDecoder::decode_title(MsgpackReader &r) {
+    title_.cli_title[0] = '\0';
+    title_.is_cluster = false;
+    title_.temp_overheat_warning = 0;
+
+    uint32_t n;
+    if (!r.read_map(n))
+        return false;
+    for (uint32_t i = 0; i < n && r.ok(); i++) {
+        const char *key, *s;
+        uint32_t key_len, len;
+        if (!r.read_str(key, key_len))
+            return false;
+        if (key_is(key, key_len, "cli_title") && r.read_str(s, len))
+            copy_str(title_.cli_title, sizeof(title_.cli_title), s, len);
+        else if (key_is(key, key_len, "is_cluster"))
+            r.read_bool(title_.is_cluster);
+        else if (key_is(key, key_len, "temp_overheat_warning"))
+            r.read_uint(title_.temp_overheat_warning);
+        else
+            r.skip();
+    }
+    return r.ok();
+}
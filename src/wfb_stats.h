@@ -0,0 +1,137 @@
+#ifndef WFB_STATS_H
+#define WFB_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ---------------------------------------------------------------------------
+// MsgpackReader: a cursor over one msgpack message, reading it in place.
+//
+//  Strings come out as pointers into the message, so nothing is copied or
+//  allocated.  Every read checks its type and the bounds; the first
+//  failure sticks (ok() turns false) and later reads fail too.
+// ---------------------------------------------------------------------------
+
+class MsgpackReader {
+public:
+    MsgpackReader(const uint8_t *data, size_t len) : p_(data), end_(data + len) {}
+
+    bool read_map(uint32_t &n);
+    bool read_array(uint32_t &n);
+    // str or bin
+    bool read_str(const char *&s, uint32_t &len);
+    // Any integer in range; read_uint also takes non-negative ints.
+    bool read_uint(uint64_t &v);
+    bool read_int(int64_t &v);
+    bool read_bool(bool &v);
+    // One whole object, however nested.
+    bool skip();
+
+    bool ok() const { return ok_; }
+    bool at_end() const { return p_ == end_; }
+
+private:
+    bool fail() { ok_ = false; return false; }
+    bool take(size_t n, const uint8_t *&out);
+    bool read_be(size_t n, uint64_t &v);
+    bool read_integer(uint64_t &bits, bool &negative);
+
+    const uint8_t *p_;
+    const uint8_t *end_;
+    bool ok_ = true;
+};
+
+// ---------------------------------------------------------------------------
+// WfbStatsDecoder: the wfb-ng stats API messages, decoded into structures.
+//
+//  A message is a map whose "type" is "rx", "tx" or "cli_title".  The
+//  decoder finds the type, then reads the map once more into the matching
+//  structure; counters and antennas it knows go to fixed slots, anything
+//  else is skipped.  The structures are members, reused from one message
+//  to the next.
+// ---------------------------------------------------------------------------
+
+static constexpr size_t WFB_ID_MAX = 64;
+static constexpr unsigned WFB_MAX_ANTENNAS = 32;
+
+// The "packets" counters of an rx message, in the order of WFB_RX_COUNTERS
+enum WfbRxCounter {
+    WFB_RX_ALL, WFB_RX_ALL_BYTES, WFB_RX_DEC_ERR, WFB_RX_SESSION, WFB_RX_DATA, WFB_RX_UNIQ,
+    WFB_RX_FEC_REC, WFB_RX_LOST, WFB_RX_BAD, WFB_RX_OUT, WFB_RX_OUT_BYTES, WFB_RX_COUNT
+};
+extern const char *const WFB_RX_COUNTERS[WFB_RX_COUNT];
+
+enum WfbTxCounter {
+    WFB_TX_FEC_TIMEOUTS, WFB_TX_INCOMING, WFB_TX_INCOMING_BYTES, WFB_TX_INJECTED,
+    WFB_TX_INJECTED_BYTES, WFB_TX_DROPPED, WFB_TX_TRUNCATED, WFB_TX_COUNT
+};
+extern const char *const WFB_TX_COUNTERS[WFB_TX_COUNT];
+
+struct WfbCounter {
+    bool present = false;
+    uint64_t delta = 0;
+    uint64_t total = 0;
+};
+
+struct WfbAntStats {
+    uint32_t freq = 0, mcs = 0, bw = 0;
+    uint64_t ant_id = 0;
+    int64_t pkt_recv = 0;
+    int64_t rssi_min = 0, rssi_avg = 0, rssi_max = 0;
+    int64_t snr_min = 0, snr_avg = 0, snr_max = 0;
+};
+
+struct WfbRx {
+    char id[WFB_ID_MAX] = "";
+    WfbCounter packets[WFB_RX_COUNT];
+    WfbAntStats ants[WFB_MAX_ANTENNAS];
+    unsigned n_ants = 0;
+};
+
+struct WfbRfTemperature {
+    int64_t ant_id = 0;
+    int64_t temperature = 0;
+};
+
+struct WfbTx {
+    char id[WFB_ID_MAX] = "";
+    WfbCounter packets[WFB_TX_COUNT];
+    WfbRfTemperature rf_temperature[WFB_MAX_ANTENNAS];
+    unsigned n_rf_temperature = 0;
+};
+
+struct WfbTitle {
+    char cli_title[WFB_ID_MAX] = "";
+    bool is_cluster = false;
+    uint64_t temp_overheat_warning = 0;
+};
+
+class WfbStatsDecoder {
+public:
+    enum Type { INVALID, UNKNOWN, RX, TX, TITLE };
+
+    // Decodes one message; the result is in rx(), tx() or title() by type.
+    Type decode(const uint8_t *data, size_t len);
+
+    const WfbRx &rx() const { return rx_; }
+    const WfbTx &tx() const { return tx_; }
+    const WfbTitle &title() const { return title_; }
+    // The type of an UNKNOWN message, what went wrong with an INVALID one.
+    const char *error() const { return error_; }
+
+private:
+    bool decode_rx(MsgpackReader &r);
+    bool decode_tx(MsgpackReader &r);
+    bool decode_title(MsgpackReader &r);
+    bool read_counters(MsgpackReader &r, const char *const *names, unsigned count,
+                       WfbCounter *out);
+    bool read_ant_stats(MsgpackReader &r);
+    bool read_rf_temperature(MsgpackReader &r);
+
+    WfbRx rx_;
+    WfbTx tx_;
+    WfbTitle title_;
+    char error_[WFB_ID_MAX] = "";
+};
+
+#endif // WFB_STATS_H
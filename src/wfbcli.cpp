@@ -1,5 +1,5 @@
 /**
- * Client for WFB-ng stats API using MessagePack
+ * Client for WFB-ng stats API using MessagePack, decoded by wfb_stats.h
  */
 
 #include <arpa/inet.h>
@@ -17,277 +17,219 @@
 #include <sys/types.h>
 #include <cstdint>
 #include <iostream>
-#include <msgpack.hpp>
+#include <vector>
 #include "spdlog/spdlog.h"
 
 #include "gsmenu/gs_system.h"
 #include "wfbcli.hpp"
+#include "wfb_stats.h"
 extern "C" {
 #include "osd.h"
 }
 
-#define BUFFER_SIZE 10 * 1024
+// Longest message taken from the server; anything bigger means the stream is out of sync
+#define MAX_MSG_SIZE (1024 * 1024)
 
 int wfb_thread_signal = 0;
 
 uint64_t gtotal_tunnel_data = 0; // global variable for easyer access in gsmenu
 extern enum RXMode RXMODE;
 
-int process_rx(const msgpack::object& packet) {
-
-    void *batch = osd_batch_init(2);
-    osd_tag tags[2];
-
-    // Access the map and find the required keys
-    std::string id;
-    msgpack::object packets;
-    msgpack::object rx_ant_stats;
-
-    for (size_t i = 0; i < packet.via.map.size; ++i) {
-        std::string key = packet.via.map.ptr[i].key.as<std::string>();
-        if (key == "id") {
-            id = packet.via.map.ptr[i].val.as<std::string>();
-            strcpy(tags[0].key, "id");
-            strcpy(tags[0].val, id.c_str());
-        } else if (key == "packets") {
-            packets = packet.via.map.ptr[i].val;
-        } else if (key == "rx_ant_stats") {
-            rx_ant_stats = packet.via.map.ptr[i].val;
-        }
-    }
+// Fact names, in the order of WFB_RX_COUNTERS / WFB_TX_COUNTERS
+#define COUNTER_FACTS(dir, key) {"wfbcli." dir ".packets." key ".delta", "wfbcli." dir ".packets." key ".total"}
+static const char *const RX_COUNTER_FACTS[][2] = {
+    COUNTER_FACTS("rx", "all"), COUNTER_FACTS("rx", "all_bytes"), COUNTER_FACTS("rx", "dec_err"),
+    COUNTER_FACTS("rx", "session"), COUNTER_FACTS("rx", "data"), COUNTER_FACTS("rx", "uniq"),
+    COUNTER_FACTS("rx", "fec_rec"), COUNTER_FACTS("rx", "lost"), COUNTER_FACTS("rx", "bad"),
+    COUNTER_FACTS("rx", "out"), COUNTER_FACTS("rx", "out_bytes"),
+};
+static const char *const TX_COUNTER_FACTS[][2] = {
+    COUNTER_FACTS("tx", "fec_timeouts"), COUNTER_FACTS("tx", "incoming"),
+    COUNTER_FACTS("tx", "incoming_bytes"), COUNTER_FACTS("tx", "injected"),
+    COUNTER_FACTS("tx", "injected_bytes"), COUNTER_FACTS("tx", "dropped"),
+    COUNTER_FACTS("tx", "truncated"),
+};
+static_assert(sizeof(RX_COUNTER_FACTS) / sizeof(RX_COUNTER_FACTS[0]) == WFB_RX_COUNT, "rx counters");
+static_assert(sizeof(TX_COUNTER_FACTS) / sizeof(TX_COUNTER_FACTS[0]) == WFB_TX_COUNT, "tx counters");
+
+// The tags of a stream and of each of its antennas, made the first time
+// they are seen and reused for every message after that.
+struct StreamTags {
+    osd_tag id[1];
+    struct Ant {
+        int64_t ant_id;
+        osd_tag tags[2];   // id, ant_id
+    };
+    std::vector<Ant> ants;
+};
+static std::vector<StreamTags> rx_tags, tx_tags;
+// wfb-ng has a handful of streams; a server sending endless new ids only
+// gets the cache dropped now and then
+#define MAX_STREAMS 32
+
+static void set_tag(osd_tag &tag, const char *key, const char *val) {
+    strncpy(tag.key, key, TAG_MAX_LEN - 1);
+    tag.key[TAG_MAX_LEN - 1] = '\0';
+    strncpy(tag.val, val, TAG_MAX_LEN - 1);
+    tag.val[TAG_MAX_LEN - 1] = '\0';
+}
+
+static StreamTags &stream_tags(std::vector<StreamTags> &cache, const char *id) {
+    for (StreamTags &s : cache)
+        if (!strcmp(s.id[0].val, id))
+            return s;
+    if (cache.size() >= MAX_STREAMS)
+        cache.clear();
+    cache.emplace_back();
+    set_tag(cache.back().id[0], "id", id);
+    return cache.back();
+}
+
+static osd_tag *ant_tags(StreamTags &s, int64_t ant_id, const char *fmt) {
+    for (StreamTags::Ant &a : s.ants)
+        if (a.ant_id == ant_id)
+            return a.tags;
+    if (s.ants.size() >= WFB_MAX_ANTENNAS)
+        s.ants.clear();
+    s.ants.emplace_back();
+    StreamTags::Ant &a = s.ants.back();
+    a.ant_id = ant_id;
+    a.tags[0] = s.id[0];
+    char val[TAG_MAX_LEN];
+    snprintf(val, sizeof(val), fmt, ant_id);
+    set_tag(a.tags[1], "ant_id", val);
+    return a.tags;
+}
+
+static unsigned counters_present(const WfbCounter *packets, unsigned count) {
+    unsigned n = 0;
+    for (unsigned i = 0; i < count; i++)
+        n += packets[i].present;
+    return n;
+}
 
-    // Process packets
-    for (size_t i = 0; i < packets.via.map.size; ++i) {
-		std::string key = packets.via.map.ptr[i].key.as<std::string>();
-		msgpack::object_array& array = packets.via.map.ptr[i].val.via.array;
-		uint32_t delta = array.ptr[0].as<uint32_t>();
-		uint64_t total = array.ptr[1].as<uint64_t>();
-		if (! strcmp("data",key.c_str()) && ! strcmp("tunnel rx",tags[0].val))
-			gtotal_tunnel_data = total; // store total in global variable for gsmenu
-		// If you need to use these values elsewhere, you can pass them to other functions
-		osd_add_uint_fact(batch, (std::string("wfbcli.rx.packets.") + key + ".delta").c_str(), tags, 1, delta);
-		osd_add_uint_fact(batch, (std::string("wfbcli.rx.packets.") + key + ".total").c_str(), tags, 1, total);
+int process_rx(const WfbRx &rx) {
+    StreamTags &tags = stream_tags(rx_tags, rx.id);
+    void *batch = osd_batch_init(2 * counters_present(rx.packets, WFB_RX_COUNT) + 10 * rx.n_ants);
+
+    for (unsigned i = 0; i < WFB_RX_COUNT; i++) {
+        const WfbCounter &c = rx.packets[i];
+        if (!c.present)
+            continue;
+        if (i == WFB_RX_DATA && !strcmp("tunnel rx", rx.id))
+            gtotal_tunnel_data = c.total; // store total in global variable for gsmenu
+        osd_add_uint_fact(batch, RX_COUNTER_FACTS[i][0], tags.id, 1, (uint32_t)c.delta);
+        osd_add_uint_fact(batch, RX_COUNTER_FACTS[i][1], tags.id, 1, c.total);
     }
 
-    // Process rx_ant_stats
-    for (size_t i = 0; i < rx_ant_stats.via.map.size; ++i) {
-        // Extract the key (which is an array: [[frequency, mcs, bandwidth], antenna_id])
-        msgpack::object_array key_array = rx_ant_stats.via.map.ptr[i].key.via.array;
-
-        // Extract the first element of the key (which is an array: [frequency, mcs, bandwidth])
-        msgpack::object_array freq_mcs_bw_array = key_array.ptr[0].via.array;
-
-        // Extract frequency, mcs, and bandwidth from the inner array
-        uint32_t frequency = freq_mcs_bw_array.ptr[0].as<uint32_t>();
-        uint32_t mcs = freq_mcs_bw_array.ptr[1].as<uint32_t>();
-        uint32_t bandwidth = freq_mcs_bw_array.ptr[2].as<uint32_t>();
-
-        // Extract the second element of the key (antenna_id)
-        uint64_t antenna_id = key_array.ptr[1].as<uint64_t>();
-
-        strcpy(tags[1].key, "ant_id");
-        snprintf(tags[1].val, sizeof(tags[0].val), "%lu", antenna_id);
-
-        // Extract the value (which is an array: [packets_delta, rssi_min, rssi_avg, rssi_max, snr_min, snr_avg, snr_max])
-        msgpack::object_array value_array = rx_ant_stats.via.map.ptr[i].val.via.array;
-        // Extract packets_delta, rssi_min, rssi_avg, rssi_max, snr_min, snr_avg, snr_max from the value
-        int32_t packets_delta = value_array.ptr[0].as<int32_t>();
-        int32_t rssi_min = value_array.ptr[1].as<int32_t>();
-        int32_t rssi_avg = value_array.ptr[2].as<int32_t>();
-        int32_t rssi_max = value_array.ptr[3].as<int32_t>();
-        int32_t snr_min = value_array.ptr[4].as<int32_t>();
-        int32_t snr_avg = value_array.ptr[5].as<int32_t>();
-        int32_t snr_max = value_array.ptr[6].as<int32_t>();
-        osd_add_uint_fact(batch, "wfbcli.rx.ant_stats.freq", tags, 2, frequency);
-        osd_add_uint_fact(batch, "wfbcli.rx.ant_stats.mcs", tags, 2, mcs);
-        osd_add_uint_fact(batch, "wfbcli.rx.ant_stats.bw", tags, 2, bandwidth);
-        osd_add_uint_fact(batch, "wfbcli.rx.ant_stats.pkt_recv", tags, 2, packets_delta);
-        osd_add_int_fact(batch, "wfbcli.rx.ant_stats.rssi_min", tags, 2, rssi_min);
-        osd_add_int_fact(batch, "wfbcli.rx.ant_stats.rssi_avg", tags, 2, rssi_avg);
-        osd_add_int_fact(batch, "wfbcli.rx.ant_stats.rssi_max", tags, 2, rssi_max);
-        osd_add_int_fact(batch, "wfbcli.rx.ant_stats.snr_min", tags, 2, snr_min);
-        osd_add_int_fact(batch, "wfbcli.rx.ant_stats.snr_avg", tags, 2, snr_avg);
-        osd_add_int_fact(batch, "wfbcli.rx.ant_stats.snr_max", tags, 2, snr_max);
+    for (unsigned i = 0; i < rx.n_ants; i++) {
+        const WfbAntStats &a = rx.ants[i];
+        osd_tag *t = ant_tags(tags, (int64_t)a.ant_id, "%lu");
+        osd_add_uint_fact(batch, "wfbcli.rx.ant_stats.freq", t, 2, a.freq);
+        osd_add_uint_fact(batch, "wfbcli.rx.ant_stats.mcs", t, 2, a.mcs);
+        osd_add_uint_fact(batch, "wfbcli.rx.ant_stats.bw", t, 2, a.bw);
+        osd_add_uint_fact(batch, "wfbcli.rx.ant_stats.pkt_recv", t, 2, (int32_t)a.pkt_recv);
+        osd_add_int_fact(batch, "wfbcli.rx.ant_stats.rssi_min", t, 2, (int32_t)a.rssi_min);
+        osd_add_int_fact(batch, "wfbcli.rx.ant_stats.rssi_avg", t, 2, (int32_t)a.rssi_avg);
+        osd_add_int_fact(batch, "wfbcli.rx.ant_stats.rssi_max", t, 2, (int32_t)a.rssi_max);
+        osd_add_int_fact(batch, "wfbcli.rx.ant_stats.snr_min", t, 2, (int32_t)a.snr_min);
+        osd_add_int_fact(batch, "wfbcli.rx.ant_stats.snr_avg", t, 2, (int32_t)a.snr_avg);
+        osd_add_int_fact(batch, "wfbcli.rx.ant_stats.snr_max", t, 2, (int32_t)a.snr_max);
     }
 
     osd_publish_batch(batch);
     return 0;
 }
 
-int process_tx(const msgpack::object& packet) {
-
-    void *batch = osd_batch_init(2);
-    osd_tag tags[2];
-
-    // Access the map and find the required keys
-    std::string id;
-    msgpack::object packets;
-    msgpack::object latency;
-	msgpack::object rf_temperature;
-
-    //std::cout << "Unpacked MessagePack packet: " << packet << std::endl;
-
-    for (size_t i = 0; i < packet.via.map.size; ++i) {
-        std::string key = packet.via.map.ptr[i].key.as<std::string>();
-        if (key == "id") {
-            id = packet.via.map.ptr[i].val.as<std::string>();
-            strcpy(tags[0].key, "id");
-            strcpy(tags[0].val, id.c_str());
-        } else if (key == "packets") {
-            packets = packet.via.map.ptr[i].val;
-        } else if (key == "latency") {
-            latency = packet.via.map.ptr[i].val;
-        } else if (key == "rf_temperature") {
-            rf_temperature = packet.via.map.ptr[i].val;
-        }
-    }
+int process_tx(const WfbTx &tx) {
+    StreamTags &tags = stream_tags(tx_tags, tx.id);
+    void *batch = osd_batch_init(2 * counters_present(tx.packets, WFB_TX_COUNT) + tx.n_rf_temperature);
 
-	for (size_t i = 0; i < packets.via.map.size; ++i) {
-        std::string key = packets.via.map.ptr[i].key.as<std::string>();
-        if (key == "fec_timeouts") {
-			msgpack::object_array& array = packets.via.map.ptr[i].val.via.array;
-			uint32_t delta = array.ptr[0].as<uint32_t>();
-			uint64_t total = array.ptr[1].as<uint64_t>();
-			osd_add_uint_fact(batch, "wfbcli.tx.packets.fec_timeouts.delta", tags, 1, delta);			
-			osd_add_uint_fact(batch, "wfbcli.tx.packets.fec_timeouts.total", tags, 1, total);			
-        } else if (key == "incoming") {
-			msgpack::object_array& array = packets.via.map.ptr[i].val.via.array;
-			uint32_t delta = array.ptr[0].as<uint32_t>();
-			uint64_t total = array.ptr[1].as<uint64_t>();
-			osd_add_uint_fact(batch, "wfbcli.tx.packets.incoming.delta", tags, 1, delta);			
-			osd_add_uint_fact(batch, "wfbcli.tx.packets.incoming.total", tags, 1, total);	
-        } else if (key == "incoming_bytes") {
-			msgpack::object_array& array = packets.via.map.ptr[i].val.via.array;
-			uint32_t delta = array.ptr[0].as<uint32_t>();
-			uint64_t total = array.ptr[1].as<uint64_t>();
-			osd_add_uint_fact(batch, "wfbcli.tx.packets.incoming_bytes.delta", tags, 1, delta);			
-			osd_add_uint_fact(batch, "wfbcli.tx.packets.incoming_bytes.total", tags, 1, total);
-        } else if (key == "injected") {
-			msgpack::object_array& array = packets.via.map.ptr[i].val.via.array;
-			uint32_t delta = array.ptr[0].as<uint32_t>();
-			uint64_t total = array.ptr[1].as<uint64_t>();
-			osd_add_uint_fact(batch, "wfbcli.tx.packets.injected.delta", tags, 1, delta);			
-			osd_add_uint_fact(batch, "wfbcli.tx.packets.injected.total", tags, 1, total);
-        } else if (key == "injected_bytes") {
-			msgpack::object_array& array = packets.via.map.ptr[i].val.via.array;
-			uint32_t delta = array.ptr[0].as<uint32_t>();
-			uint64_t total = array.ptr[1].as<uint64_t>();
-			osd_add_uint_fact(batch, "wfbcli.tx.packets.injected_bytes.delta", tags, 1, delta);			
-			osd_add_uint_fact(batch, "wfbcli.tx.packets.injected_bytes.total", tags, 1, total);
-        } else if (key == "dropped") {
-			msgpack::object_array& array = packets.via.map.ptr[i].val.via.array;
-			uint32_t delta = array.ptr[0].as<uint32_t>();
-			uint64_t total = array.ptr[1].as<uint64_t>();
-			osd_add_uint_fact(batch, "wfbcli.tx.packets.dropped.delta", tags, 1, delta);			
-			osd_add_uint_fact(batch, "wfbcli.tx.packets.dropped.total", tags, 1, total);
-        } else if (key == "truncated") {
-			msgpack::object_array& array = packets.via.map.ptr[i].val.via.array;
-			uint32_t delta = array.ptr[0].as<uint32_t>();
-			uint64_t total = array.ptr[1].as<uint64_t>();
-			osd_add_uint_fact(batch, "wfbcli.tx.packets.truncated.delta", tags, 1, delta);			
-			osd_add_uint_fact(batch, "wfbcli.tx.packets.truncated.total", tags, 1, total);
-        }
+    for (unsigned i = 0; i < WFB_TX_COUNT; i++) {
+        const WfbCounter &c = tx.packets[i];
+        if (!c.present)
+            continue;
+        osd_add_uint_fact(batch, TX_COUNTER_FACTS[i][0], tags.id, 1, (uint32_t)c.delta);
+        osd_add_uint_fact(batch, TX_COUNTER_FACTS[i][1], tags.id, 1, c.total);
     }
 
-	for (size_t i = 0; i < rf_temperature.via.map.size; ++i) {
-        int antenna_id = rf_temperature.via.map.ptr[i].key.as<int>();
-		int temperature = rf_temperature.via.map.ptr[i].val.as<int>();
-		strcpy(tags[1].key, "ant_id");
-		snprintf(tags[1].val, sizeof(tags[0].val), "%u", antenna_id);
-		osd_add_uint_fact(batch, "wfbcli.rf_temperature", tags, 2, temperature);
-    }	
+    for (unsigned i = 0; i < tx.n_rf_temperature; i++) {
+        const WfbRfTemperature &t = tx.rf_temperature[i];
+        osd_add_uint_fact(batch, "wfbcli.rf_temperature", ant_tags(tags, t.ant_id, "%ld"), 2,
+                          (int)t.temperature);
+    }
 
     osd_publish_batch(batch);
-
     return 0;
 }
 
-int process_title(const msgpack::object& packet) {
-    std::string cli_title;
-    bool is_cluster = false;
-    uint32_t temp_overheat_warning = 0;
-
-    // Access the map and find the required keys
-    for (size_t i = 0; i < packet.via.map.size; ++i) {
-        std::string key = packet.via.map.ptr[i].key.as<std::string>();
-        if (key == "cli_title") {
-            cli_title = packet.via.map.ptr[i].val.as<std::string>();
-        } else if (key == "is_cluster") {
-            is_cluster = packet.via.map.ptr[i].val.as<bool>();
-        } else if (key == "temp_overheat_warning") {
-            temp_overheat_warning = packet.via.map.ptr[i].val.as<int>();
-        }
-    }
-
-    void *batch = osd_batch_init(2);
-    osd_add_str_fact(batch, "wfbcli.cli_title", nullptr, 0, cli_title.c_str());
-    osd_add_bool_fact(batch, "wfbcli.is_cluster", nullptr, 0, is_cluster);
-    osd_add_uint_fact(batch, "wfbcli.temp_overheat_warning", nullptr, 0, temp_overheat_warning);
+int process_title(const WfbTitle &title) {
+    void *batch = osd_batch_init(3);
+    osd_add_str_fact(batch, "wfbcli.cli_title", nullptr, 0, title.cli_title);
+    osd_add_bool_fact(batch, "wfbcli.is_cluster", nullptr, 0, title.is_cluster);
+    osd_add_uint_fact(batch, "wfbcli.temp_overheat_warning", nullptr, 0, (uint32_t)title.temp_overheat_warning);
     osd_publish_batch(batch);
     return 0;
 }
 
-int process_packet(const msgpack::object& packet) {
-    std::string type;
-
-    // Find the "type" key in the map
-    for (size_t i = 0; i < packet.via.map.size; ++i) {
-        std::string key = packet.via.map.ptr[i].key.as<std::string>();
-        if (key == "type") {
-            type = packet.via.map.ptr[i].val.as<std::string>();
-            break;
-        }
-    }
-
-    if (type == "rx") {
-        process_rx(packet);
-    } else if (type == "tx") {
-        process_tx(packet);
-    } else if (type == "cli_title") {
-        process_title(packet);
-    } else {
-        SPDLOG_ERROR("Unknown wfbcli packet type {}", type);
+int process_packet(WfbStatsDecoder &decoder, const uint8_t *data, size_t len) {
+    switch (decoder.decode(data, len)) {
+    case WfbStatsDecoder::RX:
+        return process_rx(decoder.rx());
+    case WfbStatsDecoder::TX:
+        return process_tx(decoder.tx());
+    case WfbStatsDecoder::TITLE:
+        return process_title(decoder.title());
+    case WfbStatsDecoder::UNKNOWN:
+        SPDLOG_ERROR("Unknown wfbcli packet type {}", decoder.error());
+        return -1;
+    default:
+        SPDLOG_ERROR("Failed to unpack data: {}", decoder.error());
         return -1;
     }
-    return 0;
+}
+
+static bool recv_all(int sock, void *buf, size_t len) {
+	size_t total_read = 0;
+	while (total_read < len) {
+		ssize_t bytes_read = recv(sock, (uint8_t *)buf + total_read, len - total_read, 0);
+		if (bytes_read <= 0)
+			return false;
+		total_read += bytes_read;
+	}
+	return true;
 }
 
 void handle_server_connection(int sock) {
-	std::vector<char> buffer(BUFFER_SIZE);
+	// Reused for every message, grown only when one doesn't fit
+	static std::vector<uint8_t> buffer(10 * 1024);
+	static WfbStatsDecoder decoder;
 	while (!wfb_thread_signal) {
 		// Read the length prefix (4 bytes)
 		uint32_t msg_length;
-		ssize_t bytes_read = recv(sock, &msg_length, sizeof(msg_length), 0);
-		if (bytes_read <= 0) {
+		if (!recv_all(sock, &msg_length, sizeof(msg_length))) {
 			SPDLOG_ERROR("Server disconnected or error occurred");
 			close(sock);
 			return;
 		}
 
 		msg_length = ntohl(msg_length); // Convert from network byte order
+		if (msg_length > MAX_MSG_SIZE) {
+			SPDLOG_ERROR("wfbcli message of {} bytes, dropping the connection", msg_length);
+			close(sock);
+			return;
+		}
+		if (msg_length > buffer.size())
+			buffer.resize(msg_length);
 
 		// Read the actual MessagePack data
-		std::vector<char> data(msg_length);
-		size_t total_read = 0;
-		while (total_read < msg_length) {
-			bytes_read = recv(sock, data.data() + total_read, msg_length - total_read, 0);
-			if (bytes_read <= 0) {
-				SPDLOG_ERROR("Incomplete data, connection closed.");
-				close(sock);
-				return;
-			}
-			total_read += bytes_read;
+		if (!recv_all(sock, buffer.data(), msg_length)) {
+			SPDLOG_ERROR("Incomplete data, connection closed.");
+			close(sock);
+			return;
 		}
 
-		// Unpack the MessagePack data
-		try {
-			msgpack::object_handle oh = msgpack::unpack(data.data(), data.size());
-			msgpack::object obj = oh.get();
-		    // std::cout << "Unpacked MessagePack data: " << obj << std::endl;
-			process_packet(obj);
-		} catch (const msgpack::unpack_error& e) {
-			SPDLOG_ERROR("Failed to unpack data: {}", e.what());
-		}
+		process_packet(decoder, buffer.data(), msg_length);
 	}
 }
 
@@ -0,0 +1,117 @@
+// Micro-benchmark of the ImageOps backends on the re-encode path's work:
+//
+//   image_ops_bench [<width>x<height> [<iterations>]]
+//
+// Times copy, 2/3 scaling, NV12 <-> BGRA and a full-frame OSD blend with
+// the plain C, SIMD and RGA backends.  The buffers come from an MPP DRM
+// group so the RGA can use them; an operation a backend can't do is
+// reported as such.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <functional>
+#include <memory>
+
+#include <rockchip/rk_mpi.h>
+
+#include "../src/image_ops.h"
+
+struct BenchBuffer {
+    MppBuffer buffer = nullptr;
+    ImageBuffer image;
+
+    BenchBuffer(MppBufferGroup grp, uint32_t w, uint32_t h, ImageFormat fmt) {
+        uint32_t hs = (w + 15) & ~15u, vs = (h + 15) & ~15u;
+        size_t size = fmt == ImageFormat::BGRA ? (size_t)hs * vs * 4 : (size_t)hs * vs * 3 / 2;
+        if (mpp_buffer_get(grp, &buffer, size) != MPP_OK)
+            return;
+        image.fd = mpp_buffer_get_fd(buffer);
+        image.ptr = (uint8_t *)mpp_buffer_get_ptr(buffer);
+        image.size = size;
+        image.width = w;
+        image.height = h;
+        image.hor_stride = hs;
+        image.ver_stride = vs;
+        image.fmt = fmt;
+        for (size_t i = 0; i < size; i++)
+            image.ptr[i] = (uint8_t)(i * 2654435761u >> 24);
+    }
+    ~BenchBuffer() {
+        if (buffer) mpp_buffer_put(buffer);
+    }
+};
+
+// Milliseconds per call, or -1 when the backend refuses.
+static double time_op(int iterations, const std::function<bool()> &op) {
+    if (!op())   // warm-up, and maps the buffers
+        return -1;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        op();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t1 - t0).count() / iterations;
+}
+
+int main(int argc, char **argv) {
+    uint32_t width = 1920, height = 1080;
+    int iterations = 50;
+    if (argc > 1 && sscanf(argv[1], "%ux%u", &width, &height) != 2) {
+        fprintf(stderr, "usage: %s [<width>x<height> [<iterations>]]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 2)
+        iterations = atoi(argv[2]) > 0 ? atoi(argv[2]) : 1;
+    width &= ~1u;
+    height &= ~1u;
+
+    MppBufferGroup grp = nullptr;
+    if (mpp_buffer_group_get_internal(&grp, MPP_BUFFER_TYPE_DRM) != MPP_OK) {
+        fprintf(stderr, "no DRM buffer group\n");
+        return 1;
+    }
+    {
+        BenchBuffer frame(grp, width, height, ImageFormat::NV12);
+        BenchBuffer copy(grp, width, height, ImageFormat::NV12);
+        BenchBuffer scaled(grp, width * 2 / 3 & ~1u, height * 2 / 3 & ~1u, ImageFormat::NV12);
+        BenchBuffer bgra(grp, width, height, ImageFormat::BGRA);
+        BenchBuffer osd(grp, width, height, ImageFormat::BGRA);
+        if (!frame.buffer || !copy.buffer || !scaled.buffer || !bgra.buffer || !osd.buffer) {
+            fprintf(stderr, "out of DRM buffers\n");
+            return 1;
+        }
+        BlendRect all;
+        all.w = width;
+        all.h = height;
+
+        struct Backend {
+            const char *label;
+            std::unique_ptr<ImageOps> ops;
+        } backends[] = {
+            {"cpu (C)", image_ops_cpu(false)},
+            {"cpu (SIMD)", image_ops_cpu(true)},
+            {"rga", image_ops_rga()},
+        };
+
+        printf("%ux%u, %d iterations, ms per call\n", width, height, iterations);
+        printf("%-12s %9s %9s %9s %9s %9s\n", "", "copy", "scale", "to BGRA", "to NV12", "blend");
+        for (auto &b : backends) {
+            ImageOps *ops = b.ops.get();
+            double ms[] = {
+                time_op(iterations, [&] { return ops->copy(frame.image, copy.image); }),
+                time_op(iterations, [&] { return ops->resize(frame.image, scaled.image); }),
+                time_op(iterations, [&] { return ops->convert(frame.image, bgra.image); }),
+                time_op(iterations, [&] { return ops->convert(bgra.image, copy.image); }),
+                time_op(iterations, [&] { return ops->blend(osd.image, true, all, copy.image); }),
+            };
+            printf("%-12s", b.label);
+            for (double m : ms) {
+                if (m < 0) printf(" %9s", "failed");
+                else printf(" %9.2f", m);
+            }
+            printf("\n");
+        }
+    }
+    mpp_buffer_group_put(grp);
+    return 0;
+}
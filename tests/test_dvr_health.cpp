@@ -0,0 +1,119 @@
+#include <catch2/catch.hpp>
+
+#include <vector>
+
+#include "../src/dvr_health.h"
+
+struct HealthActions {
+    bool reencoder = true;
+    bool both = true;
+    std::vector<unsigned> bitrates;
+    bool raw_only = false;
+    bool drop_non_reference = false;
+
+    DvrHealth::Actions actions() {
+        DvrHealth::Actions a;
+        a.set_bitrate = [this](unsigned pct) {
+            if (!reencoder)
+                return false;
+            bitrates.push_back(pct);
+            return true;
+        };
+        a.raw_only = [this]() {
+            if (!both)
+                return false;
+            raw_only = true;
+            reencoder = false;
+            return true;
+        };
+        a.drop_non_reference = [this](bool on) {
+            drop_non_reference = on;
+            return true;
+        };
+        return a;
+    }
+};
+
+static DvrStorageSample busy_sample(unsigned busy_pct) {
+    DvrStorageSample s;
+    s.busy_pct = busy_pct;
+    return s;
+}
+
+TEST_CASE("Sustained pressure walks down the degradation ladder", "[DvrHealth]")
+{
+    HealthActions fake;
+    DvrHealth health(fake.actions(), true);
+    int writer;
+    uint64_t t = 1000;
+
+    // Short bursts don't count
+    DvrHealth::report(&writer, busy_sample(95), t);
+    health.tick(t);
+    REQUIRE(health.level() == DvrHealth::PRESSURE);
+    REQUIRE(fake.bitrates.empty());
+
+    // Then one step per cooldown: 75%, 50%, 25%, raw only, non-reference
+    for (t += 1000; t < 1000 + 40000; t += 1000) {
+        DvrHealth::report(&writer, busy_sample(95), t);
+        health.tick(t);
+    }
+    REQUIRE(fake.bitrates == std::vector<unsigned>{75, 50, 25});
+    REQUIRE(fake.raw_only);
+    REQUIRE(fake.drop_non_reference);
+    REQUIRE(health.level() == DvrHealth::DEGRADED);
+
+    // Recovery undoes the steps last first, the raw-only switch stays
+    for (; t < 1000 + 40000 + 80000; t += 1000) {
+        DvrHealth::report(&writer, busy_sample(10), t);
+        health.tick(t);
+    }
+    REQUIRE_FALSE(fake.drop_non_reference);
+    REQUIRE(health.bitrate_pct() == 100);
+    REQUIRE(health.raw_only());
+    REQUIRE(health.level() == DvrHealth::DEGRADED);
+    DvrHealth::forget(&writer);
+}
+
+TEST_CASE("Dropped frames escalate at once and skip steps that don't apply", "[DvrHealth]")
+{
+    HealthActions fake;
+    fake.reencoder = false;
+    fake.both = false;
+    DvrHealth health(fake.actions(), true);
+    int writer;
+
+    DvrStorageSample s;
+    s.dropped_frames = 3;
+    DvrHealth::report(&writer, s, 1000);
+    health.tick(1000);
+    REQUIRE(health.level() == DvrHealth::LOSING_FRAMES);
+    REQUIRE(fake.bitrates.empty());
+    REQUIRE_FALSE(fake.raw_only);
+    REQUIRE(fake.drop_non_reference);
+
+    // The same drop count again is not a new loss
+    DvrHealth::report(&writer, s, 2000);
+    health.tick(2000);
+    REQUIRE(health.level() == DvrHealth::DEGRADED);
+    DvrHealth::forget(&writer);
+}
+
+TEST_CASE("A writer that stops reporting is stalled", "[DvrHealth]")
+{
+    HealthActions fake;
+    DvrHealth health(fake.actions(), false);
+    int writer;
+
+    DvrHealth::report(&writer, busy_sample(10), 1000);
+    health.tick(2000);
+    REQUIRE(health.level() == DvrHealth::HEALTHY);
+    health.tick(1000 + DvrHealth::STALE_S * 1000);
+    REQUIRE(health.level() == DvrHealth::PRESSURE);
+    // Monitor only: nothing is changed
+    for (uint64_t t = 5000; t < 30000; t += 1000)
+        health.tick(t);
+    REQUIRE(fake.bitrates.empty());
+    REQUIRE_FALSE(fake.drop_non_reference);
+    DvrHealth::forget(&writer);
+}
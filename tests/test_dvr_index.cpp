@@ -0,0 +1,140 @@
+#include <catch2/catch.hpp>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/dvr_index.h"
+
+// Stand-in for a recording: only its size matters to the index.
+static std::string make_recording(size_t size) {
+    char path[] = "/tmp/dvr_index_testXXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    REQUIRE(ftruncate(fd, size) == 0);
+    close(fd);
+    return path;
+}
+
+static void remove_recording(const std::string &path) {
+    unlink(path.c_str());
+    unlink(DvrIndex::sidecar_path(path).c_str());
+}
+
+TEST_CASE("Keyframe index round-trips through the sidecar", "[DvrIndex]")
+{
+    std::string mp4 = make_recording(100000);
+    {
+        DvrIndex writer;
+        REQUIRE(writer.create(mp4, true));
+        for (int i = 0; i < 10; i++)
+            writer.append(i * 90000ull, 40 + i * 9000ull);
+    }
+
+    DvrIndex index;
+    REQUIRE(index.load(mp4));
+    REQUIRE(index.entries().size() == 10);
+    REQUIRE(index.entries()[3].time == 3 * 90000);
+    REQUIRE(index.entries()[3].offset == 40 + 3 * 9000);
+    remove_recording(mp4);
+}
+
+TEST_CASE("Keyframe lookups", "[DvrIndex]")
+{
+    DvrIndex index;
+    for (int i = 0; i < 5; i++)
+        index.add(i * 90000ull, i * 1000ull);
+
+    REQUIRE(index.at_or_before(95000)->time == 90000);
+    REQUIRE(index.at_or_before(90000)->time == 90000);
+    REQUIRE(index.at_or_before(10000000)->time == 4 * 90000);
+    REQUIRE(index.after(90000)->time == 180000);
+    REQUIRE(index.after(4 * 90000) == nullptr);
+
+    DvrIndex empty;
+    REQUIRE(empty.at_or_before(0) == nullptr);
+    REQUIRE(empty.after(0) == nullptr);
+}
+
+TEST_CASE("Keyframe index ignores entries past the end of the file", "[DvrIndex]")
+{
+    std::string mp4 = make_recording(25000);
+    DvrIndex index;
+    for (int i = 0; i < 5; i++)
+        index.add(i * 90000ull, i * 10000ull);
+    REQUIRE(index.save(mp4, false));
+
+    // Torn last record
+    FILE *f = fopen(DvrIndex::sidecar_path(mp4).c_str(), "ab");
+    REQUIRE(f);
+    fwrite("\x01\x02\x03", 1, 3, f);
+    fclose(f);
+
+    DvrIndex loaded;
+    REQUIRE(loaded.load(mp4));
+    REQUIRE(loaded.entries().size() == 3);
+    REQUIRE(loaded.entries().back().offset == 20000);
+    remove_recording(mp4);
+}
+
+static uint64_t be(const uint8_t *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+TEST_CASE("Keyframes of a fragmented file as an mfra box", "[DvrIndex]")
+{
+    std::string mp4 = make_recording(100000);
+    DvrIndex index;
+    REQUIRE(index.create(mp4, false));
+    index.append(0, 1200);
+    index.append(90000, 52000);
+    index.close();
+    REQUIRE(index.entries().size() == 2);   // kept after the sidecar is closed
+
+    std::vector<uint8_t> box = index.mfra(1);
+    REQUIRE(box.size() == 8 + 24 + 2 * 19 + 16);
+    REQUIRE(be(box.data(), 4) == box.size());
+    REQUIRE(memcmp(box.data() + 4, "mfra", 4) == 0);
+    const uint8_t *tfra = box.data() + 8;
+    REQUIRE(memcmp(tfra + 4, "tfra", 4) == 0);
+    REQUIRE(tfra[8] == 1);                  // version 1
+    REQUIRE(be(tfra + 12, 4) == 1);         // track_ID
+    REQUIRE(be(tfra + 20, 4) == 2);
+    REQUIRE(be(tfra + 24 + 19, 8) == 90000);
+    REQUIRE(be(tfra + 24 + 19 + 8, 8) == 52000);
+    // mfro: read from the end of the file to find the mfra
+    const uint8_t *mfro = box.data() + box.size() - 16;
+    REQUIRE(memcmp(mfro + 4, "mfro", 4) == 0);
+    REQUIRE(be(mfro + 12, 4) == box.size());
+    remove_recording(mp4);
+}
+
+TEST_CASE("The first slice of a sample is found past AUD and SEI", "[DvrIndex]")
+{
+    char path[] = "/tmp/dvr_index_sampleXXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    const uint8_t h265[] = {
+        0, 0, 0, 3, 0x46, 0x01, 0x50,               // AUD
+        0, 0, 0, 4, 0x4e, 0x01, 0x05, 0x80,         // prefix SEI
+        0, 0, 0, 3, 0x26, 0x01, 0xaf,               // IDR_W_RADL
+    };
+    const uint8_t h264[] = {
+        0, 0, 0, 2, 0x09, 0xf0,                     // AUD
+        0, 0, 0, 3, 0x06, 0x05, 0x80,               // SEI
+        0, 0, 0, 2, 0x41, 0x9a,                     // non-IDR slice
+    };
+    REQUIRE(pwrite(fd, h265, sizeof(h265), 0) == sizeof(h265));
+    REQUIRE(pwrite(fd, h264, sizeof(h264), 100) == sizeof(h264));
+
+    REQUIRE(dvr_index_slice_type(fd, 0, sizeof(h265), true) == 19);
+    REQUIRE(dvr_index_slice_type(fd, 100, sizeof(h264), false) == 1);
+    // Sample cut before its slice
+    REQUIRE(dvr_index_slice_type(fd, 0, 15, true) == -1);
+    REQUIRE(dvr_index_slice_type(fd, 100, 6, false) == -1);
+    close(fd);
+    unlink(path);
+}
@@ -0,0 +1,102 @@
+#include <catch2/catch.hpp>
+
+#include "../src/dvr_preroll.h"
+#include "../src/nal_view.h"
+
+// Synthetic H.265 access unit: VPS/SPS/PPS + IDR_W_RADL for keyframes,
+// TRAIL_R otherwise, each NAL behind a 4-byte start code.
+static EncodedFramePtr make_au(bool keyframe, size_t payload) {
+    std::vector<uint8_t> au;
+    auto nal = [&](uint8_t type, size_t len) {
+        au.insert(au.end(), {0, 0, 0, 1, (uint8_t)(type << 1), 1});
+        au.insert(au.end(), len, 0x55);
+    };
+    if (keyframe) {
+        nal(32, 16);
+        nal(33, 32);
+        nal(34, 8);
+        nal(19, payload);
+    } else {
+        nal(1, payload);
+    }
+    return EncodedFrame::adopt(std::move(au));
+}
+
+// Feed n frames at 60 fps with a keyframe every gop frames, starting at frame first.
+static void feed(DvrPreroll &preroll, int first, int n, int gop, size_t payload = 1000) {
+    NalView view;
+    for (int i = first; i < first + n; i++) {
+        auto au = make_au(i % gop == 0, payload);
+        view.scan(au->data(), au->size(), true);
+        DvrPrerollFrame f;
+        f.data = au;
+        f.timestamp = (uint64_t)i * 1500;
+        f.arrival_us = (uint64_t)i * 1000000 / 60;
+        f.keyframe = view.has_irap();
+        preroll.push(f);
+    }
+}
+
+TEST_CASE("Pre-roll is disabled until configured", "[DvrPreroll]")
+{
+    DvrPreroll preroll;
+    feed(preroll, 0, 120, 30);
+    REQUIRE_FALSE(preroll.enabled());
+    REQUIRE(preroll.frames() == 0);
+}
+
+TEST_CASE("Pre-roll starts at a keyframe", "[DvrPreroll]")
+{
+    DvrPreroll preroll;
+    preroll.configure(5000000, 64 << 20);
+    feed(preroll, 1, 29, 30);
+    REQUIRE(preroll.frames() == 0);
+    feed(preroll, 30, 10, 30);
+    REQUIRE(preroll.frames() == 10);
+
+    auto frames = preroll.take();
+    REQUIRE(frames.size() == 10);
+    REQUIRE(frames.front().keyframe);
+    REQUIRE(frames.front().timestamp == 30 * 1500);
+    REQUIRE(preroll.frames() == 0);
+    REQUIRE(preroll.bytes() == 0);
+}
+
+TEST_CASE("Pre-roll keeps whole GOPs covering the window", "[DvrPreroll]")
+{
+    DvrPreroll preroll;
+    preroll.configure(2000000, 64 << 20);   // 2 s
+    feed(preroll, 0, 600, 60);              // 10 s, 1 s GOPs
+
+    auto frames = preroll.take();
+    REQUIRE(frames.front().keyframe);
+    uint64_t span = frames.back().arrival_us - frames.front().arrival_us;
+    REQUIRE(span >= 2000000 - 1000000 / 60);
+    REQUIRE(span < 3000000);
+    REQUIRE(frames.back().timestamp == 599 * 1500);
+    // No frame missing in between
+    for (size_t i = 1; i < frames.size(); i++)
+        REQUIRE(frames[i].timestamp - frames[i - 1].timestamp == 1500);
+}
+
+TEST_CASE("Pre-roll respects the memory cap", "[DvrPreroll]")
+{
+    DvrPreroll preroll;
+    preroll.configure(60000000, 200000);
+    feed(preroll, 0, 600, 30, 2000);        // ~60 KB per GOP
+    REQUIRE(preroll.bytes() <= 200000);
+    REQUIRE(preroll.frames() > 0);
+    auto frames = preroll.take();
+    REQUIRE(frames.front().keyframe);
+
+    SECTION("a single GOP over the cap is dropped entirely") {
+        DvrPreroll small;
+        small.configure(60000000, 10000);
+        feed(small, 0, 20, 30, 2000);
+        REQUIRE(small.frames() == 0);
+        REQUIRE(small.bytes() == 0);
+        // and buffering resumes at the next keyframe
+        feed(small, 30, 2, 30, 2000);
+        REQUIRE(small.frames() == 2);
+    }
+}
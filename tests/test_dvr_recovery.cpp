@@ -0,0 +1,131 @@
+#include <catch2/catch.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "../src/dvr.h"
+
+namespace fs = std::filesystem;
+
+static void put_nal(std::vector<uint8_t> &out, std::initializer_list<uint8_t> nal) {
+    uint32_t len = nal.size();
+    for (int i = 3; i >= 0; i--)
+        out.push_back((uint8_t)(len >> (8 * i)));
+    out.insert(out.end(), nal);
+}
+
+static std::vector<uint8_t> read_file(const std::string &path) {
+    std::vector<uint8_t> data;
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+        return data;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(f);
+    return data;
+}
+
+static uint32_t be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+// Sample durations from the stts box of the rebuilt file.
+static std::vector<uint32_t> sample_durations(const std::vector<uint8_t> &mp4) {
+    std::vector<uint32_t> out;
+    for (size_t i = 4; i + 12 <= mp4.size(); i++) {
+        if (memcmp(mp4.data() + i, "stts", 4) != 0)
+            continue;
+        const uint8_t *p = mp4.data() + i + 8;
+        uint32_t entries = be32(p);
+        for (uint32_t e = 0; e < entries; e++)
+            for (uint32_t k = 0; k < be32(p + 4 + e * 8); k++)
+                out.push_back(be32(p + 8 + e * 8));
+        break;
+    }
+    return out;
+}
+
+TEST_CASE("Recovery restores the frame durations from the journal", "[DvrRecovery]")
+{
+    char tmpl[] = "/tmp/dvr_recovery_testXXXXXX";
+    REQUIRE(mkdtemp(tmpl));
+    std::string dir = tmpl;
+    std::string mp4 = dir + "/flight.mp4";
+
+    // What the muxer leaves behind without MP4E_close(): ftyp, the mdat
+    // placeholder, then length-prefixed NAL units.
+    static const uint8_t ftyp[] = {0, 0, 0, 0x18, 'f', 't', 'y', 'p', 'm', 'p', '4', '2', 0, 0, 0, 0,
+                                   'm', 'p', '4', '2', 'i', 's', 'o', 'm'};
+    std::vector<uint8_t> file(ftyp, ftyp + sizeof(ftyp));
+    file.insert(file.end(), ftyp, ftyp + 8);
+    file.resize(40, 0);
+    size_t start = file.size();
+    put_nal(file, {0x65, 0x88, 0x84, 0x00, 0x33});   // IDR
+    size_t idr = file.size() - start;
+    for (int i = 0; i < 4; i++)
+        put_nal(file, {0x41, 0x9a, 0x02, 0x04, 0x08, 0x10});   // P
+    FILE *f = fopen(mp4.c_str(), "wb");
+    REQUIRE(f);
+    REQUIRE(fwrite(file.data(), 1, file.size(), f) == file.size());
+    fclose(f);
+
+    // Four frames made it into the journal, the fifth one only partly
+    f = fopen((mp4 + ".rec").c_str(), "w");
+    REQUIRE(f);
+    fprintf(f, "codec=h264\nwidth=1280\nheight=720\nframerate=30\nfragmented=0\n");
+    fprintf(f, "sps=6742001f96540280\npps=68ce3880\n");
+    fprintf(f, "%zu 3000\n10 4500\n10 1500\n10 9000\n1", idr);
+    fclose(f);
+
+    DvrRecovery recovery(dir);
+    REQUIRE(recovery.pending());
+    DvrRecovery::__THREAD__(&recovery);
+
+    REQUIRE_FALSE(fs::exists(mp4 + ".rec"));
+    std::vector<uint32_t> durations = sample_durations(read_file(mp4));
+    REQUIRE(durations == std::vector<uint32_t>{3000, 4500, 1500, 9000, 3000});
+    fs::remove_all(dir);
+}
+
+TEST_CASE("Recovery falls back to the nominal rate when the journal doesn't match", "[DvrRecovery]")
+{
+    char tmpl[] = "/tmp/dvr_recovery_testXXXXXX";
+    REQUIRE(mkdtemp(tmpl));
+    std::string dir = tmpl;
+    std::string mp4 = dir + "/flight.mp4";
+
+    static const uint8_t ftyp[] = {0, 0, 0, 0x18, 'f', 't', 'y', 'p', 'm', 'p', '4', '2', 0, 0, 0, 0,
+                                   'm', 'p', '4', '2', 'i', 's', 'o', 'm'};
+    std::vector<uint8_t> file(ftyp, ftyp + sizeof(ftyp));
+    file.insert(file.end(), ftyp, ftyp + 8);
+    file.resize(40, 0);
+    put_nal(file, {0x65, 0x88, 0x84, 0x00, 0x33});
+    put_nal(file, {0x41, 0x9a, 0x02, 0x04, 0x08, 0x10});
+    put_nal(file, {0x41, 0x9a, 0x02, 0x04, 0x08, 0x10});
+    FILE *f = fopen(mp4.c_str(), "wb");
+    REQUIRE(f);
+    REQUIRE(fwrite(file.data(), 1, file.size(), f) == file.size());
+    fclose(f);
+
+    // The second frame claims more bytes than its NAL unit has
+    f = fopen((mp4 + ".rec").c_str(), "w");
+    REQUIRE(f);
+    fprintf(f, "codec=h264\nwidth=1280\nheight=720\nframerate=50\nfragmented=0\n");
+    fprintf(f, "sps=6742001f96540280\npps=68ce3880\n");
+    fprintf(f, "9 6000\n7 6000\n10 6000\n");
+    fclose(f);
+
+    DvrRecovery recovery(dir);
+    DvrRecovery::__THREAD__(&recovery);
+
+    std::vector<uint32_t> durations = sample_durations(read_file(mp4));
+    REQUIRE(durations == std::vector<uint32_t>{6000, 1800, 1800});
+    fs::remove_all(dir);
+}
@@ -0,0 +1,57 @@
+#include <catch2/catch.hpp>
+
+// The gsmenu interface to the re-encoder's rate control (main.cpp). No
+// encoder runs here, so this is what the next one starts with.
+extern "C" {
+void dvr_reenc_set_rc_mode(int mode);
+void dvr_reenc_set_qp_range(int qp_min, int qp_max);
+void dvr_reenc_set_fixed_qp(int qp);
+void dvr_reenc_set_gop(int frames);
+void dvr_reenc_set_intra_refresh(int rows);
+int  dvr_reenc_get_rc_mode(void);
+void dvr_reenc_get_qp_range(int *qp_min, int *qp_max);
+int  dvr_reenc_get_fixed_qp(void);
+int  dvr_reenc_get_gop(void);
+int  dvr_reenc_get_intra_refresh(void);
+}
+
+TEST_CASE("Rate control settings read back, out of range ones are ignored", "[DvrReenc]")
+{
+    int qp_min = 0, qp_max = 0;
+
+    dvr_reenc_set_rc_mode(2);
+    REQUIRE(dvr_reenc_get_rc_mode() == 2);
+    dvr_reenc_set_rc_mode(4);
+    dvr_reenc_set_rc_mode(-1);
+    REQUIRE(dvr_reenc_get_rc_mode() == 2);
+
+    dvr_reenc_set_qp_range(20, 40);
+    dvr_reenc_get_qp_range(&qp_min, &qp_max);
+    REQUIRE(qp_min == 20);
+    REQUIRE(qp_max == 40);
+    dvr_reenc_set_qp_range(30, 25);
+    dvr_reenc_set_qp_range(0, 40);
+    dvr_reenc_set_qp_range(20, 52);
+    dvr_reenc_get_qp_range(&qp_min, &qp_max);
+    REQUIRE(qp_min == 20);
+    REQUIRE(qp_max == 40);
+
+    dvr_reenc_set_fixed_qp(30);
+    dvr_reenc_set_fixed_qp(52);
+    REQUIRE(dvr_reenc_get_fixed_qp() == 30);
+
+    dvr_reenc_set_gop(120);
+    dvr_reenc_set_gop(-5);
+    REQUIRE(dvr_reenc_get_gop() == 120);
+
+    dvr_reenc_set_intra_refresh(4);
+    dvr_reenc_set_intra_refresh(-1);
+    REQUIRE(dvr_reenc_get_intra_refresh() == 4);
+
+    // Back to the defaults
+    dvr_reenc_set_rc_mode(0);
+    dvr_reenc_set_qp_range(10, 51);
+    dvr_reenc_set_fixed_qp(26);
+    dvr_reenc_set_gop(0);
+    dvr_reenc_set_intra_refresh(0);
+}
@@ -0,0 +1,93 @@
+#include <catch2/catch.hpp>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <filesystem>
+
+#include "../src/dvr_retention.h"
+
+// Empty DVR directory, removed with everything in it.
+struct TempDir {
+    std::string path;
+    TempDir() {
+        char tpl[] = "/tmp/dvr_retention_testXXXXXX";
+        path = mkdtemp(tpl);
+    }
+    ~TempDir() { std::filesystem::remove_all(path); }
+    std::string file(const std::string &name) const { return path + "/" + name; }
+};
+
+// A recording of the given size, last modified age seconds ago.
+static void make_file(const std::string &path, size_t size, int age = 0) {
+    FILE *f = fopen(path.c_str(), "w");
+    REQUIRE(f);
+    fclose(f);
+    REQUIRE(truncate(path.c_str(), size) == 0);
+    if (age) {
+        struct timespec times[2];
+        times[0].tv_sec = times[1].tv_sec = time(nullptr) - age;
+        times[0].tv_nsec = times[1].tv_nsec = 0;
+        REQUIRE(utimensat(AT_FDCWD, path.c_str(), times, 0) == 0);
+    }
+}
+
+static bool exists(const std::string &path) {
+    return access(path.c_str(), F_OK) == 0;
+}
+
+TEST_CASE("Retention catalogues existing recordings", "[DvrRetention]")
+{
+    TempDir dir;
+    make_file(dir.file("0003_a.mp4"), 1000);
+    make_file(dir.file("0007_b.mp4"), 2000);
+    make_file(dir.file("notes.txt"), 10);
+
+    DvrRetention retention(dir.path, 0, 0);
+    auto recordings = retention.recordings();
+    REQUIRE(recordings.size() == 2);
+    REQUIRE(recordings["0007_b.mp4"].size == 2000);
+    REQUIRE(retention.next_sequence() == 8);
+    REQUIRE(retention.next_sequence() == 9);
+
+    // The catalogue survives a restart, durations included
+    retention.begin(dir.file("0009_c.mp4"), "h265");
+    make_file(dir.file("0009_c.mp4"), 500);
+    retention.finish(dir.file("0009_c.mp4"), 60000);
+    DvrRetention reloaded(dir.path, 0, 0);
+    recordings = reloaded.recordings();
+    REQUIRE(recordings.size() == 3);
+    REQUIRE(recordings["0009_c.mp4"].duration_ms == 60000);
+    REQUIRE(recordings["0009_c.mp4"].codec == "h265");
+    REQUIRE(recordings["0009_c.mp4"].size == 500);
+}
+
+TEST_CASE("Retention deletes the oldest unprotected recordings over quota", "[DvrRetention]")
+{
+    TempDir dir;
+    make_file(dir.file("oldest.mp4"), 4000, 300);
+    make_file(dir.file("oldest.mp4.idx"), 32);
+    make_file(dir.file("kept.mp4"), 4000, 200);
+    make_file(dir.file("kept.mp4.keep"), 0);
+    make_file(dir.file("older.mp4"), 4000, 100);
+    make_file(dir.file("newest.mp4"), 4000, 10);
+
+    DvrRetention retention(dir.path, 0, 10000);
+    REQUIRE(retention.make_room());
+    REQUIRE_FALSE(exists(dir.file("oldest.mp4")));
+    REQUIRE_FALSE(exists(dir.file("oldest.mp4.idx")));
+    REQUIRE(exists(dir.file("kept.mp4")));
+    REQUIRE_FALSE(exists(dir.file("older.mp4")));
+    REQUIRE(exists(dir.file("newest.mp4")));
+
+    // The recording in progress is never deleted, even over quota
+    retention.begin(dir.file("live.mp4"), "h264");
+    make_file(dir.file("live.mp4"), 20000);
+    REQUIRE(retention.update(dir.file("live.mp4"), 20000));
+    REQUIRE(exists(dir.file("live.mp4")));
+    REQUIRE(exists(dir.file("kept.mp4")));
+    REQUIRE_FALSE(exists(dir.file("newest.mp4")));
+}
@@ -0,0 +1,88 @@
+#include <catch2/catch.hpp>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+#include "../src/dvr_telemetry.h"
+
+static uint64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string slurp(const std::string &path) {
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+TEST_CASE("Telemetry fact selection", "[DvrTelemetry]")
+{
+    DvrTelemetry::select("mavlink.*,wfbcli.rx.ant_stats.rssi_avg");
+    REQUIRE(DvrTelemetry::wanted("mavlink.gps.lat"));
+    REQUIRE(DvrTelemetry::wanted("wfbcli.rx.ant_stats.rssi_avg"));
+    REQUIRE_FALSE(DvrTelemetry::wanted("wfbcli.rx.ant_stats.rssi_min"));
+    REQUIRE_FALSE(DvrTelemetry::wanted("dvr.recording"));
+    DvrTelemetry::select("");
+    REQUIRE_FALSE(DvrTelemetry::selected());
+}
+
+TEST_CASE("Telemetry CSV sidecar follows the video time", "[DvrTelemetry]")
+{
+    char dir[] = "/tmp/dvr_telemetry_testXXXXXX";
+    REQUIRE(mkdtemp(dir));
+    std::string mp4 = std::string(dir) + "/rec.mp4";
+    DvrTelemetry::select("link.*");
+
+    DvrTelemetry telemetry(DvrTelemetry::CSV);
+    REQUIRE(telemetry.open(mp4));
+    REQUIRE(DvrTelemetry::active());
+    DvrTelemetry::record("link.rssi", "ant_id=1", "-42");
+    DvrTelemetry::record("other.fact", "", "1");   // the publisher filters, record() doesn't
+    DvrTelemetry::record("link.name", "", "a,b");
+    // The frame that arrived now is 10 s into the file
+    telemetry.flush(now_us(), 10000000);
+    telemetry.close();
+    REQUIRE_FALSE(DvrTelemetry::active());
+
+    std::string csv = slurp(DvrTelemetry::sidecar_path(mp4, DvrTelemetry::CSV));
+    REQUIRE(csv.rfind("time_s,fact,tags,value\n", 0) == 0);
+    REQUIRE(csv.find(",link.rssi,ant_id=1,-42\n") != std::string::npos);
+    REQUIRE(csv.find(",link.name,,\"a,b\"\n") != std::string::npos);
+    // Recorded just before the anchor frame: close to 10 s
+    REQUIRE(csv.find("\n9.9") != std::string::npos);
+
+    unlink(DvrTelemetry::sidecar_path(mp4, DvrTelemetry::CSV).c_str());
+    rmdir(dir);
+    DvrTelemetry::select("");
+}
+
+TEST_CASE("Telemetry SRT sidecar shows the latest values", "[DvrTelemetry]")
+{
+    char dir[] = "/tmp/dvr_telemetry_testXXXXXX";
+    REQUIRE(mkdtemp(dir));
+    std::string mp4 = std::string(dir) + "/rec.mp4";
+    DvrTelemetry::select("link.rssi");
+
+    DvrTelemetry telemetry(DvrTelemetry::SRT);
+    REQUIRE(telemetry.open(mp4));
+    DvrTelemetry::record("link.rssi", "", "-40");
+    uint64_t t0 = now_us();
+    telemetry.flush(t0, 0);
+    DvrTelemetry::record("link.rssi", "", "-50");
+    telemetry.flush(t0 - 2000000, 0);   // as if this one came 2 s later
+    telemetry.close();
+
+    std::string srt = slurp(DvrTelemetry::sidecar_path(mp4, DvrTelemetry::SRT));
+    REQUIRE(srt.rfind("1\n00:00:00,000 --> 00:00:00,500\nlink.rssi=-40\n", 0) == 0);
+    REQUIRE(srt.find("00:00:01,500 --> 00:00:02,000\nlink.rssi=-40\n") != std::string::npos);
+    REQUIRE(srt.find("00:00:02,000 --> 00:00:02,500\nlink.rssi=-50\n") != std::string::npos);
+
+    unlink(DvrTelemetry::sidecar_path(mp4, DvrTelemetry::SRT).c_str());
+    rmdir(dir);
+    DvrTelemetry::select("");
+}
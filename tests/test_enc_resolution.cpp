@@ -0,0 +1,53 @@
+#include <catch2/catch.hpp>
+
+#include "../src/mpp_encoder.h"
+
+TEST_CASE("Resolutions parse as height presets or explicit sizes", "[EncResolution]")
+{
+    EncResolution r;
+    REQUIRE(EncResolution::parse("1080p", r));
+    REQUIRE(r == EncResolution(1920, 1080));
+    REQUIRE(EncResolution::parse("720p", r));
+    REQUIRE(r == EncResolution(1280, 720));
+    REQUIRE(EncResolution::parse("480p", r));
+    REQUIRE(r == EncResolution(854, 480));
+    REQUIRE(EncResolution::parse("640x360", r));
+    REQUIRE(r == EncResolution(640, 360));
+
+    // Odd, too small, too large and malformed sizes leave r alone
+    REQUIRE_FALSE(EncResolution::parse("641x360", r));
+    REQUIRE_FALSE(EncResolution::parse("32x32", r));
+    REQUIRE_FALSE(EncResolution::parse("8192x4320", r));
+    REQUIRE_FALSE(EncResolution::parse("720", r));
+    REQUIRE_FALSE(EncResolution::parse("720px", r));
+    REQUIRE_FALSE(EncResolution::parse("hd", r));
+    REQUIRE(r == EncResolution(640, 360));
+}
+
+TEST_CASE("Frames are fitted into the box keeping their aspect", "[EncResolution]")
+{
+    uint32_t w, h;
+    EncResolution(1920, 1080).fit(1280, 720, w, h);
+    REQUIRE(w == 1920);
+    REQUIRE(h == 1080);
+
+    // 4:3 source: pillarbox width
+    EncResolution(854, 480).fit(1440, 1080, w, h);
+    REQUIRE(w == 640);
+    REQUIRE(h == 480);
+
+    // Wider than the box: full width, even height
+    EncResolution(854, 480).fit(2560, 1080, w, h);
+    REQUIRE(w == 854);
+    REQUIRE(h == 360);
+
+    // 1280x720 into 480p rounds to an even width
+    EncResolution(854, 480).fit(1280, 720, w, h);
+    REQUIRE(w == 854);
+    REQUIRE(h == 480);
+
+    // Unknown source size: the box itself
+    EncResolution(1280, 720).fit(0, 0, w, h);
+    REQUIRE(w == 1280);
+    REQUIRE(h == 720);
+}
@@ -0,0 +1,54 @@
+#include <catch2/catch.hpp>
+
+#include <cstring>
+
+#include "../src/encoded_frame.h"
+
+TEST_CASE("Borrowed frames release their memory with the last reference", "[EncodedFrame]")
+{
+    uint8_t bytes[] = {0, 0, 0, 1, 0x26, 1};
+    int released = 0;
+    EncodedFramePtr frame = EncodedFrame::borrow(bytes, sizeof(bytes), [&]() { released++; });
+    REQUIRE(frame->data() == bytes);
+    REQUIRE(frame->size() == sizeof(bytes));
+
+    EncodedFramePtr other = frame;
+    frame.reset();
+    REQUIRE(released == 0);
+    other.reset();
+    REQUIRE(released == 1);
+}
+
+TEST_CASE("Only scarce frames are compacted", "[EncodedFrame]")
+{
+    uint8_t bytes[] = {0, 0, 0, 1, 0x02, 1, 0x55, 0x55};
+    int released = 0;
+
+    EncodedFramePtr plain = EncodedFrame::borrow(bytes, sizeof(bytes), [&]() { released++; });
+    REQUIRE(EncodedFrame::compact(plain) == plain);
+
+    EncodedFramePtr scarce = EncodedFrame::borrow(bytes, sizeof(bytes), [&]() { released++; }, true);
+    EncodedFramePtr kept = EncodedFrame::compact(scarce);
+    REQUIRE(kept != scarce);
+    REQUIRE_FALSE(kept->scarce());
+    REQUIRE(kept->data() != bytes);
+    REQUIRE(kept->size() == sizeof(bytes));
+    REQUIRE(memcmp(kept->data(), bytes, sizeof(bytes)) == 0);
+
+    // The scarce buffer goes back as soon as the producer's reference does
+    scarce.reset();
+    REQUIRE(released == 1);
+}
+
+TEST_CASE("Owned frames keep their bytes", "[EncodedFrame]")
+{
+    std::vector<uint8_t> bytes(1000, 0x55);
+    for (int i = 0; i < 40; i++) {
+        EncodedFramePtr copied = EncodedFrame::copy(bytes.data(), bytes.size() - i);
+        REQUIRE(copied->size() == bytes.size() - i);
+        REQUIRE(copied->data()[0] == 0x55);
+    }
+    EncodedFramePtr adopted = EncodedFrame::adopt(std::move(bytes));
+    REQUIRE(adopted->size() == 1000);
+    REQUIRE_FALSE(adopted->empty());
+}
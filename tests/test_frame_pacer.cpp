@@ -0,0 +1,122 @@
+#include <catch2/catch.hpp>
+
+#include <deque>
+#include <random>
+
+#include "../src/frame_pacer.h"
+
+// A source of the given period and jitter feeding the pacer, ticked as the
+// timer thread would. A frame is published processing_ns after it was fed.
+struct PacerSim {
+    FramePacer &pacer;
+    int64_t period_ns, processing_ns;
+    std::mt19937 rng{1};
+    std::uniform_int_distribution<int64_t> jitter;
+    int64_t next_frame = 1000000000;
+    int64_t next_ts;
+    int64_t tick = next_frame;
+    std::deque<int64_t> published;
+
+    unsigned ticks = 0;
+    int64_t min_gap = INT64_MAX;   // between ticks, while locked
+    int64_t max_gap = 0;
+
+    PacerSim(FramePacer &p, int64_t period, int64_t jitter_ns, int64_t processing = 3000000)
+        : pacer(p), period_ns(period), processing_ns(processing), jitter(-jitter_ns, jitter_ns) {
+        next_ts = next_frame + jitter(rng);
+    }
+
+    void run(int64_t duration_ns) {
+        int64_t end = tick + duration_ns;
+        ticks = 0;
+        min_gap = INT64_MAX;
+        max_gap = 0;
+        while (tick < end) {
+            int64_t next = pacer.next_tick(tick);
+            REQUIRE(next > tick);
+            // Frames fed before the tick
+            while (next_ts <= next) {
+                pacer.source_frame(next_ts / 1000000 * 1000000);   // ms timestamps
+                published.push_back(next_ts + processing_ns);
+                next_frame += period_ns;
+                next_ts = next_frame + jitter(rng);
+            }
+            bool fresh = false;
+            while (!published.empty() && published.front() <= next) {
+                published.pop_front();
+                fresh = true;
+            }
+            if (pacer.locked() && ticks > 0) {
+                min_gap = std::min(min_gap, next - tick);
+                max_gap = std::max(max_gap, next - tick);
+            }
+            tick = next;
+            pacer.tick(fresh);
+            ticks++;
+        }
+    }
+};
+
+TEST_CASE("The pacer locks to a source running slightly off", "[FramePacer]")
+{
+    const int64_t interval = 1000000000 / 60;
+    // The air unit's clock runs 0.2% slow against ours
+    const int64_t source = interval * 1002 / 1000;
+    FramePacer pacer(interval);
+    PacerSim sim(pacer, source, 2000000);
+
+    sim.run(5000000000LL);
+    REQUIRE(pacer.locked());
+    REQUIRE(pacer.period_ns() == Approx(source).margin(20000));
+
+    // Once locked, a minute of jittery frames goes through one per tick
+    uint64_t dup = pacer.duplicated(), drop = pacer.dropped();
+    sim.run(60000000000LL);
+    REQUIRE(pacer.duplicated() - dup < 5);
+    REQUIRE(pacer.dropped() - drop < 5);
+    REQUIRE(sim.min_gap > interval * 9 / 10);
+    REQUIRE(sim.max_gap < interval * 11 / 10);
+}
+
+TEST_CASE("A source at a different rate is paced by the interval", "[FramePacer]")
+{
+    const int64_t interval = 1000000000 / 60;
+    FramePacer pacer(interval);
+
+    // 30 fps into 60: every other tick repeats a frame
+    PacerSim sim(pacer, interval * 2, 1000000);
+    sim.run(10000000000LL);
+    REQUIRE_FALSE(pacer.locked());
+    REQUIRE(pacer.duplicated() == Approx(sim.ticks / 2).epsilon(0.05));
+
+    // 60 fps into 30: every other frame is dropped
+    FramePacer slow(interval * 2);
+    PacerSim fast(slow, interval, 1000000);
+    fast.run(10000000000LL);
+    REQUIRE_FALSE(slow.locked());
+    REQUIRE(slow.dropped() == Approx(fast.ticks).epsilon(0.05));
+}
+
+TEST_CASE("A stalled source is acquired again", "[FramePacer]")
+{
+    const int64_t interval = 1000000000 / 60;
+    FramePacer pacer(interval);
+    for (int i = 0; i < 60; i++)
+        pacer.source_frame(i * interval);
+    REQUIRE(pacer.locked());
+
+    // No frames for a second: free running until the source is back
+    int64_t t = 60 * interval + 1000000000;
+    REQUIRE(pacer.next_tick(t) == t + interval);
+    pacer.source_frame(t);
+    REQUIRE_FALSE(pacer.locked());
+    for (int i = 1; i < 60; i++)
+        pacer.source_frame(t + i * interval);
+    REQUIRE(pacer.locked());
+
+    // Frames seen while nothing is recorded aren't drops
+    pacer.idle_tick();
+    pacer.source_frame(t + 60 * interval);
+    pacer.tick(true);
+    REQUIRE(pacer.dropped() == 0);
+}
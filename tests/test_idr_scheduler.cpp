@@ -0,0 +1,138 @@
+#include <catch2/catch.hpp>
+
+#include <string>
+#include <vector>
+
+#include "../src/idr_scheduler.h"
+
+// Records when requests went out; destination decides whether they can.
+struct FakeSender {
+    std::vector<uint64_t> sent;
+    std::vector<std::string> reasons;
+    bool destination = true;
+    uint64_t now = 0;
+
+    IdrScheduler::Send send() {
+        return [this](const char *r) {
+            if (!destination)
+                return false;
+            sent.push_back(now);
+            reasons.push_back(r);
+            return true;
+        };
+    }
+};
+
+// Runs the scheduler thread's loop by hand from now to end.
+static void run(IdrScheduler &s, FakeSender &f, uint64_t end) {
+    while (f.now < end) {
+        uint64_t wait = s.tick(f.now);
+        f.now += wait ? std::min(wait, end - f.now) : 1;
+    }
+}
+
+TEST_CASE("Triggers merge into the outstanding request", "[IdrScheduler]")
+{
+    FakeSender f;
+    IdrScheduler s(f.send());
+    REQUIRE_FALSE(s.awaiting_idr());
+
+    s.trigger(IdrTrigger::STREAM_UP, 3, 0);
+    REQUIRE(s.awaiting_idr());
+    s.trigger(IdrTrigger::REFERENCE_LOSS, 1, 0);
+    s.tick(0);
+    REQUIRE(f.sent.size() == 1);
+    REQUIRE(f.reasons[0] == "stream-up+reference-loss");
+    REQUIRE(s.state() == IdrScheduler::WAITING);
+
+    for (int i = 0; i < 20; i++)
+        s.trigger(IdrTrigger::REFERENCE_LOSS, 1, 10 + i);
+    s.tick(100);
+    REQUIRE(f.sent.size() == 1);
+
+    s.idr_received(120);
+    REQUIRE(s.state() == IdrScheduler::IDLE);
+    REQUIRE_FALSE(s.awaiting_idr());
+    IdrScheduler::Stats st = s.stats();
+    REQUIRE(st.requests == 1);
+    REQUIRE(st.merged == 21);
+    REQUIRE(st.confirmed == 1);
+    REQUIRE(st.triggers[(int)IdrTrigger::REFERENCE_LOSS] == 21);
+    REQUIRE(st.triggers[(int)IdrTrigger::STREAM_UP] == 1);
+}
+
+TEST_CASE("Unanswered requests back off until out of attempts", "[IdrScheduler]")
+{
+    FakeSender f;
+    IdrScheduler s(f.send());
+    s.trigger(IdrTrigger::RECORD_START, 3, 0);
+    run(s, f, 10000);
+
+    REQUIRE(f.sent.size() == 3);
+    REQUIRE(f.sent[0] == 0);
+    REQUIRE(f.sent[1] == IdrScheduler::RETRY_MS);
+    REQUIRE(f.sent[2] == IdrScheduler::RETRY_MS * 3);
+    REQUIRE(s.state() == IdrScheduler::IDLE);
+    REQUIRE(s.stats().abandoned == 1);
+    REQUIRE(s.backoff_ms() == IdrScheduler::BACKOFF_MAX_MS);
+    // Still watching for the keyframe that resets the backoff
+    REQUIRE(s.awaiting_idr());
+    s.idr_received(f.now);
+    REQUIRE(s.backoff_ms() == IdrScheduler::RETRY_MS);
+    REQUIRE_FALSE(s.awaiting_idr());
+}
+
+TEST_CASE("Sustained loss gets fewer and fewer requests", "[IdrScheduler]")
+{
+    FakeSender f;
+    IdrScheduler s(f.send());
+    while (f.now < 30000) {
+        s.trigger(IdrTrigger::REFERENCE_LOSS, 1, f.now);
+        s.tick(f.now);
+        f.now += 10;
+    }
+    REQUIRE(f.sent.size() < 15);
+    for (size_t i = 2; i < f.sent.size(); i++) {
+        uint64_t gap = f.sent[i] - f.sent[i - 1];
+        REQUIRE(gap >= f.sent[i - 1] - f.sent[i - 2]);
+        REQUIRE(gap <= IdrScheduler::BACKOFF_MAX_MS + 10);
+    }
+    REQUIRE(s.stats().triggers[(int)IdrTrigger::REFERENCE_LOSS] == 3000);
+}
+
+TEST_CASE("Requests are never closer than the minimum interval", "[IdrScheduler]")
+{
+    FakeSender f;
+    IdrScheduler s(f.send());
+    s.trigger(IdrTrigger::DECODER_ISSUE, 1, 0);
+    s.tick(0);
+    s.idr_received(40);
+    s.trigger(IdrTrigger::DECODE_STALL, 1, 50);
+    f.now = 50;
+    run(s, f, 1000);
+    REQUIRE(f.sent.size() == 2);
+    REQUIRE(f.sent[1] == IdrScheduler::MIN_INTERVAL_MS);
+}
+
+TEST_CASE("Requests wait for a destination", "[IdrScheduler]")
+{
+    FakeSender f;
+    f.destination = false;
+    IdrScheduler s(f.send());
+    s.trigger(IdrTrigger::RECORD_START, 3, 0);
+    run(s, f, 2000);
+    REQUIRE(f.sent.empty());
+    REQUIRE(s.state() == IdrScheduler::PENDING);
+    REQUIRE(s.stats().requests == 0);
+
+    f.destination = true;
+    run(s, f, 2400);
+    REQUIRE(f.sent.size() == 1);
+    REQUIRE(f.reasons[0] == "record-start");
+
+    // A new stream gets the outstanding request again, without the backoff
+    s.reset();
+    REQUIRE(s.state() == IdrScheduler::PENDING);
+    s.tick(f.now);
+    REQUIRE(f.sent.size() == 2);
+}
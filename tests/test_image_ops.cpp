@@ -0,0 +1,293 @@
+#include <catch2/catch.hpp>
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "../src/image_ops.h"
+
+// An image in plain memory, no DMA-buf, as the CPU backend sees it.
+struct TestImage {
+    std::vector<uint8_t> mem;
+    ImageBuffer buf;
+
+    TestImage(uint32_t w, uint32_t h, ImageFormat fmt, uint32_t stride = 0) {
+        buf.width = w;
+        buf.height = h;
+        buf.fmt = fmt;
+        buf.hor_stride = stride ? stride : w;
+        buf.ver_stride = h;
+        mem.assign(fmt == ImageFormat::BGRA ? (size_t)buf.hor_stride * h * 4
+                                            : (size_t)buf.hor_stride * h * 3 / 2, 0);
+        buf.ptr = mem.data();
+        buf.size = mem.size();
+    }
+    uint8_t &y(uint32_t x, uint32_t row) { return mem[(size_t)row * buf.hor_stride + x]; }
+    uint8_t &uv(uint32_t x, uint32_t row, int c) {
+        return mem[(size_t)buf.hor_stride * buf.ver_stride +
+                   (size_t)(row / 2) * buf.hor_stride + (x & ~1u) + c];
+    }
+    uint8_t *px(uint32_t x, uint32_t row) {
+        return &mem[((size_t)row * buf.hor_stride + x) * 4];
+    }
+    void noise(unsigned seed) {
+        srand(seed);
+        for (auto &b : mem) b = (uint8_t)rand();
+    }
+};
+
+TEST_CASE("Copies keep the pixels across strides", "[ImageOps]")
+{
+    auto ops = image_ops_cpu();
+    TestImage src(30, 20, ImageFormat::NV12, 32);
+    TestImage dst(30, 20, ImageFormat::NV12, 64);
+    src.noise(1);
+    REQUIRE(ops->copy(src.buf, dst.buf));
+    for (uint32_t row = 0; row < 20; row++) {
+        for (uint32_t x = 0; x < 30; x++) {
+            REQUIRE(dst.y(x, row) == src.y(x, row));
+            REQUIRE(dst.uv(x, row, x & 1) == src.uv(x, row, x & 1));
+        }
+    }
+
+    // Different sizes or formats are refused
+    TestImage other(32, 20, ImageFormat::NV12);
+    REQUIRE_FALSE(ops->copy(src.buf, other.buf));
+    TestImage bgra(30, 20, ImageFormat::BGRA);
+    REQUIRE_FALSE(ops->copy(src.buf, bgra.buf));
+}
+
+TEST_CASE("Scaling is bilinear with the sample centres lined up", "[ImageOps]")
+{
+    auto ops = image_ops_cpu();
+
+    // A flat picture stays flat
+    TestImage flat(64, 48, ImageFormat::NV12);
+    std::fill(flat.mem.begin(), flat.mem.begin() + 64 * 48, 90);
+    std::fill(flat.mem.begin() + 64 * 48, flat.mem.end(), 140);
+    TestImage half(32, 24, ImageFormat::NV12);
+    REQUIRE(ops->resize(flat.buf, half.buf));
+    for (uint32_t row = 0; row < 24; row++) {
+        for (uint32_t x = 0; x < 32; x++) {
+            REQUIRE(half.y(x, row) == 90);
+            REQUIRE(half.uv(x, row, x & 1) == 140);
+        }
+    }
+
+    // Halving averages pixel pairs
+    TestImage stripes(64, 48, ImageFormat::NV12);
+    for (uint32_t row = 0; row < 48; row++)
+        for (uint32_t x = 0; x < 64; x++)
+            stripes.y(x, row) = x & 1 ? 200 : 100;
+    REQUIRE(ops->resize(stripes.buf, half.buf));
+    REQUIRE(half.y(0, 0) == 150);
+    REQUIRE(half.y(31, 23) == 150);
+
+    // A ramp stays a ramp when scaled up
+    TestImage ramp(16, 16, ImageFormat::NV12);
+    for (uint32_t row = 0; row < 16; row++)
+        for (uint32_t x = 0; x < 16; x++)
+            ramp.y(x, row) = (uint8_t)(x * 16);
+    TestImage big(40, 30, ImageFormat::NV12);
+    REQUIRE(ops->resize(ramp.buf, big.buf));
+    for (uint32_t x = 1; x < 40; x++)
+        REQUIRE(big.y(x, 15) >= big.y(x - 1, 15));
+    REQUIRE(big.y(0, 15) == 0);
+    REQUIRE(big.y(39, 15) == 240);
+
+    // 10-bit frames can't be scaled on the CPU
+    TestImage ten(64, 48, ImageFormat::NV12_10);
+    TestImage ten_half(32, 24, ImageFormat::NV12_10);
+    REQUIRE_FALSE(ops->resize(ten.buf, ten_half.buf));
+}
+
+TEST_CASE("NV12 and BGRA convert both ways", "[ImageOps]")
+{
+    auto ops = image_ops_cpu();
+    TestImage nv12(34, 8, ImageFormat::NV12);
+    TestImage bgra(34, 8, ImageFormat::BGRA);
+
+    // White, black and a pure red block
+    for (uint32_t x = 0; x < 34; x++) {
+        for (uint32_t row = 0; row < 8; row++) {
+            nv12.y(x, row) = row < 4 ? 235 : 16;
+            nv12.uv(x, row, 0) = 128;
+            nv12.uv(x, row, 1) = 128;
+        }
+    }
+    nv12.y(0, 0) = nv12.y(1, 0) = nv12.y(0, 1) = nv12.y(1, 1) = 81;
+    nv12.uv(0, 0, 0) = 90;
+    nv12.uv(0, 0, 1) = 240;
+    REQUIRE(ops->convert(nv12.buf, bgra.buf));
+    REQUIRE(bgra.px(10, 0)[0] == 255);
+    REQUIRE(bgra.px(10, 0)[1] == 255);
+    REQUIRE(bgra.px(10, 0)[2] == 255);
+    REQUIRE(bgra.px(10, 0)[3] == 255);
+    REQUIRE(bgra.px(33, 7)[0] == 0);
+    REQUIRE(bgra.px(33, 7)[2] == 0);
+    REQUIRE(bgra.px(1, 1)[2] >= 250);
+    REQUIRE(bgra.px(1, 1)[1] <= 5);
+    REQUIRE(bgra.px(1, 1)[0] <= 5);
+
+    // And back, within rounding
+    TestImage back(34, 8, ImageFormat::NV12);
+    REQUIRE(ops->convert(bgra.buf, back.buf));
+    for (uint32_t row = 0; row < 8; row++) {
+        for (uint32_t x = 0; x < 34; x++) {
+            REQUIRE(abs(back.y(x, row) - nv12.y(x, row)) <= 2);
+            REQUIRE(abs(back.uv(x, row, x & 1) - nv12.uv(x, row, x & 1)) <= 2);
+        }
+    }
+}
+
+TEST_CASE("The CPU blend matches nv12_blend", "[ImageOps]")
+{
+    for (bool premultiplied : {true, false}) {
+        for (uint32_t osd_w : {96u, 64u}) {
+            TestImage osd(osd_w, 48, ImageFormat::BGRA);
+            osd.noise(7);
+            for (uint32_t row = 0; row < 48; row++)
+                osd.px(row % osd_w, row)[3] = 0;   // some transparent pixels
+
+            TestImage frame(96, 48, ImageFormat::NV12);
+            frame.noise(9);
+            TestImage expected = frame;
+            expected.buf.ptr = expected.mem.data();
+
+            BlendRect r;
+            r.x = 6;
+            r.y = 4;
+            r.w = osd_w - 10;
+            r.h = 36;
+            auto ops = image_ops_cpu();
+            REQUIRE(ops->blend(osd.buf, premultiplied, r, frame.buf));
+
+            BgraImage img;
+            img.data = osd.mem.data();
+            img.width = osd_w;
+            img.height = 48;
+            img.stride = osd_w * 4;
+            img.premultiplied = premultiplied;
+            nv12_blend(nv12_image_of(expected.buf), img, r);
+            REQUIRE(frame.mem == expected.mem);
+        }
+    }
+}
+
+TEST_CASE("The blend honours the alpha mode", "[ImageOps]")
+{
+    // 50% grey over black: straight alpha takes the colour as is,
+    // premultiplied as already scaled by alpha (i.e. white).
+    for (bool premultiplied : {false, true}) {
+        TestImage osd(8, 8, ImageFormat::BGRA);
+        for (uint32_t row = 0; row < 8; row++)
+            for (uint32_t x = 0; x < 8; x++)
+                memset(osd.px(x, row), 128, 4);
+
+        TestImage frame(8, 8, ImageFormat::NV12);
+        memset(frame.mem.data(), 16, 8 * 8);
+        memset(frame.mem.data() + 8 * 8, 128, 8 * 4);
+
+        BlendRect r;
+        r.x = 0;
+        r.y = 0;
+        r.w = 8;
+        r.h = 8;
+        auto ops = image_ops_cpu();
+        REQUIRE(ops->blend(osd.buf, premultiplied, r, frame.buf));
+        CHECK(frame.y(3, 5) == (premultiplied ? 126 : 71));
+        CHECK(frame.uv(3, 5, 0) == 128);
+        CHECK(frame.uv(3, 5, 1) == 128);
+    }
+}
+
+TEST_CASE("SIMD and plain C give the same bytes", "[ImageOps]")
+{
+    auto simd = image_ops_cpu(true);
+    auto plain = image_ops_cpu(false);
+
+    TestImage src(100, 60, ImageFormat::NV12, 112);
+    src.noise(3);
+    TestImage a(70, 40, ImageFormat::NV12), b(70, 40, ImageFormat::NV12);
+    REQUIRE(simd->resize(src.buf, a.buf));
+    REQUIRE(plain->resize(src.buf, b.buf));
+    REQUIRE(a.mem == b.mem);
+
+    TestImage ca(100, 60, ImageFormat::BGRA), cb(100, 60, ImageFormat::BGRA);
+    REQUIRE(simd->convert(src.buf, ca.buf));
+    REQUIRE(plain->convert(src.buf, cb.buf));
+    REQUIRE(ca.mem == cb.mem);
+
+    TestImage na(100, 60, ImageFormat::NV12), nb(100, 60, ImageFormat::NV12);
+    REQUIRE(simd->convert(ca.buf, na.buf));
+    REQUIRE(plain->convert(ca.buf, nb.buf));
+    REQUIRE(na.mem == nb.mem);
+
+    TestImage osd(100, 60, ImageFormat::BGRA);
+    osd.noise(5);
+    BlendRect r;
+    r.w = 100;
+    r.h = 60;
+    REQUIRE(simd->blend(osd.buf, false, r, na.buf));
+    REQUIRE(plain->blend(osd.buf, false, r, nb.buf));
+    REQUIRE(na.mem == nb.mem);
+}
+
+// Fails whatever it is asked to do, counting the attempts; copies work
+// again once *fixed is set.
+struct BrokenOps : ImageOps {
+    int *calls;
+    bool *fixed;
+    BrokenOps(int *c, bool *f) : calls(c), fixed(f) {}
+    const char *name() const override { return "broken"; }
+    bool copy(const ImageBuffer &, const ImageBuffer &) override { ++*calls; return *fixed; }
+    bool resize(const ImageBuffer &, const ImageBuffer &) override { ++*calls; return false; }
+    bool convert(const ImageBuffer &, const ImageBuffer &) override { ++*calls; return false; }
+    bool blend(const ImageBuffer &, bool, const BlendRect &, const ImageBuffer &) override {
+        ++*calls;
+        return false;
+    }
+};
+
+TEST_CASE("A failing backend hands over to the fallback", "[ImageOps]")
+{
+    int calls = 0;
+    bool fixed = false;
+    auto ops = image_ops_fallback(std::unique_ptr<ImageOps>(new BrokenOps(&calls, &fixed)),
+                                  image_ops_cpu());
+    TestImage src(32, 16, ImageFormat::NV12);
+    src.noise(11);
+    TestImage dst(32, 16, ImageFormat::NV12);
+    REQUIRE(ops->copy(src.buf, dst.buf));
+    REQUIRE(dst.mem == src.mem);
+    REQUIRE(ops->copy(src.buf, dst.buf));
+    REQUIRE(calls == 1);    // not asked again for a while
+
+    TestImage half(16, 8, ImageFormat::NV12);
+    REQUIRE(ops->resize(src.buf, half.buf));
+    REQUIRE(calls == 2);
+
+    // Tried again after the backoff, which doubles when it still fails
+    for (unsigned i = 1; i < FALLBACK_RETRY_FIRST; i++)
+        REQUIRE(ops->copy(src.buf, dst.buf));
+    REQUIRE(calls == 2);
+    REQUIRE(ops->copy(src.buf, dst.buf));
+    REQUIRE(calls == 3);
+    for (unsigned i = 0; i < 2 * FALLBACK_RETRY_FIRST; i++)
+        REQUIRE(ops->copy(src.buf, dst.buf));
+    REQUIRE(calls == 3);
+
+    // Working again: back for good
+    fixed = true;
+    REQUIRE(ops->copy(src.buf, dst.buf));
+    REQUIRE(calls == 4);
+    REQUIRE(ops->copy(src.buf, dst.buf));
+    REQUIRE(calls == 5);
+
+    ImageBackend backend;
+    REQUIRE(image_backend_parse("cpu", backend));
+    REQUIRE(backend == ImageBackend::CPU);
+    REQUIRE(image_backend_parse("auto", backend));
+    REQUIRE(backend == ImageBackend::AUTO);
+    REQUIRE_FALSE(image_backend_parse("gpu", backend));
+}
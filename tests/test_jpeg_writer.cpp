@@ -0,0 +1,91 @@
+#include <catch2/catch.hpp>
+
+#include <vector>
+
+#include "../src/jpeg_writer.h"
+
+struct TestFrame {
+    uint32_t width, height;
+    std::vector<uint8_t> px;
+
+    TestFrame(uint32_t w, uint32_t h) : width(w), height(h), px((size_t)w * h * 3 / 2) {
+        for (uint32_t y = 0; y < h; y++)
+            for (uint32_t x = 0; x < w; x++)
+                px[(size_t)y * w + x] = (x * 7919 + y * 104729) % 97 < 48 ? 16 : 235;
+        for (size_t i = (size_t)w * h; i < px.size(); i++)
+            px[i] = (uint8_t)(64 + i % 128);
+    }
+    Nv12Image image() {
+        Nv12Image img;
+        img.y = px.data();
+        img.uv = px.data() + (size_t)width * height;
+        img.width = width;
+        img.height = height;
+        img.stride = width;
+        return img;
+    }
+};
+
+static size_t find_marker(const std::vector<uint8_t> &jpeg, uint8_t marker) {
+    for (size_t i = 0; i + 1 < jpeg.size(); i++)
+        if (jpeg[i] == 0xff && jpeg[i + 1] == marker)
+            return i;
+    return jpeg.size();
+}
+
+TEST_CASE("A frame is written as a baseline JFIF", "[JpegWriter]")
+{
+    TestFrame frame(98, 62);   // partial MCUs on both edges
+    std::vector<uint8_t> jpeg;
+    REQUIRE(jpeg_encode_nv12(frame.image(), 90, jpeg));
+
+    REQUIRE(jpeg.size() > 600);
+    REQUIRE(jpeg[0] == 0xff);
+    REQUIRE(jpeg[1] == 0xd8);
+    REQUIRE(jpeg[jpeg.size() - 2] == 0xff);
+    REQUIRE(jpeg[jpeg.size() - 1] == 0xd9);
+
+    size_t sof = find_marker(jpeg, 0xc0);
+    REQUIRE(sof < jpeg.size());
+    REQUIRE(jpeg[sof + 5] == 0);
+    REQUIRE(jpeg[sof + 6] == 62);
+    REQUIRE(jpeg[sof + 7] == 0);
+    REQUIRE(jpeg[sof + 8] == 98);
+    REQUIRE(jpeg[sof + 9] == 3);
+    REQUIRE(jpeg[sof + 11] == 0x22);   // luma 2x2: 4:2:0
+
+    // Entropy coded data: every 0xff is stuffed
+    size_t sos = find_marker(jpeg, 0xda);
+    REQUIRE(sos < jpeg.size());
+    for (size_t i = sos + 14; i < jpeg.size() - 2; i++) {
+        if (jpeg[i] == 0xff)
+            REQUIRE(jpeg[i + 1] == 0x00);
+    }
+}
+
+TEST_CASE("Quality trades size", "[JpegWriter]")
+{
+    TestFrame frame(64, 64);
+    std::vector<uint8_t> low, high;
+    REQUIRE(jpeg_encode_nv12(frame.image(), 20, low));
+    REQUIRE(jpeg_encode_nv12(frame.image(), 95, high));
+    REQUIRE(low.size() < high.size());
+
+    // Out of range qualities are clamped
+    std::vector<uint8_t> clamped;
+    REQUIRE(jpeg_encode_nv12(frame.image(), 500, clamped));
+    std::vector<uint8_t> best;
+    REQUIRE(jpeg_encode_nv12(frame.image(), 100, best));
+    REQUIRE(clamped == best);
+}
+
+TEST_CASE("Odd and empty frames are refused", "[JpegWriter]")
+{
+    TestFrame frame(64, 64);
+    Nv12Image img = frame.image();
+    std::vector<uint8_t> jpeg;
+    img.width = 63;
+    REQUIRE_FALSE(jpeg_encode_nv12(img, 90, jpeg));
+    img.width = 0;
+    REQUIRE_FALSE(jpeg_encode_nv12(img, 90, jpeg));
+}
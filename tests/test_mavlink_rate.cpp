@@ -0,0 +1,42 @@
+#include <catch2/catch.hpp>
+
+extern "C" {
+#include "../src/mavlink.h"
+}
+
+// Message ids of their own per test case: the throttle table is global.
+
+TEST_CASE("Without a rate every message goes through", "[MavlinkRate]")
+{
+    mavlink_max_rate = 0;
+    for (uint64_t t = 0; t < 10; t++)
+        REQUIRE(mavlink_rate_allow(1000, 1, 1, 0, t));
+}
+
+TEST_CASE("Each message type is published at most at the rate", "[MavlinkRate]")
+{
+    mavlink_max_rate = 10;
+    int published = 0;
+    // 200 Hz for one second
+    for (uint64_t t = 0; t < 1000; t += 5)
+        published += mavlink_rate_allow(1001, 1, 1, 0, t);
+    REQUIRE(published == 10);
+
+    // Another type, or the same type from another sender, has a budget of its own
+    REQUIRE(mavlink_rate_allow(1002, 1, 1, 0, 995));
+    REQUIRE(mavlink_rate_allow(1001, 1, 2, 0, 995));
+    REQUIRE(mavlink_rate_allow(1001, 2, 1, 0, 995));
+    mavlink_max_rate = 0;
+}
+
+TEST_CASE("Instances within a sender are throttled apart", "[MavlinkRate]")
+{
+    mavlink_max_rate = 5;
+    REQUIRE(mavlink_rate_allow(1003, 1, 1, 0, 0));
+    REQUIRE(mavlink_rate_allow(1003, 1, 1, 1, 10));
+    REQUIRE_FALSE(mavlink_rate_allow(1003, 1, 1, 0, 20));
+    REQUIRE_FALSE(mavlink_rate_allow(1003, 1, 1, 1, 30));
+    REQUIRE(mavlink_rate_allow(1003, 1, 1, 0, 200));
+    REQUIRE(mavlink_rate_allow(1003, 1, 1, 1, 210));
+    mavlink_max_rate = 0;
+}
@@ -0,0 +1,150 @@
+#include <catch2/catch.hpp>
+
+#include <vector>
+
+#include "../src/osd_blend.h"
+
+struct Bgra {
+    uint32_t width, height;
+    std::vector<uint8_t> px;
+
+    Bgra(uint32_t w, uint32_t h) : width(w), height(h), px((size_t)w * h * 4, 0) {}
+    void fill(uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+              uint8_t b, uint8_t g, uint8_t r, uint8_t a) {
+        for (uint32_t j = y; j < y + h; j++)
+            for (uint32_t i = x; i < x + w; i++) {
+                uint8_t *p = &px[((size_t)j * width + i) * 4];
+                p[0] = b; p[1] = g; p[2] = r; p[3] = a;
+            }
+    }
+    BgraImage image(bool premultiplied = true) const {
+        BgraImage img;
+        img.data = px.data();
+        img.width = width;
+        img.height = height;
+        img.stride = width * 4;
+        img.premultiplied = premultiplied;
+        return img;
+    }
+};
+
+struct Nv12 {
+    uint32_t width, height;
+    std::vector<uint8_t> px;
+
+    Nv12(uint32_t w, uint32_t h, uint8_t y, uint8_t u, uint8_t v)
+        : width(w), height(h), px((size_t)w * h * 3 / 2, y) {
+        for (size_t i = (size_t)w * h; i < px.size(); i += 2) {
+            px[i] = u;
+            px[i + 1] = v;
+        }
+    }
+    Nv12Image image() {
+        Nv12Image img;
+        img.y = px.data();
+        img.uv = px.data() + (size_t)width * height;
+        img.width = width;
+        img.height = height;
+        img.stride = width;
+        return img;
+    }
+    uint8_t y(uint32_t x, uint32_t row) const { return px[(size_t)row * width + x]; }
+    uint8_t u(uint32_t x, uint32_t row) const { return px[(size_t)width * height + row / 2 * width + (x & ~1u)]; }
+    uint8_t v(uint32_t x, uint32_t row) const { return px[(size_t)width * height + row / 2 * width + (x & ~1u) + 1]; }
+};
+
+TEST_CASE("Only tiles with visible pixels are blended", "[OsdBlend]")
+{
+    Bgra osd(320, 192);
+    OsdTiles tiles;
+
+    tiles.scan(osd.px.data(), osd.width, osd.height, osd.width * 4);
+    REQUIRE(tiles.rects().empty());
+    REQUIRE(tiles.coverage_pct() == 0);
+
+    // A widget over 2x2 tiles and a single pixel in the bottom right tile;
+    // colour without alpha doesn't count
+    osd.fill(40, 40, 40, 40, 255, 255, 255, 255);
+    osd.fill(319, 191, 1, 1, 0, 0, 0, 1);
+    osd.fill(200, 0, 10, 10, 255, 255, 255, 0);
+    tiles.scan(osd.px.data(), osd.width, osd.height, osd.width * 4);
+
+    const auto &rects = tiles.rects();
+    REQUIRE(rects.size() == 2);
+    REQUIRE(rects[0].x == 32);
+    REQUIRE(rects[0].y == 32);
+    REQUIRE(rects[0].w == 64);
+    REQUIRE(rects[0].h == 64);
+    REQUIRE(rects[1].x == 288);
+    REQUIRE(rects[1].y == 160);
+    REQUIRE(rects[1].w == 32);
+    REQUIRE(rects[1].h == 32);
+    REQUIRE(tiles.coverage_pct() == 8);
+}
+
+TEST_CASE("OSD rectangles map to even frame rectangles", "[OsdBlend]")
+{
+    BlendRect o;
+    o.x = 32; o.y = 32; o.w = 64; o.h = 64;
+    BlendRect same = osd_rect_on_frame(o, 1920, 1080, 1920, 1080);
+    REQUIRE(same.x == 32);
+    REQUIRE(same.w == 64);
+
+    BlendRect f = osd_rect_on_frame(o, 1920, 1080, 1280, 720);
+    REQUIRE(f.x == 20);
+    REQUIRE(f.y == 20);
+    REQUIRE(f.w == 44);
+    REQUIRE(f.h == 44);
+
+    // Clipped to the frame
+    o.x = 1900; o.w = 20;
+    f = osd_rect_on_frame(o, 1920, 1080, 1280, 720);
+    REQUIRE(f.x + f.w == 1280);
+}
+
+TEST_CASE("Software blend composites into NV12", "[OsdBlend]")
+{
+    Bgra osd(64, 64);
+    Nv12 frame(64, 64, 16, 128, 128);   // black
+    BlendRect all;
+    all.w = 64; all.h = 64;
+
+    // Opaque white replaces the pixel, transparent leaves it alone
+    osd.fill(0, 0, 32, 64, 255, 255, 255, 255);
+    nv12_blend(frame.image(), osd.image(), all);
+    REQUIRE(frame.y(0, 0) == 235);
+    REQUIRE(frame.u(0, 0) == 128);
+    REQUIRE(frame.v(0, 0) == 128);
+    REQUIRE(frame.y(40, 0) == 16);
+
+    // Half-transparent red, straight alpha, over black
+    Nv12 red_frame(64, 64, 16, 128, 128);
+    Bgra red(64, 64);
+    red.fill(0, 0, 64, 64, 0, 0, 255, 128);
+    nv12_blend(red_frame.image(), red.image(false), all);
+    // Full red is Y 82, V 240
+    REQUIRE(red_frame.y(10, 10) == Approx(16 + (82 - 16) / 2).margin(1));
+    REQUIRE(red_frame.v(10, 10) == Approx(128 + (240 - 128) / 2).margin(1));
+
+    // The premultiplied equivalent gives the same result
+    Nv12 pre_frame(64, 64, 16, 128, 128);
+    Bgra pre(64, 64);
+    pre.fill(0, 0, 64, 64, 0, 0, 128, 128);
+    nv12_blend(pre_frame.image(), pre.image(true), all);
+    REQUIRE(pre_frame.y(10, 10) == red_frame.y(10, 10));
+    REQUIRE(pre_frame.v(10, 10) == red_frame.v(10, 10));
+}
+
+TEST_CASE("The OSD is scaled to the frame", "[OsdBlend]")
+{
+    Bgra osd(128, 128);
+    osd.fill(64, 64, 64, 64, 255, 255, 255, 255);
+    Nv12 frame(64, 64, 16, 128, 128);
+    BlendRect r;
+    r.x = 64; r.y = 64; r.w = 64; r.h = 64;
+
+    nv12_blend(frame.image(), osd.image(), r);
+    REQUIRE(frame.y(31, 31) == 16);
+    REQUIRE(frame.y(32, 32) == 235);
+    REQUIRE(frame.y(63, 63) == 235);
+}
@@ -0,0 +1,110 @@
+#include <catch2/catch.hpp>
+
+#include "../src/ref_loss.h"
+
+TEST_CASE("Clean decoding asks for nothing", "[RefLoss]")
+{
+    RefLossTracker t;
+    t.fed(10, true, true, 0, false);
+    t.fed(20, true, false, 0, false);
+    t.fed(30, false, false, 0, false);
+    REQUIRE(t.decoded(10, false, 0) == RefLossTracker::OK);
+    REQUIRE(t.decoded(20, false, 0) == RefLossTracker::OK);
+    REQUIRE(t.decoded(30, false, 0) == RefLossTracker::OK);
+    REQUIRE(t.stats().breaks == 0);
+}
+
+TEST_CASE("Losses in non-reference pictures are concealed", "[RefLoss]")
+{
+    RefLossTracker t;
+    t.fed(10, true, true, 0, false);
+    t.fed(20, false, false, 3, true);   // damaged, nothing refers to it
+    t.fed(30, true, false, 0, false);
+    REQUIRE(t.decoded(10, false, 0) == RefLossTracker::OK);
+    REQUIRE(t.decoded(20, true, 0) == RefLossTracker::CONCEALED);
+    REQUIRE(t.decoded(30, false, 0) == RefLossTracker::OK);
+
+    // Damaged but concealed without a flag
+    t.fed(40, false, false, 5, true);
+    REQUIRE(t.decoded(40, false, 0) == RefLossTracker::CONCEALED);
+
+    // A non-reference picture that never came out
+    t.fed(50, false, false, 2, true);
+    t.fed(60, true, false, 0, false);
+    REQUIRE(t.decoded(60, false, 0) == RefLossTracker::CONCEALED);
+
+    RefLossTracker::Stats s = t.stats();
+    REQUIRE(s.breaks == 0);
+    REQUIRE(s.concealed == 3);
+    REQUIRE(s.lost_packets == 10);
+    REQUIRE_FALSE(t.broken());
+}
+
+TEST_CASE("A loss in a reference picture breaks the chain even when it decodes clean", "[RefLoss]")
+{
+    RefLossTracker t;
+    t.fed(10, true, false, 5, true);
+    t.fed(20, true, false, 0, false);
+    REQUIRE(t.decoded(10, false, 0) == RefLossTracker::BROKEN);
+    REQUIRE(t.decoded(20, false, 0) == RefLossTracker::BROKEN);
+    REQUIRE(t.stats().breaks == 1);
+    REQUIRE(t.stats().concealed == 0);
+}
+
+TEST_CASE("A loss across access units may have held a reference picture", "[RefLoss]")
+{
+    RefLossTracker t;
+    t.fed(10, false, false, 4, false);
+    REQUIRE(t.decoded(10, false, 0) == RefLossTracker::BROKEN);
+    t.fed(20, true, true, 0, false);
+    REQUIRE(t.decoded(20, false, 0) == RefLossTracker::OK);
+
+    // Even when the picture after it never came out
+    t.fed(30, false, false, 2, false);
+    t.fed(40, true, false, 0, false);
+    REQUIRE(t.decoded(40, false, 0) == RefLossTracker::BROKEN);
+    REQUIRE(t.stats().breaks == 2);
+}
+
+TEST_CASE("A damaged reference picture breaks the chain until a keyframe", "[RefLoss]")
+{
+    RefLossTracker t;
+    t.fed(10, true, false, 4, true);
+    t.fed(20, false, false, 0, false);
+    t.fed(30, true, false, 0, false);
+    t.fed(40, true, true, 0, false);
+    REQUIRE(t.decoded(10, true, 0) == RefLossTracker::BROKEN);
+    REQUIRE(t.broken());
+    // Whatever decodes before the keyframe still refers to the damage
+    REQUIRE(t.decoded(20, false, 0) == RefLossTracker::BROKEN);
+    REQUIRE(t.decoded(30, false, 0) == RefLossTracker::BROKEN);
+    REQUIRE(t.decoded(40, false, 0) == RefLossTracker::OK);
+    REQUIRE_FALSE(t.broken());
+    REQUIRE(t.stats().breaks == 1);
+}
+
+TEST_CASE("A reference picture lost after a gap breaks the chain", "[RefLoss]")
+{
+    RefLossTracker t;
+    t.fed(10, true, false, 6, true);    // dropped by the decoder
+    t.fed(20, true, false, 0, false);
+    REQUIRE(t.decoded(20, false, 0) == RefLossTracker::BROKEN);
+
+    // Without a loss a picture that doesn't come out is the decoder's business
+    t.reset();
+    t.fed(30, true, false, 0, false);
+    t.fed(40, true, false, 0, false);
+    REQUIRE(t.decoded(40, false, 0) == RefLossTracker::OK);
+}
+
+TEST_CASE("Frames of the same millisecond match in feed order", "[RefLoss]")
+{
+    RefLossTracker t;
+    t.fed(10, true, false, 0, false);
+    t.fed(10, false, false, 1, true);
+    REQUIRE(t.decoded(10, false, 0) == RefLossTracker::OK);
+    REQUIRE(t.decoded(10, true, 0) == RefLossTracker::CONCEALED);
+
+    // Errors on frames it never saw fed are taken at their worst
+    REQUIRE(t.decoded(99, true, 0) == RefLossTracker::BROKEN);
+}
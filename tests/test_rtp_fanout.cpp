@@ -0,0 +1,200 @@
+#include <catch2/catch.hpp>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../src/rtp_fanout.h"
+
+// A loopback UDP socket to send to; recv gives up after a second.
+struct Receiver {
+    int fd;
+    sockaddr_in addr = {};
+
+    Receiver() {
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(fd, (sockaddr *)&addr, sizeof(addr));
+        socklen_t len = sizeof(addr);
+        getsockname(fd, (sockaddr *)&addr, &len);
+        struct timeval tv = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+    ~Receiver() { close(fd); }
+
+    // Packets waiting, without blocking.
+    int pending() {
+        int n = 0;
+        uint8_t buf[2048];
+        while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+            n++;
+        return n;
+    }
+    std::string name() const {
+        return "127.0.0.1:" + std::to_string(ntohs(addr.sin_port));
+    }
+};
+
+static void submit(RtpFanout &f, int count, size_t size = 100) {
+    std::vector<uint8_t> p(size);
+    for (int i = 0; i < count; i++) {
+        p[0] = (uint8_t)i;
+        f.submit(p.data(), p.size());
+    }
+}
+
+TEST_CASE("Destinations parse as host:port", "[RtpFanout]")
+{
+    sockaddr_in addr;
+    REQUIRE(RtpFanout::parse_destination("192.168.0.10:5600", addr));
+    REQUIRE(ntohs(addr.sin_port) == 5600);
+    REQUIRE(ntohl(addr.sin_addr.s_addr) == 0xc0a8000a);
+    REQUIRE(RtpFanout::parse_destination("localhost:5000", addr));
+    REQUIRE(ntohl(addr.sin_addr.s_addr) == 0x7f000001);
+    REQUIRE_FALSE(RtpFanout::parse_destination("192.168.0.10", addr));
+    REQUIRE_FALSE(RtpFanout::parse_destination(":5600", addr));
+    REQUIRE_FALSE(RtpFanout::parse_destination("192.168.0.10:0", addr));
+    REQUIRE_FALSE(RtpFanout::parse_destination("192.168.0.10:70000", addr));
+    REQUIRE_FALSE(RtpFanout::parse_destination("192.168.0.10:56x", addr));
+}
+
+TEST_CASE("Every destination gets every packet", "[RtpFanout]")
+{
+    Receiver a, b, c;
+    RtpFanout f(RtpFanout::Params{});
+    int added = 0;
+    f.on_added = [&]() { added++; };
+    REQUIRE(f.add(a.addr));
+    REQUIRE(f.add(b.addr));
+    REQUIRE(f.add(c.addr));
+    REQUIRE_FALSE(f.add(a.addr));   // once is enough
+    REQUIRE(added == 3);
+    REQUIRE(f.active() == 3);
+
+    submit(f, 2 * RtpFanout::BATCH + 5);
+    f.tick(0);
+    REQUIRE(a.pending() == 2 * RtpFanout::BATCH + 5);
+    REQUIRE(b.pending() == 2 * RtpFanout::BATCH + 5);
+    REQUIRE(c.pending() == 2 * RtpFanout::BATCH + 5);
+
+    std::vector<RtpFanout::Destination> d = f.destinations();
+    REQUIRE(d.size() == 3);
+    REQUIRE(d[0].name == a.name());
+    REQUIRE(d[0].packets == 2 * RtpFanout::BATCH + 5);
+    REQUIRE(d[0].bytes == (2 * RtpFanout::BATCH + 5) * 100);
+    REQUIRE(d[0].send_errors == 0);
+
+    REQUIRE(f.remove(b.addr));
+    REQUIRE_FALSE(f.remove(b.addr));
+    submit(f, 3);
+    f.tick(0);
+    REQUIRE(a.pending() == 3);
+    REQUIRE(b.pending() == 0);
+    REQUIRE(c.pending() == 3);
+}
+
+TEST_CASE("A disabled destination is skipped and keeps its place", "[RtpFanout]")
+{
+    Receiver a, b;
+    RtpFanout f(RtpFanout::Params{});
+    int added = 0;
+    f.on_added = [&]() { added++; };
+    f.add(a.addr);
+    f.add(b.addr);
+    REQUIRE(f.set_enabled(b.addr, false));
+    REQUIRE(f.active() == 1);
+
+    submit(f, 10);
+    f.tick(0);
+    REQUIRE(a.pending() == 10);
+    REQUIRE(b.pending() == 0);
+
+    REQUIRE(f.set_enabled(b.addr, true));
+    REQUIRE(added == 3);   // re-enabled: wants a keyframe too
+    submit(f, 4);
+    f.tick(0);
+    REQUIRE(a.pending() == 4);
+    REQUIRE(b.pending() == 4);
+
+    // Nobody enabled: nothing is even queued
+    f.set_enabled(a.addr, false);
+    f.set_enabled(b.addr, false);
+    REQUIRE(f.active() == 0);
+    submit(f, 4);
+    f.set_enabled(a.addr, true);
+    f.tick(0);
+    REQUIRE(a.pending() == 0);
+}
+
+TEST_CASE("Pacing spreads packets over time", "[RtpFanout]")
+{
+    Receiver fast, slow;
+    RtpFanout f(RtpFanout::Params{});
+    f.add(fast.addr);
+    f.add(slow.addr, 200);   // 25 bytes per ms
+
+    submit(f, 100, 500);
+    uint64_t wait = f.tick(0);
+    REQUIRE(fast.pending() == 100);
+    int burst = slow.pending();
+    REQUIRE(burst > 0);
+    REQUIRE(burst < 10);
+    REQUIRE(wait >= 1);
+    REQUIRE(wait <= 20);
+
+    // Half a second's worth at 200 kbps, sent as the tokens come
+    int sent = burst;
+    uint64_t now = 0;
+    while (now < 500) {
+        now += f.tick(now);
+        sent += slow.pending();
+    }
+    REQUIRE(sent >= burst + 23);
+    REQUIRE(sent <= burst + 27);
+    while (now < 3000) {
+        now += f.tick(now);
+        sent += slow.pending();
+    }
+    REQUIRE(sent == 100);
+    REQUIRE(f.destinations()[1].dropped == 0);
+}
+
+TEST_CASE("A destination that falls behind drops its oldest packets", "[RtpFanout]")
+{
+    Receiver a;
+    RtpFanout::Params p;
+    p.backlog = 64;
+    RtpFanout f(p);
+    f.add(a.addr, 8);   // 1 byte per ms
+
+    submit(f, 100, 1000);
+    REQUIRE(f.destinations()[0].dropped == 36);
+    f.tick(0);
+    uint8_t buf[2048];
+    REQUIRE(recv(a.fd, buf, sizeof(buf), 0) == 1000);
+    REQUIRE(buf[0] == 36);   // the first 36 were dropped
+}
+
+TEST_CASE("The control FIFO commands", "[RtpFanout]")
+{
+    Receiver a;
+    RtpFanout f(RtpFanout::Params{});
+    REQUIRE(f.command("add " + a.name() + " 2000"));
+    REQUIRE(f.destinations()[0].pace_kbps == 2000);
+    REQUIRE(f.command("pace " + a.name() + " 0"));
+    REQUIRE(f.destinations()[0].pace_kbps == 0);
+    REQUIRE(f.command("disable " + a.name()));
+    REQUIRE_FALSE(f.destinations()[0].enabled);
+    REQUIRE(f.command("enable " + a.name()));
+    REQUIRE(f.destinations()[0].enabled);
+    REQUIRE(f.command("remove " + a.name()));
+    REQUIRE(f.destinations().empty());
+
+    REQUIRE_FALSE(f.command("add nowhere"));
+    REQUIRE_FALSE(f.command("pace " + a.name()));
+    REQUIRE_FALSE(f.command("add " + a.name() + " fast"));
+    REQUIRE_FALSE(f.command("jump " + a.name()));
+    REQUIRE(f.command(""));
+}
@@ -0,0 +1,154 @@
+#include <catch2/catch.hpp>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../src/rtp_restream.h"
+
+using Packet = std::vector<uint8_t>;
+
+static std::vector<Packet> packetize(RtpPacketizer &p, const std::vector<uint8_t> &au,
+                                     uint32_t ts = 0) {
+    std::vector<Packet> out;
+    p.packetize(au.data(), au.size(), ts, [&](const uint8_t *d, size_t n) {
+        out.emplace_back(d, d + n);
+    });
+    return out;
+}
+
+static void append_nal(std::vector<uint8_t> &au, std::initializer_list<uint8_t> header,
+                       size_t payload) {
+    au.insert(au.end(), {0, 0, 0, 1});
+    au.insert(au.end(), header);
+    for (size_t i = 0; i < payload; i++)
+        au.push_back((uint8_t)(i * 7 + 3) | 1);   // never a start code
+}
+
+static bool marker(const Packet &p) { return p[1] & 0x80; }
+static uint16_t seq(const Packet &p) { return (uint16_t)(p[2] << 8 | p[3]); }
+
+TEST_CASE("Small H.264 NALs go one per packet", "[RtpRestream]")
+{
+    RtpPacketizer p(false, 0x11223344, 96, 200);
+    std::vector<uint8_t> au;
+    append_nal(au, {0x67}, 10);   // SPS
+    append_nal(au, {0x68}, 4);    // PPS
+    append_nal(au, {0x65}, 100);  // IDR slice
+    std::vector<Packet> packets = packetize(p, au, 0xabcdef01);
+
+    REQUIRE(packets.size() == 3);
+    for (size_t i = 0; i < packets.size(); i++) {
+        const Packet &pk = packets[i];
+        REQUIRE(pk[0] == 0x80);
+        REQUIRE((pk[1] & 0x7f) == 96);
+        REQUIRE(marker(pk) == (i == 2));
+        REQUIRE(pk[4] == 0xab);
+        REQUIRE(pk[7] == 0x01);
+        REQUIRE(pk[8] == 0x11);
+        REQUIRE(pk[11] == 0x44);
+        if (i) REQUIRE(seq(pk) == (uint16_t)(seq(packets[i - 1]) + 1));
+    }
+    REQUIRE(packets[0][RTP_HEADER_LEN] == 0x67);
+    REQUIRE(packets[0].size() == RTP_HEADER_LEN + 11);
+    REQUIRE(packets[2].size() == RTP_HEADER_LEN + 101);
+}
+
+TEST_CASE("Big H.264 NALs are split into FU-A", "[RtpRestream]")
+{
+    RtpPacketizer p(false, 1, 96, 200);
+    std::vector<uint8_t> au;
+    append_nal(au, {0x65}, 1000);
+    std::vector<Packet> packets = packetize(p, au);
+
+    REQUIRE(packets.size() > 1);
+    std::vector<uint8_t> nal = {0x65};
+    for (size_t i = 0; i < packets.size(); i++) {
+        const Packet &pk = packets[i];
+        REQUIRE(pk.size() <= 200);
+        REQUIRE(pk[RTP_HEADER_LEN] == ((0x65 & 0xe0) | 28));
+        uint8_t fu = pk[RTP_HEADER_LEN + 1];
+        REQUIRE((fu & 0x1f) == 5);
+        REQUIRE(bool(fu & 0x80) == (i == 0));
+        REQUIRE(bool(fu & 0x40) == (i + 1 == packets.size()));
+        REQUIRE(marker(pk) == (i + 1 == packets.size()));
+        nal.insert(nal.end(), pk.begin() + RTP_HEADER_LEN + 2, pk.end());
+    }
+    REQUIRE(std::vector<uint8_t>(au.begin() + 4, au.end()) == nal);
+}
+
+TEST_CASE("Big H.265 NALs are split into FUs", "[RtpRestream]")
+{
+    RtpPacketizer p(true, 1, 97, 300);
+    std::vector<uint8_t> au;
+    append_nal(au, {0x26, 0x01}, 700);   // IDR_W_RADL
+    std::vector<Packet> packets = packetize(p, au);
+
+    REQUIRE(packets.size() > 1);
+    std::vector<uint8_t> nal = {0x26, 0x01};
+    for (size_t i = 0; i < packets.size(); i++) {
+        const Packet &pk = packets[i];
+        REQUIRE((pk[1] & 0x7f) == 97);
+        REQUIRE(pk[RTP_HEADER_LEN] == (49 << 1));
+        REQUIRE(pk[RTP_HEADER_LEN + 1] == 0x01);
+        uint8_t fu = pk[RTP_HEADER_LEN + 2];
+        REQUIRE((fu & 0x3f) == 19);
+        REQUIRE(bool(fu & 0x80) == (i == 0));
+        REQUIRE(bool(fu & 0x40) == (i + 1 == packets.size()));
+        nal.insert(nal.end(), pk.begin() + RTP_HEADER_LEN + 3, pk.end());
+    }
+    REQUIRE(marker(packets.back()));
+    REQUIRE(std::vector<uint8_t>(au.begin() + 4, au.end()) == nal);
+}
+
+TEST_CASE("Header-only access units carry no marker", "[RtpRestream]")
+{
+    RtpPacketizer p(false, 1);
+    std::vector<uint8_t> au;
+    append_nal(au, {0x67}, 10);
+    append_nal(au, {0x68}, 4);
+    uint16_t first = p.next_seq();
+    std::vector<Packet> packets = packetize(p, au);
+    REQUIRE(packets.size() == 2);
+    REQUIRE_FALSE(marker(packets[0]));
+    REQUIRE_FALSE(marker(packets[1]));
+    REQUIRE(seq(packets[0]) == first);
+    REQUIRE(p.next_seq() == (uint16_t)(first + 2));
+}
+
+TEST_CASE("Frames reach the fanout's destinations over UDP", "[RtpRestream]")
+{
+    int rx = socket(AF_INET, SOCK_DGRAM, 0);
+    REQUIRE(rx >= 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    REQUIRE(bind(rx, (sockaddr *)&addr, sizeof(addr)) == 0);
+    socklen_t len = sizeof(addr);
+    REQUIRE(getsockname(rx, (sockaddr *)&addr, &len) == 0);
+    struct timeval tv = {1, 0};
+    setsockopt(rx, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    RtpFanout fanout(RtpFanout::Params{});
+    RtpRestream restream(RtpRestream::Params{}, fanout);
+    std::vector<uint8_t> au;
+    append_nal(au, {0x65}, 50);
+
+    // Nobody watching: not even packetized
+    restream.frame(EncodedFrame::copy(au.data(), au.size()), 0);
+    REQUIRE(fanout.add(addr));
+    fanout.tick(0);
+    REQUIRE(fanout.destinations()[0].packets == 0);
+
+    restream.frame(EncodedFrame::copy(au.data(), au.size()), 1000);
+    fanout.tick(0);
+
+    uint8_t buf[2048];
+    ssize_t n = recv(rx, buf, sizeof(buf), 0);
+    REQUIRE(n == (ssize_t)(RTP_HEADER_LEN + au.size() - 4));
+    REQUIRE(buf[0] == 0x80);
+    REQUIRE(buf[1] == (0x80 | 96));
+    REQUIRE(memcmp(buf + RTP_HEADER_LEN, au.data() + 4, au.size() - 4) == 0);
+    close(rx);
+}
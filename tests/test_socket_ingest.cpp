@@ -0,0 +1,164 @@
+#include <catch2/catch.hpp>
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../src/socket_ingest.h"
+
+// A connected datagram pair: write to tx, the ingest reads rx.
+struct Pair {
+    int tx = -1, rx = -1;
+    explicit Pair(int type = SOCK_DGRAM) {
+        int fds[2];
+        REQUIRE(socketpair(AF_UNIX, type, 0, fds) == 0);
+        tx = fds[0];
+        rx = fds[1];
+    }
+    ~Pair() { close(tx); close(rx); }
+
+    void send(size_t len, uint8_t tag = 0) {
+        std::vector<uint8_t> p(len, tag);
+        REQUIRE(::send(tx, p.data(), p.size(), 0) == (ssize_t)len);
+    }
+};
+
+// Buffers the way the pool hands them out.
+struct Buffers {
+    std::vector<std::vector<uint8_t>> storage;
+    std::vector<uint8_t *> ptrs;
+    std::vector<size_t> lens;
+    Buffers(unsigned n, size_t size) : storage(n, std::vector<uint8_t>(size)), lens(n) {
+        for (auto &b : storage)
+            ptrs.push_back(b.data());
+    }
+};
+
+TEST_CASE("Datagrams are read a batch at a time", "[SocketIngest]")
+{
+    Pair pair;
+    SocketIngestParams p;
+    p.batch = 8;
+    SocketIngest ingest(p);
+    Buffers b(8, p.packet_size);
+
+    for (int i = 0; i < 20; i++)
+        pair.send(100 + i, (uint8_t)i);
+
+    int got = ingest.read(pair.rx, b.ptrs.data(), 8, b.lens.data());
+    REQUIRE(got == 8);
+    for (int i = 0; i < 8; i++) {
+        REQUIRE(b.lens[i] == (size_t)(100 + i));
+        REQUIRE(b.storage[i][0] == i);
+    }
+    REQUIRE(ingest.read(pair.rx, b.ptrs.data(), 8, b.lens.data()) == 8);
+    REQUIRE(ingest.read(pair.rx, b.ptrs.data(), 8, b.lens.data()) == 4);
+    REQUIRE(b.storage[3][0] == 19);
+
+    // Dry: nothing, without blocking
+    REQUIRE(ingest.read(pair.rx, b.ptrs.data(), 8, b.lens.data()) < 0);
+    REQUIRE((errno == EAGAIN || errno == EWOULDBLOCK));
+
+    SocketIngest::Stats s = ingest.stats();
+    REQUIRE(s.packets == 20);
+    REQUIRE(s.batches == 3);
+    REQUIRE(s.bytes == 20 * 100 + 190);
+}
+
+TEST_CASE("Jumbo packets fit a bigger packet size, truncated ones are dropped", "[SocketIngest]")
+{
+    Pair pair;
+    SocketIngestParams p;
+    p.packet_size = 9000;
+    SocketIngest ingest(p);
+    Buffers b(4, p.packet_size);
+
+    pair.send(8000);
+    pair.send(9001);
+    pair.send(10);     // runt: no room for an RTP header
+    pair.send(13);
+    REQUIRE(ingest.read(pair.rx, b.ptrs.data(), 4, b.lens.data()) == 4);
+    REQUIRE(b.lens[0] == 8000);
+    REQUIRE(b.lens[1] == 0);
+    REQUIRE(b.lens[2] == 0);
+    REQUIRE(b.lens[3] == 13);
+
+    SocketIngest::Stats s = ingest.stats();
+    REQUIRE(s.packets == 2);
+    REQUIRE(s.truncated == 1);
+    REQUIRE(s.runts == 1);
+}
+
+TEST_CASE("Without buffers datagrams are drained and counted", "[SocketIngest]")
+{
+    Pair pair;
+    SocketIngest ingest(SocketIngestParams{});
+    pair.send(500);
+    pair.send(500);
+    REQUIRE(ingest.discard(pair.rx) == 500);
+    REQUIRE(ingest.discard(pair.rx) == 500);
+    REQUIRE(ingest.discard(pair.rx) < 0);
+    ingest.pushed(5, false);
+    ingest.pushed(7, true);
+
+    SocketIngest::Stats s = ingest.stats();
+    REQUIRE(s.pool_exhausted == 2);
+    REQUIRE(s.push_errors == 5);
+    REQUIRE(s.packets == 0);
+}
+
+TEST_CASE("SOCK_SEQPACKET reads the same way", "[SocketIngest]")
+{
+    Pair pair(SOCK_SEQPACKET);
+    SocketIngest ingest(SocketIngestParams{});
+    Buffers b(32, 4096);
+    pair.send(1400);
+    pair.send(1400);
+    pair.send(200);
+    REQUIRE(ingest.read(pair.rx, b.ptrs.data(), 32, b.lens.data()) == 3);
+    REQUIRE(b.lens[2] == 200);
+}
+
+TEST_CASE("Parameters are kept within bounds", "[SocketIngest]")
+{
+    SocketIngestParams p;
+    p.batch = 0;
+    p.pool_buffers = 4;
+    p.packet_size = 1 << 20;
+    SocketIngest ingest(p);
+    REQUIRE(ingest.params().batch == 1);
+    REQUIRE(ingest.params().packet_size == SocketIngest::MAX_PACKET_SIZE);
+
+    p.batch = 100000;
+    SocketIngest big(p);
+    REQUIRE(big.params().batch == SocketIngest::MAX_BATCH);
+    REQUIRE(big.params().pool_buffers == SocketIngest::MAX_BATCH);
+}
+
+TEST_CASE("A closed SOCK_SEQPACKET peer reads as the end, not as runts", "[SocketIngest]")
+{
+    int fds[2];
+    REQUIRE(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) == 0);
+    SocketIngestParams p;
+    p.seqpacket = true;
+    SocketIngest ingest(p);
+    Buffers b(4, p.packet_size);
+
+    std::vector<uint8_t> pkt(200, 1);
+    REQUIRE(send(fds[0], pkt.data(), pkt.size(), 0) == 200);
+    REQUIRE(send(fds[0], pkt.data(), pkt.size(), 0) == 200);
+    close(fds[0]);
+
+    // What was sent before the close, then the end on every call
+    REQUIRE(ingest.read(fds[1], b.ptrs.data(), 4, b.lens.data()) == 2);
+    REQUIRE(ingest.read(fds[1], b.ptrs.data(), 4, b.lens.data()) == 0);
+    REQUIRE(ingest.read(fds[1], b.ptrs.data(), 4, b.lens.data()) == 0);
+    REQUIRE(ingest.discard(fds[1]) == 0);
+
+    SocketIngest::Stats s = ingest.stats();
+    REQUIRE(s.packets == 2);
+    REQUIRE(s.runts == 0);
+    REQUIRE(s.pool_exhausted == 0);
+    close(fds[1]);
+}
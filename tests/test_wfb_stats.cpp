@@ -0,0 +1,192 @@
+#include <catch2/catch.hpp>
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "../src/wfb_stats.h"
+
+// Just enough of a msgpack packer to build the server's messages.
+struct Pack {
+    std::vector<uint8_t> b;
+
+    void be(uint64_t v, int n) {
+        for (int i = n - 1; i >= 0; i--)
+            b.push_back((uint8_t)(v >> (i * 8)));
+    }
+    Pack &map(uint32_t n) {
+        if (n < 16) b.push_back(0x80 | n);
+        else { b.push_back(0xde); be(n, 2); }
+        return *this;
+    }
+    Pack &array(uint32_t n) {
+        if (n < 16) b.push_back(0x90 | n);
+        else { b.push_back(0xdc); be(n, 2); }
+        return *this;
+    }
+    Pack &str(const std::string &s) {
+        if (s.size() < 32) b.push_back(0xa0 | s.size());
+        else { b.push_back(0xd9); be(s.size(), 1); }
+        b.insert(b.end(), s.begin(), s.end());
+        return *this;
+    }
+    Pack &uint(uint64_t v) {
+        if (v < 128) b.push_back((uint8_t)v);
+        else if (v <= 0xffff) { b.push_back(0xcd); be(v, 2); }
+        else { b.push_back(0xcf); be(v, 8); }
+        return *this;
+    }
+    Pack &sint(int64_t v) {
+        if (v >= -32 && v < 0) b.push_back((uint8_t)v);
+        else if (v >= 0) uint(v);
+        else { b.push_back(0xd1); be((uint64_t)v, 2); }
+        return *this;
+    }
+    Pack &boolean(bool v) { b.push_back(v ? 0xc3 : 0xc2); return *this; }
+    Pack &raw(std::initializer_list<uint8_t> bytes) { b.insert(b.end(), bytes); return *this; }
+    Pack &counter(const std::string &name, uint64_t delta, uint64_t total) {
+        return str(name).array(2).uint(delta).uint(total);
+    }
+};
+
+TEST_CASE("Messages are read in place", "[MsgpackReader]")
+{
+    Pack p;
+    p.array(6).uint(70000).sint(-5).sint(-300).str("hello").boolean(true)
+        .raw({0xcb, 0, 0, 0, 0, 0, 0, 0, 0});   // float64, skipped
+    MsgpackReader r(p.b.data(), p.b.size());
+    uint32_t n;
+    uint64_t u;
+    int64_t i;
+    const char *s;
+    uint32_t len;
+    bool v;
+    REQUIRE(r.read_array(n));
+    REQUIRE(n == 6);
+    REQUIRE((r.read_uint(u) && u == 70000));
+    REQUIRE((r.read_int(i) && i == -5));
+    REQUIRE((r.read_int(i) && i == -300));
+    REQUIRE(r.read_str(s, len));
+    REQUIRE(std::string(s, len) == "hello");
+    REQUIRE((const void *)s == p.b.data() + 15);   // no copy
+    REQUIRE((r.read_bool(v) && v));
+    REQUIRE(r.skip());
+    REQUIRE(r.at_end());
+
+    // Wrong type or past the end: the failure sticks
+    MsgpackReader bad(p.b.data(), p.b.size());
+    REQUIRE_FALSE(bad.read_map(n));
+    REQUIRE_FALSE(bad.ok());
+    REQUIRE_FALSE(bad.read_array(n));
+
+    MsgpackReader neg(p.b.data() + 10, 1);   // the -5
+    REQUIRE_FALSE(neg.read_uint(u));
+
+    // A map claiming more entries than there are bytes
+    uint8_t huge[] = {0xdf, 0xff, 0xff, 0xff, 0xff, 0x01};
+    MsgpackReader h(huge, sizeof(huge));
+    REQUIRE_FALSE(h.skip());
+}
+
+TEST_CASE("An rx message decodes into counters and antennas", "[WfbStatsDecoder]")
+{
+    Pack p;
+    p.map(5).str("type").str("rx").str("timestamp").raw({0xcb, 0, 0, 0, 0, 0, 0, 0, 0})
+        .str("id").str("video rx")
+        .str("packets").map(4)
+            .counter("all", 120, 5000)
+            .counter("data", 100, 4000000000ull)
+            .counter("something_new", 1, 2)
+            .counter("lost", 0, 7)
+        .str("rx_ant_stats").map(2)
+            .array(2).array(3).uint(5805).uint(1).uint(20).uint(256)
+                .array(7).uint(60).sint(-70).sint(-65).sint(-60).uint(10).uint(20).uint(30)
+            .array(2).array(3).uint(5805).uint(1).uint(20).uint(257)
+                .array(7).uint(58).sint(-80).sint(-75).sint(-72).uint(5).uint(8).uint(12);
+
+    WfbStatsDecoder d;
+    REQUIRE(d.decode(p.b.data(), p.b.size()) == WfbStatsDecoder::RX);
+    const WfbRx &rx = d.rx();
+    REQUIRE(std::string(rx.id) == "video rx");
+    REQUIRE(rx.packets[WFB_RX_ALL].present);
+    REQUIRE(rx.packets[WFB_RX_ALL].delta == 120);
+    REQUIRE(rx.packets[WFB_RX_DATA].total == 4000000000ull);
+    REQUIRE(rx.packets[WFB_RX_LOST].present);
+    REQUIRE_FALSE(rx.packets[WFB_RX_FEC_REC].present);
+    REQUIRE(rx.n_ants == 2);
+    REQUIRE(rx.ants[0].freq == 5805);
+    REQUIRE(rx.ants[0].bw == 20);
+    REQUIRE(rx.ants[0].ant_id == 256);
+    REQUIRE(rx.ants[0].rssi_avg == -65);
+    REQUIRE(rx.ants[1].ant_id == 257);
+    REQUIRE(rx.ants[1].rssi_min == -80);
+    REQUIRE(rx.ants[1].snr_max == 12);
+
+    // The next message starts from scratch
+    Pack q;
+    q.map(2).str("id").str("tunnel rx").str("type").str("rx");
+    REQUIRE(d.decode(q.b.data(), q.b.size()) == WfbStatsDecoder::RX);
+    REQUIRE(std::string(d.rx().id) == "tunnel rx");
+    REQUIRE(d.rx().n_ants == 0);
+    REQUIRE_FALSE(d.rx().packets[WFB_RX_ALL].present);
+}
+
+TEST_CASE("tx and title messages", "[WfbStatsDecoder]")
+{
+    Pack p;
+    p.map(5).str("type").str("tx").str("id").str("video tx")
+        .str("latency").map(1).str("x").array(3).uint(1).uint(2).uint(3)
+        .str("packets").map(2).counter("injected", 50, 900).counter("dropped", 2, 3)
+        .str("rf_temperature").map(2).uint(0).uint(61).uint(1).sint(-3);
+    WfbStatsDecoder d;
+    REQUIRE(d.decode(p.b.data(), p.b.size()) == WfbStatsDecoder::TX);
+    const WfbTx &tx = d.tx();
+    REQUIRE(std::string(tx.id) == "video tx");
+    REQUIRE(tx.packets[WFB_TX_INJECTED].delta == 50);
+    REQUIRE(tx.packets[WFB_TX_DROPPED].total == 3);
+    REQUIRE_FALSE(tx.packets[WFB_TX_TRUNCATED].present);
+    REQUIRE(tx.n_rf_temperature == 2);
+    REQUIRE(tx.rf_temperature[0].temperature == 61);
+    REQUIRE(tx.rf_temperature[1].ant_id == 1);
+    REQUIRE(tx.rf_temperature[1].temperature == -3);
+
+    Pack t;
+    t.map(4).str("type").str("cli_title").str("cli_title").str("WFB-ng_24.7 @gs 5805 MHz")
+        .str("is_cluster").boolean(true).str("temp_overheat_warning").uint(80);
+    REQUIRE(d.decode(t.b.data(), t.b.size()) == WfbStatsDecoder::TITLE);
+    REQUIRE(std::string(d.title().cli_title) == "WFB-ng_24.7 @gs 5805 MHz");
+    REQUIRE(d.title().is_cluster);
+    REQUIRE(d.title().temp_overheat_warning == 80);
+}
+
+TEST_CASE("Unknown, truncated and malformed messages", "[WfbStatsDecoder]")
+{
+    WfbStatsDecoder d;
+
+    Pack u;
+    u.map(1).str("type").str("settings");
+    REQUIRE(d.decode(u.b.data(), u.b.size()) == WfbStatsDecoder::UNKNOWN);
+    REQUIRE(std::string(d.error()) == "settings");
+
+    Pack notype;
+    notype.map(1).str("id").str("video rx");
+    REQUIRE(d.decode(notype.b.data(), notype.b.size()) == WfbStatsDecoder::INVALID);
+
+    Pack p;
+    p.map(3).str("type").str("rx").str("id").str("video rx")
+        .str("packets").map(1).counter("all", 1, 2);
+    for (size_t len = 0; len < p.b.size(); len++)
+        REQUIRE(d.decode(p.b.data(), len) == WfbStatsDecoder::INVALID);
+    REQUIRE(d.decode(p.b.data(), p.b.size()) == WfbStatsDecoder::RX);
+
+    // A counter that isn't [delta, total]
+    Pack bad;
+    bad.map(2).str("type").str("tx").str("packets").map(1).str("injected").str("oops");
+    REQUIRE(d.decode(bad.b.data(), bad.b.size()) == WfbStatsDecoder::INVALID);
+
+    // Ids longer than the structure are cut, not overrun
+    Pack longid;
+    longid.map(2).str("type").str("rx").str("id").str(std::string(100, 'x'));
+    REQUIRE(d.decode(longid.b.data(), longid.b.size()) == WfbStatsDecoder::RX);
+    REQUIRE(strlen(d.rx().id) == WFB_ID_MAX - 1);
+}